@@ -0,0 +1,426 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "autotune.h"
+#include "bench.h"
+#include "bench-stats.h"
+#include "cpu-table.h"
+#include "hist.h"
+#include "msr.h"
+#include "timing.h"
+#include "topology.h"
+
+#ifndef AUTOTUNE_CPUINFO
+#define AUTOTUNE_CPUINFO "/proc/cpuinfo"
+#endif
+
+static const char *const objective_names[] = {
+    [AUTOTUNE_THROUGHPUT] = "throughput",
+    [AUTOTUNE_LATENCY] = "latency",
+};
+
+// candidate groupings, in the order they're tried
+static const struct autotune_config autotune_groupings[] = {
+    { .is_group_by = 0 },
+    { .is_group_by = 1, .group_by = TOPOLOGY_SOCKET, .group_split = 1 },
+    { .is_group_by = 1, .group_by = TOPOLOGY_SOCKET, .group_split = 2 },
+    { .is_group_by = 1, .group_by = TOPOLOGY_SOCKET, .group_split = 4 },
+    { .is_group_by = 1, .group_by = TOPOLOGY_NUMA, .group_split = 1 },
+    { .is_group_by = 1, .group_by = TOPOLOGY_NUMA, .group_split = 2 },
+    { .is_group_by = 1, .group_by = TOPOLOGY_NUMA, .group_split = 4 },
+    { .is_group_by = 1, .group_by = TOPOLOGY_LLC, .group_split = 1 },
+};
+
+int autotune_objective_parse(const char *name, enum autotune_objective *obj)
+{
+    uint32_t i;
+    for (i = 0; i < sizeof(objective_names) / sizeof(objective_names[0]); i++) {
+        if (!strcmp(name, objective_names[i])) {
+            *obj = (enum autotune_objective) i;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+const char *autotune_objective_name(enum autotune_objective obj)
+{
+    return objective_names[obj];
+}
+
+static int autotune_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// distinct domains at a level
+static uint32_t autotune_count(const struct topology *topo, enum topology_level level,
+                               uint32_t *tmp)
+{
+    uint32_t n = 0;
+    uint32_t i;
+    for (i = 0; i < topo->n_cpus; i++) {
+        tmp[i] = topology_domain(topo, i, level);
+    }
+    qsort(tmp, topo->n_cpus, sizeof(uint32_t), autotune_cmp_u32);
+    for (i = 0; i < topo->n_cpus; i++) {
+        n += !i || tmp[i] != tmp[i - 1];
+    }
+    return n;
+}
+
+static void autotune_cpu_model(char *buf, size_t size)
+{
+    char line[256];
+    char *p;
+    FILE *f;
+    struct msr_topology t;
+    // a backend with its own topology isn't the host's CPU
+    if (!msr_get_topology(0, &t)) {
+        snprintf(buf, size, "%s", msr_backend_get_name());
+        return;
+    }
+    snprintf(buf, size, "unknown");
+    f = fopen(AUTOTUNE_CPUINFO, "r");
+    if (!f) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (!strncmp(line, "model name", 10) && (p = strchr(line, ':'))) {
+            for (p++; *p == ' ' || *p == '\t'; p++);
+            p[strcspn(p, "\n")] = '\0';
+            snprintf(buf, size, "%s", p);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+int autotune_fingerprint(char *buf, size_t size)
+{
+    struct topology topo;
+    char model[128];
+    uint32_t *tmp;
+    if (topology_load(&topo)) {
+        return -1;
+    }
+    tmp = malloc((topo.n_cpus ? topo.n_cpus : 1) * sizeof(uint32_t));
+    if (!tmp) {
+        perror("malloc");
+        topology_free(&topo);
+        return -1;
+    }
+    autotune_cpu_model(model, sizeof(model));
+    snprintf(buf, size, "backend=%s model=%s cpus=%"PRIu32" sockets=%"PRIu32" cores=%"PRIu32
+             " llcs=%"PRIu32" nodes=%"PRIu32, msr_backend_get_name(), model, topo.n_cpus,
+             autotune_count(&topo, TOPOLOGY_SOCKET, tmp), autotune_count(&topo, TOPOLOGY_CORE, tmp),
+             autotune_count(&topo, TOPOLOGY_LLC, tmp), autotune_count(&topo, TOPOLOGY_NUMA, tmp));
+    free(tmp);
+    topology_free(&topo);
+    return 0;
+}
+
+// FNV-1a, so cache keys are short and free of spaces
+static uint64_t autotune_hash(const void *data, size_t n, uint64_t h)
+{
+    const unsigned char *p = data;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        h = (h ^ p[i]) * UINT64_C(0x100000001b3);
+    }
+    return h;
+}
+
+#define AUTOTUNE_HASH_INIT UINT64_C(0xcbf29ce484222325)
+
+int autotune_cache_path(char *buf, size_t size)
+{
+    const char *dir = getenv("XDG_CACHE_HOME");
+    if (dir && *dir) {
+        snprintf(buf, size, "%s/%s", dir, AUTOTUNE_CACHE_NAME);
+    } else if ((dir = getenv("HOME")) && *dir) {
+        snprintf(buf, size, "%s/.cache/%s", dir, AUTOTUNE_CACHE_NAME);
+    } else {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+void autotune_config_grouping(const struct autotune_config *cfg, char *buf, size_t size)
+{
+    if (!cfg->is_group_by) {
+        snprintf(buf, size, "all");
+    } else {
+        snprintf(buf, size, "%s/%"PRIu32, topology_level_name(cfg->group_by), cfg->group_split);
+    }
+}
+
+static int autotune_grouping_parse(const char *s, struct autotune_config *cfg)
+{
+    char level[16];
+    if (!strcmp(s, "all")) {
+        cfg->is_group_by = 0;
+        return 0;
+    }
+    if (sscanf(s, "%15[^/]/%"SCNu32, level, &cfg->group_split) != 2 || !cfg->group_split ||
+        topology_level_parse(level, &cfg->group_by)) {
+        errno = EINVAL;
+        return -1;
+    }
+    cfg->is_group_by = 1;
+    return 0;
+}
+
+// one line per fingerprint and objective: key objective strategy grouping score # fingerprint
+static int autotune_cache_parse(const char *line, char *key, char *obj, char *strategy,
+                                char *grouping, double *score)
+{
+    return sscanf(line, "%16s %15s %31s %31s %lf", key, obj, strategy, grouping, score) == 5 ?
+           0 : -1;
+}
+
+int autotune_cache_load(const char *path, const char *fingerprint,
+                        enum autotune_objective obj, struct autotune_config *cfg)
+{
+    char line[AUTOTUNE_FINGERPRINT_MAX + 128];
+    char want[17];
+    char key[17];
+    char o[16];
+    char strategy[32];
+    char grouping[32];
+    double score;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    snprintf(want, sizeof(want), "%016"PRIx64,
+             autotune_hash(fingerprint, strlen(fingerprint), AUTOTUNE_HASH_INIT));
+    while (fgets(line, sizeof(line), f)) {
+        // a score of 0 measured nothing, e.g., a run without MSRs, so it's not a choice
+        if (line[0] == '#' || autotune_cache_parse(line, key, o, strategy, grouping, &score) ||
+            strcmp(key, want) || strcmp(o, objective_names[obj]) || !(score > 0)) {
+            continue;
+        }
+        fclose(f);
+        cfg->strategy = bench_strategy_find(strategy);
+        if (!cfg->strategy || !cfg->strategy->session || autotune_grouping_parse(grouping, cfg)) {
+            fprintf(stderr, "autotune: Bad cache entry in %s: %s", path, line);
+            errno = EINVAL;
+            return -1;
+        }
+        cfg->score = score;
+        return 0;
+    }
+    fclose(f);
+    errno = ENOENT;
+    return -1;
+}
+
+// like mkdir -p for the directories leading to path
+static int autotune_mkdirs(const char *path)
+{
+    char dir[4096];
+    char *p;
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (p = strchr(dir + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(dir, 0755) && errno != EEXIST) {
+            perror(dir);
+            return -1;
+        }
+        *p = '/';
+    }
+    return 0;
+}
+
+int autotune_cache_save(const char *path, const char *fingerprint,
+                        enum autotune_objective obj, const struct autotune_config *cfg)
+{
+    char line[AUTOTUNE_FINGERPRINT_MAX + 128];
+    char tmp[4096];
+    char want[17];
+    char key[17];
+    char o[16];
+    char strategy[32];
+    char grouping[32];
+    double score;
+    FILE *in;
+    FILE *out;
+    int rc = 0;
+    if (!(cfg->score > 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (autotune_mkdirs(path)) {
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    out = fopen(tmp, "w");
+    if (!out) {
+        perror(tmp);
+        return -1;
+    }
+    snprintf(want, sizeof(want), "%016"PRIx64,
+             autotune_hash(fingerprint, strlen(fingerprint), AUTOTUNE_HASH_INIT));
+    // keep every other entry
+    in = fopen(path, "r");
+    if (in) {
+        while (fgets(line, sizeof(line), in)) {
+            if (!autotune_cache_parse(line, key, o, strategy, grouping, &score) &&
+                !strcmp(key, want) && !strcmp(o, objective_names[obj])) {
+                continue;
+            }
+            fputs(line, out);
+        }
+        fclose(in);
+    } else {
+        fprintf(out, "# key objective strategy grouping score_ns # fingerprint\n");
+    }
+    autotune_config_grouping(cfg, grouping, sizeof(grouping));
+    fprintf(out, "%s %s %s %s %.1f # %s\n", want, objective_names[obj], cfg->strategy->name,
+            grouping, cfg->score, fingerprint);
+    if (fclose(out)) {
+        perror(tmp);
+        rc = -1;
+    } else if (rename(tmp, path)) {
+        perror(path);
+        rc = -1;
+    }
+    if (rc) {
+        remove(tmp);
+    }
+    return rc;
+}
+
+int autotune_config_groups(const struct autotune_config *cfg, struct cpu_table *t)
+{
+    if (cfg->is_group_by) {
+        return cpu_table_add_topology(t, cfg->group_by, cfg->group_split);
+    }
+    return cpu_table_add_all(t);
+}
+
+// identifies the grouping a table holds, to skip candidates that come out the same
+static uint64_t autotune_table_hash(const struct cpu_table *t)
+{
+    uint64_t h = autotune_hash(&t->n_groups, sizeof(t->n_groups), AUTOTUNE_HASH_INIT);
+    h = autotune_hash(t->offsets, (t->n_groups + 1) * sizeof(uint32_t), h);
+    return autotune_hash(t->cpus, t->n_cpus * sizeof(uint32_t), h);
+}
+
+static int autotune_run_one(const struct bench *base, enum autotune_objective obj,
+                            uint32_t iters, const struct cpu_table *t,
+                            const struct bench_strategy *strategy, double *score)
+{
+    struct bench ctx = *base;
+    uint64_t reads;
+    int rc;
+    ctx.cpu_groups = t->groups;
+    ctx.n_cpu_groups = t->n_groups;
+    ctx.rate = 0;
+    ctx.duration = 0;
+    ctx.stats = NULL;
+    ctx.store = NULL;
+    ctx.sched = NULL;
+    ctx.out = NULL;
+    ctx.iters = iters / 10;
+    if (ctx.iters && strategy->run(&ctx)) {
+        return -1;
+    }
+    ctx.iters = iters;
+    ctx.stats = bench_stats_alloc(ctx.n_cpu_groups);
+    if (!ctx.stats) {
+        return -1;
+    }
+    rc = bench_strategy_run(strategy, &ctx);
+    if (!rc && !ctx.stats->iter.count) {
+        errno = ENODATA;
+        rc = -1;
+    }
+    if (!rc) {
+        reads = (uint64_t) t->n_cpus * ctx.n_msrs * ctx.stats->iter.count;
+        if (obj == AUTOTUNE_THROUGHPUT) {
+            *score = reads ? timing_ticks_to_ns(ctx.stats->elapsed) / reads : 0;
+        } else {
+            *score = timing_ticks_to_ns(hist_percentile(&ctx.stats->iter, 99.0));
+        }
+    }
+    bench_stats_free(ctx.stats);
+    return rc;
+}
+
+int autotune_run(const struct bench *base, enum autotune_objective obj, uint32_t iters,
+                 struct autotune_config *cfg, FILE *f)
+{
+    const uint32_t n_groupings = sizeof(autotune_groupings) / sizeof(autotune_groupings[0]);
+    struct cpu_table t;
+    uint64_t seen[sizeof(autotune_groupings) / sizeof(autotune_groupings[0])];
+    uint32_t n_seen = 0;
+    char grouping[32];
+    double score;
+    uint32_t gr;
+    uint32_t st;
+    uint32_t i;
+    int found = 0;
+
+    // without MSRs every candidate reads nothing, so all would score the same 0
+    if (!base->n_msrs || !iters) {
+        errno = EINVAL;
+        return -1;
+    }
+    fprintf(f, "Autotune: %s, %"PRIu32" iterations per candidate\n", objective_names[obj], iters);
+    fprintf(f, "%-24s %-12s %8s %14s\n", "strategy", "grouping", "groups",
+            obj == AUTOTUNE_THROUGHPUT ? "ns/read" : "iter p99 ns");
+    for (gr = 0; gr < n_groupings; gr++) {
+        cpu_table_init(&t);
+        if (autotune_config_groups(&autotune_groupings[gr], &t)) {
+            cpu_table_free(&t);
+            return -1;
+        }
+        seen[n_seen] = autotune_table_hash(&t);
+        for (i = 0; i < n_seen && seen[i] != seen[n_seen]; i++);
+        if (i < n_seen) {
+            cpu_table_free(&t);
+            continue;
+        }
+        n_seen++;
+        if (cpu_table_build(&t) || cpu_table_open(&t)) {
+            cpu_table_free(&t);
+            return -1;
+        }
+        autotune_config_grouping(&autotune_groupings[gr], grouping, sizeof(grouping));
+        for (st = 0; st < bench_n_strategies; st++) {
+            if (!bench_strategies[st].session || !bench_strategies[st].reads) {
+                continue;
+            }
+            if (autotune_run_one(base, obj, iters, &t, &bench_strategies[st], &score)) {
+                fprintf(f, "%-24s %-12s %8"PRIu32" %14s (%s)\n", bench_strategies[st].name,
+                        grouping, t.n_groups, "failed", strerror(errno));
+                continue;
+            }
+            fprintf(f, "%-24s %-12s %8"PRIu32" %14.1f\n", bench_strategies[st].name, grouping,
+                    t.n_groups, score);
+            if (!found || score < cfg->score) {
+                *cfg = autotune_groupings[gr];
+                cfg->strategy = &bench_strategies[st];
+                cfg->score = score;
+                found = 1;
+            }
+        }
+        cpu_table_free(&t);
+    }
+    if (!found) {
+        fprintf(stderr, "autotune: No candidate ran\n");
+        errno = ENODEV;
+        return -1;
+    }
+    return 0;
+}
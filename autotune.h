@@ -0,0 +1,99 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "cpu-table.h"
+#include "topology.h"
+
+#ifndef AUTOTUNE_ITERS_DEFAULT
+#define AUTOTUNE_ITERS_DEFAULT 100
+#endif
+
+// relative to $XDG_CACHE_HOME, or to $HOME/.cache if unset
+#ifndef AUTOTUNE_CACHE_NAME
+#define AUTOTUNE_CACHE_NAME "msr-scaling-bench/autotune"
+#endif
+
+#ifndef AUTOTUNE_FINGERPRINT_MAX
+#define AUTOTUNE_FINGERPRINT_MAX 512
+#endif
+
+/*
+ * Pick the strategy and CPU grouping that best reads the configured MSRs on this host, by
+ * briefly running every candidate, and remember the choice in a cache file keyed by a
+ * fingerprint of the host's topology and MSR backend.
+ * Candidates are the strategies that support sampling one iteration at a time (so
+ * libmsrsampler users can use the choice too) over all CPUs in one group, and grouped by
+ * socket, NUMA node, and LLC, whole or split in 2 or 4. Groupings that come out the same on
+ * this host are only run once.
+ */
+
+enum autotune_objective {
+    // minimize the amortized time per read
+    AUTOTUNE_THROUGHPUT,
+    // minimize the p99 time per iteration, i.e., per sample
+    AUTOTUNE_LATENCY,
+};
+
+struct autotune_config {
+    const struct bench_strategy *strategy;
+    // all CPUs in one group unless is_group_by
+    int is_group_by;
+    enum topology_level group_by;
+    uint32_t group_split;
+    // the objective's score, in ns
+    double score;
+};
+
+int autotune_objective_parse(const char *name, enum autotune_objective *obj);
+
+const char *autotune_objective_name(enum autotune_objective obj);
+
+/**
+ * Describe the host: MSR backend, CPU model, and the number of CPUs, sockets, cores, LLCs,
+ * and NUMA nodes.
+ */
+int autotune_fingerprint(char *buf, size_t size);
+
+/**
+ * Get the default cache path, from $XDG_CACHE_HOME or $HOME.
+ */
+int autotune_cache_path(char *buf, size_t size);
+
+/**
+ * Look up the choice for a fingerprint and objective.
+ * Returns -1 with errno=ENOENT if there's none.
+ */
+int autotune_cache_load(const char *path, const char *fingerprint,
+                        enum autotune_objective obj, struct autotune_config *cfg);
+
+/**
+ * Record the choice for a fingerprint and objective, replacing any previous one.
+ * Returns -1 with errno=EINVAL for a score of 0, which measured nothing.
+ */
+int autotune_cache_save(const char *path, const char *fingerprint,
+                        enum autotune_objective obj, const struct autotune_config *cfg);
+
+/**
+ * Add the CPU groups of a configuration to an empty table.
+ */
+int autotune_config_groups(const struct autotune_config *cfg, struct cpu_table *t);
+
+/**
+ * Describe a configuration's grouping, e.g., "socket/2" or "all".
+ */
+void autotune_config_grouping(const struct autotune_config *cfg, char *buf, size_t size);
+
+/**
+ * Run every candidate for iters iterations (after a tenth as many untimed) with base's MSRs
+ * and options, report each to f, and return the best in cfg.
+ * Returns -1 with errno=EINVAL without MSRs or iterations, which nothing could be tuned by.
+ */
+int autotune_run(const struct bench *base, enum autotune_objective obj, uint32_t iters,
+                 struct autotune_config *cfg, FILE *f);
+
+#endif // AUTOTUNE_H
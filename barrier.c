@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "barrier.h"
+
+#define BARRIER_ROUNDS_MAX 32
+
+struct barrier_flag {
+    _Alignas(64) atomic_uint val;
+    atomic_uint sleeping;
+};
+
+struct barrier_central {
+    _Alignas(64) atomic_uint count;
+    _Alignas(64) atomic_uint gen;
+    atomic_uint sleepers;
+};
+
+struct barrier_dissem_local {
+    // the episode this participant is waiting to complete, only touched by its owner
+    _Alignas(64) uint32_t episode;
+};
+
+struct barrier {
+    enum barrier_type type;
+    uint32_t n;
+    uint32_t spin;
+    uint32_t rounds;
+    struct barrier_central central;
+    // dissemination: flags[id * rounds + round], written by the round's partner
+    struct barrier_flag *flags;
+    struct barrier_dissem_local *local;
+};
+
+static void futex_wait(atomic_uint *addr, uint32_t val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake_all(atomic_uint *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+struct barrier *barrier_alloc(enum barrier_type type, uint32_t n, uint32_t spin)
+{
+    struct barrier *b;
+    uint32_t i;
+    b = aligned_alloc(64, sizeof(*b));
+    if (!b) {
+        perror("aligned_alloc");
+        return NULL;
+    }
+    memset(b, 0, sizeof(*b));
+    b->type = type;
+    b->n = n;
+    b->spin = spin;
+    atomic_init(&b->central.count, n);
+    atomic_init(&b->central.gen, 0);
+    atomic_init(&b->central.sleepers, 0);
+    if (type == BARRIER_DISSEMINATION) {
+        while (b->rounds < BARRIER_ROUNDS_MAX && (UINT64_C(1) << b->rounds) < n) {
+            b->rounds++;
+        }
+        b->flags = aligned_alloc(64, (size_t) n * (b->rounds ? b->rounds : 1) *
+                                     sizeof(struct barrier_flag));
+        b->local = aligned_alloc(64, n * sizeof(struct barrier_dissem_local));
+        if (!b->flags || !b->local) {
+            perror("aligned_alloc");
+            barrier_free(b);
+            return NULL;
+        }
+        for (i = 0; i < n * b->rounds; i++) {
+            atomic_init(&b->flags[i].val, 0);
+            atomic_init(&b->flags[i].sleeping, 0);
+        }
+        for (i = 0; i < n; i++) {
+            b->local[i].episode = 0;
+        }
+    }
+    return b;
+}
+
+void barrier_free(struct barrier *b)
+{
+    if (b) {
+        free(b->flags);
+        free(b->local);
+        free(b);
+    }
+}
+
+static void barrier_central_wait(struct barrier *b)
+{
+    struct barrier_central *c = &b->central;
+    uint32_t gen = atomic_load_explicit(&c->gen, memory_order_acquire);
+    uint32_t i;
+    if (atomic_fetch_sub_explicit(&c->count, 1, memory_order_acq_rel) == 1) {
+        atomic_store_explicit(&c->count, b->n, memory_order_relaxed);
+        // seq_cst store/load pairs with the waiter's sleepers increment/gen load
+        atomic_store(&c->gen, gen + 1);
+        if (atomic_load(&c->sleepers)) {
+            futex_wake_all(&c->gen);
+        }
+        return;
+    }
+    for (i = 0; i < b->spin; i++) {
+        if (atomic_load_explicit(&c->gen, memory_order_acquire) != gen) {
+            return;
+        }
+        cpu_relax();
+    }
+    atomic_fetch_add(&c->sleepers, 1);
+    while (atomic_load(&c->gen) == gen) {
+        futex_wait(&c->gen, gen);
+    }
+    atomic_fetch_sub(&c->sleepers, 1);
+}
+
+static inline int barrier_flag_reached(struct barrier_flag *f, uint32_t episode)
+{
+    // wrap-safe: the flag holds the last episode it was signaled for
+    return (int32_t) (atomic_load_explicit(&f->val, memory_order_acquire) - episode) >= 0;
+}
+
+static void barrier_dissem_wait(struct barrier *b, uint32_t id)
+{
+    struct barrier_flag *f;
+    uint32_t episode = ++b->local[id].episode;
+    uint32_t partner;
+    uint32_t r;
+    uint32_t i;
+    for (r = 0; r < b->rounds; r++) {
+        // signal the partner 2^r ahead, then wait for the one 2^r behind
+        partner = (uint32_t) ((id + (UINT64_C(1) << r)) % b->n);
+        f = &b->flags[partner * b->rounds + r];
+        atomic_store(&f->val, episode);
+        if (atomic_load(&f->sleeping)) {
+            futex_wake_all(&f->val);
+        }
+        f = &b->flags[id * b->rounds + r];
+        for (i = 0; i < b->spin && !barrier_flag_reached(f, episode); i++) {
+            cpu_relax();
+        }
+        if (!barrier_flag_reached(f, episode)) {
+            atomic_store(&f->sleeping, 1);
+            while (!barrier_flag_reached(f, episode)) {
+                futex_wait(&f->val, episode - 1);
+            }
+            atomic_store_explicit(&f->sleeping, 0, memory_order_relaxed);
+        }
+    }
+}
+
+void barrier_wait(struct barrier *b, uint32_t id)
+{
+    if (b->type == BARRIER_DISSEMINATION) {
+        barrier_dissem_wait(b, id);
+    } else {
+        barrier_central_wait(b);
+    }
+}
+
+int barrier_type_parse(const char *name, enum barrier_type *type)
+{
+    if (!strcmp(name, "central")) {
+        *type = BARRIER_CENTRAL;
+    } else if (!strcmp(name, "dissemination")) {
+        *type = BARRIER_DISSEMINATION;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
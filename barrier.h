@@ -0,0 +1,42 @@
+#ifndef BARRIER_H
+#define BARRIER_H
+
+#include <inttypes.h>
+
+#ifndef BARRIER_SPIN_DEFAULT
+#define BARRIER_SPIN_DEFAULT 10000
+#endif
+
+/*
+ * Reusable barriers built on C11 atomics.
+ * Waiters spin for a bounded number of polls, then sleep on a futex.
+ * Every flag that is written by one thread and polled by another has its own cache line.
+ */
+
+enum barrier_type {
+    // sense-reversing counter: n arrivals on one word, one broadcast wakeup
+    BARRIER_CENTRAL,
+    // ceil(log2(n)) rounds of pairwise signals, no shared counter
+    BARRIER_DISSEMINATION,
+};
+
+struct barrier;
+
+/**
+ * Allocate a barrier for n participants, identified as 0..n-1.
+ */
+struct barrier *barrier_alloc(enum barrier_type type, uint32_t n, uint32_t spin);
+
+void barrier_free(struct barrier *b);
+
+/**
+ * Wait for all participants to arrive.
+ */
+void barrier_wait(struct barrier *b, uint32_t id);
+
+/**
+ * Parse a barrier type name ("central" or "dissemination"), returns -1 if unknown.
+ */
+int barrier_type_parse(const char *name, enum barrier_type *type);
+
+#endif // BARRIER_H
@@ -0,0 +1,471 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench-stats.h"
+#include "hist.h"
+#include "timing.h"
+
+#ifndef BENCH_PAIRS_CAP_MIN
+#define BENCH_PAIRS_CAP_MIN 64
+#endif
+
+static struct bench_group_stats *bench_group_stats_alloc(uint32_t n)
+{
+    struct bench_group_stats *gs = aligned_alloc(64, n * sizeof(struct bench_group_stats));
+    uint32_t i;
+    if (!gs) {
+        perror("aligned_alloc");
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        gs[i].pairs = NULL;
+    }
+    return gs;
+}
+
+static void bench_group_stats_free(struct bench_group_stats *gs, uint32_t n)
+{
+    uint32_t i;
+    if (gs) {
+        for (i = 0; i < n; i++) {
+            bench_group_stats_free_pairs(&gs[i]);
+        }
+        free(gs);
+    }
+}
+
+struct bench_stats *bench_stats_alloc(uint32_t n_groups)
+{
+    struct bench_stats *s = malloc(sizeof(*s));
+    if (!s) {
+        perror("malloc");
+        return NULL;
+    }
+    s->n_groups = n_groups;
+    s->workers = NULL;
+    s->n_workers = 0;
+    s->pairs = 0;
+    s->groups = bench_group_stats_alloc(n_groups);
+    if (!s->groups) {
+        free(s);
+        return NULL;
+    }
+    bench_stats_reset(s);
+    return s;
+}
+
+void bench_stats_free(struct bench_stats *s)
+{
+    if (s) {
+        bench_group_stats_free(s->groups, s->n_groups);
+        bench_group_stats_free(s->workers, s->n_workers);
+        free(s);
+    }
+}
+
+static void bench_pairs_clear(struct bench_pairs *p)
+{
+    uint32_t i;
+    for (i = 0; i < p->cap; i++) {
+        memset(&p->slots[i], 0, sizeof(p->slots[i]));
+        p->slots[i].src = UINT32_MAX;
+    }
+    p->n = 0;
+}
+
+static int bench_pairs_init(struct bench_pairs *p, uint32_t cap)
+{
+    p->slots = malloc(cap * sizeof(struct bench_pair));
+    if (!p->slots) {
+        perror("malloc");
+        return -1;
+    }
+    p->cap = cap;
+    bench_pairs_clear(p);
+    return 0;
+}
+
+static uint32_t bench_pairs_hash(uint32_t src, uint32_t dst)
+{
+    uint64_t k = ((uint64_t) src << 32 | dst) * UINT64_C(0x9e3779b97f4a7c15);
+    return (uint32_t) (k >> 32);
+}
+
+static struct bench_pair *bench_pairs_slot(struct bench_pairs *p, uint32_t src, uint32_t dst)
+{
+    uint32_t i = bench_pairs_hash(src, dst) & (p->cap - 1);
+    // linear probing - the table is never more than half full
+    while (p->slots[i].src != UINT32_MAX &&
+           (p->slots[i].src != src || p->slots[i].dst != dst)) {
+        i = (i + 1) & (p->cap - 1);
+    }
+    return &p->slots[i];
+}
+
+struct bench_pair *bench_pairs_get(struct bench_pairs *p, uint32_t src, uint32_t dst)
+{
+    struct bench_pairs grown;
+    struct bench_pair *e = bench_pairs_slot(p, src, dst);
+    uint32_t i;
+    if (e->src != UINT32_MAX) {
+        return e;
+    }
+    if (2 * (p->n + 1) > p->cap) {
+        if (bench_pairs_init(&grown, 2 * p->cap)) {
+            return NULL;
+        }
+        for (i = 0; i < p->cap; i++) {
+            if (p->slots[i].src != UINT32_MAX) {
+                *bench_pairs_slot(&grown, p->slots[i].src, p->slots[i].dst) = p->slots[i];
+            }
+        }
+        grown.n = p->n;
+        free(p->slots);
+        *p = grown;
+        e = bench_pairs_slot(p, src, dst);
+    }
+    e->src = src;
+    e->dst = dst;
+    p->n++;
+    return e;
+}
+
+int bench_group_stats_alloc_pairs(struct bench_group_stats *gs)
+{
+    if (gs->pairs) {
+        return 0;
+    }
+    gs->pairs = malloc(sizeof(struct bench_pairs));
+    if (!gs->pairs) {
+        perror("malloc");
+        return -1;
+    }
+    if (bench_pairs_init(gs->pairs, BENCH_PAIRS_CAP_MIN)) {
+        free(gs->pairs);
+        gs->pairs = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void bench_group_stats_free_pairs(struct bench_group_stats *gs)
+{
+    if (gs->pairs) {
+        free(gs->pairs->slots);
+        free(gs->pairs);
+        gs->pairs = NULL;
+    }
+}
+
+void bench_group_stats_reset(struct bench_group_stats *gs)
+{
+    hist_reset(&gs->read);
+    hist_reset(&gs->group);
+    hist_reset(&gs->wake);
+    hist_reset(&gs->migrate);
+    hist_reset(&gs->first);
+    gs->local = 0;
+    gs->remote = 0;
+    gs->migrated = 0;
+    gs->migrated_from = BENCH_PAIR_CPU_UNKNOWN;
+    if (gs->pairs) {
+        bench_pairs_clear(gs->pairs);
+    }
+    gs->t_first = 0;
+    gs->t_last = 0;
+}
+
+static void bench_group_stats_merge_into(struct bench_group_stats *dst,
+                                        const struct bench_group_stats *src, int with_group)
+{
+    struct bench_pair *e;
+    uint32_t i;
+    hist_merge(&dst->read, &src->read);
+    if (with_group) {
+        hist_merge(&dst->group, &src->group);
+    }
+    hist_merge(&dst->wake, &src->wake);
+    hist_merge(&dst->migrate, &src->migrate);
+    hist_merge(&dst->first, &src->first);
+    dst->local += src->local;
+    dst->remote += src->remote;
+    if (!dst->pairs || !src->pairs) {
+        return;
+    }
+    for (i = 0; i < src->pairs->cap; i++) {
+        if (src->pairs->slots[i].src == UINT32_MAX) {
+            continue;
+        }
+        e = bench_pairs_get(dst->pairs, src->pairs->slots[i].src, src->pairs->slots[i].dst);
+        if (!e) {
+            return;
+        }
+        e->migrations += src->pairs->slots[i].migrations;
+        e->migrate += src->pairs->slots[i].migrate;
+        e->firsts += src->pairs->slots[i].firsts;
+        e->first += src->pairs->slots[i].first;
+        e->reads += src->pairs->slots[i].reads;
+        e->read += src->pairs->slots[i].read;
+    }
+}
+
+void bench_group_stats_merge(struct bench_group_stats *dst, const struct bench_group_stats *src)
+{
+    bench_group_stats_merge_into(dst, src, 1);
+}
+
+int bench_stats_alloc_workers(struct bench_stats *s, uint32_t n_workers)
+{
+    uint32_t w;
+    if (s->n_workers != n_workers) {
+        bench_group_stats_free(s->workers, s->n_workers);
+        s->n_workers = 0;
+        s->workers = bench_group_stats_alloc(n_workers);
+        if (!s->workers) {
+            return -1;
+        }
+        s->n_workers = n_workers;
+    }
+    for (w = 0; w < n_workers; w++) {
+        if (s->pairs && bench_group_stats_alloc_pairs(&s->workers[w])) {
+            return -1;
+        }
+        bench_group_stats_reset(&s->workers[w]);
+    }
+    return 0;
+}
+
+int bench_stats_enable_pairs(struct bench_stats *s)
+{
+    uint32_t g;
+    s->pairs = 1;
+    for (g = 0; g < s->n_groups; g++) {
+        if (bench_group_stats_alloc_pairs(&s->groups[g])) {
+            return -1;
+        }
+    }
+    for (g = 0; g < s->n_workers; g++) {
+        if (bench_group_stats_alloc_pairs(&s->workers[g])) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void bench_stats_reset(struct bench_stats *s)
+{
+    uint32_t g;
+    // touch everything now so page faults don't land in the measurements
+    for (g = 0; g < s->n_groups; g++) {
+        bench_group_stats_reset(&s->groups[g]);
+    }
+    for (g = 0; g < s->n_workers; g++) {
+        bench_group_stats_reset(&s->workers[g]);
+    }
+    hist_reset(&s->iter);
+    hist_reset(&s->skew);
+    hist_reset(&s->jitter);
+    s->slots = 0;
+    s->missed = 0;
+    s->elapsed = 0;
+    s->sched = 0;
+    memset(&s->sched_driver, 0, sizeof(s->sched_driver));
+    memset(&s->sched_workers, 0, sizeof(s->sched_workers));
+}
+
+static void bench_stats_print_hist(FILE *f, const char *name, const struct hist *h)
+{
+    if (!h->count) {
+        fprintf(f, "%-16s %12"PRIu64"\n", name, h->count);
+        return;
+    }
+    fprintf(f, "%-16s %12"PRIu64" %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+            name, h->count,
+            timing_ticks_to_ns(h->min),
+            timing_ticks_to_ns(hist_percentile(h, 50.0)),
+            timing_ticks_to_ns(hist_percentile(h, 99.0)),
+            timing_ticks_to_ns(hist_percentile(h, 99.9)),
+            timing_ticks_to_ns(h->max),
+            timing_ticks_to_ns(hist_mean(h)));
+}
+
+static void bench_stats_print_each(FILE *f, const char *kind,
+                                   const struct bench_group_stats *gs, uint32_t n)
+{
+    char name[32];
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "%s[%"PRIu32"].read", kind, i);
+        bench_stats_print_hist(f, name, &gs[i].read);
+        snprintf(name, sizeof(name), "%s[%"PRIu32"]", kind, i);
+        bench_stats_print_hist(f, name, &gs[i].group);
+        if (gs[i].wake.count) {
+            snprintf(name, sizeof(name), "%s[%"PRIu32"].wake", kind, i);
+            bench_stats_print_hist(f, name, &gs[i].wake);
+        }
+    }
+}
+
+void bench_stats_merge(const struct bench_stats *s, struct hist *read, struct hist *group,
+                       struct hist *wake)
+{
+    uint32_t g;
+    hist_reset(read);
+    hist_reset(group);
+    hist_reset(wake);
+    for (g = 0; g < s->n_groups; g++) {
+        hist_merge(read, &s->groups[g].read);
+        hist_merge(group, &s->groups[g].group);
+        hist_merge(wake, &s->groups[g].wake);
+    }
+    for (g = 0; g < s->n_workers; g++) {
+        hist_merge(read, &s->workers[g].read);
+        hist_merge(wake, &s->workers[g].wake);
+    }
+}
+
+struct bench_group_stats *bench_stats_merge_all(const struct bench_stats *s)
+{
+    struct bench_group_stats *all = bench_group_stats_alloc(1);
+    uint32_t g;
+    if (!all) {
+        return NULL;
+    }
+    if (s->pairs && bench_group_stats_alloc_pairs(all)) {
+        bench_group_stats_free(all, 1);
+        return NULL;
+    }
+    bench_group_stats_reset(all);
+    for (g = 0; g < s->n_groups; g++) {
+        bench_group_stats_merge_into(all, &s->groups[g], 1);
+    }
+    for (g = 0; g < s->n_workers; g++) {
+        bench_group_stats_merge_into(all, &s->workers[g], 0);
+    }
+    return all;
+}
+
+void bench_stats_merge_free(struct bench_group_stats *all)
+{
+    bench_group_stats_free(all, 1);
+}
+
+static double bench_stats_mean(uint64_t sum, uint64_t n)
+{
+    return n ? timing_ticks_to_ns((double) sum / n) : 0.0;
+}
+
+static int bench_pair_cmp(const void *a, const void *b)
+{
+    const struct bench_pair *pa = (const struct bench_pair *)a;
+    const struct bench_pair *pb = (const struct bench_pair *)b;
+    if (pa->src != pb->src) {
+        return pa->src < pb->src ? -1 : 1;
+    }
+    return pa->dst < pb->dst ? -1 : pa->dst > pb->dst;
+}
+
+static void bench_stats_print_pairs(FILE *f, const struct bench_pairs *p)
+{
+    struct bench_pair *sorted;
+    char name[32];
+    uint32_t i;
+    uint32_t n = 0;
+    sorted = malloc((p->n ? p->n : 1) * sizeof(*sorted));
+    if (!sorted) {
+        perror("malloc");
+        return;
+    }
+    for (i = 0; i < p->cap; i++) {
+        if (p->slots[i].src != UINT32_MAX) {
+            sorted[n++] = p->slots[i];
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), bench_pair_cmp);
+    fprintf(f, "%-16s %12s %10s %10s %12s %10s\n",
+            "Pair (src->dst)", "migrations", "migrate", "first", "reads", "read");
+    for (i = 0; i < n; i++) {
+        if (sorted[i].src == BENCH_PAIR_CPU_UNKNOWN) {
+            snprintf(name, sizeof(name), "?->%"PRIu32, sorted[i].dst);
+        } else {
+            snprintf(name, sizeof(name), "%"PRIu32"->%"PRIu32, sorted[i].src, sorted[i].dst);
+        }
+        fprintf(f, "%-16s %12"PRIu64" %10.0f %10.0f %12"PRIu64" %10.0f\n", name,
+                sorted[i].migrations, bench_stats_mean(sorted[i].migrate, sorted[i].migrations),
+                bench_stats_mean(sorted[i].first, sorted[i].firsts), sorted[i].reads,
+                bench_stats_mean(sorted[i].read, sorted[i].reads));
+    }
+    free(sorted);
+}
+
+static void bench_stats_print_sched(FILE *f, const struct bench_stats *s)
+{
+    double n = s->iter.count ? (double) s->iter.count : 1;
+    uint32_t i;
+    fprintf(f, "%-24s %14s %14s %14s\n", "Scheduling (per iter)", "driver", "threads", "total");
+    for (i = 0; i < SCHED_N_COUNTERS; i++) {
+        fprintf(f, "%-24s %14.3f %14.3f %14.3f\n", sched_counter_names[i],
+                s->sched_driver.v[i] / n, s->sched_workers.v[i] / n,
+                (s->sched_driver.v[i] + s->sched_workers.v[i]) / n);
+    }
+}
+
+void bench_stats_print(FILE *f, const struct bench_stats *s, uint64_t reads_per_iter)
+{
+    struct bench_group_stats *all;
+    double elapsed_ns = timing_ticks_to_ns(s->elapsed);
+    uint64_t reads = reads_per_iter * s->iter.count;
+
+    all = bench_stats_merge_all(s);
+    if (!all) {
+        return;
+    }
+
+    fprintf(f, "Elapsed: %.0f ns, iterations: %"PRIu64", reads: %"PRIu64"\n",
+            elapsed_ns, s->iter.count, reads);
+    if (reads && elapsed_ns > 0) {
+        fprintf(f, "Throughput: %.0f reads/s, %.1f ns/read amortized\n",
+                reads / (elapsed_ns / 1e9), elapsed_ns / reads);
+    }
+    if (s->slots) {
+        fprintf(f, "Fixed rate: %"PRIu64" slots, %"PRIu64" missed (%.2f%%)\n",
+                s->slots, s->missed, 100.0 * s->missed / s->slots);
+    }
+    if (all->local + all->remote) {
+        fprintf(f, "Locality: %.2f%% of reads issued on the target CPU\n",
+                100.0 * all->local / (all->local + all->remote));
+    }
+    fprintf(f, "%-16s %12s %10s %10s %10s %10s %10s %10s\n",
+            "Latency (ns)", "count", "min", "p50", "p99", "p99.9", "max", "mean");
+    bench_stats_print_hist(f, "read", &all->read);
+    // group-level stats are empty when the work is split by worker instead
+    if (all->group.count || !s->n_workers) {
+        bench_stats_print_hist(f, "group", &all->group);
+    }
+    if (all->wake.count) {
+        bench_stats_print_hist(f, "wake", &all->wake);
+    }
+    // migration cost, and what the first read pays on top of a warm one
+    if (all->migrate.count) {
+        bench_stats_print_hist(f, "migrate", &all->migrate);
+        bench_stats_print_hist(f, "first", &all->first);
+    }
+    bench_stats_print_hist(f, "iteration", &s->iter);
+    bench_stats_print_hist(f, "skew", &s->skew);
+    if (s->slots) {
+        bench_stats_print_hist(f, "jitter", &s->jitter);
+    }
+    if (s->n_groups > 1 && (all->group.count || !s->n_workers)) {
+        bench_stats_print_each(f, "group", s->groups, s->n_groups);
+    }
+    bench_stats_print_each(f, "worker", s->workers, s->n_workers);
+    if (s->sched) {
+        bench_stats_print_sched(f, s);
+    }
+    if (all->pairs && all->pairs->n) {
+        bench_stats_print_pairs(f, all->pairs);
+    }
+    bench_stats_merge_free(all);
+}
@@ -0,0 +1,159 @@
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "hist.h"
+#include "sched-counters.h"
+
+/*
+ * Latency statistics, in timing ticks (see timing.h).
+ * Each group's histograms are only written by the thread servicing that group,
+ * and the iteration histogram only by the driving thread, so no locking is needed.
+ */
+
+// source of a pair when msr_get_cur_cpu() can't tell
+#define BENCH_PAIR_CPU_UNKNOWN (UINT32_MAX - 1)
+
+// costs attributed to one {source CPU, target CPU} pair, sums in ticks
+struct bench_pair {
+    // UINT32_MAX if the slot is empty
+    uint32_t src;
+    uint32_t dst;
+    uint64_t migrations;
+    uint64_t migrate;
+    // reads right after migrating from src to dst
+    uint64_t firsts;
+    uint64_t first;
+    // reads issued on src targeting dst
+    uint64_t reads;
+    uint64_t read;
+};
+
+// open-addressing hash table of pairs
+struct bench_pairs {
+    struct bench_pair *slots;
+    uint32_t cap;
+    uint32_t n;
+};
+
+struct bench_group_stats {
+    // per msr_read
+    struct hist read;
+    // per pass over the group's handles
+    struct hist group;
+    // from the driver's go-ahead until a thread starts its pass (threaded benchmarks only)
+    struct hist wake;
+    // per migration to a handle's CPU (migrating benchmarks only)
+    struct hist migrate;
+    // the first read after each migration, also counted in read
+    struct hist first;
+    // reads issued from the target CPU or not, per msr_get_cur_cpu()
+    uint64_t local;
+    uint64_t remote;
+    // set by a migration until the next read, with the CPU it migrated from
+    int migrated;
+    uint32_t migrated_from;
+    // optional, NULL unless per-pair attribution is enabled
+    struct bench_pairs *pairs;
+    // completion of the first and last read in the current sample, 0 if none yet
+    uint64_t t_first;
+    uint64_t t_last;
+} __attribute__((aligned(64)));
+
+struct bench_stats {
+    struct bench_group_stats *groups;
+    uint32_t n_groups;
+    // optional, for benchmarks whose threads aren't tied to one group
+    struct bench_group_stats *workers;
+    uint32_t n_workers;
+    // allocate pair tables for all group stats, including workers
+    int pairs;
+    // per iteration over all groups
+    struct hist iter;
+    // per iteration, from the first to the last read completing
+    struct hist skew;
+    // fixed-rate mode only: lateness of each sample's start relative to its deadline
+    struct hist jitter;
+    // fixed-rate mode only: sample slots in the run, and those skipped by overruns
+    uint64_t slots;
+    uint64_t missed;
+    // total time spent in the benchmark
+    uint64_t elapsed;
+    // scheduling counts of the driving thread and of all threads it started, if recorded
+    int sched;
+    struct sched_counts sched_driver;
+    struct sched_counts sched_workers;
+};
+
+struct bench_stats *bench_stats_alloc(uint32_t n_groups);
+
+void bench_stats_free(struct bench_stats *s);
+
+/**
+ * (Re)allocate per-worker stats, where "group" is a worker's pass over its share of the work.
+ */
+int bench_stats_alloc_workers(struct bench_stats *s, uint32_t n_workers);
+
+void bench_stats_reset(struct bench_stats *s);
+
+/**
+ * Reset all stats, keeping (but emptying) any pair table.
+ */
+void bench_group_stats_reset(struct bench_group_stats *gs);
+
+int bench_group_stats_alloc_pairs(struct bench_group_stats *gs);
+
+void bench_group_stats_free_pairs(struct bench_group_stats *gs);
+
+/**
+ * Merge everything in src into dst, e.g., per-thread stats into their group.
+ */
+void bench_group_stats_merge(struct bench_group_stats *dst, const struct bench_group_stats *src);
+
+/**
+ * Allocate pair tables for every group and worker, now and in later
+ * bench_stats_alloc_workers() calls.
+ */
+int bench_stats_enable_pairs(struct bench_stats *s);
+
+/**
+ * Find or insert the entry for a pair. Returns NULL if out of memory.
+ */
+struct bench_pair *bench_pairs_get(struct bench_pairs *p, uint32_t src, uint32_t dst);
+
+/**
+ * Note a read completing at time t for skew tracking.
+ */
+static inline void bench_group_stats_mark(struct bench_group_stats *gs, uint64_t t)
+{
+    if (!gs->t_first) {
+        gs->t_first = t;
+    }
+    gs->t_last = t;
+}
+
+/**
+ * Merge the read, group, and wake histograms of all groups and workers.
+ * Worker passes aren't group passes, so they're left out of group.
+ */
+void bench_stats_merge(const struct bench_stats *s, struct hist *read, struct hist *group,
+                       struct hist *wake);
+
+/**
+ * Merge everything in all groups and workers into newly allocated stats, with a pair table
+ * if pairs are enabled. Worker passes are left out of group, as above.
+ * Returns NULL if out of memory. Free with bench_stats_merge_free().
+ */
+struct bench_group_stats *bench_stats_merge_all(const struct bench_stats *s);
+
+void bench_stats_merge_free(struct bench_group_stats *all);
+
+/**
+ * Print a latency report.
+ * reads_per_iter is used to compute throughput.
+ */
+void bench_stats_print(FILE *f, const struct bench_stats *s, uint64_t reads_per_iter);
+
+#endif // BENCH_STATS_H
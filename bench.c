@@ -1,314 +1,2381 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
 
 #include "affinity.h"
+#include "barrier.h"
 #include "bench.h"
+#include "bench-stats.h"
+#include "delta.h"
+#include "deque.h"
+#include "hist.h"
 #include "msr.h"
+#include "msr-info.h"
+#include "msr-uring.h"
+#include "read-plan.h"
+#include "sample-store.h"
+#include "sched-counters.h"
+#include "timing.h"
+#include "topology.h"
+#include "trace.h"
 
 #ifndef BENCH_DEBUG
 #define BENCH_DEBUG 0
 #endif
 
-static int bench_rdmsrs(const struct msr_handle *h, const uint32_t *msrs, uint32_t n_msrs)
+static inline struct bench_group_stats *bench_group_stats(const struct bench *ctx,
+                                                          uint32_t g)
+{
+    return ctx->stats ? &ctx->stats->groups[g] : NULL;
+}
+
+static inline uint64_t bench_stats_begin(const struct bench *ctx)
+{
+    return ctx->stats ? timing_now() : 0;
+}
+
+static inline void bench_stats_end(struct hist *h, uint64_t t0)
+{
+    if (h) {
+        hist_record(h, timing_now() - t0);
+    }
+}
+
+static inline struct sample_block *bench_store_block(const struct bench *ctx, uint32_t g,
+                                                     uint32_t h)
+{
+    return ctx->store ? sample_store_block(ctx->store, g, h) : NULL;
+}
+
+// call from the thread that will store the samples, so they're local to it
+static inline void bench_store_touch(const struct bench *ctx, uint32_t g, uint32_t h_first,
+                                     uint32_t n)
+{
+    if (ctx->store) {
+        sample_store_touch(ctx->store, g, h_first, n);
+    }
+}
+
+static inline uint32_t bench_cur_cpu(void)
+{
+    uint32_t cpu = msr_get_cur_cpu();
+    return cpu == UINT32_MAX ? BENCH_PAIR_CPU_UNKNOWN : cpu;
+}
+
+// migrate to the handle's CPU, attributing the cost to the {current CPU, target} pair
+static int bench_migrate(const struct msr_handle *handle, struct bench_group_stats *gs)
+{
+    struct bench_pair *e;
+    uint64_t t0;
+    uint64_t dt;
+    uint32_t src;
+    int rc;
+    if (!gs) {
+        trace_record(TRACE_MIGRATE, msr_get_cpu(handle), TRACE_NONE);
+        rc = msr_migrate(handle);
+        trace_record(TRACE_MIGRATE | TRACE_END, msr_get_cpu(handle), TRACE_NONE);
+        return rc;
+    }
+    src = bench_cur_cpu();
+    t0 = timing_now();
+    trace_record(TRACE_MIGRATE, msr_get_cpu(handle), TRACE_NONE);
+    rc = msr_migrate(handle);
+    trace_record(TRACE_MIGRATE | TRACE_END, msr_get_cpu(handle), TRACE_NONE);
+    dt = timing_now() - t0;
+    hist_record(&gs->migrate, dt);
+    gs->migrated = 1;
+    gs->migrated_from = src;
+    if (gs->pairs && (e = bench_pairs_get(gs->pairs, src, msr_get_cpu(handle)))) {
+        e->migrations++;
+        e->migrate += dt;
+    }
+    return rc;
+}
+
+// attribute a read issued from cur to the handle's CPU
+static void bench_read_attr(struct bench_group_stats *gs, uint32_t cur, uint32_t dst,
+                            uint64_t dt)
+{
+    struct bench_pair *e;
+    if (cur == dst) {
+        gs->local++;
+    } else {
+        gs->remote++;
+    }
+    if (gs->migrated) {
+        hist_record(&gs->first, dt);
+        if (gs->pairs && (e = bench_pairs_get(gs->pairs, gs->migrated_from, dst))) {
+            e->firsts++;
+            e->first += dt;
+        }
+        gs->migrated = 0;
+    }
+    if (gs->pairs && (e = bench_pairs_get(gs->pairs, cur, dst))) {
+        e->reads++;
+        e->read += dt;
+    }
+}
+
+// read MSRs [lo, hi), and finish the stored sample if commit
+static int bench_rdmsrs_range(const struct bench *ctx, uint32_t g, uint32_t h, uint32_t lo,
+                              uint32_t hi, int commit, struct bench_group_stats *gs)
 {
+    const struct msr_handle *handle = ctx->cpu_groups[g].handles[h];
+    struct sample_block *blk = bench_store_block(ctx, g, h);
+    uint32_t row = ctx->plan ? read_plan_row(ctx->plan, g, h) : ctx->cpu_groups[g].first + h;
+    uint64_t *out = ctx->out ? &ctx->out[(uint64_t) row * ctx->n_msrs] : NULL;
     uint64_t data;
+    uint64_t t0 = 0;
+    uint64_t t1;
+    uint32_t cpu = msr_get_cpu(handle);
+    uint32_t cur = 0;
     uint32_t m;
-#if BENCH_DEBUG
-    uint32_t cpu = msr_get_cpu(h);
-#endif
-    for (m = 0; m < n_msrs; m++) {
-        if (msr_read(h, msrs[m], &data) < 0) {
+    int err;
+    int rc;
+    if (gs) {
+        // where reads are issued from can only change at a migration, so look it up once
+        cur = bench_cur_cpu();
+        t0 = timing_now();
+    }
+    for (m = lo; m < hi; m++) {
+        if (ctx->plan && !read_plan_reads(ctx->plan, g, h, m)) {
+            continue;
+        }
+        trace_record(TRACE_READ, cpu, ctx->msrs[m]);
+        rc = msr_read(handle, ctx->msrs[m], &data);
+        trace_record(TRACE_READ | TRACE_END, cpu, ctx->msrs[m]);
+        // a short read, e.g., past the end of a file, leaves data unset, so it fails too
+        if (rc != sizeof(uint64_t)) {
+            err = rc < 0 ? errno : EIO;
             perror("msr_read");
+            errno = err;
             return -1;
         }
+        if (gs) {
+            // chain timestamps so each read costs a single clock read
+            t1 = timing_now();
+            hist_record(&gs->read, t1 - t0);
+            bench_read_attr(gs, cur, cpu, t1 - t0);
+            bench_group_stats_mark(gs, t1);
+            t0 = t1;
+        }
+        if (blk) {
+            sample_block_put(blk, m, data);
+        }
+        if (out) {
+            out[m] = data;
+        }
 #if BENCH_DEBUG
-        printf("%"PRIu32": %"PRIu32": 0x%08lx\n", cpu, msrs[m], data);
+        printf("%"PRIu32": %"PRIu32": 0x%08lx\n", cpu, ctx->msrs[m], data);
 #endif
     }
+    if (blk && commit) {
+        sample_block_commit(blk, gs ? t0 : timing_now());
+    }
     return 0;
 }
 
-int bench_serial(const struct bench *ctx)
+static int bench_rdmsrs(const struct bench *ctx, uint32_t g, uint32_t h,
+                        struct bench_group_stats *gs)
 {
-    uint32_t i;
-    uint32_t g;
-    uint32_t h;
-    for (i = 0; i < ctx->iters; i++) {
-        for (g = 0; g < ctx->n_cpu_groups; g++) {
-            for (h = 0; h < ctx->cpu_groups[g].n_handles; h++) {
-                if (bench_rdmsrs(ctx->cpu_groups[g].handles[h], ctx->msrs, ctx->n_msrs)) {
-                    return -1;
-                }
-            }
+    return bench_rdmsrs_range(ctx, g, h, 0, ctx->n_msrs, 1, gs);
+}
+
+// fixed-rate pacing: sample k is due at t0 + k * period, so lateness never accumulates
+struct bench_pace {
+    uint64_t t0;
+    uint64_t period;
+    uint64_t slot;
+    uint64_t n_slots;
+};
+
+static uint64_t bench_pace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_pace_init(const struct bench *ctx, struct bench_pace *p)
+{
+    p->slot = 0;
+    p->n_slots = ctx->iters;
+    if (ctx->rate > 0) {
+        p->period = (uint64_t) (1e9 / ctx->rate);
+        if (ctx->duration > 0) {
+            p->n_slots = (uint64_t) (ctx->duration * ctx->rate);
+        }
+        p->t0 = bench_pace_now();
+        if (ctx->stats) {
+            ctx->stats->slots += p->n_slots;
         }
     }
-    return 0;
 }
 
-int bench_serial_migrate(const struct bench *ctx)
+/**
+ * Wait for the next sample's deadline. Returns 0 when the run is over.
+ * A sample that can't start within its period is skipped and counted as missed.
+ */
+static int bench_pace_next(const struct bench *ctx, struct bench_pace *p)
+{
+    struct timespec ts;
+    uint64_t deadline;
+    uint64_t now;
+    uint64_t late;
+    if (!(ctx->rate > 0)) {
+        return p->slot++ < p->n_slots;
+    }
+    now = bench_pace_now();
+    deadline = p->t0 + p->slot * p->period;
+    if (now >= deadline + p->period) {
+        late = (now - deadline) / p->period;
+        if (late > p->n_slots - p->slot) {
+            late = p->n_slots - p->slot;
+        }
+        p->slot += late;
+        if (ctx->stats) {
+            ctx->stats->missed += late;
+        }
+        deadline = p->t0 + p->slot * p->period;
+    }
+    if (p->slot >= p->n_slots) {
+        return 0;
+    }
+    p->slot++;
+    ts.tv_sec = deadline / 1000000000;
+    ts.tv_nsec = deadline % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    if (ctx->stats) {
+        now = bench_pace_now();
+        hist_record(&ctx->stats->jitter,
+                    now > deadline ? (uint64_t) timing_ns_to_ticks(now - deadline) : 0);
+    }
+    return 1;
+}
+
+static void bench_sample_skew_scan(struct bench_group_stats *gs, uint32_t n,
+                                   uint64_t *first, uint64_t *last)
 {
-    struct affinity aff;
     uint32_t i;
-    uint32_t g;
-    uint32_t h;
-    int err = 0;
-    affinity_save(&aff);
-    for (i = 0; i < ctx->iters; i++) {
-        for (g = 0; g < ctx->n_cpu_groups; g++) {
-            for (h = 0; h < ctx->cpu_groups[g].n_handles; h++) {
-                affinity_set_cpu(msr_get_cpu(ctx->cpu_groups[g].handles[h]));
-                if (bench_rdmsrs(ctx->cpu_groups[g].handles[h], ctx->msrs, ctx->n_msrs)) {
-                    err = errno;
-                }
-                if (err) {
-                    affinity_restore(&aff);
-                    errno = err;
-                    return -1;
-                }
+    for (i = 0; i < n; i++) {
+        if (gs[i].t_first) {
+            if (gs[i].t_first < *first) {
+                *first = gs[i].t_first;
+            }
+            if (gs[i].t_last > *last) {
+                *last = gs[i].t_last;
             }
+            gs[i].t_first = 0;
+            gs[i].t_last = 0;
         }
     }
-    affinity_restore(&aff);
-    return 0;
 }
 
-struct bench_thr_ctx {
-    pthread_t thr;
-    pthread_mutex_t mtx;
-    pthread_cond_t cond;
-    int is_notif;
-    const struct bench *ctx;
-    uint32_t cpu_group;
-    int go;
-    int die;
-    int err;
+/**
+ * Record the spread between the first and last read of the sample just completed.
+ * extra holds stats not reachable through ctx->stats, e.g., per-thread ones.
+ * Must only be called while no reader is active.
+ */
+static void bench_sample_skew(const struct bench *ctx, struct bench_group_stats *extra,
+                              uint32_t n_extra)
+{
+    uint64_t first = UINT64_MAX;
+    uint64_t last = 0;
+    if (!ctx->stats) {
+        return;
+    }
+    bench_sample_skew_scan(ctx->stats->groups, ctx->stats->n_groups, &first, &last);
+    bench_sample_skew_scan(ctx->stats->workers, ctx->stats->n_workers, &first, &last);
+    if (extra) {
+        bench_sample_skew_scan(extra, n_extra, &first, &last);
+    }
+    if (last) {
+        hist_record(&ctx->stats->skew, last - first);
+    }
+}
+
+// a way of reading a whole group at once
+struct bench_batch_ops {
+    const char *name;
+    void *(*alloc)(struct msr_handle *const *handles, uint32_t n_handles,
+                   const uint32_t *msrs, uint32_t n_msrs);
+    void (*free)(void *b);
+    int (*read)(void *b, uint64_t *data);
 };
 
-static void *bench_thr(void *arg)
+static void *bench_msr_batch_alloc(struct msr_handle *const *handles, uint32_t n_handles,
+                                   const uint32_t *msrs, uint32_t n_msrs)
 {
-    struct bench_thr_ctx *btc = (struct bench_thr_ctx *)arg;
-    const struct bench *ctx = btc->ctx;
-    const struct bench_cpu_group *group = &ctx->cpu_groups[btc->cpu_group];
-    uint32_t h;
-    while (!btc->die) {
-        // wait for go-ahead
-        if (btc->go) {
-            for (h = 0; h < group->n_handles; h++) {
-                if (bench_rdmsrs(group->handles[h], ctx->msrs, ctx->n_msrs)) {
-                    btc->err = errno;
-                }
-            }
-            btc->go = 0;
+    return msr_batch_alloc(handles, n_handles, msrs, n_msrs);
+}
+
+static void bench_msr_batch_free(void *b)
+{
+    msr_batch_free((struct msr_batch *)b);
+}
+
+static int bench_msr_batch_read(void *b, uint64_t *data)
+{
+    return msr_batch_read((struct msr_batch *)b, data);
+}
+
+static const struct bench_batch_ops bench_batch_ops_msr = {
+    .name = "msr_batch",
+    .alloc = bench_msr_batch_alloc,
+    .free = bench_msr_batch_free,
+    .read = bench_msr_batch_read,
+};
+
+static void *bench_msr_uring_alloc(struct msr_handle *const *handles, uint32_t n_handles,
+                                   const uint32_t *msrs, uint32_t n_msrs)
+{
+    return msr_uring_alloc(handles, n_handles, msrs, n_msrs);
+}
+
+static void bench_msr_uring_free(void *b)
+{
+    msr_uring_free((struct msr_uring *)b);
+}
+
+static int bench_msr_uring_read(void *b, uint64_t *data)
+{
+    return msr_uring_read((struct msr_uring *)b, data);
+}
+
+static const struct bench_batch_ops bench_batch_ops_uring = {
+    .name = "msr_uring",
+    .alloc = bench_msr_uring_alloc,
+    .free = bench_msr_uring_free,
+    .read = bench_msr_uring_read,
+};
+
+// with a read plan, a group's batch is one batch per set of MSRs its handles read
+struct bench_plan_part {
+    void *b;
+    struct msr_handle **handles;
+    // the part's handles' indexes in the group, and its MSRs' indexes in ctx->msrs
+    uint32_t *hs;
+    uint32_t n_handles;
+    uint32_t *msrs;
+    uint32_t *ms;
+    uint32_t n_msrs;
+    uint64_t *data;
+};
+
+struct bench_plan_batch {
+    const struct bench_batch_ops *ops;
+    struct bench_plan_part *parts;
+    uint32_t n_parts;
+};
+
+static void bench_plan_batch_free(struct bench_plan_batch *pb)
+{
+    struct bench_plan_part *part;
+    uint32_t x;
+    for (x = 0; x < pb->n_parts; x++) {
+        part = &pb->parts[x];
+        if (part->b) {
+            pb->ops->free(part->b);
         }
-        pthread_yield();
+        free(part->handles);
+        free(part->hs);
+        free(part->msrs);
+        free(part->ms);
+        free(part->data);
     }
-    return NULL;
+    free(pb->parts);
+    free(pb);
 }
 
-static void *bench_thr_migrate(void *arg)
+static struct bench_plan_batch *bench_plan_batch_alloc(const struct bench_batch_ops *ops,
+                                                       const struct bench *ctx, uint32_t g)
 {
-    struct bench_thr_ctx *btc = (struct bench_thr_ctx *)arg;
-    const struct bench *ctx = btc->ctx;
-    const struct bench_cpu_group *group = &ctx->cpu_groups[btc->cpu_group];
+    const struct read_plan *p = ctx->plan;
+    const struct bench_cpu_group *group = &ctx->cpu_groups[g];
+    const uint8_t *reads = &p->reads[(uint64_t) group->first * ctx->n_msrs];
+    struct bench_plan_batch *pb;
+    struct bench_plan_part *part;
     uint32_t h;
-    while (!btc->die) {
-        // wait for go-ahead
-        if (btc->go) {
-            for (h = 0; h < group->n_handles; h++) {
-                affinity_set_cpu(msr_get_cpu(group->handles[h]));
-                if (bench_rdmsrs(group->handles[h], ctx->msrs, ctx->n_msrs)) {
-                    btc->err = errno;
+    uint32_t m;
+    uint32_t x;
+    pb = calloc(1, sizeof(*pb));
+    if (!pb) {
+        perror("calloc");
+        return NULL;
+    }
+    pb->ops = ops;
+    pb->parts = calloc(group->n_handles ? group->n_handles : 1, sizeof(*pb->parts));
+    if (!pb->parts) {
+        perror("calloc");
+        free(pb);
+        return NULL;
+    }
+    for (h = 0; h < group->n_handles; h++) {
+        for (x = 0; x < pb->n_parts; x++) {
+            if (!memcmp(&reads[(uint64_t) h * ctx->n_msrs],
+                        &reads[(uint64_t) pb->parts[x].hs[0] * ctx->n_msrs], ctx->n_msrs)) {
+                break;
+            }
+        }
+        part = &pb->parts[x];
+        if (x == pb->n_parts) {
+            pb->n_parts++;
+            part->handles = malloc(group->n_handles * sizeof(struct msr_handle *));
+            part->hs = malloc(group->n_handles * sizeof(uint32_t));
+            part->msrs = malloc(ctx->n_msrs * sizeof(uint32_t));
+            part->ms = malloc(ctx->n_msrs * sizeof(uint32_t));
+            if (!part->handles || !part->hs || !part->msrs || !part->ms) {
+                perror("malloc");
+                goto fail;
+            }
+            for (m = 0; m < ctx->n_msrs; m++) {
+                if (reads[(uint64_t) h * ctx->n_msrs + m]) {
+                    part->ms[part->n_msrs] = m;
+                    part->msrs[part->n_msrs++] = ctx->msrs[m];
                 }
             }
-            btc->go = 0;
         }
-        pthread_yield();
+        part->handles[part->n_handles] = group->handles[h];
+        part->hs[part->n_handles++] = h;
     }
+    for (x = 0; x < pb->n_parts; x++) {
+        part = &pb->parts[x];
+        part->data = malloc((uint64_t) part->n_handles * part->n_msrs * sizeof(uint64_t));
+        if (!part->data) {
+            perror("malloc");
+            goto fail;
+        }
+        // fault it in now, not in the first measured sample
+        memset(part->data, 0, (uint64_t) part->n_handles * part->n_msrs * sizeof(uint64_t));
+        part->b = ops->alloc(part->handles, part->n_handles, part->msrs, part->n_msrs);
+        if (!part->b) {
+            perror(ops->name);
+            goto fail;
+        }
+    }
+    return pb;
+
+fail:
+    bench_plan_batch_free(pb);
     return NULL;
 }
 
-static void *bench_thr_notif(void *arg)
+// read every part, scattering the values into the group's handle-major layout
+static int bench_plan_batch_read(const struct bench *ctx, struct bench_plan_batch *pb,
+                                 uint64_t *data)
 {
-    struct bench_thr_ctx *btc = (struct bench_thr_ctx *)arg;
-    const struct bench *ctx = btc->ctx;
-    const struct bench_cpu_group *group = &ctx->cpu_groups[btc->cpu_group];
-    uint32_t h;
-    pthread_mutex_lock(&btc->mtx);
-    while (!btc->die) {
-        // wait for go-ahead
-        while (!btc->go && !btc->die) {
-            pthread_cond_wait(&btc->cond, &btc->mtx);
-        }
-        if (btc->die) {
-            break;
+    const struct bench_plan_part *part;
+    uint32_t x;
+    uint32_t i;
+    uint32_t j;
+    for (x = 0; x < pb->n_parts; x++) {
+        part = &pb->parts[x];
+        if (pb->ops->read(part->b, part->data)) {
+            return -1;
         }
-        for (h = 0; h < group->n_handles; h++) {
-            if (bench_rdmsrs(group->handles[h], ctx->msrs, ctx->n_msrs)) {
-                btc->err = errno;
+        for (i = 0; i < part->n_handles; i++) {
+            for (j = 0; j < part->n_msrs; j++) {
+                data[(uint64_t) part->hs[i] * ctx->n_msrs + part->ms[j]] =
+                    part->data[(uint64_t) i * part->n_msrs + j];
             }
         }
-        btc->go = 0;
     }
-    pthread_mutex_unlock(&btc->mtx);
-    return NULL;
+    return 0;
 }
 
-static void *bench_thr_notif_migrate(void *arg)
+static int bench_batch_read(const struct bench *ctx, const struct bench_batch_ops *ops,
+                            void *b, uint64_t *data)
 {
-    struct bench_thr_ctx *btc = (struct bench_thr_ctx *)arg;
-    const struct bench *ctx = btc->ctx;
-    const struct bench_cpu_group *group = &ctx->cpu_groups[btc->cpu_group];
+    return ctx->plan ? bench_plan_batch_read(ctx, b, data) : ops->read(b, data);
+}
+
+static void bench_batch_free(const struct bench *ctx, const struct bench_batch_ops *ops, void *b)
+{
+    if (ctx->plan) {
+        bench_plan_batch_free(b);
+    } else {
+        ops->free(b);
+    }
+}
+
+static int bench_rdbatch(const struct bench *ctx, const struct bench_batch_ops *ops,
+                         uint32_t g, void *b, uint64_t *data, struct bench_group_stats *gs)
+{
+    const struct read_plan *plan = ctx->plan;
+    struct sample_block *blk;
+    uint32_t n_handles = ctx->cpu_groups[g].n_handles;
+    uint64_t n_reads = plan ? plan->group_reads[g] : (uint64_t) n_handles * ctx->n_msrs;
+    uint64_t *out;
+    uint64_t t0 = 0;
+    uint64_t t1 = 0;
     uint32_t h;
-    pthread_mutex_lock(&btc->mtx);
-    while (!btc->die) {
-        // wait for go-ahead
-        while (!btc->go && !btc->die) {
-            pthread_cond_wait(&btc->cond, &btc->mtx);
+    uint32_t m;
+    int err;
+    // the group's values are contiguous and handle-major in out too, so read straight into it
+    if (ctx->out && !plan) {
+        data = &ctx->out[(uint64_t) ctx->cpu_groups[g].first * ctx->n_msrs];
+    }
+    if (gs) {
+        t0 = timing_now();
+    }
+    trace_record(TRACE_BATCH, TRACE_NONE, TRACE_NONE);
+    if (bench_batch_read(ctx, ops, b, data)) {
+        // perror() may set errno, e.g., on its first use of stderr
+        err = errno;
+        perror(ops->name);
+        errno = err;
+        return -1;
+    }
+    trace_record(TRACE_BATCH | TRACE_END, TRACE_NONE, TRACE_NONE);
+    if (gs || ctx->store) {
+        t1 = timing_now();
+    }
+    if (gs) {
+        // the reads aren't individually observable, so record the amortized cost
+        bench_group_stats_mark(gs, t1);
+        hist_record(&gs->group, t1 - t0);
+        if (n_reads) {
+            hist_record_n(&gs->read, (t1 - t0) / n_reads, n_reads);
         }
-        if (btc->die) {
-            break;
+    }
+    for (h = 0; h < n_handles && ctx->out && plan; h++) {
+        out = &ctx->out[(uint64_t) read_plan_row(plan, g, h) * ctx->n_msrs];
+        for (m = 0; m < ctx->n_msrs; m++) {
+            if (read_plan_reads(plan, g, h, m)) {
+                out[m] = data[h * ctx->n_msrs + m];
+            }
         }
-        for (h = 0; h < group->n_handles; h++) {
-            affinity_set_cpu(msr_get_cpu(group->handles[h]));
-            if (bench_rdmsrs(group->handles[h], ctx->msrs, ctx->n_msrs)) {
-                btc->err = errno;
+    }
+    for (h = 0; h < n_handles && ctx->store; h++) {
+        blk = sample_store_block(ctx->store, g, h);
+        for (m = 0; m < ctx->n_msrs; m++) {
+            if (!plan || read_plan_reads(plan, g, h, m)) {
+                sample_block_put(blk, m, data[h * ctx->n_msrs + m]);
             }
         }
-        btc->go = 0;
+        sample_block_commit(blk, t1);
     }
-    pthread_mutex_unlock(&btc->mtx);
-    return NULL;
+    return 0;
 }
-    
-static int bench_thread_create(const struct bench *ctx,
-                               void *(*start_routine) (void *),
-                               struct bench_thr_ctx *thr_ctxs,
-                               int is_notif)
+
+static void *bench_batch_alloc(const struct bench_batch_ops *ops, const struct bench *ctx,
+                               uint32_t g, uint64_t **data)
 {
-    uint32_t i;
-    for (i = 0; i < ctx->n_cpu_groups; i++) {
-        pthread_mutex_init(&thr_ctxs[i].mtx, NULL);
-        pthread_cond_init(&thr_ctxs[i].cond, NULL);
-        thr_ctxs[i].is_notif = is_notif;
-        thr_ctxs[i].ctx = ctx;
-        thr_ctxs[i].cpu_group = i;
-        thr_ctxs[i].go = 0;
-        thr_ctxs[i].die = 0;
-        thr_ctxs[i].err = 0;
-        errno = pthread_create(&thr_ctxs[i].thr, NULL, start_routine, &thr_ctxs[i]);
-        if (errno) {
-            perror("pthread_create");
-            return -1;
+    const struct bench_cpu_group *group = &ctx->cpu_groups[g];
+    void *b;
+    *data = malloc((group->n_handles ? group->n_handles : 1) * ctx->n_msrs * sizeof(uint64_t));
+    if (!*data) {
+        perror("malloc");
+        return NULL;
+    }
+    // fault it in now, not in the first measured sample
+    memset(*data, 0, (group->n_handles ? group->n_handles : 1) * ctx->n_msrs * sizeof(uint64_t));
+    if (ctx->plan) {
+        b = bench_plan_batch_alloc(ops, ctx, g);
+    } else {
+        b = ops->alloc(group->handles, group->n_handles, ctx->msrs, ctx->n_msrs);
+        if (!b) {
+            perror(ops->name);
         }
     }
-    return 0;
+    if (!b) {
+        free(*data);
+        *data = NULL;
+    }
+    return b;
 }
 
-static int bench_thread_drive(const struct bench *ctx,
-                              struct bench_thr_ctx *thr_ctxs)
+struct bench_thr_ctx;
+struct bench_pipe;
+struct bench_session;
+
+// the trace buffer of the driver (0) or a group's thread (1 + g), NULL if not tracing
+static inline struct trace_buf *bench_trace_buf(const struct bench *ctx, uint32_t i)
 {
-    uint32_t iter;
-    uint32_t i;
-    for (iter = 0; iter < ctx->iters; iter++) {
-        // tell threads to start an iteration
-        for (i = 0; i < ctx->n_cpu_groups; i++) {
-            if (thr_ctxs[i].is_notif) {
-                pthread_mutex_lock(&thr_ctxs[i].mtx);
-                thr_ctxs[i].go = 1;
-                pthread_cond_signal(&thr_ctxs[i].cond);
-                pthread_mutex_unlock(&thr_ctxs[i].mtx);
-            } else {
-                thr_ctxs[i].go = 1;
-            }
-        }
-        // wait for all threads to complete an iteration
-        for (i = 0; i < ctx->n_cpu_groups; i++) {
-            while (thr_ctxs[i].go) {
-                pthread_yield();
-            }
-            if (thr_ctxs[i].err) {
-                errno = thr_ctxs[i].err;
-                return -1;
-            }
-        }
+    return ctx->trace && i < ctx->trace->n_bufs ? &ctx->trace->bufs[i] : NULL;
+}
+
+// the i-th thread's buffer, named for what it reads, e.g., "group 2"
+static struct trace_buf *bench_trace_thr(const struct bench *ctx, uint32_t i, const char *what,
+                                         uint32_t n)
+{
+    struct trace_buf *b = bench_trace_buf(ctx, 1 + i);
+    if (b) {
+        snprintf(b->name, sizeof(b->name), "%s %"PRIu32, what, n);
     }
-    return 0;
+    return b;
 }
 
-static int bench_thread_join(const struct bench *ctx,
-                             struct bench_thr_ctx *thr_ctxs)
+// record the start of a wait the first time a loop has to wait
+static inline void bench_trace_wait(int *waited)
 {
-    uint32_t i;
-    int err = 0;
-    for (i = 0; i < ctx->n_cpu_groups; i++) {
-        if (thr_ctxs[i].is_notif) {
-            pthread_mutex_lock(&thr_ctxs[i].mtx);
-            thr_ctxs[i].die = 1;
-            pthread_cond_signal(&thr_ctxs[i].cond);
-            pthread_mutex_unlock(&thr_ctxs[i].mtx);
-        } else {
-            thr_ctxs[i].die = 1;
-        }
-        errno = pthread_join(thr_ctxs[i].thr, NULL);
-        if (errno) {
-            perror("pthread_join");
-            err = errno;
-        } else if (thr_ctxs[i].err) {
-            err = thr_ctxs[i].err;
-        }
-        pthread_cond_destroy(&thr_ctxs[i].cond);
-        pthread_mutex_destroy(&thr_ctxs[i].mtx);
+    if (!*waited) {
+        trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+        *waited = 1;
     }
-    errno = err;
-    return err ? -1 : 0;
 }
 
-static int bench_thread_exec(const struct bench *ctx,
-                             void *(*start_routine) (void *),
-                             int is_notif)
+static inline void bench_trace_wait_end(int waited)
 {
-    int rc;
+    if (waited) {
+        trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+    }
+}
+
+// how a strategy takes samples one at a time
+struct bench_session_ops {
+    int (*start)(struct bench_session *s);
+    // take one sample, complete when this returns
+    int (*sample)(struct bench_session *s);
+    // optional: start a sample that may still be in flight, and wait for all in flight
+    int (*issue)(struct bench_session *s);
+    int (*drain)(struct bench_session *s);
+    int (*stop)(struct bench_session *s);
+    // serial*: bind to each handle's CPU before reading it
+    int migrate;
+    // batch, uring
+    const struct bench_batch_ops *batch;
+    // thread*
+    void *(*start_routine)(void *);
+    int is_notif;
+};
+
+struct bench_session {
+    const struct bench *ctx;
+    const struct bench_session_ops *ops;
+    // serial_migrate: the caller's affinity, restored at stop
+    struct affinity aff;
+    // batch, uring: one batch and buffer per group
+    void **batches;
+    uint64_t **data;
+    // thread*: iterations issued to the threads, and retired once every group completed them
+    struct bench_thr_ctx **thr_ctxs;
+    // BENCH_THR_PACKED: the array thr_ctxs point into
+    struct bench_thr_packed *thr_packed;
+    struct bench_pipe *pipe;
+    uint64_t issued;
+    uint64_t retired;
+};
+
+/**
+ * Run a strategy's samples back-to-back or paced, over one session. Everything the
+ * strategy sets up is done before timing starts.
+ */
+static int bench_session_exec(const struct bench *ctx, const struct bench_session_ops *ops)
+{
+    struct bench_session s;
+    struct bench_pace pace;
+    uint64_t t_start;
+    uint32_t seq = 0;
+    int rc = 0;
     int err;
-    struct bench_thr_ctx *thr_ctxs = calloc(ctx->n_cpu_groups,
-                                            sizeof(struct bench_thr_ctx));
-    if (!thr_ctxs) {
-        perror("calloc");
+    memset(&s, 0, sizeof(s));
+    s.ctx = ctx;
+    s.ops = ops;
+    if (ops->start(&s)) {
         return -1;
     }
-    rc = bench_thread_create(ctx, start_routine, thr_ctxs, is_notif);
-    if (!rc) {
-        rc = bench_thread_drive(ctx, thr_ctxs);
+    trace_attach(bench_trace_buf(ctx, 0));
+    t_start = bench_stats_begin(ctx);
+    bench_pace_init(ctx, &pace);
+    while (!rc && bench_pace_next(ctx, &pace)) {
+        trace_iter_begin(seq++);
+        rc = ops->issue ? ops->issue(&s) : ops->sample(&s);
+        trace_record(TRACE_ITER | TRACE_END, TRACE_NONE, TRACE_NONE);
+    }
+    if (!rc && ops->drain) {
+        rc = ops->drain(&s);
+    }
+    trace_attach(NULL);
+    if (!rc && ctx->stats) {
+        ctx->stats->elapsed += timing_now() - t_start;
     }
     if (rc) {
         err = errno;
-        bench_thread_join(ctx, thr_ctxs);
+        ops->stop(&s);
         errno = err;
     } else {
-        rc = bench_thread_join(ctx, thr_ctxs);
+        rc = ops->stop(&s);
     }
-    free(thr_ctxs);
     return rc;
 }
 
-int bench_thread(const struct bench *ctx)
+static int bench_serial_start(struct bench_session *s)
 {
-    return bench_thread_exec(ctx, bench_thr, 0);
+    const struct bench *ctx = s->ctx;
+    uint32_t g;
+    if (s->ops->migrate) {
+        affinity_save(&s->aff);
+    }
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        bench_store_touch(ctx, g, 0, ctx->cpu_groups[g].n_handles);
+    }
+    return 0;
 }
 
-int bench_thread_migrate(const struct bench *ctx)
+static int bench_serial_sample(struct bench_session *s)
 {
-    return bench_thread_exec(ctx, bench_thr_migrate, 0);
-}
-
-int bench_thread_notif(const struct bench *ctx)
+    const struct bench *ctx = s->ctx;
+    struct bench_group_stats *gs;
+    uint64_t t_iter;
+    uint64_t t_group;
+    uint32_t g;
+    uint32_t h;
+    t_iter = bench_stats_begin(ctx);
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        gs = bench_group_stats(ctx, g);
+        t_group = bench_stats_begin(ctx);
+        for (h = 0; h < ctx->cpu_groups[g].n_handles; h++) {
+            if (s->ops->migrate) {
+                bench_migrate(ctx->cpu_groups[g].handles[h], gs);
+            }
+            if (bench_rdmsrs(ctx, g, h, gs)) {
+                return -1;
+            }
+        }
+        bench_stats_end(gs ? &gs->group : NULL, t_group);
+    }
+    bench_stats_end(ctx->stats ? &ctx->stats->iter : NULL, t_iter);
+    bench_sample_skew(ctx, NULL, 0);
+    return 0;
+}
+
+static int bench_serial_stop(struct bench_session *s)
+{
+    if (s->ops->migrate) {
+        affinity_restore(&s->aff);
+    }
+    return 0;
+}
+
+static const struct bench_session_ops bench_session_serial = {
+    .start = bench_serial_start,
+    .sample = bench_serial_sample,
+    .stop = bench_serial_stop,
+};
+
+static const struct bench_session_ops bench_session_serial_migrate = {
+    .start = bench_serial_start,
+    .sample = bench_serial_sample,
+    .stop = bench_serial_stop,
+    .migrate = 1,
+};
+
+int bench_serial(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_serial);
+}
+
+int bench_serial_migrate(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_serial_migrate);
+}
+
+static int bench_batch_stop(struct bench_session *s)
+{
+    uint32_t g;
+    for (g = 0; g < s->ctx->n_cpu_groups; g++) {
+        if (s->batches && s->batches[g]) {
+            bench_batch_free(s->ctx, s->ops->batch, s->batches[g]);
+        }
+        if (s->data) {
+            free(s->data[g]);
+        }
+    }
+    free(s->batches);
+    free(s->data);
+    s->batches = NULL;
+    s->data = NULL;
+    return 0;
+}
+
+static int bench_batch_start(struct bench_session *s)
+{
+    const struct bench *ctx = s->ctx;
+    uint32_t g;
+    int err;
+    s->batches = calloc(ctx->n_cpu_groups, sizeof(void *));
+    s->data = calloc(ctx->n_cpu_groups, sizeof(uint64_t *));
+    if (!s->batches || !s->data) {
+        perror("calloc");
+        bench_batch_stop(s);
+        return -1;
+    }
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        s->batches[g] = bench_batch_alloc(s->ops->batch, ctx, g, &s->data[g]);
+        if (!s->batches[g]) {
+            err = errno;
+            bench_batch_stop(s);
+            errno = err;
+            return -1;
+        }
+        bench_store_touch(ctx, g, 0, ctx->cpu_groups[g].n_handles);
+    }
+    return 0;
+}
+
+static int bench_batch_sample(struct bench_session *s)
+{
+    const struct bench *ctx = s->ctx;
+    uint64_t t_iter = bench_stats_begin(ctx);
+    uint32_t g;
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        if (bench_rdbatch(ctx, s->ops->batch, g, s->batches[g], s->data[g],
+                          bench_group_stats(ctx, g))) {
+            return -1;
+        }
+    }
+    bench_stats_end(ctx->stats ? &ctx->stats->iter : NULL, t_iter);
+    bench_sample_skew(ctx, NULL, 0);
+    return 0;
+}
+
+static const struct bench_session_ops bench_session_batch = {
+    .start = bench_batch_start,
+    .sample = bench_batch_sample,
+    .stop = bench_batch_stop,
+    .batch = &bench_batch_ops_msr,
+};
+
+static const struct bench_session_ops bench_session_uring = {
+    .start = bench_batch_start,
+    .sample = bench_batch_sample,
+    .stop = bench_batch_stop,
+    .batch = &bench_batch_ops_uring,
+};
+
+int bench_batch(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_batch);
+}
+
+int bench_uring(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_uring);
+}
+
+// a worker thread's start routine, wrapped to count the thread's scheduling events
+struct bench_thr_start {
+    void *(*start_routine)(void *);
+    void *arg;
+    struct sched_counts counts;
+};
+
+static inline int bench_sched_enabled(const struct bench *ctx)
+{
+    return ctx->sched && ctx->stats;
+}
+
+static void *bench_thr_counted(void *arg)
+{
+    struct bench_thr_start *s = (struct bench_thr_start *)arg;
+    struct sched_counters c;
+    void *ret;
+    // count what the thread can, without failing the benchmark over it
+    if (sched_counters_open(&c)) {
+        return s->start_routine(s->arg);
+    }
+    ret = s->start_routine(s->arg);
+    sched_counters_read(&c, &s->counts);
+    sched_counters_close(&c);
+    return ret;
+}
+
+// start the i-th thread, pinned as ctx->thr_cpus says
+static int bench_thr_spawn(const struct bench *ctx, uint32_t i, pthread_t *thr,
+                           struct bench_thr_start *s, void *(*start_routine)(void *), void *arg)
+{
+    pthread_attr_t attr;
+    cpu_set_t cpus;
+    int rc;
+    if (bench_sched_enabled(ctx)) {
+        memset(s, 0, sizeof(*s));
+        s->start_routine = start_routine;
+        s->arg = arg;
+        start_routine = bench_thr_counted;
+        arg = s;
+    }
+    if (!ctx->thr_cpus || !ctx->n_thr_cpus) {
+        return pthread_create(thr, NULL, start_routine, arg);
+    }
+    if ((rc = pthread_attr_init(&attr))) {
+        return rc;
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(ctx->thr_cpus[i % ctx->n_thr_cpus], &cpus);
+    rc = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    if (!rc) {
+        rc = pthread_create(thr, &attr, start_routine, arg);
+    }
+    pthread_attr_destroy(&attr);
+    return rc;
+}
+
+// fold a joined thread's counts into the run's
+static void bench_thr_collect(const struct bench *ctx, const struct bench_thr_start *s)
+{
+    if (bench_sched_enabled(ctx)) {
+        sched_counts_add(&ctx->stats->sched_workers, &s->counts);
+    }
+}
+
+// one iteration in flight: issued by the driver, retired once every group completes it
+struct bench_pipe_slot {
+    // groups yet to complete the iteration
+    _Alignas(64) atomic_uint remaining;
+    uint64_t t_issue;
+    // first and last read completing across groups, and the last group completing
+    atomic_uint_fast64_t t_first;
+    atomic_uint_fast64_t t_last;
+    atomic_uint_fast64_t t_done;
+};
+
+// lock-free ring of the iterations in flight, indexed by sequence number
+struct bench_pipe {
+    // iterations issued so far, only written by the driver
+    _Alignas(64) atomic_uint_fast64_t issued;
+    uint64_t mask;
+    struct bench_pipe_slot *slots;
+};
+
+// what the driver and a thread signal each other with
+struct bench_thr_flags {
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    atomic_int die;
+    // errno of the thread's last failure, stored before it completes the iteration
+    atomic_int err;
+};
+
+// a thread's own state, next to its flags in the configured layout
+struct bench_thr_ctx {
+    // set up by the driver before the thread starts, then read-only
+    const struct bench *ctx;
+    struct bench_pipe *pipe;
+    struct bench_thr_flags *flags;
+    uint32_t cpu_group;
+    int is_notif;
+    // filled in by pthread_create() and the thread's wrapper, read by the driver after the join
+    pthread_t thr;
+    struct bench_thr_start start;
+    // only written by the thread, every iteration: iterations it has completed, it may run up
+    // to pipeline_depth ahead of others
+    uint64_t done;
+};
+
+// BENCH_THR_PACKED: each thread's context with its flags inline, next to its neighbours'
+struct bench_thr_packed {
+    struct bench_thr_ctx ctx;
+    struct bench_thr_flags flags;
+};
+
+// BENCH_THR_LOCAL: each thread's context and flags share one block, on lines of their own
+#define BENCH_THR_FLAGS_OFFSET ((sizeof(struct bench_thr_ctx) + 63) / 64 * 64)
+#define BENCH_THR_BLOCK_SIZE (BENCH_THR_FLAGS_OFFSET + \
+                              (sizeof(struct bench_thr_flags) + 63) / 64 * 64)
+
+static inline struct bench_pipe_slot *bench_pipe_slot(struct bench_pipe *pipe, uint64_t seq)
+{
+    return &pipe->slots[seq & pipe->mask];
+}
+
+static void bench_atomic_min(atomic_uint_fast64_t *a, uint64_t v)
+{
+    uint_fast64_t cur = atomic_load_explicit(a, memory_order_relaxed);
+    while (v < cur && !atomic_compare_exchange_weak_explicit(a, &cur, v, memory_order_relaxed,
+                                                             memory_order_relaxed));
+}
+
+static void bench_atomic_max(atomic_uint_fast64_t *a, uint64_t v)
+{
+    uint_fast64_t cur = atomic_load_explicit(a, memory_order_relaxed);
+    while (v > cur && !atomic_compare_exchange_weak_explicit(a, &cur, v, memory_order_relaxed,
+                                                             memory_order_relaxed));
+}
+
+/**
+ * Wait for an iteration this thread hasn't done yet. Returns 0 when told to exit.
+ */
+static int bench_thr_next(struct bench_thr_ctx *btc)
+{
+    struct bench_thr_flags *f = btc->flags;
+    int waited = 0;
+    if (btc->is_notif) {
+        pthread_mutex_lock(&f->mtx);
+        while (!atomic_load_explicit(&f->die, memory_order_acquire) &&
+               atomic_load_explicit(&btc->pipe->issued, memory_order_acquire) == btc->done) {
+            bench_trace_wait(&waited);
+            pthread_cond_wait(&f->cond, &f->mtx);
+        }
+        pthread_mutex_unlock(&f->mtx);
+    } else {
+        while (!atomic_load_explicit(&f->die, memory_order_acquire) &&
+               atomic_load_explicit(&btc->pipe->issued, memory_order_acquire) == btc->done) {
+            bench_trace_wait(&waited);
+            sched_yield();
+        }
+    }
+    bench_trace_wait_end(waited);
+    return !atomic_load_explicit(&f->die, memory_order_acquire);
+}
+
+static uint64_t bench_thr_begin(struct bench_thr_ctx *btc, struct bench_group_stats *gs)
+{
+    uint64_t t = bench_stats_begin(btc->ctx);
+    trace_iter_begin((uint32_t) btc->done);
+    if (gs) {
+        hist_record(&gs->wake, t - bench_pipe_slot(btc->pipe, btc->done)->t_issue);
+    }
+    return t;
+}
+
+// record errno as the thread's failure, which completing the iteration then publishes
+static void bench_thr_fail(struct bench_thr_ctx *btc)
+{
+    atomic_store_explicit(&btc->flags->err, errno, memory_order_release);
+}
+
+// hand this group's part of the iteration's skew to the driver, then complete it
+static void bench_thr_done(struct bench_thr_ctx *btc, struct bench_group_stats *gs)
+{
+    struct bench_pipe_slot *slot = bench_pipe_slot(btc->pipe, btc->done);
+    if (gs) {
+        if (gs->t_first) {
+            bench_atomic_min(&slot->t_first, gs->t_first);
+            bench_atomic_max(&slot->t_last, gs->t_last);
+            gs->t_first = 0;
+            gs->t_last = 0;
+        }
+        bench_atomic_max(&slot->t_done, timing_now());
+    }
+    trace_record(TRACE_ITER | TRACE_END, TRACE_NONE, TRACE_NONE);
+    atomic_fetch_sub_explicit(&slot->remaining, 1, memory_order_release);
+    btc->done++;
+}
+
+static void *bench_thr(void *arg)
+{
+    struct bench_thr_ctx *btc = (struct bench_thr_ctx *)arg;
+    const struct bench *ctx = btc->ctx;
+    const struct bench_cpu_group *group = &ctx->cpu_groups[btc->cpu_group];
+    struct bench_group_stats *gs = bench_group_stats(ctx, btc->cpu_group);
+    uint64_t t_group;
+    uint32_t h;
+    bench_store_touch(ctx, btc->cpu_group, 0, group->n_handles);
+    trace_attach(bench_trace_thr(ctx, btc->cpu_group, "group", btc->cpu_group));
+    while (bench_thr_next(btc)) {
+        t_group = bench_thr_begin(btc, gs);
+        for (h = 0; h < group->n_handles; h++) {
+            if (bench_rdmsrs(ctx, btc->cpu_group, h, gs)) {
+                bench_thr_fail(btc);
+            }
+        }
+        bench_stats_end(gs ? &gs->group : NULL, t_group);
+        bench_thr_done(btc, gs);
+    }
+    return NULL;
+}
+
+static void *bench_thr_migrate(void *arg)
+{
+    struct bench_thr_ctx *btc = (struct bench_thr_ctx *)arg;
+    const struct bench *ctx = btc->ctx;
+    const struct bench_cpu_group *group = &ctx->cpu_groups[btc->cpu_group];
+    struct bench_group_stats *gs = bench_group_stats(ctx, btc->cpu_group);
+    uint64_t t_group;
+    uint32_t h;
+    bench_store_touch(ctx, btc->cpu_group, 0, group->n_handles);
+    trace_attach(bench_trace_thr(ctx, btc->cpu_group, "group", btc->cpu_group));
+    while (bench_thr_next(btc)) {
+        t_group = bench_thr_begin(btc, gs);
+        for (h = 0; h < group->n_handles; h++) {
+            bench_migrate(group->handles[h], gs);
+            if (bench_rdmsrs(ctx, btc->cpu_group, h, gs)) {
+                bench_thr_fail(btc);
+            }
+        }
+        bench_stats_end(gs ? &gs->group : NULL, t_group);
+        bench_thr_done(btc, gs);
+    }
+    return NULL;
+}
+
+static void bench_thr_batched(struct bench_thr_ctx *btc, const struct bench_batch_ops *ops)
+{
+    const struct bench *ctx = btc->ctx;
+    const struct bench_cpu_group *group = &ctx->cpu_groups[btc->cpu_group];
+    struct bench_group_stats *gs = bench_group_stats(ctx, btc->cpu_group);
+    uint64_t *data;
+    void *batch;
+    bench_store_touch(ctx, btc->cpu_group, 0, group->n_handles);
+    trace_attach(bench_trace_thr(ctx, btc->cpu_group, "group", btc->cpu_group));
+    // allocate in the thread so the batch is local to where it's used
+    batch = bench_batch_alloc(ops, ctx, btc->cpu_group, &data);
+    if (!batch) {
+        bench_thr_fail(btc);
+    }
+    while (bench_thr_next(btc)) {
+        bench_thr_begin(btc, gs);
+        if (batch && bench_rdbatch(ctx, ops, btc->cpu_group, batch, data, gs)) {
+            bench_thr_fail(btc);
+        }
+        bench_thr_done(btc, gs);
+    }
+    if (batch) {
+        bench_batch_free(ctx, ops, batch);
+    }
+    free(data);
+}
+
+static void *bench_thr_batch(void *arg)
+{
+    bench_thr_batched((struct bench_thr_ctx *)arg, &bench_batch_ops_msr);
+    return NULL;
+}
+
+static void *bench_thr_uring(void *arg)
+{
+    bench_thr_batched((struct bench_thr_ctx *)arg, &bench_batch_ops_uring);
+    return NULL;
+}
+
+static int bench_thread_create(const struct bench *ctx,
+                               void *(*start_routine) (void *),
+                               struct bench_thr_ctx **thr_ctxs,
+                               struct bench_pipe *pipe,
+                               int is_notif)
+{
+    struct bench_thr_ctx *btc;
+    uint32_t i;
+    for (i = 0; i < ctx->n_cpu_groups; i++) {
+        btc = thr_ctxs[i];
+        pthread_mutex_init(&btc->flags->mtx, NULL);
+        pthread_cond_init(&btc->flags->cond, NULL);
+        atomic_init(&btc->flags->die, 0);
+        atomic_init(&btc->flags->err, 0);
+        btc->is_notif = is_notif;
+        btc->ctx = ctx;
+        btc->pipe = pipe;
+        btc->cpu_group = i;
+        btc->done = 0;
+        errno = bench_thr_spawn(ctx, i, &btc->thr, &btc->start, start_routine, btc);
+        if (errno) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int bench_thread_check(const struct bench *ctx, struct bench_thr_ctx *const *thr_ctxs)
+{
+    uint32_t i;
+    int err;
+    for (i = 0; i < ctx->n_cpu_groups; i++) {
+        err = atomic_load_explicit(&thr_ctxs[i]->flags->err, memory_order_acquire);
+        if (err) {
+            errno = err;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// retire iterations every group has completed, in order
+static void bench_thread_retire(const struct bench *ctx, struct bench_pipe *pipe,
+                                uint64_t issued, uint64_t *retired)
+{
+    struct bench_pipe_slot *slot;
+    uint64_t t_first;
+    uint64_t t_last;
+    for (; *retired < issued; (*retired)++) {
+        slot = bench_pipe_slot(pipe, *retired);
+        if (atomic_load_explicit(&slot->remaining, memory_order_acquire)) {
+            break;
+        }
+        if (ctx->stats) {
+            hist_record(&ctx->stats->iter, slot->t_done - slot->t_issue);
+            t_first = atomic_load_explicit(&slot->t_first, memory_order_relaxed);
+            t_last = atomic_load_explicit(&slot->t_last, memory_order_relaxed);
+            if (t_last) {
+                hist_record(&ctx->stats->skew, t_last - t_first);
+            }
+        }
+    }
+}
+
+/**
+ * Issue an iteration to the group threads, first waiting until fewer than pipeline_depth are
+ * in flight, so a fast group can run ahead of a slow one instead of every iteration waiting
+ * for the slowest. A depth of 1 runs groups in lockstep.
+ */
+static int bench_thread_issue(struct bench_session *s)
+{
+    const struct bench *ctx = s->ctx;
+    uint64_t depth = ctx->pipeline_depth ? ctx->pipeline_depth : 1;
+    struct bench_pipe_slot *slot;
+    struct bench_thr_flags *f;
+    uint32_t i;
+    int waited = 0;
+    // wait for the slowest group to be less than depth iterations behind
+    while (1) {
+        if (bench_thread_check(ctx, s->thr_ctxs)) {
+            bench_trace_wait_end(waited);
+            return -1;
+        }
+        bench_thread_retire(ctx, s->pipe, s->issued, &s->retired);
+        if (s->issued - s->retired < depth) {
+            break;
+        }
+        bench_trace_wait(&waited);
+        sched_yield();
+    }
+    bench_trace_wait_end(waited);
+    slot = bench_pipe_slot(s->pipe, s->issued);
+    atomic_store_explicit(&slot->remaining, ctx->n_cpu_groups, memory_order_relaxed);
+    atomic_store_explicit(&slot->t_first, UINT64_MAX, memory_order_relaxed);
+    atomic_store_explicit(&slot->t_last, 0, memory_order_relaxed);
+    atomic_store_explicit(&slot->t_done, 0, memory_order_relaxed);
+    slot->t_issue = bench_stats_begin(ctx);
+    // tell threads to start an iteration
+    atomic_store_explicit(&s->pipe->issued, ++s->issued, memory_order_release);
+    // the flags, not the contexts: those share lines with what the threads write
+    for (i = 0; s->ops->is_notif && i < ctx->n_cpu_groups; i++) {
+        f = s->thr_ctxs[i]->flags;
+        pthread_mutex_lock(&f->mtx);
+        pthread_cond_signal(&f->cond);
+        pthread_mutex_unlock(&f->mtx);
+    }
+    return 0;
+}
+
+// wait for all threads to complete every iteration issued
+static int bench_thread_drain(struct bench_session *s)
+{
+    int waited = 0;
+    while (s->retired < s->issued) {
+        if (bench_thread_check(s->ctx, s->thr_ctxs)) {
+            bench_trace_wait_end(waited);
+            return -1;
+        }
+        bench_thread_retire(s->ctx, s->pipe, s->issued, &s->retired);
+        if (s->retired < s->issued) {
+            bench_trace_wait(&waited);
+            sched_yield();
+        }
+    }
+    bench_trace_wait_end(waited);
+    // a failure in the last iteration: retiring it made the thread's error visible
+    return bench_thread_check(s->ctx, s->thr_ctxs);
+}
+
+static int bench_thread_sample(struct bench_session *s)
+{
+    return bench_thread_issue(s) || bench_thread_drain(s) ? -1 : 0;
+}
+
+static int bench_thread_join(const struct bench *ctx,
+                             struct bench_thr_ctx **thr_ctxs)
+{
+    struct bench_thr_flags *f;
+    uint32_t i;
+    int err = 0;
+    int thr_err;
+    for (i = 0; i < ctx->n_cpu_groups; i++) {
+        f = thr_ctxs[i]->flags;
+        if (thr_ctxs[i]->is_notif) {
+            pthread_mutex_lock(&f->mtx);
+            atomic_store_explicit(&f->die, 1, memory_order_release);
+            pthread_cond_signal(&f->cond);
+            pthread_mutex_unlock(&f->mtx);
+        } else {
+            atomic_store_explicit(&f->die, 1, memory_order_release);
+        }
+        errno = pthread_join(thr_ctxs[i]->thr, NULL);
+        if (errno) {
+            perror("pthread_join");
+            err = errno;
+        } else {
+            bench_thr_collect(ctx, &thr_ctxs[i]->start);
+            // joining ordered the thread's last store
+            thr_err = atomic_load_explicit(&f->err, memory_order_relaxed);
+            if (thr_err) {
+                err = thr_err;
+            }
+        }
+        pthread_cond_destroy(&f->cond);
+        pthread_mutex_destroy(&f->mtx);
+    }
+    errno = err;
+    return err ? -1 : 0;
+}
+
+// the NUMA node of the group's first CPU, -1 if unknown
+static int bench_thr_node(const struct topology *topo, const struct bench_cpu_group *group)
+{
+    uint32_t cpu;
+    uint32_t i;
+    if (!group->n_handles) {
+        return -1;
+    }
+    cpu = msr_get_cpu(group->handles[0]);
+    for (i = 0; i < topo->n_cpus; i++) {
+        if (topo->cpus[i] == cpu) {
+            return (int) topology_domain(topo, i, TOPOLOGY_NUMA);
+        }
+    }
+    return -1;
+}
+
+static pthread_once_t bench_topo_once = PTHREAD_ONCE_INIT;
+static struct topology bench_topo;
+static int bench_has_topo;
+
+// loaded once for the process, since it's a full sysfs scan and sessions restart on reconfigure
+static void bench_topo_load(void)
+{
+    bench_has_topo = !topology_load(&bench_topo);
+}
+
+// prefer node for a mapping's pages, before they're first touched
+static void bench_thr_bind(void *addr, size_t len, int node)
+{
+    unsigned long mask[16] = { 0 };
+    const int n_bits = (int) (8 * sizeof(mask));
+    if (node < 0 || node >= n_bits) {
+        return;
+    }
+    mask[node / (8 * sizeof(mask[0]))] |= 1ul << (node % (8 * sizeof(mask[0])));
+    // best effort: the state is still isolated, e.g., where nodes are simulated
+    syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, (unsigned long) n_bits + 1, 0);
+}
+
+/**
+ * Allocate the threads' contexts and flags in the configured layout. BENCH_THR_LOCAL maps a
+ * block per thread, preferring its group's node before the driver first touches it, since
+ * the threads aren't pinned to their groups' CPUs.
+ */
+static int bench_thread_alloc(struct bench_session *s)
+{
+    const struct bench *ctx = s->ctx;
+    void *block;
+    uint32_t i;
+
+    if (ctx->thr_layout == BENCH_THR_PACKED) {
+        s->thr_packed = calloc(ctx->n_cpu_groups, sizeof(struct bench_thr_packed));
+        if (!s->thr_packed) {
+            perror("calloc");
+            return -1;
+        }
+        for (i = 0; i < ctx->n_cpu_groups; i++) {
+            s->thr_ctxs[i] = &s->thr_packed[i].ctx;
+            s->thr_ctxs[i]->flags = &s->thr_packed[i].flags;
+        }
+        return 0;
+    }
+
+    // nodes are only a preference, so do without them if there's no topology
+    pthread_once(&bench_topo_once, bench_topo_load);
+    for (i = 0; i < ctx->n_cpu_groups; i++) {
+        block = mmap(NULL, BENCH_THR_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (block == MAP_FAILED) {
+            perror("mmap");
+            break;
+        }
+        if (bench_has_topo) {
+            bench_thr_bind(block, BENCH_THR_BLOCK_SIZE,
+                           bench_thr_node(&bench_topo, &ctx->cpu_groups[i]));
+        }
+        s->thr_ctxs[i] = block;
+        s->thr_ctxs[i]->flags = (struct bench_thr_flags *) ((char *) block +
+                                                            BENCH_THR_FLAGS_OFFSET);
+    }
+    return i < ctx->n_cpu_groups ? -1 : 0;
+}
+
+static void bench_thread_free(struct bench_session *s)
+{
+    uint32_t i;
+    if (s->pipe) {
+        free(s->pipe->slots);
+    }
+    free(s->pipe);
+    for (i = 0; s->thr_ctxs && !s->thr_packed && i < s->ctx->n_cpu_groups; i++) {
+        if (s->thr_ctxs[i]) {
+            munmap(s->thr_ctxs[i], BENCH_THR_BLOCK_SIZE);
+        }
+    }
+    free(s->thr_packed);
+    free(s->thr_ctxs);
+    s->pipe = NULL;
+    s->thr_ctxs = NULL;
+    s->thr_packed = NULL;
+}
+
+static int bench_thread_start(struct bench_session *s)
+{
+    const struct bench *ctx = s->ctx;
+    uint64_t n_slots = 1;
+    int err;
+    while (n_slots < ctx->pipeline_depth) {
+        n_slots <<= 1;
+    }
+    s->thr_ctxs = calloc(ctx->n_cpu_groups, sizeof(struct bench_thr_ctx *));
+    s->pipe = aligned_alloc(64, sizeof(struct bench_pipe));
+    if (s->pipe) {
+        s->pipe->slots = aligned_alloc(64, n_slots * sizeof(struct bench_pipe_slot));
+    }
+    if (!s->thr_ctxs || !s->pipe || !s->pipe->slots) {
+        perror("calloc");
+        bench_thread_free(s);
+        return -1;
+    }
+    if (bench_thread_alloc(s)) {
+        bench_thread_free(s);
+        return -1;
+    }
+    // fault the ring in now, not in the first measured iterations
+    memset(s->pipe->slots, 0, n_slots * sizeof(struct bench_pipe_slot));
+    atomic_init(&s->pipe->issued, 0);
+    s->pipe->mask = n_slots - 1;
+    s->issued = 0;
+    s->retired = 0;
+    if (bench_thread_create(ctx, s->ops->start_routine, s->thr_ctxs, s->pipe,
+                            s->ops->is_notif)) {
+        err = errno;
+        bench_thread_join(ctx, s->thr_ctxs);
+        bench_thread_free(s);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static int bench_thread_stop(struct bench_session *s)
+{
+    int rc = bench_thread_join(s->ctx, s->thr_ctxs);
+    int err = errno;
+    bench_thread_free(s);
+    errno = err;
+    return rc;
+}
+
+#define BENCH_SESSION_THREAD(fn, notif) { \
+    .start = bench_thread_start, \
+    .sample = bench_thread_sample, \
+    .issue = bench_thread_issue, \
+    .drain = bench_thread_drain, \
+    .stop = bench_thread_stop, \
+    .start_routine = fn, \
+    .is_notif = notif, \
+}
+
+static const struct bench_session_ops bench_session_thread = BENCH_SESSION_THREAD(bench_thr, 0);
+static const struct bench_session_ops bench_session_thread_migrate =
+    BENCH_SESSION_THREAD(bench_thr_migrate, 0);
+static const struct bench_session_ops bench_session_thread_batch =
+    BENCH_SESSION_THREAD(bench_thr_batch, 0);
+static const struct bench_session_ops bench_session_thread_uring =
+    BENCH_SESSION_THREAD(bench_thr_uring, 0);
+static const struct bench_session_ops bench_session_thread_notif =
+    BENCH_SESSION_THREAD(bench_thr, 1);
+static const struct bench_session_ops bench_session_thread_notif_migrate =
+    BENCH_SESSION_THREAD(bench_thr_migrate, 1);
+
+int bench_thread(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_thread);
+}
+
+int bench_thread_migrate(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_thread_migrate);
+}
+
+int bench_thread_batch(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_thread_batch);
+}
+
+int bench_thread_uring(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_thread_uring);
+}
+
+int bench_thread_notif(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_thread_notif);
+}
+
+int bench_thread_notif_migrate(const struct bench *ctx)
+{
+    return bench_session_exec(ctx, &bench_session_thread_notif_migrate);
+}
+
+struct bench_bar_shared {
+    struct barrier *bar;
+    // start gate: 1 to enter the barrier loop, -1 to abort (not all threads started)
+    _Alignas(64) atomic_int start;
+    // written by the driver before each release
+    _Alignas(64) uint64_t t_release;
+    int die;
+};
+
+struct bench_bar_ctx {
+    pthread_t thr;
+    struct bench_thr_start start;
+    const struct bench *ctx;
+    struct bench_bar_shared *shared;
+    // barrier participant id, the driver is 0
+    uint32_t id;
+    uint32_t cpu_group;
+    uint32_t h_first;
+    uint32_t n_handles;
+    // bind to the first handle's CPU once at thread start
+    int pin;
+    // bind to each handle's CPU before reading it
+    int migrate;
+    struct bench_group_stats *stats;
+    int err;
+} __attribute__((aligned(64)));
+
+static void *bench_thr_barrier(void *arg)
+{
+    struct bench_bar_ctx *bbc = (struct bench_bar_ctx *)arg;
+    struct bench_bar_shared *sh = bbc->shared;
+    const struct bench *ctx = bbc->ctx;
+    struct msr_handle *const *handles = &ctx->cpu_groups[bbc->cpu_group].handles[bbc->h_first];
+    struct bench_group_stats *gs = bbc->stats;
+    uint64_t t_group;
+    uint32_t seq = 0;
+    uint32_t h;
+    int start;
+    while (!(start = atomic_load_explicit(&sh->start, memory_order_acquire))) {
+        sched_yield();
+    }
+    if (start < 0) {
+        return NULL;
+    }
+    if (bbc->pin) {
+        trace_attach(bench_trace_thr(ctx, bbc->id - 1, "CPU", msr_get_cpu(handles[0])));
+        bench_migrate(handles[0], gs);
+    } else {
+        trace_attach(bench_trace_thr(ctx, bbc->id - 1, "group", bbc->cpu_group));
+    }
+    bench_store_touch(ctx, bbc->cpu_group, bbc->h_first, bbc->n_handles);
+    while (1) {
+        // wait for go-ahead
+        trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+        barrier_wait(sh->bar, bbc->id);
+        trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+        if (sh->die) {
+            break;
+        }
+        trace_iter_begin(seq++);
+        t_group = bench_stats_begin(ctx);
+        if (gs) {
+            hist_record(&gs->wake, t_group - sh->t_release);
+        }
+        for (h = 0; h < bbc->n_handles; h++) {
+            if (bbc->migrate) {
+                bench_migrate(handles[h], gs);
+            }
+            if (bench_rdmsrs(ctx, bbc->cpu_group, bbc->h_first + h, gs)) {
+                bbc->err = errno;
+            }
+        }
+        bench_stats_end(gs ? &gs->group : NULL, t_group);
+        trace_record(TRACE_ITER | TRACE_END, TRACE_NONE, TRACE_NONE);
+        // signal completion
+        trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+        barrier_wait(sh->bar, bbc->id);
+        trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+    }
+    trace_attach(NULL);
+    return NULL;
+}
+
+static int bench_barrier_exec(const struct bench *ctx, int per_cpu, int migrate)
+{
+    struct bench_bar_shared *sh;
+    struct bench_bar_ctx *bbcs;
+    struct bench_group_stats *stats = NULL;
+    uint64_t t_start;
+    uint64_t t_iter;
+    uint32_t seq = 0;
+    uint32_t n = 0;
+    uint32_t n_started;
+    struct bench_pace pace;
+    uint32_t step;
+    uint32_t g;
+    uint32_t h;
+    uint32_t i;
+    int err = 0;
+
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        n += per_cpu ? ctx->cpu_groups[g].n_handles : 1;
+    }
+    sh = aligned_alloc(64, sizeof(struct bench_bar_shared));
+    bbcs = aligned_alloc(64, n * sizeof(struct bench_bar_ctx));
+    if (ctx->stats && per_cpu) {
+        // per-thread since the threads of a group can't share its stats
+        stats = aligned_alloc(64, n * sizeof(struct bench_group_stats));
+    }
+    if (!sh || !bbcs || (ctx->stats && per_cpu && !stats)) {
+        perror("aligned_alloc");
+        free(sh);
+        free(bbcs);
+        free(stats);
+        return -1;
+    }
+    // all threads plus the driver
+    sh->bar = barrier_alloc(ctx->barrier, n + 1, ctx->spin);
+    if (!sh->bar) {
+        free(sh);
+        free(bbcs);
+        free(stats);
+        return -1;
+    }
+    atomic_init(&sh->start, 0);
+    sh->t_release = 0;
+    sh->die = 0;
+
+    i = 0;
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        step = per_cpu ? 1 : ctx->cpu_groups[g].n_handles;
+        for (h = 0; h < ctx->cpu_groups[g].n_handles; h += step, i++) {
+            bbcs[i].ctx = ctx;
+            bbcs[i].shared = sh;
+            bbcs[i].id = i + 1;
+            bbcs[i].cpu_group = g;
+            bbcs[i].h_first = h;
+            bbcs[i].n_handles = step;
+            bbcs[i].pin = per_cpu;
+            bbcs[i].migrate = migrate;
+            bbcs[i].stats = stats ? &stats[i] : bench_group_stats(ctx, g);
+            bbcs[i].err = 0;
+            if (stats) {
+                stats[i].pairs = NULL;
+                if (ctx->stats->pairs && bench_group_stats_alloc_pairs(&stats[i])) {
+                    err = errno;
+                }
+                bench_group_stats_reset(&stats[i]);
+            }
+        }
+    }
+    for (n_started = 0; n_started < n; n_started++) {
+        errno = bench_thr_spawn(ctx, n_started, &bbcs[n_started].thr,
+                                &bbcs[n_started].start, bench_thr_barrier, &bbcs[n_started]);
+        if (errno) {
+            perror("pthread_create");
+            err = errno;
+            break;
+        }
+    }
+    // the barrier needs every participant, so abort if any thread didn't start
+    atomic_store_explicit(&sh->start, err ? -1 : 1, memory_order_release);
+
+    trace_attach(bench_trace_buf(ctx, 0));
+    t_start = bench_stats_begin(ctx);
+    bench_pace_init(ctx, &pace);
+    while (!err && bench_pace_next(ctx, &pace)) {
+        trace_iter_begin(seq++);
+        t_iter = bench_stats_begin(ctx);
+        sh->t_release = t_iter;
+        // start an iteration, then wait for all threads to complete it
+        barrier_wait(sh->bar, 0);
+        trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+        barrier_wait(sh->bar, 0);
+        trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+        bench_stats_end(ctx->stats ? &ctx->stats->iter : NULL, t_iter);
+        trace_record(TRACE_ITER | TRACE_END, TRACE_NONE, TRACE_NONE);
+        bench_sample_skew(ctx, stats, n);
+        for (i = 0; i < n; i++) {
+            if (bbcs[i].err) {
+                err = bbcs[i].err;
+                break;
+            }
+        }
+    }
+    trace_attach(NULL);
+    if (ctx->stats) {
+        ctx->stats->elapsed += timing_now() - t_start;
+    }
+
+    if (n_started == n) {
+        sh->die = 1;
+        barrier_wait(sh->bar, 0);
+    }
+    for (i = 0; i < n_started; i++) {
+        errno = pthread_join(bbcs[i].thr, NULL);
+        if (errno) {
+            perror("pthread_join");
+            err = errno;
+        } else {
+            bench_thr_collect(ctx, &bbcs[i].start);
+        }
+    }
+
+    if (stats) {
+        // fold per-thread stats into their groups
+        for (i = 0; i < n; i++) {
+            bench_group_stats_merge(&ctx->stats->groups[bbcs[i].cpu_group], &stats[i]);
+        }
+        for (i = 0; i < n; i++) {
+            bench_group_stats_free_pairs(&stats[i]);
+        }
+    }
+    barrier_free(sh->bar);
+    free(stats);
+    free(bbcs);
+    free(sh);
+    errno = err;
+    return err ? -1 : 0;
+}
+
+int bench_thread_percpu(const struct bench *ctx)
 {
-    return bench_thread_exec(ctx, bench_thr_notif, 1);
+    return bench_barrier_exec(ctx, 1, 0);
 }
 
-int bench_thread_notif_migrate(const struct bench *ctx)
+int bench_thread_barrier(const struct bench *ctx)
+{
+    return bench_barrier_exec(ctx, 0, 0);
+}
+
+int bench_thread_barrier_migrate(const struct bench *ctx)
+{
+    return bench_barrier_exec(ctx, 0, 1);
+}
+
+// MSRs [lo, hi) of a CPU to read in the worker pool
+struct bench_pool_task {
+    const struct msr_handle *handle;
+    uint32_t cpu_group;
+    uint32_t h;
+    uint32_t lo;
+    uint32_t hi;
+    // the CPU's tasks, and its counter of them done this iteration if more than one
+    uint32_t n_ranges;
+    uint32_t cpu;
+};
+
+struct bench_pool_shared {
+    struct bench_bar_shared bar;
+    struct bench_pool_task *tasks;
+    // per CPU, for a sample stored in several tasks, which may run on different workers
+    atomic_uint *ranges_done;
+    struct bench_pool_worker *workers;
+    uint32_t n_workers;
+    // workers that have pushed their tasks this iteration
+    _Alignas(64) atomic_uint pushed;
+};
+
+struct bench_pool_worker {
+    struct deque dq;
+    pthread_t thr;
+    struct bench_thr_start start;
+    const struct bench *ctx;
+    struct bench_pool_shared *shared;
+    // barrier participant id, the driver is 0
+    uint32_t id;
+    // the tasks this worker pushes each iteration
+    uint32_t *own;
+    uint32_t n_own;
+    // pin here once at thread start
+    const struct msr_handle *home;
+    uint64_t rand;
+    struct bench_group_stats *stats;
+    int err;
+} __attribute__((aligned(64)));
+
+static uint32_t bench_pool_victim(struct bench_pool_worker *w, uint32_t n)
+{
+    // xorshift64
+    w->rand ^= w->rand << 13;
+    w->rand ^= w->rand >> 7;
+    w->rand ^= w->rand << 17;
+    return (uint32_t) (w->rand % n);
+}
+
+// returns DEQUE_EMPTY only once no other worker has anything left to steal
+static uint32_t bench_pool_steal(struct bench_pool_worker *w)
+{
+    struct bench_pool_shared *sh = w->shared;
+    uint32_t first;
+    uint32_t v;
+    uint32_t k;
+    uint32_t x;
+    uint32_t n_pushed;
+    int busy;
+    while (1) {
+        // sample before scanning: if everyone had pushed and all deques are empty, we're done
+        n_pushed = atomic_load_explicit(&sh->pushed, memory_order_acquire);
+        busy = 0;
+        first = bench_pool_victim(w, sh->n_workers);
+        for (k = 0; k < sh->n_workers; k++) {
+            v = (first + k) % sh->n_workers;
+            if (v == w->id - 1) {
+                continue;
+            }
+            x = deque_steal(&sh->workers[v].dq);
+            if (x == DEQUE_ABORT) {
+                busy = 1;
+            } else if (x != DEQUE_EMPTY) {
+                return x;
+            }
+        }
+        if (!busy && n_pushed == sh->n_workers) {
+            return DEQUE_EMPTY;
+        }
+        sched_yield();
+    }
+}
+
+static int bench_pool_run(const struct bench *ctx, struct bench_pool_shared *sh,
+                          const struct bench_pool_task *t, struct bench_group_stats *gs)
+{
+    struct sample_block *blk;
+    int rc;
+    if (t->n_ranges == 1) {
+        return bench_rdmsrs(ctx, t->cpu_group, t->h, gs);
+    }
+    rc = bench_rdmsrs_range(ctx, t->cpu_group, t->h, t->lo, t->hi, 0, gs);
+    // whichever worker reads the CPU's last range stores the sample; the next iteration
+    // only starts after the barrier, so the counter can be reset here
+    if (atomic_fetch_add_explicit(&sh->ranges_done[t->cpu], 1, memory_order_acq_rel) + 1 ==
+        t->n_ranges) {
+        atomic_store_explicit(&sh->ranges_done[t->cpu], 0, memory_order_relaxed);
+        if ((blk = bench_store_block(ctx, t->cpu_group, t->h))) {
+            sample_block_commit(blk, timing_now());
+        }
+    }
+    return rc;
+}
+
+static void *bench_thr_pool(void *arg)
+{
+    struct bench_pool_worker *w = (struct bench_pool_worker *)arg;
+    struct bench_pool_shared *sh = w->shared;
+    const struct bench *ctx = w->ctx;
+    struct bench_group_stats *gs = w->stats;
+    uint64_t t_group;
+    uint32_t seq = 0;
+    uint32_t i;
+    uint32_t x;
+    int start;
+    while (!(start = atomic_load_explicit(&sh->bar.start, memory_order_acquire))) {
+        sched_yield();
+    }
+    if (start < 0) {
+        return NULL;
+    }
+    trace_attach(bench_trace_thr(ctx, w->id - 1, "worker", w->id - 1));
+    if (w->home) {
+        bench_migrate(w->home, gs);
+    }
+    // stolen tasks are stored remotely, but most are our own
+    for (i = 0; i < w->n_own; i++) {
+        bench_store_touch(ctx, sh->tasks[w->own[i]].cpu_group, sh->tasks[w->own[i]].h, 1);
+    }
+    while (1) {
+        // wait for go-ahead
+        trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+        barrier_wait(sh->bar.bar, w->id);
+        trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+        if (sh->bar.die) {
+            break;
+        }
+        trace_iter_begin(seq++);
+        t_group = bench_stats_begin(ctx);
+        if (gs) {
+            hist_record(&gs->wake, t_group - sh->bar.t_release);
+        }
+        for (i = 0; i < w->n_own; i++) {
+            deque_push(&w->dq, w->own[i]);
+        }
+        atomic_fetch_add_explicit(&sh->pushed, 1, memory_order_release);
+        while (1) {
+            x = deque_take(&w->dq);
+            if (x == DEQUE_EMPTY) {
+                // out of our own work, wait for some to steal, or for none to be left
+                trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+                x = bench_pool_steal(w);
+                trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+            }
+            if (x == DEQUE_EMPTY) {
+                break;
+            }
+            if (bench_pool_run(ctx, sh, &sh->tasks[x], gs)) {
+                w->err = errno;
+            }
+        }
+        bench_stats_end(gs ? &gs->group : NULL, t_group);
+        trace_record(TRACE_ITER | TRACE_END, TRACE_NONE, TRACE_NONE);
+        // signal completion
+        trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+        barrier_wait(sh->bar.bar, w->id);
+        trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+    }
+    trace_attach(NULL);
+    return NULL;
+}
+
+int bench_pool(const struct bench *ctx)
+{
+    struct bench_pool_shared *sh;
+    struct bench_pool_worker *workers;
+    uint32_t *own;
+    uint64_t t_start;
+    uint64_t t_iter;
+    uint32_t n_workers = ctx->workers ? ctx->workers : ctx->n_cpu_groups;
+    uint32_t seq = 0;
+    uint32_t n_tasks = 0;
+    uint32_t n_cpus = 0;
+    uint32_t n_ranges = 1;
+    uint32_t per_task = ctx->n_msrs;
+    uint32_t c = 0;
+    uint32_t r;
+    uint32_t n_inited = 0;
+    uint32_t n_started = 0;
+    struct bench_pace pace;
+    uint32_t g;
+    uint32_t h;
+    uint32_t i;
+    uint32_t w;
+    int err = 0;
+
+    if (ctx->task_msrs && ctx->task_msrs < ctx->n_msrs) {
+        per_task = ctx->task_msrs;
+        n_ranges = (ctx->n_msrs + per_task - 1) / per_task;
+    }
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        n_cpus += ctx->cpu_groups[g].n_handles;
+    }
+    n_tasks = n_cpus * n_ranges;
+    if (!n_workers || !n_tasks) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (ctx->stats && bench_stats_alloc_workers(ctx->stats, n_workers)) {
+        return -1;
+    }
+    sh = aligned_alloc(64, sizeof(struct bench_pool_shared));
+    workers = aligned_alloc(64, n_workers * sizeof(struct bench_pool_worker));
+    own = malloc(n_tasks * sizeof(uint32_t));
+    if (sh) {
+        sh->tasks = malloc(n_tasks * sizeof(struct bench_pool_task));
+        sh->ranges_done = calloc(n_cpus, sizeof(atomic_uint));
+    }
+    if (!sh || !workers || !own || !sh->tasks || !sh->ranges_done) {
+        perror("malloc");
+        if (sh) {
+            free(sh->tasks);
+            free(sh->ranges_done);
+        }
+        free(sh);
+        free(workers);
+        free(own);
+        return -1;
+    }
+    sh->bar.bar = barrier_alloc(ctx->barrier, n_workers + 1, ctx->spin);
+    if (!sh->bar.bar) {
+        err = errno;
+        goto out;
+    }
+    atomic_init(&sh->bar.start, 0);
+    sh->bar.t_release = 0;
+    sh->bar.die = 0;
+    sh->workers = workers;
+    sh->n_workers = n_workers;
+    atomic_init(&sh->pushed, 0);
+
+    // group g belongs to worker g % n_workers, so lay out each worker's tasks contiguously
+    i = 0;
+    for (w = 0; w < n_workers; w++) {
+        workers[w].own = &own[i];
+        workers[w].n_own = 0;
+        for (g = w; g < ctx->n_cpu_groups; g += n_workers) {
+            for (h = 0; h < ctx->cpu_groups[g].n_handles; h++) {
+                for (r = 0; r < n_ranges; r++) {
+                    sh->tasks[i].handle = ctx->cpu_groups[g].handles[h];
+                    sh->tasks[i].cpu_group = g;
+                    sh->tasks[i].h = h;
+                    sh->tasks[i].lo = r * per_task;
+                    sh->tasks[i].hi = r + 1 < n_ranges ? (r + 1) * per_task : ctx->n_msrs;
+                    sh->tasks[i].n_ranges = n_ranges;
+                    sh->tasks[i].cpu = c;
+                    own[i] = i;
+                    workers[w].n_own++;
+                    i++;
+                }
+                c++;
+            }
+        }
+    }
+    for (w = 0; w < n_workers; w++) {
+        workers[w].ctx = ctx;
+        workers[w].shared = sh;
+        workers[w].id = w + 1;
+        // spread the workers evenly across the CPUs being read
+        workers[w].home = sh->tasks[(uint64_t) w * n_tasks / n_workers].handle;
+        workers[w].rand = ((uint64_t) w + 1) * UINT64_C(0x9e3779b97f4a7c15);
+        workers[w].stats = ctx->stats ? &ctx->stats->workers[w] : NULL;
+        workers[w].err = 0;
+        if (deque_init(&workers[w].dq, workers[w].n_own ? workers[w].n_own : 1)) {
+            err = errno;
+            goto out;
+        }
+        n_inited++;
+    }
+    for (n_started = 0; n_started < n_workers; n_started++) {
+        errno = bench_thr_spawn(ctx, n_started, &workers[n_started].thr,
+                                &workers[n_started].start, bench_thr_pool, &workers[n_started]);
+        if (errno) {
+            perror("pthread_create");
+            err = errno;
+            break;
+        }
+    }
+    // the barrier needs every participant, so abort if any thread didn't start
+    atomic_store_explicit(&sh->bar.start, err ? -1 : 1, memory_order_release);
+
+    trace_attach(bench_trace_buf(ctx, 0));
+    t_start = bench_stats_begin(ctx);
+    bench_pace_init(ctx, &pace);
+    while (!err && bench_pace_next(ctx, &pace)) {
+        trace_iter_begin(seq++);
+        t_iter = bench_stats_begin(ctx);
+        sh->bar.t_release = t_iter;
+        atomic_store_explicit(&sh->pushed, 0, memory_order_relaxed);
+        // start an iteration, then wait for all workers to complete it
+        barrier_wait(sh->bar.bar, 0);
+        trace_record(TRACE_WAIT, TRACE_NONE, TRACE_NONE);
+        barrier_wait(sh->bar.bar, 0);
+        trace_record(TRACE_WAIT | TRACE_END, TRACE_NONE, TRACE_NONE);
+        bench_stats_end(ctx->stats ? &ctx->stats->iter : NULL, t_iter);
+        trace_record(TRACE_ITER | TRACE_END, TRACE_NONE, TRACE_NONE);
+        bench_sample_skew(ctx, NULL, 0);
+        for (w = 0; w < n_workers; w++) {
+            if (workers[w].err) {
+                err = workers[w].err;
+                break;
+            }
+        }
+    }
+    trace_attach(NULL);
+    if (ctx->stats) {
+        ctx->stats->elapsed += timing_now() - t_start;
+    }
+
+    if (n_started == n_workers) {
+        sh->bar.die = 1;
+        barrier_wait(sh->bar.bar, 0);
+    }
+    for (w = 0; w < n_started; w++) {
+        errno = pthread_join(workers[w].thr, NULL);
+        if (errno) {
+            perror("pthread_join");
+            err = errno;
+        } else {
+            bench_thr_collect(ctx, &workers[w].start);
+        }
+    }
+
+out:
+    for (w = 0; w < n_inited; w++) {
+        deque_destroy(&workers[w].dq);
+    }
+    barrier_free(sh->bar.bar);
+    free(sh->tasks);
+    free(sh->ranges_done);
+    free(sh);
+    free(workers);
+    free(own);
+    errno = err;
+    return err ? -1 : 0;
+}
+
+int bench_delta(const struct bench *ctx)
+{
+    struct bench_group_stats *gs;
+    struct bench_pace pace;
+    const struct msr_info *info;
+    uint64_t *prev;
+    uint64_t *frames;
+    uint64_t *cur;
+    uint64_t *total;
+    uint64_t *masks;
+    double *scaled;
+    double *scales;
+    uint64_t rand = UINT64_C(0x9e3779b97f4a7c15);
+    uint64_t t_start;
+    uint64_t t_iter;
+    uint64_t t_group;
+    uint64_t n = 0;
+    uint64_t first;
+    uint64_t i;
+    uint32_t seq = 0;
+    uint32_t frame = 0;
+    uint32_t n_handles;
+    uint32_t g;
+    uint32_t m;
+
+    // there's nothing to process without MSRs
+    if (!ctx->n_msrs) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        n += ctx->cpu_groups[g].n_handles;
+    }
+    // per MSR, all CPUs' values are contiguous
+    prev = aligned_alloc(64, n * ctx->n_msrs * sizeof(uint64_t));
+    frames = aligned_alloc(64, 2 * n * ctx->n_msrs * sizeof(uint64_t));
+    total = aligned_alloc(64, n * ctx->n_msrs * sizeof(uint64_t));
+    scaled = aligned_alloc(64, n * ctx->n_msrs * sizeof(double));
+    masks = malloc(ctx->n_msrs * sizeof(uint64_t));
+    scales = malloc(ctx->n_msrs * sizeof(double));
+    if (!prev || !frames || !total || !scaled || !masks || !scales) {
+        perror("malloc");
+        free(prev);
+        free(frames);
+        free(total);
+        free(scaled);
+        free(masks);
+        free(scales);
+        return -1;
+    }
+    for (m = 0; m < ctx->n_msrs; m++) {
+        info = msr_info_get(ctx->msrs[m]);
+        masks[m] = msr_info_mask(info);
+        scales[m] = info->scale;
+    }
+    // two frames of random counter values, so every other delta wraps about half the time
+    for (i = 0; i < 2 * n * ctx->n_msrs; i++) {
+        rand ^= rand << 13;
+        rand ^= rand >> 7;
+        rand ^= rand << 17;
+        frames[i] = rand & masks[(i % (n * ctx->n_msrs)) / n];
+    }
+    memcpy(prev, &frames[n * ctx->n_msrs], n * ctx->n_msrs * sizeof(uint64_t));
+    memset(total, 0, n * ctx->n_msrs * sizeof(uint64_t));
+    memset(scaled, 0, n * ctx->n_msrs * sizeof(double));
+
+    trace_attach(bench_trace_buf(ctx, 0));
+    t_start = bench_stats_begin(ctx);
+    bench_pace_init(ctx, &pace);
+    while (bench_pace_next(ctx, &pace)) {
+        trace_iter_begin(seq++);
+        t_iter = bench_stats_begin(ctx);
+        cur = &frames[frame * n * ctx->n_msrs];
+        frame ^= 1;
+        first = 0;
+        for (g = 0; g < ctx->n_cpu_groups; g++) {
+            gs = bench_group_stats(ctx, g);
+            n_handles = ctx->cpu_groups[g].n_handles;
+            t_group = bench_stats_begin(ctx);
+            for (m = 0; m < ctx->n_msrs; m++) {
+                i = m * n + first;
+                ctx->delta->apply(&prev[i], &cur[i], &total[i], &scaled[i], n_handles,
+                                  masks[m], scales[m]);
+            }
+            if (gs) {
+                // values aren't individually observable, so record the amortized cost
+                t_group = timing_now() - t_group;
+                hist_record(&gs->group, t_group);
+                if (n_handles) {
+                    hist_record_n(&gs->read, t_group / ((uint64_t) n_handles * ctx->n_msrs),
+                                  (uint64_t) n_handles * ctx->n_msrs);
+                }
+            }
+            first += n_handles;
+        }
+        bench_stats_end(ctx->stats ? &ctx->stats->iter : NULL, t_iter);
+        trace_record(TRACE_ITER | TRACE_END, TRACE_NONE, TRACE_NONE);
+    }
+    trace_attach(NULL);
+    if (ctx->stats) {
+        ctx->stats->elapsed += timing_now() - t_start;
+    }
+    free(prev);
+    free(frames);
+    free(total);
+    free(scaled);
+    free(masks);
+    free(scales);
+    return 0;
+}
+
+const struct bench_strategy bench_strategies[] = {
+    { "serial",                 bench_serial,                   1, &bench_session_serial },
+    { "serial_migrate",         bench_serial_migrate,           1, &bench_session_serial_migrate },
+    { "thread",                 bench_thread,                   1, &bench_session_thread },
+    { "thread_migrate",         bench_thread_migrate,           1, &bench_session_thread_migrate },
+    { "thread_notif",           bench_thread_notif,             1, &bench_session_thread_notif },
+    { "thread_notif_migrate",   bench_thread_notif_migrate,     1,
+      &bench_session_thread_notif_migrate },
+    { "batch",                  bench_batch,                    1, &bench_session_batch },
+    { "thread_batch",           bench_thread_batch,             1, &bench_session_thread_batch },
+    { "uring",                  bench_uring,                    1, &bench_session_uring },
+    { "thread_uring",           bench_thread_uring,             1, &bench_session_thread_uring },
+    { "thread_percpu",          bench_thread_percpu,            1, NULL },
+    { "thread_barrier",         bench_thread_barrier,           1, NULL },
+    { "thread_barrier_migrate", bench_thread_barrier_migrate,   1, NULL },
+    { "pool",                   bench_pool,                     1, NULL },
+    { "delta",                  bench_delta,                    0, NULL },
+};
+
+const uint32_t bench_n_strategies = sizeof(bench_strategies) / sizeof(bench_strategies[0]);
+
+// set up every handle's reads, so the backend doesn't do it in the first timed ones
+static int bench_prepare(const struct bench *ctx)
+{
+    const struct bench_cpu_group *group;
+    uint32_t g;
+    uint32_t h;
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        group = &ctx->cpu_groups[g];
+        for (h = 0; h < group->n_handles; h++) {
+            if (msr_prepare(group->handles[h], ctx->msrs, ctx->n_msrs)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int bench_strategy_run(const struct bench_strategy *strategy, const struct bench *ctx)
+{
+    int rc;
+    if (bench_prepare(ctx)) {
+        return -1;
+    }
+    if (!bench_sched_enabled(ctx)) {
+        return strategy->run(ctx);
+    }
+    if (sched_counters_reset(ctx->sched)) {
+        return -1;
+    }
+    rc = strategy->run(ctx);
+    if (!rc && !sched_counters_read(ctx->sched, &ctx->stats->sched_driver)) {
+        ctx->stats->sched = 1;
+    }
+    return rc;
+}
+
+int bench_thr_layout_parse(const char *name, enum bench_thr_layout *layout)
+{
+    if (!strcmp(name, "local")) {
+        *layout = BENCH_THR_LOCAL;
+    } else if (!strcmp(name, "packed")) {
+        *layout = BENCH_THR_PACKED;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+const char *bench_thr_layout_name(enum bench_thr_layout layout)
+{
+    return layout == BENCH_THR_PACKED ? "packed" : "local";
+}
+
+int bench_strategy_has_thr_layout(const struct bench_strategy *strategy)
+{
+    return strategy->session && strategy->session->start_routine;
+}
+
+uint32_t bench_strategy_n_threads(const struct bench_strategy *strategy,
+                                  const struct bench *ctx)
+{
+    uint32_t n = 0;
+    uint32_t g;
+    if (strategy->run == bench_thread_percpu) {
+        for (g = 0; g < ctx->n_cpu_groups; g++) {
+            n += ctx->cpu_groups[g].n_handles;
+        }
+        return n;
+    }
+    if (strategy->run == bench_pool) {
+        return ctx->workers ? ctx->workers : ctx->n_cpu_groups;
+    }
+    if (bench_strategy_has_thr_layout(strategy) || strategy->run == bench_thread_barrier ||
+        strategy->run == bench_thread_barrier_migrate) {
+        return ctx->n_cpu_groups;
+    }
+    return 0;
+}
+
+const struct bench_strategy *bench_strategy_find(const char *name)
+{
+    uint32_t i;
+    for (i = 0; i < bench_n_strategies; i++) {
+        if (!strcmp(bench_strategies[i].name, name)) {
+            return &bench_strategies[i];
+        }
+    }
+    return NULL;
+}
+
+struct bench_session *bench_session_start(const struct bench_strategy *strategy,
+                                          const struct bench *ctx)
+{
+    struct bench_session *s;
+    int err;
+    if (!strategy->session) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    if (bench_prepare(ctx)) {
+        return NULL;
+    }
+    s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->ctx = ctx;
+    s->ops = strategy->session;
+    if (s->ops->start(s)) {
+        err = errno;
+        free(s);
+        errno = err;
+        return NULL;
+    }
+    return s;
+}
+
+int bench_session_sample(struct bench_session *s)
+{
+    const struct bench *ctx = s->ctx;
+    if (s->ops->sample(s)) {
+        return -1;
+    }
+    if (ctx->plan && ctx->out) {
+        read_plan_fanout(ctx->plan, ctx->out);
+    }
+    return 0;
+}
+
+int bench_session_stop(struct bench_session *s)
 {
-    return bench_thread_exec(ctx, bench_thr_notif_migrate, 1);
+    int rc = s->ops->stop(s);
+    int err = errno;
+    free(s);
+    errno = err;
+    return rc;
 }
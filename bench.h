@@ -3,11 +3,30 @@
 
 #include <inttypes.h>
 
+#include "barrier.h"
+#include "bench-stats.h"
+#include "delta.h"
 #include "msr.h"
+#include "sample-store.h"
+#include "sched-counters.h"
+
+struct read_plan;
+struct trace;
 
 struct bench_cpu_group {
     struct msr_handle **handles;
     uint32_t n_handles;
+    // index of the group's first handle among all groups' handles, in group order
+    uint32_t first;
+};
+
+// how the driver lays out thread* strategies' per-thread state
+enum bench_thr_layout {
+    // each thread's state on cache lines of its own, on its group's NUMA node, with its
+    // read-only configuration apart from the flags the driver and thread signal each other with
+    BENCH_THR_LOCAL,
+    // every thread's state in one array allocated by the driver, so neighbours share lines
+    BENCH_THR_PACKED,
 };
 
 struct bench {
@@ -16,6 +35,45 @@ struct bench {
     uint32_t *msrs;
     uint32_t n_msrs;
     uint32_t iters;
+    // fixed-rate mode: start iterations at rate Hz (0 to run back-to-back),
+    // for duration seconds (0 to run iters samples)
+    double rate;
+    double duration;
+    // for barrier-driven benchmarks
+    enum barrier_type barrier;
+    uint32_t spin;
+    // for the worker pool, 0 for one worker per CPU group
+    uint32_t workers;
+    // for the worker pool: MSRs per task, 0 for all of a CPU's in one task
+    uint32_t task_msrs;
+    // for thread*: iterations in flight at once, 1 (or 0) for lockstep
+    uint32_t pipeline_depth;
+    // for thread*: where per-thread state lives
+    enum bench_thr_layout thr_layout;
+    // optional, NULL to disable latency recording
+    struct bench_stats *stats;
+    // optional, NULL to discard the values read
+    struct sample_store *store;
+    // for the delta benchmark
+    const struct delta_kernel *delta;
+    // optional, NULL to skip scheduling counters; the driving thread's own, opened by it.
+    // Worker threads open theirs when they start. Counts are only kept with stats.
+    struct sched_counters *sched;
+    // optional, NULL to not return the values read; otherwise n_msrs values per handle,
+    // handle-major, with group g's handles starting at cpu_groups[g].first
+    uint64_t *out;
+    // optional, NULL to read every MSR on every handle; otherwise cpu_groups are the plan's
+    // groups, each handle reads only its planned MSRs, and out rows are the plan's
+    const struct read_plan *plan;
+    // optional, NULL to not trace; buffers for the driver and each thread a strategy starts
+    // (see bench_strategy_n_threads()), which record their iterations, waits, migrations,
+    // and reads to
+    struct trace *trace;
+    // optional, NULL to leave threads' affinity as inherited; otherwise the i-th thread a
+    // strategy starts begins pinned to thr_cpus[i % n_thr_cpus]. Strategies that bind their
+    // threads to the CPUs they read still do.
+    const uint32_t *thr_cpus;
+    uint32_t n_thr_cpus;
 };
 
 /**
@@ -38,6 +96,26 @@ int bench_thread(const struct bench *ctx);
  */
 int bench_thread_migrate(const struct bench *ctx);
 
+/**
+ * Iterate CPU groups with one batch read per group (let the kernel spread the reads).
+ */
+int bench_batch(const struct bench *ctx);
+
+/**
+ * Iterate CPU groups in threads with one batch read per group (let the kernel spread the reads).
+ */
+int bench_thread_batch(const struct bench *ctx);
+
+/**
+ * Iterate CPU groups with one io_uring submission per group (let the kernel overlap the reads).
+ */
+int bench_uring(const struct bench *ctx);
+
+/**
+ * Iterate CPU groups in threads with one io_uring submission per group.
+ */
+int bench_thread_uring(const struct bench *ctx);
+
 /**
  * Iterate CPU groups in threads without explicit CPU migration (let the kernel migrate).
  * Use thread notification instead of polling.
@@ -50,4 +128,113 @@ int bench_thread_notif(const struct bench *ctx);
  */
 int bench_thread_notif_migrate(const struct bench *ctx);
 
+/**
+ * Read each CPU from its own thread, pinned once at creation so every read is local.
+ * Threads are released and collected each iteration with the configured barrier.
+ * Group statistics are per-thread passes, i.e., per CPU.
+ */
+int bench_thread_percpu(const struct bench *ctx);
+
+/**
+ * Iterate CPU groups in threads without explicit CPU migration (let the kernel migrate).
+ * Use the configured atomic barrier instead of polling or notification.
+ */
+int bench_thread_barrier(const struct bench *ctx);
+
+/**
+ * Iterate CPU groups in threads with explicit CPU migration for each handle.
+ * Use the configured atomic barrier instead of polling or notification.
+ */
+int bench_thread_barrier_migrate(const struct bench *ctx);
+
+/**
+ * Read every CPU once per iteration from a pool of pinned worker threads.
+ * Each CPU group is assigned to a worker, which pushes the group's CPUs, split into tasks
+ * of task_msrs MSRs each, onto its work-stealing deque; idle workers steal tasks from the
+ * others until all are read.
+ * Worker statistics are per-worker passes over the iteration.
+ */
+int bench_pool(const struct bench *ctx);
+
+/**
+ * Process synthetic samples with the configured delta kernel instead of reading MSRs:
+ * one kernel pass per CPU group and MSR over the group's CPUs, whose samples are
+ * contiguous per MSR. Read statistics are the amortized cost per value processed.
+ * Returns -1 with errno=EINVAL without MSRs.
+ */
+int bench_delta(const struct bench *ctx);
+
+struct bench_session_ops;
+
+struct bench_strategy {
+    const char *name;
+    int (*run)(const struct bench *ctx);
+    // 0 if the strategy doesn't read MSRs
+    int reads;
+    // NULL if the strategy can't be sampled one iteration at a time
+    const struct bench_session_ops *session;
+};
+
+/**
+ * All benchmarks, in the order they're listed.
+ */
+extern const struct bench_strategy bench_strategies[];
+extern const uint32_t bench_n_strategies;
+
+/**
+ * Run a benchmark, adding the driver's and its threads' scheduling counts to the stats
+ * if ctx->sched is set. The backend sets up every handle's reads (msr_prepare()) first.
+ */
+int bench_strategy_run(const struct bench_strategy *strategy, const struct bench *ctx);
+
+/**
+ * Look up a benchmark by name, NULL if unknown.
+ */
+const struct bench_strategy *bench_strategy_find(const char *name);
+
+/**
+ * Parse a thread layout name ("local" or "packed"), returns -1 if unknown.
+ */
+int bench_thr_layout_parse(const char *name, enum bench_thr_layout *layout);
+
+const char *bench_thr_layout_name(enum bench_thr_layout layout);
+
+/**
+ * Returns 1 if the strategy's per-thread state follows ctx->thr_layout, i.e., for thread*
+ * strategies that support sampling.
+ */
+int bench_strategy_has_thr_layout(const struct bench_strategy *strategy);
+
+/**
+ * Get the number of threads the strategy starts with ctx's groups and options, besides the
+ * calling thread.
+ */
+uint32_t bench_strategy_n_threads(const struct bench_strategy *strategy,
+                                  const struct bench *ctx);
+
+/*
+ * A strategy kept set up between iterations, e.g., with its threads waiting, so the caller
+ * can take one sample at a time. Strategies run the same way over a session, so a session's
+ * samples cost what the benchmark measures.
+ */
+struct bench_session;
+
+/**
+ * Set up a strategy for sampling. ctx must outlive the session; its out pointer may be
+ * changed between samples.
+ * Returns NULL with errno=ENOTSUP if the strategy has no session support.
+ */
+struct bench_session *bench_session_start(const struct bench_strategy *strategy,
+                                          const struct bench *ctx);
+
+/**
+ * Take one sample (iteration), returning once every value is read.
+ */
+int bench_session_sample(struct bench_session *s);
+
+/**
+ * Tear down and free the session. Returns non-zero if any sample failed in a thread.
+ */
+int bench_session_stop(struct bench_session *s);
+
 #endif // BENCH_H
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "cpu-table.h"
+#include "msr.h"
+#include "topology.h"
+
+#ifndef CPU_TABLE_CAP_MIN
+#define CPU_TABLE_CAP_MIN 64
+#endif
+
+void cpu_table_init(struct cpu_table *t)
+{
+    memset(t, 0, sizeof(*t));
+}
+
+static int cpu_table_close(struct cpu_table *t)
+{
+    int rc = 0;
+    while (t->n_open) {
+        rc |= msr_close(t->handles[--t->n_open]);
+    }
+    return rc;
+}
+
+int cpu_table_free(struct cpu_table *t)
+{
+    int rc = cpu_table_close(t);
+    msr_free_array(t->arena);
+    free(t->handles);
+    free(t->groups);
+    free(t->cpus);
+    free(t->offsets);
+    cpu_table_init(t);
+    return rc;
+}
+
+static int cpu_table_grow(uint32_t **arr, uint32_t *cap, uint32_t n)
+{
+    uint32_t *a;
+    uint32_t c;
+    if (n < *cap) {
+        return 0;
+    }
+    c = *cap ? *cap * 2 : CPU_TABLE_CAP_MIN;
+    if (c <= *cap) {
+        errno = E2BIG;
+        return -1;
+    }
+    a = realloc(*arr, c * sizeof(uint32_t));
+    if (!a) {
+        perror("realloc");
+        return -1;
+    }
+    *arr = a;
+    *cap = c;
+    return 0;
+}
+
+int cpu_table_add_group(struct cpu_table *t)
+{
+    // offsets has a trailing entry for the end of the last group
+    if (cpu_table_grow(&t->offsets, &t->cap_groups, t->n_groups + 1)) {
+        return -1;
+    }
+    t->offsets[t->n_groups++] = t->n_cpus;
+    t->offsets[t->n_groups] = t->n_cpus;
+    return 0;
+}
+
+int cpu_table_add_cpu(struct cpu_table *t, uint32_t cpu)
+{
+    if (!t->n_groups) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cpu_table_grow(&t->cpus, &t->cap_cpus, t->n_cpus)) {
+        return -1;
+    }
+    t->cpus[t->n_cpus++] = cpu;
+    t->offsets[t->n_groups] = t->n_cpus;
+    return 0;
+}
+
+void cpu_table_drop_group(struct cpu_table *t)
+{
+    if (!t->n_groups) {
+        return;
+    }
+    // the dropped group's start becomes the end of the one before it
+    t->n_cpus = t->offsets[--t->n_groups];
+}
+
+int cpu_table_build(struct cpu_table *t)
+{
+    uint32_t g;
+    uint32_t i;
+    t->arena = msr_alloc_array(t->cpus, t->n_cpus);
+    if (!t->arena) {
+        return -1;
+    }
+    t->handles = malloc((t->n_cpus ? t->n_cpus : 1) * sizeof(struct msr_handle *));
+    t->groups = malloc((t->n_groups ? t->n_groups : 1) * sizeof(struct bench_cpu_group));
+    if (!t->handles || !t->groups) {
+        perror("malloc");
+        return -1;
+    }
+    for (i = 0; i < t->n_cpus; i++) {
+        t->handles[i] = msr_array_get(t->arena, i);
+    }
+    for (g = 0; g < t->n_groups; g++) {
+        t->groups[g].handles = &t->handles[t->offsets[g]];
+        t->groups[g].n_handles = t->offsets[g + 1] - t->offsets[g];
+        t->groups[g].first = t->offsets[g];
+    }
+    return 0;
+}
+
+int cpu_table_open(struct cpu_table *t)
+{
+    int e;
+    for (; t->n_open < t->n_cpus; t->n_open++) {
+        if (msr_open(t->handles[t->n_open])) {
+            e = errno;
+            cpu_table_close(t);
+            errno = e;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cpu_table_add_all(struct cpu_table *t)
+{
+    uint32_t n = msr_get_count();
+    uint32_t i;
+    if (!n) {
+        perror("msr_get_count");
+        return -1;
+    }
+    if (cpu_table_add_group(t)) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        if (cpu_table_add_cpu(t, i)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int cpu_table_add_topology(struct cpu_table *t, enum topology_level level, uint32_t split)
+{
+    struct topology topo;
+    uint32_t *domains = NULL;
+    uint32_t *cpus = NULL;
+    uint32_t n_domains = 0;
+    uint32_t n_cpus;
+    uint32_t chunk;
+    uint32_t d;
+    uint32_t i;
+    uint32_t j;
+    uint32_t k;
+    int rc = 0;
+
+    if (topology_load(&topo)) {
+        return -1;
+    }
+    domains = malloc(topo.n_cpus * sizeof(uint32_t));
+    cpus = malloc(topo.n_cpus * sizeof(uint32_t));
+    if (!domains || !cpus) {
+        perror("malloc");
+        rc = -1;
+        goto out;
+    }
+    // domains in order of first appearance
+    for (i = 0; i < topo.n_cpus; i++) {
+        d = topology_domain(&topo, i, level);
+        for (j = 0; j < n_domains && domains[j] != d; j++);
+        if (j == n_domains) {
+            domains[n_domains++] = d;
+        }
+    }
+
+    for (j = 0; j < n_domains; j++) {
+        n_cpus = 0;
+        for (i = 0; i < topo.n_cpus; i++) {
+            if (topology_domain(&topo, i, level) == domains[j]) {
+                cpus[n_cpus++] = topo.cpus[i];
+            }
+        }
+        chunk = (n_cpus + split - 1) / split;
+        for (i = 0; i < n_cpus; i += chunk) {
+            if (cpu_table_add_group(t)) {
+                rc = -1;
+                goto out;
+            }
+            for (k = i; k < n_cpus && k < i + chunk; k++) {
+                if (cpu_table_add_cpu(t, cpus[k])) {
+                    rc = -1;
+                    goto out;
+                }
+            }
+        }
+    }
+
+out:
+    free(cpus);
+    free(domains);
+    topology_free(&topo);
+    return rc;
+}
@@ -0,0 +1,73 @@
+#ifndef CPU_TABLE_H
+#define CPU_TABLE_H
+
+#include <inttypes.h>
+
+#include "bench.h"
+#include "msr.h"
+#include "topology.h"
+
+/*
+ * The configured CPU groups and their MSR handles, sized by what's configured instead of
+ * compile-time limits. CPUs are added group by group into flat, growable arrays, then
+ * cpu_table_build() allocates all handles in one cache-aligned arena in group-major order,
+ * and every group's handle pointers as a slice of one contiguous array.
+ */
+struct cpu_table {
+    // CPU ids, group-major; group g is cpus[offsets[g]] to cpus[offsets[g + 1] - 1]
+    uint32_t *cpus;
+    uint32_t n_cpus;
+    uint32_t cap_cpus;
+    uint32_t *offsets;
+    uint32_t n_groups;
+    uint32_t cap_groups;
+    // set by cpu_table_build()
+    struct msr_handle *arena;
+    struct msr_handle **handles;
+    struct bench_cpu_group *groups;
+    // handles opened so far by cpu_table_open()
+    uint32_t n_open;
+};
+
+void cpu_table_init(struct cpu_table *t);
+
+/**
+ * Free everything, closing any open handles first.
+ * Returns non-zero if closing any handle failed.
+ */
+int cpu_table_free(struct cpu_table *t);
+
+/**
+ * Start a new, empty group. CPUs added after this belong to it.
+ */
+int cpu_table_add_group(struct cpu_table *t);
+
+int cpu_table_add_cpu(struct cpu_table *t, uint32_t cpu);
+
+/**
+ * Remove the last group and its CPUs, e.g., when adding its CPUs failed partway.
+ * Only before cpu_table_build().
+ */
+void cpu_table_drop_group(struct cpu_table *t);
+
+/**
+ * Add one group of all CPUs the backend knows.
+ */
+int cpu_table_add_all(struct cpu_table *t);
+
+/**
+ * Add a group per topology domain at level, splitting each domain into up to split groups.
+ */
+int cpu_table_add_topology(struct cpu_table *t, enum topology_level level, uint32_t split);
+
+/**
+ * Allocate the handles and groups. No more CPUs or groups can be added after this.
+ */
+int cpu_table_build(struct cpu_table *t);
+
+/**
+ * Open all handles, closing any already opened on failure.
+ */
+int cpu_table_open(struct cpu_table *t);
+
+#endif // CPU_TABLE_H
@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "delta.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DELTA_X86 1
+#include <immintrin.h>
+#else
+#define DELTA_X86 0
+#endif
+
+static int delta_scalar_supported(void)
+{
+    return 1;
+}
+
+static void delta_scalar_apply(uint64_t *prev, const uint64_t *cur, uint64_t *total,
+                               double *scaled, size_t n, uint64_t mask, double scale)
+{
+    uint64_t d;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        // unsigned subtraction wraps, and the mask folds it to the counter's width
+        d = (cur[i] - prev[i]) & mask;
+        total[i] += d;
+        scaled[i] = (double) d * scale;
+        prev[i] = cur[i];
+    }
+}
+
+static const struct delta_kernel delta_kernel_scalar = {
+    .name = "scalar",
+    .supported = delta_scalar_supported,
+    .apply = delta_scalar_apply,
+};
+
+#if DELTA_X86
+static int delta_avx2_supported(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+// AVX2 has no unsigned 64-bit to double conversion, so build the halves' exponents by hand
+__attribute__((target("avx2")))
+static inline __m256d delta_u64_to_pd_avx2(__m256i x)
+{
+    // 2^84 and 2^52 as the exponents for the high and low 32 bits
+    const __m256d k84 = _mm256_set1_pd(19342813113834066795298816.0);
+    const __m256d k52 = _mm256_set1_pd(4503599627370496.0);
+    const __m256d k84_52 = _mm256_set1_pd(19342813118337666422669312.0);
+    __m256i hi = _mm256_or_si256(_mm256_srli_epi64(x, 32), _mm256_castpd_si256(k84));
+    __m256i lo = _mm256_blend_epi16(x, _mm256_castpd_si256(k52), 0xcc);
+    return _mm256_add_pd(_mm256_sub_pd(_mm256_castsi256_pd(hi), k84_52),
+                         _mm256_castsi256_pd(lo));
+}
+
+__attribute__((target("avx2")))
+static void delta_avx2_apply(uint64_t *prev, const uint64_t *cur, uint64_t *total,
+                             double *scaled, size_t n, uint64_t mask, double scale)
+{
+    const __m256i vmask = _mm256_set1_epi64x((long long) mask);
+    const __m256d vscale = _mm256_set1_pd(scale);
+    __m256i p;
+    __m256i c;
+    __m256i d;
+    __m256i t;
+    size_t i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        p = _mm256_loadu_si256((const __m256i *)&prev[i]);
+        c = _mm256_loadu_si256((const __m256i *)&cur[i]);
+        t = _mm256_loadu_si256((const __m256i *)&total[i]);
+        d = _mm256_and_si256(_mm256_sub_epi64(c, p), vmask);
+        _mm256_storeu_si256((__m256i *)&total[i], _mm256_add_epi64(t, d));
+        _mm256_storeu_pd(&scaled[i], _mm256_mul_pd(delta_u64_to_pd_avx2(d), vscale));
+        _mm256_storeu_si256((__m256i *)&prev[i], c);
+    }
+    delta_scalar_apply(&prev[i], &cur[i], &total[i], &scaled[i], n - i, mask, scale);
+}
+
+static const struct delta_kernel delta_kernel_avx2 = {
+    .name = "avx2",
+    .supported = delta_avx2_supported,
+    .apply = delta_avx2_apply,
+};
+
+static int delta_avx512_supported(void)
+{
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+}
+
+__attribute__((target("avx512f,avx512dq")))
+static void delta_avx512_apply(uint64_t *prev, const uint64_t *cur, uint64_t *total,
+                               double *scaled, size_t n, uint64_t mask, double scale)
+{
+    const __m512i vmask = _mm512_set1_epi64((long long) mask);
+    const __m512d vscale = _mm512_set1_pd(scale);
+    __mmask8 k;
+    __m512i p;
+    __m512i c;
+    __m512i d;
+    __m512i t;
+    size_t i;
+    for (i = 0; i < n; i += 8) {
+        // the tail uses masked loads and stores instead of a scalar loop
+        k = n - i >= 8 ? 0xff : (__mmask8) ((1u << (n - i)) - 1);
+        p = _mm512_maskz_loadu_epi64(k, &prev[i]);
+        c = _mm512_maskz_loadu_epi64(k, &cur[i]);
+        t = _mm512_maskz_loadu_epi64(k, &total[i]);
+        d = _mm512_and_si512(_mm512_sub_epi64(c, p), vmask);
+        _mm512_mask_storeu_epi64(&total[i], k, _mm512_add_epi64(t, d));
+        _mm512_mask_storeu_pd(&scaled[i], k, _mm512_mul_pd(_mm512_cvtepu64_pd(d), vscale));
+        _mm512_mask_storeu_epi64(&prev[i], k, c);
+    }
+}
+
+static const struct delta_kernel delta_kernel_avx512 = {
+    .name = "avx512",
+    .supported = delta_avx512_supported,
+    .apply = delta_avx512_apply,
+};
+#endif
+
+// fastest first
+static const struct delta_kernel *const kernels[] = {
+#if DELTA_X86
+    &delta_kernel_avx512,
+    &delta_kernel_avx2,
+#endif
+    &delta_kernel_scalar,
+};
+
+const struct delta_kernel *delta_kernel_select(const char *name)
+{
+    size_t i;
+    int is_auto = !name || !strcmp(name, "auto");
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (is_auto ? kernels[i]->supported() : !strcmp(kernels[i]->name, name)) {
+            if (!kernels[i]->supported()) {
+                fprintf(stderr, "Delta kernel not supported by this CPU: %s\n", name);
+                errno = ENOTSUP;
+                return NULL;
+            }
+            return kernels[i];
+        }
+    }
+    errno = EINVAL;
+    return NULL;
+}
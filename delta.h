@@ -0,0 +1,32 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+ * Post-read processing of free-running counters: turn consecutive samples into deltas,
+ * handling wraparound at the counter's width, then accumulate 64-bit totals and scale
+ * to units. Kernels work over contiguous arrays, e.g., one MSR across many CPUs, and
+ * come in SIMD variants selected at runtime.
+ */
+
+struct delta_kernel {
+    const char *name;
+    // returns non-zero if the running CPU can execute the kernel
+    int (*supported)(void);
+    /**
+     * For i in [0, n): d = (cur[i] - prev[i]) & mask; total[i] += d;
+     * scaled[i] = d * scale; prev[i] = cur[i].
+     */
+    void (*apply)(uint64_t *prev, const uint64_t *cur, uint64_t *total, double *scaled,
+                  size_t n, uint64_t mask, double scale);
+};
+
+/**
+ * Select a kernel by name (scalar, avx2, avx512), or the fastest supported one if
+ * name is NULL or "auto". Returns NULL with errno set if unknown or unsupported.
+ */
+const struct delta_kernel *delta_kernel_select(const char *name);
+
+#endif // DELTA_H
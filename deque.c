@@ -0,0 +1,33 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "deque.h"
+
+int deque_init(struct deque *d, uint32_t cap)
+{
+    uint64_t n = 1;
+    uint64_t i;
+    while (n < cap) {
+        n <<= 1;
+    }
+    d->buf = aligned_alloc(64, ((n * sizeof(atomic_uint) + 63) / 64) * 64);
+    if (!d->buf) {
+        perror("aligned_alloc");
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        atomic_init(&d->buf[i], 0);
+    }
+    d->mask = (long) n - 1;
+    atomic_init(&d->top, 0);
+    atomic_init(&d->bottom, 0);
+    return 0;
+}
+
+void deque_destroy(struct deque *d)
+{
+    free(d->buf);
+    d->buf = NULL;
+}
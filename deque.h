@@ -0,0 +1,91 @@
+#ifndef DEQUE_H
+#define DEQUE_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+/*
+ * Chase-Lev work-stealing deque of uint32_t items with a fixed capacity
+ * (C11 formulation from Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models").
+ * Only the owner may push and take (LIFO, at the bottom); anyone may steal (FIFO, at the top).
+ */
+
+#define DEQUE_EMPTY UINT32_MAX
+#define DEQUE_ABORT (UINT32_MAX - 1)
+
+struct deque {
+    _Alignas(64) atomic_long top;
+    _Alignas(64) atomic_long bottom;
+    atomic_uint *buf;
+    long mask;
+};
+
+/**
+ * Initialize a deque that holds up to cap items (rounded up to a power of 2).
+ */
+int deque_init(struct deque *d, uint32_t cap);
+
+void deque_destroy(struct deque *d);
+
+/**
+ * Owner only. The caller must not exceed the capacity.
+ */
+static inline void deque_push(struct deque *d, uint32_t x)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    atomic_store_explicit(&d->buf[b & d->mask], x, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+/**
+ * Owner only. Returns DEQUE_EMPTY if there's nothing left.
+ */
+static inline uint32_t deque_take(struct deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    long t;
+    uint32_t x;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return DEQUE_EMPTY;
+    }
+    x = atomic_load_explicit(&d->buf[b & d->mask], memory_order_relaxed);
+    if (t == b) {
+        // last item, race thieves for it
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                     memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            x = DEQUE_EMPTY;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return x;
+}
+
+/**
+ * Any thread. Returns DEQUE_EMPTY, or DEQUE_ABORT if it lost a race and may retry.
+ */
+static inline uint32_t deque_steal(struct deque *d)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    long b;
+    uint32_t x;
+    atomic_thread_fence(memory_order_seq_cst);
+    b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) {
+        return DEQUE_EMPTY;
+    }
+    x = atomic_load_explicit(&d->buf[t & d->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return DEQUE_ABORT;
+    }
+    return x;
+}
+
+#endif // DEQUE_H
@@ -0,0 +1,84 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "hist.h"
+
+static uint64_t hist_bucket_lower(uint32_t idx)
+{
+    uint32_t shift;
+    if (idx < 2 * HIST_SUB_COUNT) {
+        return idx;
+    }
+    shift = idx / HIST_SUB_COUNT - 1;
+    return (uint64_t) (idx - shift * HIST_SUB_COUNT) << shift;
+}
+
+static uint64_t hist_bucket_width(uint32_t idx)
+{
+    if (idx < 2 * HIST_SUB_COUNT) {
+        return 1;
+    }
+    return UINT64_C(1) << (idx / HIST_SUB_COUNT - 1);
+}
+
+void hist_reset(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    uint32_t i;
+    if (!src->count) {
+        return;
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+uint64_t hist_percentile(const struct hist *h, double p)
+{
+    uint64_t target;
+    uint64_t seen = 0;
+    uint64_t v;
+    uint32_t i;
+    if (!h->count) {
+        return 0;
+    }
+    if (p >= 100.0) {
+        return h->max;
+    }
+    target = (uint64_t) (p / 100.0 * h->count);
+    if (target >= h->count) {
+        target = h->count - 1;
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen > target) {
+            break;
+        }
+    }
+    v = hist_bucket_lower(i) + hist_bucket_width(i) / 2;
+    // the true value can't lie outside the observed range
+    if (v < h->min) {
+        v = h->min;
+    } else if (v > h->max) {
+        v = h->max;
+    }
+    return v;
+}
+
+double hist_mean(const struct hist *h)
+{
+    return h->count ? (double) h->sum / h->count : 0.0;
+}
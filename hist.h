@@ -0,0 +1,86 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <inttypes.h>
+
+/*
+ * Log-linear (HDR-style) histogram: values below 2^(HIST_SUB_BITS+1) are exact,
+ * larger values land in one of HIST_SUB_COUNT linear sub-buckets per power of 2.
+ * Relative error is bounded by 1/HIST_SUB_COUNT.
+ */
+#define HIST_SUB_BITS   4
+#define HIST_SUB_COUNT  (1u << HIST_SUB_BITS)
+// values with more significant bits than this are clamped into the last bucket
+#define HIST_MAG_MAX    40
+#define HIST_BUCKETS    ((HIST_MAG_MAX - HIST_SUB_BITS + 2) * HIST_SUB_COUNT)
+
+struct hist {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+static inline uint32_t hist_index(uint64_t v)
+{
+    uint32_t mag;
+    uint32_t shift;
+    if (v < 2 * HIST_SUB_COUNT) {
+        return (uint32_t) v;
+    }
+    mag = 63 - __builtin_clzll(v);
+    if (mag > HIST_MAG_MAX) {
+        return HIST_BUCKETS - 1;
+    }
+    shift = mag - HIST_SUB_BITS;
+    return shift * HIST_SUB_COUNT + (uint32_t) (v >> shift);
+}
+
+/**
+ * Record a value. No locking - each histogram must have a single writer.
+ */
+static inline void hist_record(struct hist *h, uint64_t v)
+{
+    h->buckets[hist_index(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+/**
+ * Record the same value n times, e.g., an amortized per-operation cost.
+ */
+static inline void hist_record_n(struct hist *h, uint64_t v, uint64_t n)
+{
+    if (!n) {
+        return;
+    }
+    h->buckets[hist_index(v)] += n;
+    h->count += n;
+    h->sum += v * n;
+    if (v < h->min) {
+        h->min = v;
+    }
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+void hist_reset(struct hist *h);
+
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/**
+ * Get the value at percentile p (0-100), resolved to the bucket midpoint.
+ */
+uint64_t hist_percentile(const struct hist *h, double p);
+
+double hist_mean(const struct hist *h);
+
+#endif // HIST_H
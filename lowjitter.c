@@ -0,0 +1,346 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "affinity.h"
+#include "bench.h"
+#include "bench-stats.h"
+#include "hist.h"
+#include "lowjitter.h"
+#include "runner.h"
+#include "sysenv.h"
+#include "timing.h"
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+enum {
+    LOWJITTER_OFF,
+    LOWJITTER_ON,
+    LOWJITTER_N_MODES,
+};
+
+static const char *const lowjitter_mode_names[] = { "default", "low-jitter" };
+
+// what a low-jitter run changed, to undo after it
+struct lowjitter_state {
+    struct affinity aff;
+    struct sched_param param;
+    int policy;
+    uint32_t applied;
+};
+
+// the quiet CPUs: the driver runs on the first, its threads on the others, one each
+struct lowjitter_cpus {
+    uint32_t list[CPU_SETSIZE];
+    uint32_t n;
+};
+
+// threads get every CPU but the driver's, unless it's the only one
+static inline const uint32_t *lowjitter_thr_cpus(const struct lowjitter_cpus *cpus)
+{
+    return cpus->n > 1 ? &cpus->list[1] : cpus->list;
+}
+
+static inline uint32_t lowjitter_n_thr_cpus(const struct lowjitter_cpus *cpus)
+{
+    return cpus->n > 1 ? cpus->n - 1 : cpus->n;
+}
+
+// what one strategy measured in each mode, across its repetitions
+struct lowjitter_result {
+    struct hist iter[LOWJITTER_N_MODES];
+    double ns[LOWJITTER_N_MODES];
+    uint32_t n[LOWJITTER_N_MODES];
+};
+
+int lowjitter_settings_parse(const char *list, uint32_t *settings)
+{
+    char *copy = strdup(list);
+    char *saveptr = NULL;
+    char *name;
+    if (!copy) {
+        perror("strdup");
+        return -1;
+    }
+    *settings = 0;
+    for (name = strtok_r(copy, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+        if (!strcmp(name, "fifo")) {
+            *settings |= LOWJITTER_FIFO;
+        } else if (!strcmp(name, "mlock")) {
+            *settings |= LOWJITTER_MLOCK;
+        } else if (!strcmp(name, "isolate")) {
+            *settings |= LOWJITTER_ISOLATE;
+        } else {
+            fprintf(stderr, "Unknown low-jitter setting: %s\n", name);
+            free(copy);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    free(copy);
+    return 0;
+}
+
+// fault in the stack the driver may grow into, which mlockall then keeps resident
+static __attribute__((noinline)) void lowjitter_prefault_stack(void)
+{
+    volatile unsigned char buf[LOWJITTER_STACK_PREFAULT];
+    size_t i;
+    for (i = 0; i < sizeof(buf); i += 4096) {
+        buf[i] = 0;
+    }
+}
+
+/**
+ * Apply settings to the calling thread (and so to the threads it starts) and the process,
+ * reporting each that fails. Returns the ones applied. Isolation only pins the driver here;
+ * its threads are pinned as they start, since the kernel doesn't balance load across
+ * isolcpus, and would leave them all on the driver's CPU.
+ */
+static uint32_t lowjitter_apply(const struct lowjitter *lj, uint32_t settings,
+                                const struct lowjitter_cpus *cpus, struct lowjitter_state *st)
+{
+    struct sched_param param;
+    cpu_set_t driver;
+    st->applied = 0;
+    if (settings & LOWJITTER_ISOLATE) {
+        affinity_save(&st->aff);
+        CPU_ZERO(&driver);
+        CPU_SET(cpus->list[0], &driver);
+        errno = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &driver);
+        if (errno) {
+            perror("low-jitter: pthread_setaffinity_np");
+        } else {
+            st->applied |= LOWJITTER_ISOLATE;
+        }
+    }
+    if (settings & LOWJITTER_MLOCK) {
+        // prefault and lock what's mapped now, and later mappings, e.g., thread stacks, as
+        // they're touched rather than all of every stack up front; the strategies fault in
+        // their per-run buffers when they set up, so only stack growth faults while measured
+        if (mlockall(MCL_CURRENT) || mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT)) {
+            perror("low-jitter: mlockall");
+            munlockall();
+        } else {
+            lowjitter_prefault_stack();
+            st->applied |= LOWJITTER_MLOCK;
+        }
+    }
+    if (settings & LOWJITTER_FIFO) {
+        st->policy = sched_getscheduler(0);
+        sched_getparam(0, &st->param);
+        param.sched_priority = lj->prio;
+        if (st->policy < 0 || sched_setscheduler(0, SCHED_FIFO, &param)) {
+            perror("low-jitter: sched_setscheduler");
+        } else {
+            st->applied |= LOWJITTER_FIFO;
+        }
+    }
+    return st->applied;
+}
+
+static void lowjitter_restore(const struct lowjitter_state *st)
+{
+    if (st->applied & LOWJITTER_FIFO) {
+        sched_setscheduler(0, st->policy, &st->param);
+    }
+    if (st->applied & LOWJITTER_MLOCK) {
+        munlockall();
+    }
+    if (st->applied & LOWJITTER_ISOLATE) {
+        affinity_restore(&st->aff);
+    }
+}
+
+static void lowjitter_print_cpus(FILE *f, const uint32_t *cpus, uint32_t n)
+{
+    uint32_t i;
+    for (i = 0; i < n; i++) {
+        fprintf(f, "%s%"PRIu32, i ? "," : "", cpus[i]);
+    }
+}
+
+static void lowjitter_print_settings(FILE *f, const struct lowjitter *lj, uint32_t settings,
+                                     const struct lowjitter_cpus *cpus)
+{
+    if (!settings) {
+        fprintf(f, "none");
+    }
+    if (settings & LOWJITTER_FIFO) {
+        fprintf(f, "SCHED_FIFO %d%s", lj->prio, settings & ~LOWJITTER_FIFO ? ", " : "");
+    }
+    if (settings & LOWJITTER_MLOCK) {
+        fprintf(f, "mlockall%s", settings & LOWJITTER_ISOLATE ? ", " : "");
+    }
+    if (settings & LOWJITTER_ISOLATE) {
+        fprintf(f, "driver on CPU %"PRIu32", threads on CPUs ", cpus->list[0]);
+        lowjitter_print_cpus(f, lowjitter_thr_cpus(cpus), lowjitter_n_thr_cpus(cpus));
+        if (lj->base.n_cpu_groups > lowjitter_n_thr_cpus(cpus)) {
+            fprintf(f, " (shared by %"PRIu32" groups)", lj->base.n_cpu_groups);
+        }
+    }
+}
+
+static int lowjitter_run_one(const struct lowjitter *lj, FILE *f, uint32_t rep, uint32_t st,
+                             int mode, uint32_t *settings, const struct lowjitter_cpus *cpus,
+                             struct lowjitter_result *res)
+{
+    const struct bench_strategy *strategy = lj->strategies[st];
+    struct lowjitter_state state;
+    struct bench ctx = lj->base;
+    double elapsed_ns;
+    double ns;
+    int rc;
+
+    memset(&state, 0, sizeof(state));
+    if (mode == LOWJITTER_ON) {
+        // drop what fails, so it's reported once and the report says what ran
+        *settings = lowjitter_apply(lj, *settings, cpus, &state);
+        if (*settings & LOWJITTER_ISOLATE) {
+            ctx.thr_cpus = lowjitter_thr_cpus(cpus);
+            ctx.n_thr_cpus = lowjitter_n_thr_cpus(cpus);
+        }
+    }
+    // warm up as measured, e.g., so thread stacks are faulted in and locked
+    rc = runner_run_strategy("low-jitter", strategy, &ctx, lj->warmup);
+    lowjitter_restore(&state);
+    if (rc) {
+        return rc;
+    }
+    elapsed_ns = timing_ticks_to_ns(ctx.stats->elapsed);
+    ns = ctx.stats->iter.count ? elapsed_ns / ctx.stats->iter.count : 0;
+    hist_merge(&res->iter[mode], &ctx.stats->iter);
+    res->ns[mode] += ns;
+    res->n[mode]++;
+    fprintf(f, "rep %3"PRIu32"  %-24s %-10s %12.1f ns/iter %12.0f ns p99\n", rep + 1,
+            strategy->name, lowjitter_mode_names[mode], ns,
+            timing_ticks_to_ns(hist_percentile(&ctx.stats->iter, 99.0)));
+    return 0;
+}
+
+static double lowjitter_pct(const struct hist *h, double p)
+{
+    return h->count ? timing_ticks_to_ns(p < 100.0 ? hist_percentile(h, p) : h->max) : 0;
+}
+
+static void lowjitter_report(const struct lowjitter *lj, FILE *f,
+                             const struct lowjitter_result *res)
+{
+    static const double pcts[] = { 50.0, 99.0, 99.9, 100.0 };
+    const uint32_t n_pcts = sizeof(pcts) / sizeof(pcts[0]);
+    double off;
+    double on;
+    uint32_t st;
+    uint32_t i;
+    int mode;
+
+    fprintf(f, "\n%-24s %-10s %12s %10s %10s %10s %10s\n", "Iteration (ns)", "mode", "ns/iter",
+            "p50", "p99", "p99.9", "max");
+    for (st = 0; st < lj->n_strategies; st++) {
+        for (mode = 0; mode < LOWJITTER_N_MODES; mode++) {
+            fprintf(f, "%-24s %-10s %12.1f", lj->strategies[st]->name, lowjitter_mode_names[mode],
+                    res[st].n[mode] ? res[st].ns[mode] / res[st].n[mode] : 0);
+            for (i = 0; i < n_pcts; i++) {
+                fprintf(f, " %10.0f", lowjitter_pct(&res[st].iter[mode], pcts[i]));
+            }
+            fprintf(f, "\n");
+        }
+    }
+
+    // whatever the low-jitter runs save at a percentile was scheduling, not the reads
+    fprintf(f, "\n%-24s %18s %18s %18s %18s\n", "Scheduling noise (ns)", "p50", "p99", "p99.9",
+            "max");
+    for (st = 0; st < lj->n_strategies; st++) {
+        fprintf(f, "%-24s", lj->strategies[st]->name);
+        for (i = 0; i < n_pcts; i++) {
+            off = lowjitter_pct(&res[st].iter[LOWJITTER_OFF], pcts[i]);
+            on = lowjitter_pct(&res[st].iter[LOWJITTER_ON], pcts[i]);
+            fprintf(f, " %+10.0f (%4.0f%%)", off - on, off > 0 ? 100.0 * (off - on) / off : 0);
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "(default - low-jitter, and its share of default; negative if low-jitter was "
+            "slower)\n");
+}
+
+int lowjitter_run(const struct lowjitter *lj, FILE *f)
+{
+    struct lowjitter_result *res;
+    struct lowjitter_cpus *cpus;
+    struct sysenv env;
+    uint32_t settings = lj->settings;
+    cpu_set_t allowed;
+    cpu_set_t quiet;
+    uint32_t rep;
+    uint32_t st;
+    int first;
+    int mode;
+    int rc = 0;
+    int i;
+
+    if (!lj->base.stats || !lj->n_strategies || !lj->reps) {
+        errno = EINVAL;
+        return -1;
+    }
+    res = calloc(lj->n_strategies, sizeof(struct lowjitter_result));
+    cpus = calloc(1, sizeof(*cpus));
+    if (!res || !cpus) {
+        perror("calloc");
+        free(res);
+        free(cpus);
+        return -1;
+    }
+    for (st = 0; st < lj->n_strategies; st++) {
+        for (mode = 0; mode < LOWJITTER_N_MODES; mode++) {
+            hist_reset(&res[st].iter[mode]);
+        }
+    }
+
+    // the quiet CPUs this process may run on
+    sysenv_snapshot(&env);
+    CPU_OR(&quiet, &env.isolated, &env.nohz_full);
+    pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &allowed);
+    CPU_AND(&quiet, &quiet, &allowed);
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &quiet)) {
+            cpus->list[cpus->n++] = (uint32_t) i;
+        }
+    }
+    if ((settings & LOWJITTER_ISOLATE) && !cpus->n) {
+        fprintf(f, "No isolcpus or nohz_full CPUs to run on, leaving affinity as is\n");
+        settings &= ~LOWJITTER_ISOLATE;
+    }
+
+    fprintf(f, "Low-jitter: %"PRIu32" pairs of %"PRIu32" iterations, %"PRIu32" warmup "
+            "iterations, with ", lj->reps, lj->base.iters, lj->warmup);
+    lowjitter_print_settings(f, lj, settings, cpus);
+    fprintf(f, "\nHost: ");
+    sysenv_print(f, &env);
+
+    // alternate which mode goes first, so drift in the host hits both alike
+    for (rep = 0; rep < lj->reps && !rc; rep++) {
+        for (st = 0; st < lj->n_strategies && !rc; st++) {
+            first = rep % 2 ? LOWJITTER_ON : LOWJITTER_OFF;
+            rc = lowjitter_run_one(lj, f, rep, st, first, &settings, cpus, &res[st]);
+            if (!rc) {
+                rc = lowjitter_run_one(lj, f, rep, st, !first, &settings, cpus, &res[st]);
+            }
+        }
+    }
+    if (!rc) {
+        lowjitter_report(lj, f, res);
+        fprintf(f, "Low-jitter settings applied: ");
+        lowjitter_print_settings(f, lj, settings, cpus);
+        fprintf(f, "\n");
+    }
+    free(res);
+    free(cpus);
+    return rc;
+}
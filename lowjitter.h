@@ -0,0 +1,61 @@
+#ifndef LOWJITTER_H
+#define LOWJITTER_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "bench.h"
+
+// what a low-jitter run changes
+#define LOWJITTER_FIFO     0x1
+#define LOWJITTER_MLOCK    0x2
+#define LOWJITTER_ISOLATE  0x4
+#define LOWJITTER_ALL      (LOWJITTER_FIFO | LOWJITTER_MLOCK | LOWJITTER_ISOLATE)
+
+#ifndef LOWJITTER_PRIO_DEFAULT
+#define LOWJITTER_PRIO_DEFAULT 50
+#endif
+
+// driver stack faulted in and locked before each low-jitter run
+#ifndef LOWJITTER_STACK_PREFAULT
+#define LOWJITTER_STACK_PREFAULT (256 * 1024)
+#endif
+
+/*
+ * Split tail latency into scheduling noise and the cost of the reads themselves: every
+ * strategy runs alternately as is and in a low-jitter mode, where the driver and the workers
+ * it starts (which inherit its policy) run SCHED_FIFO, the process is locked in memory with
+ * everything allocated so far prefaulted, and the driver and its workers are pinned to the
+ * isolcpus/nohz_full CPUs, if the host has any: the driver to the first, the workers to the
+ * others, round-robin. What the low-jitter runs shave off each percentile of the iteration
+ * latency is what scheduling cost it.
+ */
+struct lowjitter {
+    // template for every run; stats is required and reset per run
+    struct bench base;
+    const struct bench_strategy **strategies;
+    uint32_t n_strategies;
+    // untimed iterations before every measured run
+    uint32_t warmup;
+    // pairs of runs per strategy
+    uint32_t reps;
+    // LOWJITTER_* to apply in the low-jitter runs
+    uint32_t settings;
+    // SCHED_FIFO priority
+    int prio;
+};
+
+/**
+ * Parse a comma-delimited list of settings ("fifo", "mlock", "isolate"), returns -1 if any
+ * is unknown.
+ */
+int lowjitter_settings_parse(const char *list, uint32_t *settings);
+
+/**
+ * Run every pair of repetitions and write the per-run results and the comparison to f.
+ * Settings that can't be applied, e.g., without CAP_SYS_NICE, are reported and left out.
+ * Returns non-zero if any run failed, or -1 with errno set on other errors.
+ */
+int lowjitter_run(const struct lowjitter *lj, FILE *f);
+
+#endif // LOWJITTER_H
@@ -0,0 +1,70 @@
+#ifndef MSR_BACKEND_H
+#define MSR_BACKEND_H
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+#include "msr.h"
+
+/*
+ * Internal interface between msr.c and the MSR access backends.
+ */
+
+struct msr_handle {
+    uint32_t cpu;
+    int fd;
+    // backend-specific state
+    void *priv;
+};
+
+struct msr_batch {
+    struct msr_handle *const *handles;
+    uint32_t n_handles;
+    const uint32_t *msrs;
+    uint32_t n_msrs;
+    // backend-specific state
+    void *priv;
+};
+
+struct msr_backend {
+    const char *name;
+    // optional: parse comma-delimited key=value options
+    int (*init)(const char *opts);
+    uint32_t (*get_count)(void);
+    // optional: for backends that model their own topology
+    int (*get_topology)(uint32_t cpu, struct msr_topology *topo);
+    int (*open)(struct msr_handle *m);
+    int (*close)(struct msr_handle *m);
+    ssize_t (*read)(const struct msr_handle *m, uint32_t msr, uint64_t *data);
+    // optional: set up reading msrs from the handle before the first read
+    int (*prepare)(const struct msr_handle *m, const uint32_t *msrs, uint32_t n_msrs);
+    // bind the calling thread to the handle's CPU
+    int (*migrate)(const struct msr_handle *m);
+    // optional: for backends that model where threads run, otherwise sched_getcpu()
+    uint32_t (*get_cur_cpu)(void);
+    // optional: native batch support, otherwise batches are a loop over read()
+    int (*batch_init)(struct msr_batch *b);
+    void (*batch_fini)(struct msr_batch *b);
+    int (*batch_read)(struct msr_batch *b, uint64_t *data);
+};
+
+extern const struct msr_backend msr_backend_linux;
+extern const struct msr_backend msr_backend_sim;
+extern const struct msr_backend msr_backend_batch;
+extern const struct msr_backend msr_backend_perf;
+
+/**
+ * Call fn for each key=value pair in a comma-delimited option string.
+ * Stops and returns the first non-zero return value of fn.
+ */
+int msr_opts_foreach(const char *opts,
+                     int (*fn)(const char *key, const char *val, void *arg),
+                     void *arg);
+
+/**
+ * Check that a device path template contains exactly one "%u" (for the CPU) and no
+ * other conversions, so it's safe to pass to snprintf.
+ */
+int msr_path_check(const char *fmt);
+
+#endif // MSR_BACKEND_H
@@ -0,0 +1,228 @@
+/*
+ * msr-safe backend: single reads use /dev/cpu/N/msr_safe, batches use the
+ * /dev/cpu/msr_batch ioctl, which executes all operations in one syscall with
+ * the kernel spreading the IPIs across the target CPUs.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "affinity.h"
+#include "msr-backend.h"
+
+// ABI from msr-safe's msr_safe.h
+struct msr_safe_batch_op {
+    uint16_t cpu;
+    uint16_t isrdmsr;
+    int32_t err;
+    uint32_t msr;
+    uint64_t msrdata;
+    uint64_t wmask;
+};
+
+struct msr_safe_batch_array {
+    uint32_t numops;
+    struct msr_safe_batch_op *ops;
+};
+
+#define X86_IOC_MSR_BATCH _IOWR('c', 0xA2, struct msr_safe_batch_array)
+
+struct msr_batch_priv {
+    struct msr_safe_batch_array arr;
+    struct msr_safe_batch_op ops[];
+};
+
+// overridable, e.g., to point at a fake device
+static const char *path_fmt = "/dev/cpu/%u/msr_safe";
+static char path_buf[256];
+static char dev_path[256] = "/dev/cpu/msr_batch";
+
+// the batch device is shared by all batches
+static pthread_mutex_t dev_mtx = PTHREAD_MUTEX_INITIALIZER;
+static int dev_fd = -1;
+static uint32_t dev_refs;
+
+static int msr_batch_parse(const char *key, const char *val, void *arg)
+{
+    if (!strcmp(key, "path")) {
+        if (msr_path_check(val)) {
+            return -1;
+        }
+        snprintf(path_buf, sizeof(path_buf), "%s", val);
+        path_fmt = path_buf;
+        return 0;
+    }
+    if (!strcmp(key, "dev")) {
+        snprintf(dev_path, sizeof(dev_path), "%s", val);
+        return 0;
+    }
+    fprintf(stderr, "batch: Unknown option: %s\n", key);
+    errno = EINVAL;
+    return -1;
+}
+
+static int msr_batch_be_init(const char *opts)
+{
+    return msr_opts_foreach(opts, msr_batch_parse, NULL);
+}
+
+static uint32_t msr_batch_get_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0 || n > UINT32_MAX) {
+        errno = ENODEV;
+        return 0;
+    }
+    return (uint32_t) n;
+}
+
+static int msr_batch_open(struct msr_handle *m)
+{
+    char fname[320];
+    if (m->cpu > UINT16_MAX) {
+        fprintf(stderr, "batch: CPU out of range for msr-safe: %"PRIu32"\n", m->cpu);
+        errno = ERANGE;
+        return -1;
+    }
+    snprintf(fname, sizeof(fname), path_fmt, m->cpu);
+    if ((m->fd = open(fname, O_RDONLY)) < 0) {
+        fprintf(stderr, "%s: %s\n", fname, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int msr_batch_close(struct msr_handle *m)
+{
+    int rc = 0;
+    if (m->fd >= 0) {
+        rc = close(m->fd);
+        if (rc) {
+            perror("close");
+        }
+        m->fd = -1;
+    }
+    return rc;
+}
+
+static ssize_t msr_batch_rd(const struct msr_handle *m, uint32_t msr, uint64_t* data)
+{
+    return pread(m->fd, data, sizeof(uint64_t), msr);
+}
+
+static int msr_batch_migrate(const struct msr_handle *m)
+{
+    affinity_set_cpu(m->cpu);
+    return 0;
+}
+
+static int msr_batch_dev_get(void)
+{
+    int rc = 0;
+    pthread_mutex_lock(&dev_mtx);
+    if (!dev_refs) {
+        if ((dev_fd = open(dev_path, O_RDWR)) < 0) {
+            fprintf(stderr, "%s: %s\n", dev_path, strerror(errno));
+            rc = -1;
+        }
+    }
+    if (!rc) {
+        dev_refs++;
+    }
+    pthread_mutex_unlock(&dev_mtx);
+    return rc;
+}
+
+static void msr_batch_dev_put(void)
+{
+    pthread_mutex_lock(&dev_mtx);
+    if (!--dev_refs) {
+        close(dev_fd);
+        dev_fd = -1;
+    }
+    pthread_mutex_unlock(&dev_mtx);
+}
+
+static int msr_safe_batch_init(struct msr_batch *b)
+{
+    struct msr_batch_priv *p;
+    uint64_t n_ops = (uint64_t) b->n_handles * b->n_msrs;
+    uint32_t h;
+    uint32_t m;
+    uint32_t i = 0;
+    if (n_ops > UINT32_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+    p = malloc(sizeof(*p) + n_ops * sizeof(struct msr_safe_batch_op));
+    if (!p) {
+        perror("malloc");
+        return -1;
+    }
+    for (h = 0; h < b->n_handles; h++) {
+        for (m = 0; m < b->n_msrs; m++) {
+            p->ops[i].cpu = (uint16_t) b->handles[h]->cpu;
+            p->ops[i].isrdmsr = 1;
+            p->ops[i].err = 0;
+            p->ops[i].msr = b->msrs[m];
+            p->ops[i].msrdata = 0;
+            p->ops[i].wmask = 0;
+            i++;
+        }
+    }
+    p->arr.numops = (uint32_t) n_ops;
+    p->arr.ops = p->ops;
+    if (msr_batch_dev_get()) {
+        free(p);
+        return -1;
+    }
+    b->priv = p;
+    return 0;
+}
+
+static void msr_safe_batch_fini(struct msr_batch *b)
+{
+    free(b->priv);
+    b->priv = NULL;
+    msr_batch_dev_put();
+}
+
+static int msr_safe_batch_read(struct msr_batch *b, uint64_t *data)
+{
+    struct msr_batch_priv *p = (struct msr_batch_priv *)b->priv;
+    uint32_t i;
+    if (ioctl(dev_fd, X86_IOC_MSR_BATCH, &p->arr) < 0) {
+        return -1;
+    }
+    for (i = 0; i < p->arr.numops; i++) {
+        if (p->ops[i].err) {
+            errno = p->ops[i].err < 0 ? -p->ops[i].err : p->ops[i].err;
+            return -1;
+        }
+        data[i] = p->ops[i].msrdata;
+    }
+    return 0;
+}
+
+const struct msr_backend msr_backend_batch = {
+    .name = "batch",
+    .init = msr_batch_be_init,
+    .get_count = msr_batch_get_count,
+    .get_topology = NULL,
+    .open = msr_batch_open,
+    .close = msr_batch_close,
+    .read = msr_batch_rd,
+    .prepare = NULL,
+    .migrate = msr_batch_migrate,
+    .get_cur_cpu = NULL,
+    .batch_init = msr_safe_batch_init,
+    .batch_fini = msr_safe_batch_fini,
+    .batch_read = msr_safe_batch_read,
+};
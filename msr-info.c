@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msr-info.h"
+
+// RAPL energy units are 1/2^ESU Joules, with ESU from MSR_RAPL_POWER_UNIT; 14 is typical
+#define MSR_INFO_RAPL_J (1.0 / (1 << 14))
+
+#define T MSR_SCOPE_THREAD
+#define C MSR_SCOPE_CORE
+#define P MSR_SCOPE_PACKAGE
+
+static const struct msr_info msr_infos[] = {
+    { 0x10,  "IA32_TIME_STAMP_COUNTER",     64, 1.0,                "cycles",       T },
+    { 0xe7,  "IA32_MPERF",                  64, 1.0,                "cycles",       T },
+    { 0xe8,  "IA32_APERF",                  64, 1.0,                "cycles",       T },
+    { 0x19c, "IA32_THERM_STATUS",           64, 1.0,                "raw",          C },
+    { 0x1b1, "IA32_PACKAGE_THERM_STATUS",   64, 1.0,                "raw",          P },
+    { 0x309, "IA32_FIXED_CTR0",             48, 1.0,                "instructions", T },
+    { 0x30a, "IA32_FIXED_CTR1",             48, 1.0,                "cycles",       T },
+    { 0x30b, "IA32_FIXED_CTR2",             48, 1.0,                "cycles",       T },
+    { 0x3f8, "MSR_PKG_C3_RESIDENCY",        64, 1.0,                "cycles",       P },
+    { 0x3f9, "MSR_PKG_C6_RESIDENCY",        64, 1.0,                "cycles",       P },
+    { 0x3fa, "MSR_PKG_C7_RESIDENCY",        64, 1.0,                "cycles",       P },
+    { 0x3fc, "MSR_CORE_C3_RESIDENCY",       64, 1.0,                "cycles",       C },
+    { 0x3fd, "MSR_CORE_C6_RESIDENCY",       64, 1.0,                "cycles",       C },
+    { 0x3fe, "MSR_CORE_C7_RESIDENCY",       64, 1.0,                "cycles",       C },
+    { 0x60d, "MSR_PKG_C2_RESIDENCY",        64, 1.0,                "cycles",       P },
+    { 0x611, "MSR_PKG_ENERGY_STATUS",       32, MSR_INFO_RAPL_J,    "J",            P },
+    { 0x619, "MSR_DRAM_ENERGY_STATUS",      32, MSR_INFO_RAPL_J,    "J",            P },
+    { 0x639, "MSR_PP0_ENERGY_STATUS",       32, MSR_INFO_RAPL_J,    "J",            P },
+    { 0x641, "MSR_PP1_ENERGY_STATUS",       32, MSR_INFO_RAPL_J,    "J",            P },
+    { 0x64d, "MSR_PLATFORM_ENERGY_STATUS",  32, MSR_INFO_RAPL_J,    "J",            P },
+};
+
+#undef T
+#undef C
+#undef P
+
+static const struct msr_info msr_info_unknown = {
+    0, "unknown", 64, 1.0, "counts", MSR_SCOPE_THREAD
+};
+
+static const char *const msr_scope_names[] = {
+    [MSR_SCOPE_THREAD] = "thread",
+    [MSR_SCOPE_CORE] = "core",
+    [MSR_SCOPE_PACKAGE] = "package",
+};
+
+// scopes set by msr_info_set_scope(), which take precedence over the table
+static struct {
+    uint32_t msr;
+    enum msr_scope scope;
+} *msr_scopes;
+static uint32_t msr_n_scopes;
+
+const struct msr_info *msr_info_get(uint32_t msr)
+{
+    size_t i;
+    for (i = 0; i < sizeof(msr_infos) / sizeof(msr_infos[0]); i++) {
+        if (msr_infos[i].msr == msr) {
+            return &msr_infos[i];
+        }
+    }
+    return &msr_info_unknown;
+}
+
+enum msr_scope msr_info_scope(uint32_t msr)
+{
+    uint32_t i;
+    for (i = 0; i < msr_n_scopes; i++) {
+        if (msr_scopes[i].msr == msr) {
+            return msr_scopes[i].scope;
+        }
+    }
+    return msr_info_get(msr)->scope;
+}
+
+int msr_info_set_scope(uint32_t msr, enum msr_scope scope)
+{
+    void *p;
+    uint32_t i;
+    for (i = 0; i < msr_n_scopes && msr_scopes[i].msr != msr; i++);
+    if (i == msr_n_scopes) {
+        p = realloc(msr_scopes, (msr_n_scopes + 1) * sizeof(*msr_scopes));
+        if (!p) {
+            perror("realloc");
+            return -1;
+        }
+        msr_scopes = p;
+        msr_scopes[msr_n_scopes++].msr = msr;
+    }
+    msr_scopes[i].scope = scope;
+    return 0;
+}
+
+int msr_scope_parse(const char *name, enum msr_scope *scope)
+{
+    uint32_t i;
+    for (i = 0; i < MSR_SCOPE_N; i++) {
+        if (!strcmp(name, msr_scope_names[i])) {
+            *scope = (enum msr_scope) i;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+const char *msr_scope_name(enum msr_scope scope)
+{
+    return msr_scope_names[scope];
+}
@@ -0,0 +1,60 @@
+#ifndef MSR_INFO_H
+#define MSR_INFO_H
+
+#include <inttypes.h>
+
+/*
+ * What's known about common free-running counter MSRs: the width they wrap at, the
+ * scale from raw counts to units, and which CPUs share one instance of the register.
+ * MSRs not in the table are treated as per-thread 64-bit raw counts.
+ */
+
+enum msr_scope {
+    // every hardware thread has its own
+    MSR_SCOPE_THREAD,
+    // shared by a core's SMT siblings
+    MSR_SCOPE_CORE,
+    // shared by the whole package, e.g., RAPL and uncore
+    MSR_SCOPE_PACKAGE,
+    MSR_SCOPE_N,
+};
+
+struct msr_info {
+    uint32_t msr;
+    const char *name;
+    // counter width in bits, i.e., it wraps at 2^width
+    uint32_t width;
+    // raw counts to units (e.g., Joules for RAPL energy), assuming the common defaults
+    double scale;
+    const char *unit;
+    enum msr_scope scope;
+};
+
+/**
+ * Look up an MSR. Never NULL - unknown MSRs get a generic 64-bit entry.
+ */
+const struct msr_info *msr_info_get(uint32_t msr);
+
+/**
+ * Get an MSR's scope, as overridden by msr_info_set_scope() or else from the table.
+ */
+enum msr_scope msr_info_scope(uint32_t msr);
+
+/**
+ * Override an MSR's scope, e.g., for a part whose registers are shared differently.
+ */
+int msr_info_set_scope(uint32_t msr, enum msr_scope scope);
+
+int msr_scope_parse(const char *name, enum msr_scope *scope);
+
+const char *msr_scope_name(enum msr_scope scope);
+
+/**
+ * Get the mask for an MSR's counter width.
+ */
+static inline uint64_t msr_info_mask(const struct msr_info *info)
+{
+    return info->width >= 64 ? UINT64_MAX : (UINT64_C(1) << info->width) - 1;
+}
+
+#endif // MSR_INFO_H
@@ -7,48 +7,47 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-struct msr_handle {
-    uint32_t cpu;
-    int fd;
-};
+#include "affinity.h"
+#include "msr-backend.h"
 
+// overridable, e.g., to test against regular files
+static const char *path_fmt = "/dev/cpu/%u/msr";
+static char path_buf[256];
 
-uint32_t msr_get_count(void)
+static int msr_linux_parse(const char *key, const char *val, void *arg)
 {
-    long n = sysconf(_SC_NPROCESSORS_ONLN);
-    if (n <= 0 || n > UINT32_MAX) {
-        errno = ENODEV;
+    if (!strcmp(key, "path")) {
+        if (msr_path_check(val)) {
+            return -1;
+        }
+        snprintf(path_buf, sizeof(path_buf), "%s", val);
+        path_fmt = path_buf;
         return 0;
     }
-    return (uint32_t) n;
+    fprintf(stderr, "linux: Unknown option: %s\n", key);
+    errno = EINVAL;
+    return -1;
 }
 
-struct msr_handle *msr_alloc(uint32_t cpu)
+static int msr_linux_init(const char *opts)
 {
-    struct msr_handle *m;
-    m = malloc(sizeof(*m));
-    if (!m) {
-        perror("malloc");
-        return NULL;
-    }
-    m->cpu = cpu;
-    return m;
+    return msr_opts_foreach(opts, msr_linux_parse, NULL);
 }
 
-void msr_free(struct msr_handle *m)
+static uint32_t msr_linux_get_count(void)
 {
-    free(m);
-}
-
-uint32_t msr_get_cpu(const struct msr_handle *m)
-{
-    return m->cpu;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0 || n > UINT32_MAX) {
+        errno = ENODEV;
+        return 0;
+    }
+    return (uint32_t) n;
 }
 
-int msr_open(struct msr_handle *m)
+static int msr_linux_open(struct msr_handle *m)
 {
-    char fname[32];
-    snprintf(fname, sizeof(fname), "/dev/cpu/%"PRIu32"/msr", m->cpu);
+    char fname[320];
+    snprintf(fname, sizeof(fname), path_fmt, m->cpu);
     if ((m->fd = open(fname, O_RDONLY)) < 0) {
         fprintf(stderr, "%s: %s\n", fname, strerror(errno));
         return -1;
@@ -56,20 +55,42 @@ int msr_open(struct msr_handle *m)
     return 0;
 }
 
-int msr_close(struct msr_handle *m)
+static int msr_linux_close(struct msr_handle *m)
 {
     int rc = 0;
-    if (m->fd > 0) {
+    if (m->fd >= 0) {
         rc = close(m->fd);
         if (rc) {
             perror("close");
         }
-        m->fd = 0;
+        m->fd = -1;
     }
     return rc;
 }
 
-ssize_t msr_read(const struct msr_handle *m, uint32_t msr, uint64_t* data)
+static ssize_t msr_linux_read(const struct msr_handle *m, uint32_t msr, uint64_t* data)
 {
     return pread(m->fd, data, sizeof(uint64_t), msr);
 }
+
+static int msr_linux_migrate(const struct msr_handle *m)
+{
+    affinity_set_cpu(m->cpu);
+    return 0;
+}
+
+const struct msr_backend msr_backend_linux = {
+    .name = "linux",
+    .init = msr_linux_init,
+    .get_count = msr_linux_get_count,
+    .get_topology = NULL,
+    .open = msr_linux_open,
+    .close = msr_linux_close,
+    .read = msr_linux_read,
+    .prepare = NULL,
+    .migrate = msr_linux_migrate,
+    .get_cur_cpu = NULL,
+    .batch_init = NULL,
+    .batch_fini = NULL,
+    .batch_read = NULL,
+};
@@ -0,0 +1,443 @@
+/*
+ * perf_event backend: MSRs that the kernel exposes through its msr and power PMUs (TSC,
+ * APERF/MPERF, PPERF, SMI count, RAPL energy) are read as CPU-bound perf events, so neither
+ * a migration nor /dev/cpu/N/msr is needed. Other MSRs, and any whose event can't be
+ * opened, fall back to the msr device like the linux backend.
+ *
+ * Single reads use an event per MSR and handle, opened before the run by msr_prepare(), or
+ * else on the MSR's first read. Batches open one PERF_FORMAT_GROUP event group per handle
+ * and PMU, so each is a single read().
+ *
+ * Perf-backed values are counts since the event was opened, not the raw register, and
+ * RAPL energy is in the PMU's units (see the event's .scale in sysfs, 2^-32 J).
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "affinity.h"
+#include "msr-backend.h"
+
+// event not opened yet on a handle, as opposed to -1 for unavailable
+#define MSR_PERF_FD_UNTRIED -2
+
+enum msr_perf_pmu {
+    MSR_PERF_PMU_MSR,
+    MSR_PERF_PMU_POWER,
+    MSR_PERF_PMU_COUNT
+};
+
+static const char *const pmu_names[MSR_PERF_PMU_COUNT] = {
+    [MSR_PERF_PMU_MSR] = "msr",
+    [MSR_PERF_PMU_POWER] = "power",
+};
+
+struct msr_perf_event {
+    uint32_t msr;
+    enum msr_perf_pmu pmu;
+    const char *name;
+    // resolved from sysfs by init, type -1 if the PMU or event doesn't exist
+    int type;
+    uint64_t config;
+    int warned;
+};
+
+static struct msr_perf_event events[] = {
+    { 0x10,  MSR_PERF_PMU_MSR,   "tsc",          -1, 0, 0 },
+    { 0x34,  MSR_PERF_PMU_MSR,   "smi",          -1, 0, 0 },
+    { 0xe7,  MSR_PERF_PMU_MSR,   "mperf",        -1, 0, 0 },
+    { 0xe8,  MSR_PERF_PMU_MSR,   "aperf",        -1, 0, 0 },
+    { 0x64e, MSR_PERF_PMU_MSR,   "pperf",        -1, 0, 0 },
+    { 0x611, MSR_PERF_PMU_POWER, "energy-pkg",   -1, 0, 0 },
+    { 0x619, MSR_PERF_PMU_POWER, "energy-ram",   -1, 0, 0 },
+    { 0x639, MSR_PERF_PMU_POWER, "energy-cores", -1, 0, 0 },
+    { 0x641, MSR_PERF_PMU_POWER, "energy-gpu",   -1, 0, 0 },
+    { 0x64d, MSR_PERF_PMU_POWER, "energy-psys",  -1, 0, 0 },
+};
+
+#define MSR_PERF_N_EVENTS (sizeof(events) / sizeof(events[0]))
+
+struct msr_perf_handle {
+    int fds[MSR_PERF_N_EVENTS];
+};
+
+// one event group on one handle's CPU
+struct msr_perf_group {
+    int leader;
+    uint32_t n;
+    // index of the group's first member in fds and idx
+    uint32_t first;
+};
+
+struct msr_perf_batch {
+    struct msr_perf_group *groups;
+    uint32_t n_groups;
+    // members of all groups, in group order, and where each one's value goes in data
+    int *fds;
+    uint32_t *idx;
+    uint32_t n_members;
+    // ops read through the msr device instead, as indexes into data
+    uint32_t *dev;
+    uint32_t n_dev;
+    // PERF_FORMAT_GROUP read buffer: nr, then one value per member
+    uint64_t *buf;
+};
+
+// overridable, e.g., to test against regular files
+static const char *path_fmt = "/dev/cpu/%u/msr";
+static char path_buf[256];
+static char sysfs_dir[256] = "/sys/bus/event_source/devices";
+
+static int msr_perf_parse(const char *key, const char *val, void *arg)
+{
+    if (!strcmp(key, "path")) {
+        if (msr_path_check(val)) {
+            return -1;
+        }
+        snprintf(path_buf, sizeof(path_buf), "%s", val);
+        path_fmt = path_buf;
+        return 0;
+    }
+    if (!strcmp(key, "sysfs")) {
+        snprintf(sysfs_dir, sizeof(sysfs_dir), "%s", val);
+        return 0;
+    }
+    fprintf(stderr, "perf: Unknown option: %s\n", key);
+    errno = EINVAL;
+    return -1;
+}
+
+static int msr_perf_sysfs_read(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "r");
+    int rc = 0;
+    if (!f) {
+        return -1;
+    }
+    if (!fgets(buf, (int) size, f)) {
+        rc = -1;
+    }
+    fclose(f);
+    return rc;
+}
+
+static void msr_perf_resolve(void)
+{
+    char path[512];
+    char buf[64];
+    int types[MSR_PERF_PMU_COUNT];
+    uint32_t p;
+    uint32_t i;
+    for (p = 0; p < MSR_PERF_PMU_COUNT; p++) {
+        snprintf(path, sizeof(path), "%s/%s/type", sysfs_dir, pmu_names[p]);
+        types[p] = -1;
+        if (!msr_perf_sysfs_read(path, buf, sizeof(buf))) {
+            types[p] = atoi(buf);
+        }
+    }
+    for (i = 0; i < MSR_PERF_N_EVENTS; i++) {
+        events[i].type = -1;
+        if (types[events[i].pmu] < 0) {
+            continue;
+        }
+        // e.g., "event=0x04" - both PMUs use the whole config for the event
+        snprintf(path, sizeof(path), "%s/%s/events/%s", sysfs_dir, pmu_names[events[i].pmu],
+                 events[i].name);
+        if (!msr_perf_sysfs_read(path, buf, sizeof(buf)) &&
+            sscanf(buf, "event=%"SCNx64, &events[i].config) == 1) {
+            events[i].type = types[events[i].pmu];
+        }
+    }
+}
+
+static int msr_perf_init(const char *opts)
+{
+    if (msr_opts_foreach(opts, msr_perf_parse, NULL)) {
+        return -1;
+    }
+    msr_perf_resolve();
+    return 0;
+}
+
+static uint32_t msr_perf_get_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0 || n > UINT32_MAX) {
+        errno = ENODEV;
+        return 0;
+    }
+    return (uint32_t) n;
+}
+
+static int msr_perf_find(uint32_t msr)
+{
+    uint32_t i;
+    for (i = 0; i < MSR_PERF_N_EVENTS; i++) {
+        if (events[i].msr == msr) {
+            return events[i].type < 0 ? -1 : (int) i;
+        }
+    }
+    return -1;
+}
+
+static int msr_perf_event_open(uint32_t e, uint32_t cpu, int group_fd, uint64_t read_format)
+{
+    struct perf_event_attr attr;
+    int fd;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = (uint32_t) events[e].type;
+    attr.config = events[e].config;
+    attr.read_format = read_format;
+    // neither PMU supports sampling or exclude_* filters, so the rest stays 0
+    fd = (int) syscall(__NR_perf_event_open, &attr, -1, (int) cpu, group_fd,
+                       PERF_FLAG_FD_CLOEXEC);
+    if (fd < 0 && !__atomic_exchange_n(&events[e].warned, 1, __ATOMIC_RELAXED)) {
+        fprintf(stderr, "perf: %s/%s unavailable for MSR 0x%"PRIx32", using the msr device: "
+                "%s\n", pmu_names[events[e].pmu], events[e].name, events[e].msr,
+                strerror(errno));
+    }
+    return fd;
+}
+
+static int msr_perf_open(struct msr_handle *m)
+{
+    struct msr_perf_handle *p;
+    char fname[320];
+    uint32_t i;
+    p = malloc(sizeof(*p));
+    if (!p) {
+        perror("malloc");
+        return -1;
+    }
+    for (i = 0; i < MSR_PERF_N_EVENTS; i++) {
+        p->fds[i] = MSR_PERF_FD_UNTRIED;
+    }
+    m->priv = p;
+    // only needed for MSRs without an event, so report the error if one is read
+    snprintf(fname, sizeof(fname), path_fmt, m->cpu);
+    m->fd = open(fname, O_RDONLY);
+    return 0;
+}
+
+static int msr_perf_close(struct msr_handle *m)
+{
+    struct msr_perf_handle *p = (struct msr_perf_handle *)m->priv;
+    uint32_t i;
+    int rc = 0;
+    if (p) {
+        for (i = 0; i < MSR_PERF_N_EVENTS; i++) {
+            if (p->fds[i] >= 0) {
+                close(p->fds[i]);
+            }
+        }
+        free(p);
+        m->priv = NULL;
+    }
+    if (m->fd >= 0) {
+        rc = close(m->fd);
+        if (rc) {
+            perror("close");
+        }
+        m->fd = -1;
+    }
+    return rc;
+}
+
+static ssize_t msr_perf_dev_read(const struct msr_handle *m, uint32_t msr, uint64_t *data)
+{
+    if (m->fd < 0) {
+        errno = ENODEV;
+        return -1;
+    }
+    return pread(m->fd, data, sizeof(uint64_t), msr);
+}
+
+// the handle's fd for event e, opening it if not tried yet; -1 if unavailable
+static int msr_perf_handle_fd(const struct msr_handle *m, int e)
+{
+    struct msr_perf_handle *p = (struct msr_perf_handle *)m->priv;
+    if (p->fds[e] == MSR_PERF_FD_UNTRIED) {
+        p->fds[e] = msr_perf_event_open((uint32_t) e, m->cpu, -1, 0);
+    }
+    return p->fds[e];
+}
+
+static ssize_t msr_perf_read(const struct msr_handle *m, uint32_t msr, uint64_t *data)
+{
+    int e = msr_perf_find(msr);
+    int fd = e < 0 ? -1 : msr_perf_handle_fd(m, e);
+    if (fd < 0) {
+        return msr_perf_dev_read(m, msr, data);
+    }
+    return read(fd, data, sizeof(uint64_t));
+}
+
+// open the events up front: perf_event_open() in a timed read would skew its latency
+static int msr_perf_prepare(const struct msr_handle *m, const uint32_t *msrs, uint32_t n_msrs)
+{
+    uint32_t i;
+    int e;
+    for (i = 0; i < n_msrs; i++) {
+        if ((e = msr_perf_find(msrs[i])) >= 0) {
+            msr_perf_handle_fd(m, e);
+        }
+    }
+    return 0;
+}
+
+static int msr_perf_migrate(const struct msr_handle *m)
+{
+    affinity_set_cpu(m->cpu);
+    return 0;
+}
+
+static void msr_perf_batch_fini(struct msr_batch *b)
+{
+    struct msr_perf_batch *p = (struct msr_perf_batch *)b->priv;
+    uint32_t i;
+    if (!p) {
+        return;
+    }
+    for (i = 0; i < p->n_members; i++) {
+        close(p->fds[i]);
+    }
+    free(p->groups);
+    free(p->fds);
+    free(p->idx);
+    free(p->dev);
+    free(p->buf);
+    free(p);
+    b->priv = NULL;
+}
+
+static int msr_perf_batch_init(struct msr_batch *b)
+{
+    struct msr_perf_batch *p;
+    struct msr_perf_group *g;
+    uint8_t *got;
+    uint64_t n_ops = (uint64_t) b->n_handles * b->n_msrs;
+    uint32_t max_n = 0;
+    uint32_t pmu;
+    uint32_t h;
+    uint32_t m;
+    int e;
+    int fd;
+    if (n_ops > UINT32_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+    p = calloc(1, sizeof(*p));
+    if (!p) {
+        perror("calloc");
+        return -1;
+    }
+    b->priv = p;
+    p->groups = malloc((size_t) b->n_handles * MSR_PERF_PMU_COUNT * sizeof(*p->groups));
+    p->fds = malloc(n_ops * sizeof(int));
+    p->idx = malloc(n_ops * sizeof(uint32_t));
+    p->dev = malloc(n_ops * sizeof(uint32_t));
+    got = malloc(b->n_msrs ? b->n_msrs : 1);
+    if (!p->groups || !p->fds || !p->idx || !p->dev || !got) {
+        perror("malloc");
+        free(got);
+        msr_perf_batch_fini(b);
+        return -1;
+    }
+    for (h = 0; h < b->n_handles; h++) {
+        memset(got, 0, b->n_msrs);
+        // events of different PMUs can't share a group
+        for (pmu = 0; pmu < MSR_PERF_PMU_COUNT; pmu++) {
+            g = &p->groups[p->n_groups];
+            g->leader = -1;
+            g->n = 0;
+            g->first = p->n_members;
+            for (m = 0; m < b->n_msrs; m++) {
+                e = msr_perf_find(b->msrs[m]);
+                if (e < 0 || events[e].pmu != pmu) {
+                    continue;
+                }
+                fd = msr_perf_event_open((uint32_t) e, b->handles[h]->cpu, g->leader,
+                                         PERF_FORMAT_GROUP);
+                if (fd < 0) {
+                    continue;
+                }
+                if (g->leader < 0) {
+                    g->leader = fd;
+                }
+                p->fds[p->n_members] = fd;
+                p->idx[p->n_members] = h * b->n_msrs + m;
+                p->n_members++;
+                g->n++;
+                got[m] = 1;
+            }
+            if (g->n) {
+                max_n = g->n > max_n ? g->n : max_n;
+                p->n_groups++;
+            }
+        }
+        // whatever didn't get an event
+        for (m = 0; m < b->n_msrs; m++) {
+            if (!got[m]) {
+                p->dev[p->n_dev++] = h * b->n_msrs + m;
+            }
+        }
+    }
+    free(got);
+    p->buf = malloc((1 + max_n) * sizeof(uint64_t));
+    if (!p->buf) {
+        perror("malloc");
+        msr_perf_batch_fini(b);
+        return -1;
+    }
+    return 0;
+}
+
+static int msr_perf_batch_read(struct msr_batch *b, uint64_t *data)
+{
+    struct msr_perf_batch *p = (struct msr_perf_batch *)b->priv;
+    const struct msr_perf_group *g;
+    ssize_t size;
+    uint32_t i;
+    uint32_t k;
+    for (i = 0; i < p->n_groups; i++) {
+        g = &p->groups[i];
+        size = (ssize_t) ((1 + g->n) * sizeof(uint64_t));
+        if (read(g->leader, p->buf, (size_t) size) != size) {
+            return -1;
+        }
+        for (k = 0; k < g->n; k++) {
+            data[p->idx[g->first + k]] = p->buf[1 + k];
+        }
+    }
+    for (i = 0; i < p->n_dev; i++) {
+        k = p->dev[i];
+        if (msr_perf_dev_read(b->handles[k / b->n_msrs], b->msrs[k % b->n_msrs], &data[k]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const struct msr_backend msr_backend_perf = {
+    .name = "perf",
+    .init = msr_perf_init,
+    .get_count = msr_perf_get_count,
+    .get_topology = NULL,
+    .open = msr_perf_open,
+    .close = msr_perf_close,
+    .read = msr_perf_read,
+    .prepare = msr_perf_prepare,
+    .migrate = msr_perf_migrate,
+    .get_cur_cpu = NULL,
+    .batch_init = msr_perf_batch_init,
+    .batch_fini = msr_perf_batch_fini,
+    .batch_read = msr_perf_batch_read,
+};
@@ -0,0 +1,209 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "autotune.h"
+#include "bench.h"
+#include "cpu-table.h"
+#include "msr.h"
+#include "msr-sampler.h"
+#include "read-plan.h"
+
+struct msr_sampler {
+    struct cpu_table table;
+    uint32_t *msrs;
+    uint32_t cap_msrs;
+    // the template every sample runs with: no stats or store, lockstep, values to out
+    struct bench ctx;
+    struct bench_session *session;
+    // CPUs are built and open, so no more groups or MSRs can be added
+    int is_open;
+    // plan reads when opened, if is_plan
+    int is_plan;
+    int plan_fanout;
+    struct read_plan plan;
+};
+
+struct msr_sampler *msr_sampler_init(const char *backend, const char *backend_opts)
+{
+    struct msr_sampler *s;
+    if (msr_backend_select(backend ? backend : "linux", backend_opts)) {
+        return NULL;
+    }
+    s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    cpu_table_init(&s->table);
+    s->ctx.iters = 1;
+    s->ctx.pipeline_depth = 1;
+    s->ctx.barrier = BARRIER_CENTRAL;
+    s->ctx.spin = BARRIER_SPIN_DEFAULT;
+    return s;
+}
+
+int msr_sampler_add_group(struct msr_sampler *s, const uint32_t *cpus, uint32_t n_cpus)
+{
+    uint32_t i;
+    if (s->is_open || !n_cpus) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cpu_table_add_group(&s->table)) {
+        return -1;
+    }
+    for (i = 0; i < n_cpus; i++) {
+        if (cpu_table_add_cpu(&s->table, cpus[i])) {
+            // so a failed add leaves the groups as they were
+            cpu_table_drop_group(&s->table);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int msr_sampler_add_msr(struct msr_sampler *s, uint32_t msr)
+{
+    uint32_t *m;
+    if (s->is_open) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (s->ctx.n_msrs == s->cap_msrs) {
+        s->cap_msrs = s->cap_msrs ? s->cap_msrs * 2 : 16;
+        m = realloc(s->msrs, s->cap_msrs * sizeof(uint32_t));
+        if (!m) {
+            perror("realloc");
+            return -1;
+        }
+        s->msrs = m;
+        s->ctx.msrs = m;
+    }
+    s->ctx.msrs[s->ctx.n_msrs++] = msr;
+    return 0;
+}
+
+static int msr_sampler_open(struct msr_sampler *s)
+{
+    if (!s->table.n_groups || !s->ctx.n_msrs) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (cpu_table_build(&s->table) || cpu_table_open(&s->table)) {
+        return -1;
+    }
+    s->ctx.cpu_groups = s->table.groups;
+    s->ctx.n_cpu_groups = s->table.n_groups;
+    if (s->is_plan) {
+        if (read_plan_build(&s->plan, &s->table, s->ctx.msrs, s->ctx.n_msrs, s->plan_fanout)) {
+            return -1;
+        }
+        s->ctx.cpu_groups = s->plan.groups;
+        s->ctx.n_cpu_groups = s->plan.n_groups;
+        s->ctx.plan = &s->plan;
+    }
+    s->is_open = 1;
+    return 0;
+}
+
+int msr_sampler_set_read_plan(struct msr_sampler *s, int fanout)
+{
+    if (s->is_open) {
+        errno = EINVAL;
+        return -1;
+    }
+    s->is_plan = 1;
+    s->plan_fanout = fanout;
+    return 0;
+}
+
+int msr_sampler_configure(struct msr_sampler *s, const char *strategy)
+{
+    const struct bench_strategy *st = bench_strategy_find(strategy);
+    int rc;
+    if (!st) {
+        fprintf(stderr, "Unknown benchmark: %s\n", strategy);
+        errno = EINVAL;
+        return -1;
+    }
+    if (!st->session) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (!s->is_open && msr_sampler_open(s)) {
+        return -1;
+    }
+    if (s->session) {
+        rc = bench_session_stop(s->session);
+        s->session = NULL;
+        if (rc) {
+            return -1;
+        }
+    }
+    s->ctx.out = NULL;
+    s->session = bench_session_start(st, &s->ctx);
+    return s->session ? 0 : -1;
+}
+
+int msr_sampler_configure_tuned(struct msr_sampler *s, const char *objective,
+                                const char *cache_path)
+{
+    enum autotune_objective obj = AUTOTUNE_THROUGHPUT;
+    struct autotune_config cfg;
+    char path[4096];
+    char fp[AUTOTUNE_FINGERPRINT_MAX];
+    if (s->is_open || s->table.n_groups || !s->ctx.n_msrs ||
+        (objective && autotune_objective_parse(objective, &obj))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!cache_path) {
+        if (autotune_cache_path(path, sizeof(path))) {
+            return -1;
+        }
+        cache_path = path;
+    }
+    if (autotune_fingerprint(fp, sizeof(fp)) ||
+        autotune_cache_load(cache_path, fp, obj, &cfg)) {
+        return -1;
+    }
+    if (autotune_config_groups(&cfg, &s->table)) {
+        return -1;
+    }
+    return msr_sampler_configure(s, cfg.strategy->name);
+}
+
+uint32_t msr_sampler_get_n_values(const struct msr_sampler *s)
+{
+    return s->table.n_cpus * s->ctx.n_msrs;
+}
+
+int msr_sampler_sample(struct msr_sampler *s, uint64_t *values)
+{
+    if (!s->session) {
+        errno = EINVAL;
+        return -1;
+    }
+    // threads pick this up when the sample is issued
+    s->ctx.out = values;
+    return bench_session_sample(s->session);
+}
+
+int msr_sampler_teardown(struct msr_sampler *s)
+{
+    int rc = 0;
+    if (!s) {
+        return 0;
+    }
+    if (s->session) {
+        rc |= bench_session_stop(s->session);
+    }
+    read_plan_free(&s->plan);
+    rc |= cpu_table_free(&s->table);
+    free(s->msrs);
+    free(s);
+    return rc;
+}
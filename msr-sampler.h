@@ -0,0 +1,90 @@
+#ifndef MSR_SAMPLER_H
+#define MSR_SAMPLER_H
+
+#include <inttypes.h>
+
+/*
+ * Read a set of MSRs from groups of CPUs one sample at a time, with any of the benchmark's
+ * strategies that support sampling (serial, serial_migrate, thread, thread_migrate,
+ * thread_notif, thread_notif_migrate, batch, thread_batch, uring, thread_uring).
+ * The strategy's state, e.g., its threads, is set up once by msr_sampler_configure(), so a
+ * sample only reads: it allocates nothing and writes into the caller's buffer.
+ *
+ *     s = msr_sampler_init("linux", NULL);
+ *     msr_sampler_add_group(s, cpus, n_cpus);
+ *     msr_sampler_add_msr(s, 0x611);
+ *     msr_sampler_configure(s, "thread_notif");
+ *     values = malloc(msr_sampler_get_n_values(s) * sizeof(uint64_t));
+ *     while (...) {
+ *         msr_sampler_sample(s, values);
+ *     }
+ *     msr_sampler_teardown(s);
+ *
+ * The MSR backend is process-wide, so there should be only one sampler at a time.
+ */
+
+struct msr_sampler;
+
+/**
+ * Select the MSR backend (NULL for "linux") with optional comma-delimited key=value
+ * options, and create an empty sampler.
+ */
+struct msr_sampler *msr_sampler_init(const char *backend, const char *backend_opts);
+
+/**
+ * Add a group of CPUs. Threaded strategies use one thread per group.
+ * Groups can only be added before the first msr_sampler_configure().
+ * On failure, none of the group is added.
+ */
+int msr_sampler_add_group(struct msr_sampler *s, const uint32_t *cpus, uint32_t n_cpus);
+
+/**
+ * Add an MSR to read from every CPU.
+ * MSRs can only be added before the first msr_sampler_configure().
+ */
+int msr_sampler_add_msr(struct msr_sampler *s, uint32_t msr);
+
+/**
+ * Read core- and package-scoped MSRs on one CPU per core or package instead of on every
+ * CPU (see read-plan.h). With fanout, every CPU's values are filled in from the CPU that
+ * read them; otherwise only the values read are written to the caller's buffer.
+ * Must be called before the first msr_sampler_configure().
+ */
+int msr_sampler_set_read_plan(struct msr_sampler *s, int fanout);
+
+/**
+ * Open the CPUs and set up the named strategy. May be called again to switch strategies.
+ * Returns -1 with errno=ENOTSUP if the strategy can't take one sample at a time. If stopping
+ * the previous strategy fails, returns -1 without starting the new one, which another call
+ * may retry.
+ */
+int msr_sampler_configure(struct msr_sampler *s, const char *strategy);
+
+/**
+ * Instead of adding groups and configuring a strategy, use the choice that
+ * msr-scaling-bench --autotune cached for this host and objective ("throughput" or
+ * "latency", NULL for throughput). cache_path may be NULL for the default.
+ * MSRs must be added first. Returns -1 with errno=ENOENT if there's no cached choice, so
+ * the caller can fall back to msr_sampler_add_group() and msr_sampler_configure().
+ */
+int msr_sampler_configure_tuned(struct msr_sampler *s, const char *objective,
+                                const char *cache_path);
+
+/**
+ * Get the number of values in a sample: one per CPU and MSR.
+ */
+uint32_t msr_sampler_get_n_values(const struct msr_sampler *s);
+
+/**
+ * Take a sample into values. CPUs are in the order added, each with its MSRs in the order
+ * added, i.e., MSR m of the i-th CPU added is values[i * n_msrs + m].
+ */
+int msr_sampler_sample(struct msr_sampler *s, uint64_t *values);
+
+/**
+ * Stop the strategy, close the CPUs, and free the sampler.
+ * Returns non-zero if stopping or closing failed.
+ */
+int msr_sampler_teardown(struct msr_sampler *s);
+
+#endif // MSR_SAMPLER_H
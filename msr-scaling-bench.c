@@ -1,229 +1,952 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
-#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "autotune.h"
+#include "barrier.h"
 #include "bench.h"
+#include "bench-stats.h"
+#include "cpu-table.h"
+#include "hist.h"
+#include "lowjitter.h"
 #include "msr.h"
+#include "msr-info.h"
+#include "read-plan.h"
+#include "runner.h"
+#include "sample-store.h"
+#include "sched-counters.h"
+#include "shm-bench.h"
+#include "sweep.h"
+#include "timing.h"
+#include "topology.h"
+#include "trace.h"
 
-#ifndef CPU_GROUPS_MAX
-#define CPU_GROUPS_MAX 4096
-#endif
+static int bench_cpu_group_alloc_list(struct cpu_table *t, const char *cpulist)
+{
+    const char *cpu_s;
+    char *saveptr;
+    char *end;
+    unsigned long cpu;
+    uint32_t n = 0;
+    int rc = 0;
+    char *clist = strdup(cpulist);
+    if (!clist) {
+        perror("strdup");
+        return -1;
+    }
+    if (cpu_table_add_group(t)) {
+        free(clist);
+        return -1;
+    }
+    cpu_s = strtok_r(clist, ",", &saveptr);
+    while (cpu_s) {
+        errno = 0;
+        cpu = strtoul(cpu_s, &end, 0);
+        if (errno || end == cpu_s || *end || cpu >= UINT32_MAX) {
+            fprintf(stderr, "Bad CPU in list: %s\n", cpu_s);
+            errno = EINVAL;
+            rc = -1;
+            goto out;
+        }
+        if (cpu_table_add_cpu(t, (uint32_t) cpu)) {
+            rc = -1;
+            goto out;
+        }
+        n++;
+        cpu_s = strtok_r(NULL, ",", &saveptr);
+    }
+    if (!n) {
+        fprintf(stderr, "No CPUs found in list: %s\n", cpulist);
+        errno = EINVAL;
+        rc = -1;
+    }
 
-#ifndef CPUS_MAX
-#define CPUS_MAX 4096
-#endif
+out:
+    free(clist);
+    return rc;
+}
 
-#ifndef MSRS_MAX
-#define MSRS_MAX 1024
-#endif
+// override MSR scopes from a list of MSR:SCOPE
+static int bench_msr_scope_list(const char *list)
+{
+    enum msr_scope scope;
+    const char *item;
+    char *saveptr;
+    char *end;
+    unsigned long msr;
+    int rc = 0;
+    char *l = strdup(list);
+    if (!l) {
+        perror("strdup");
+        return -1;
+    }
+    for (item = strtok_r(l, ",", &saveptr); item; item = strtok_r(NULL, ",", &saveptr)) {
+        errno = 0;
+        msr = strtoul(item, &end, 0);
+        if (errno || end == item || *end != ':' || msr > UINT32_MAX ||
+            msr_scope_parse(end + 1, &scope)) {
+            fprintf(stderr, "Bad MSR scope: %s\n", item);
+            errno = EINVAL;
+            rc = -1;
+            break;
+        }
+        if ((rc = msr_info_set_scope((uint32_t) msr, scope))) {
+            break;
+        }
+    }
+    free(l);
+    return rc;
+}
 
-static void bench_cpu_group_free(struct bench_cpu_group *bcg)
+static struct sample_store *bench_store_alloc(const struct bench *ctx, uint32_t depth,
+                                              const char *path)
 {
-    uint32_t i;
-    if (bcg->handles) {
-        for (i = 0; i < bcg->n_handles; i++) {
-            if (bcg->handles[i]) {
-                msr_free(bcg->handles[i]);
-            }
+    struct sample_store *store;
+    uint32_t *n_cpus;
+    uint32_t *cpus;
+    uint32_t n_total = 0;
+    uint32_t g;
+    uint32_t h;
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        n_total += ctx->cpu_groups[g].n_handles;
+    }
+    n_cpus = malloc(ctx->n_cpu_groups * sizeof(uint32_t));
+    cpus = malloc(n_total * sizeof(uint32_t));
+    if (!n_cpus || !cpus) {
+        perror("malloc");
+        free(n_cpus);
+        free(cpus);
+        return NULL;
+    }
+    n_total = 0;
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        n_cpus[g] = ctx->cpu_groups[g].n_handles;
+        for (h = 0; h < n_cpus[g]; h++) {
+            cpus[n_total++] = msr_get_cpu(ctx->cpu_groups[g].handles[h]);
         }
-        free(bcg->handles);
     }
-    bcg->n_handles = 0;
+    store = sample_store_alloc(ctx->n_cpu_groups, n_cpus, cpus, ctx->msrs, ctx->n_msrs,
+                               depth, path);
+    free(n_cpus);
+    free(cpus);
+    return store;
 }
 
-static int bench_cpu_group_alloc_all(struct bench_cpu_group *bcg)
+// a comma-delimited list of strategies, or all that read MSRs if NULL or "all"
+static int bench_strategy_list_parse(const char *bench_list,
+                                     const struct bench_strategy **strategies, uint32_t *n)
 {
+    char *list;
+    char *name;
+    char *saveptr;
     uint32_t i;
-    bcg->n_handles = msr_get_count();
-    if (!bcg->n_handles) {
-        perror("msr_get_count");
-        return -1;
+    *n = 0;
+    if (!bench_list || !strcmp(bench_list, "all")) {
+        for (i = 0; i < bench_n_strategies; i++) {
+            if (bench_strategies[i].reads) {
+                strategies[(*n)++] = &bench_strategies[i];
+            }
+        }
+        return 0;
     }
-    bcg->handles = calloc(bcg->n_handles, sizeof(struct msr_handle*));
-    if (!bcg->handles) {
-        perror("calloc");
-        bcg->n_handles = 0;
+    if (!(list = strdup(bench_list))) {
+        perror("strdup");
         return -1;
     }
-    for (i = 0; i < bcg->n_handles; i++) {
-        bcg->handles[i] = msr_alloc(i);
-        if (!bcg->handles[i]) {
-            perror("msr_alloc");
-            bench_cpu_group_free(bcg);
+    for (name = strtok_r(list, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+        if (*n == bench_n_strategies) {
+            fprintf(stderr, "Too many benchmarks: %s\n", bench_list);
+            free(list);
+            errno = E2BIG;
+            return -1;
+        }
+        if (!(strategies[(*n)++] = bench_strategy_find(name))) {
+            fprintf(stderr, "Unknown benchmark: %s\n", name);
+            free(list);
+            errno = EINVAL;
             return -1;
         }
     }
+    free(list);
     return 0;
 }
 
-static int bench_cpu_group_alloc_list(struct bench_cpu_group *bcg,
-                                      const char *cpulist)
+struct bench_sweep_opts {
+    const char *cpus;
+    const char *groups;
+    const char *msrs;
+    const char *depths;
+    const char *shapes;
+    const char *format;
+};
+
+static int bench_sweep_exec(const struct bench *ctx, const char *bench_list,
+                            const struct bench_sweep_opts *opts)
 {
-    const char *cpu_s;
+    struct sweep sw;
+    const struct bench_strategy **strategies = NULL;
+    enum sweep_shape *shapes = NULL;
+    uint32_t *cpus = NULL;
+    uint32_t *groups = NULL;
+    uint32_t *msrs = NULL;
+    uint32_t *depths = NULL;
+    char *list = NULL;
+    char *name;
     char *saveptr;
-    uint32_t cpu;
-    uint32_t i;
-    int rc = 0;
-    char *clist = strdup(cpulist);
-    if (!clist) {
-        perror("strdup");
+    uint32_t n;
+    uint32_t g;
+    uint32_t h;
+    int rc = -1;
+
+    memset(&sw, 0, sizeof(sw));
+    sw.base = *ctx;
+    sw.base.stats = NULL;
+    sw.format = SWEEP_FORMAT_CSV;
+    if (opts->format && sweep_format_parse(opts->format, &sw.format)) {
+        fprintf(stderr, "Unknown format: %s\n", opts->format);
         return -1;
     }
 
-    // first count n_handles needed
-    bcg->n_handles = 0;
-    cpu_s = strtok_r(clist, ",", &saveptr);
-    while (cpu_s) {
-        bcg->n_handles++;
-        cpu_s = strtok_r(NULL, ",", &saveptr);
+    // every CPU from -c or --group-by, in order
+    for (g = 0; g < ctx->n_cpu_groups; g++) {
+        sw.n_handles += ctx->cpu_groups[g].n_handles;
     }
-    if (!bcg->n_handles) {
-        fprintf(stderr, "No CPUs found in list: %s\n", cpulist);
-        errno = EINVAL;
-        rc = -1;
+    sw.handles = malloc(sw.n_handles * sizeof(struct msr_handle *));
+    strategies = malloc(bench_n_strategies * sizeof(struct bench_strategy *));
+    if (!sw.handles || !strategies) {
+        perror("malloc");
         goto out;
     }
+    for (g = 0, n = 0; g < ctx->n_cpu_groups; g++) {
+        for (h = 0; h < ctx->cpu_groups[g].n_handles; h++) {
+            sw.handles[n++] = ctx->cpu_groups[g].handles[h];
+        }
+    }
 
-    // allocate handles
-    bcg->handles = calloc(bcg->n_handles, sizeof(struct msr_handle*));
-    if (!bcg->handles) {
-        perror("calloc");
-        rc = -1;
+    if (bench_strategy_list_parse(bench_list, strategies, &sw.n_strategies)) {
         goto out;
     }
+    sw.strategies = strategies;
 
-    // parse cpulist to populate handles
-    i = 0;
-    strncpy(clist, cpulist, strlen(cpulist));
-    cpu_s = strtok_r(clist, ",", &saveptr);
-    while (cpu_s) {
-        cpu = strtoul(cpu_s, NULL, 0);
-        if (cpu == ULONG_MAX && errno == ERANGE) {
-            perror("strtoul");
-            rc = -1;
-            goto fail_free_handles;
+    if (opts->cpus) {
+        if (sweep_list_parse(opts->cpus, &cpus, &sw.n_cpus)) {
+            goto out;
         }
-        bcg->handles[i] = msr_alloc(cpu);
-        if (!bcg->handles[i]) {
-            perror("msr_alloc");
-            rc = -1;
-            goto fail_free_handles;
+    } else {
+        // powers of 2, then all
+        cpus = malloc(33 * sizeof(uint32_t));
+        if (!cpus) {
+            perror("malloc");
+            goto out;
         }
-        i++;
-        cpu_s = strtok_r(NULL, ",", &saveptr);
+        for (n = 1; n < sw.n_handles; n <<= 1) {
+            cpus[sw.n_cpus++] = n;
+        }
+        cpus[sw.n_cpus++] = sw.n_handles;
     }
+    sw.cpus = cpus;
+
+    if (opts->groups) {
+        if (sweep_list_parse(opts->groups, &groups, &sw.n_groups)) {
+            goto out;
+        }
+        sw.groups = groups;
+    } else {
+        static const uint32_t one_group = 1;
+        sw.groups = &one_group;
+        sw.n_groups = 1;
+    }
+
+    if (opts->msrs) {
+        if (sweep_list_parse(opts->msrs, &msrs, &sw.n_msrs)) {
+            goto out;
+        }
+        sw.msrs = msrs;
+    } else {
+        sw.msrs = &ctx->n_msrs;
+        sw.n_msrs = 1;
+    }
+
+    if (opts->depths) {
+        if (sweep_list_parse(opts->depths, &depths, &sw.n_depths)) {
+            goto out;
+        }
+        sw.depths = depths;
+    } else {
+        sw.depths = &ctx->pipeline_depth;
+        sw.n_depths = 1;
+    }
+
+    if (opts->shapes) {
+        free(list);
+        if (!(list = strdup(opts->shapes))) {
+            perror("strdup");
+            goto out;
+        }
+        shapes = malloc((strlen(list) / 2 + 1) * sizeof(enum sweep_shape));
+        if (!shapes) {
+            perror("malloc");
+            goto out;
+        }
+        for (name = strtok_r(list, ",", &saveptr); name; name = strtok_r(NULL, ",", &saveptr)) {
+            if (sweep_shape_parse(name, &shapes[sw.n_shapes++])) {
+                fprintf(stderr, "Unknown shape: %s\n", name);
+                goto out;
+            }
+        }
+        sw.shapes = shapes;
+    } else {
+        static const enum sweep_shape block = SWEEP_SHAPE_BLOCK;
+        sw.shapes = &block;
+        sw.n_shapes = 1;
+    }
+
+    rc = sweep_run(&sw, stdout);
 
 out:
-    free(clist);
+    free(list);
+    free(shapes);
+    free(depths);
+    free(msrs);
+    free(groups);
+    free(cpus);
+    free(strategies);
+    free(sw.handles);
     return rc;
+}
 
-fail_free_handles:
-    bench_cpu_group_free(bcg);
-    free(clist);
+static int bench_runner_exec(const struct bench *ctx, const char *bench_list,
+                             const struct runner *opts)
+{
+    struct runner r = *opts;
+    const struct bench_strategy **strategies;
+    int rc = -1;
+
+    r.base = *ctx;
+    strategies = malloc(bench_n_strategies * sizeof(struct bench_strategy *));
+    if (!strategies) {
+        perror("malloc");
+        return -1;
+    }
+    if (!bench_strategy_list_parse(bench_list ? bench_list : "serial", strategies,
+                                   &r.n_strategies)) {
+        r.strategies = strategies;
+        rc = runner_run(&r, stdout);
+    }
+    free(strategies);
     return rc;
 }
 
-static int bench_cpu_group_close(struct bench_cpu_group *bcg)
+static int bench_lowjitter_exec(const struct bench *ctx, const char *bench_list,
+                                const struct runner *runner, uint32_t settings, int prio)
 {
-    uint32_t i;
-    int rc = 0;
-    for (i = 0; i < bcg->n_handles; i++) {
-        rc |= msr_close(bcg->handles[i]);
+    struct lowjitter lj;
+    const struct bench_strategy **strategies;
+    int rc = -1;
+
+    memset(&lj, 0, sizeof(lj));
+    lj.base = *ctx;
+    lj.warmup = runner->warmup;
+    lj.reps = runner->reps ? runner->reps : RUNNER_REPS_DEFAULT;
+    lj.settings = settings;
+    lj.prio = prio;
+    strategies = malloc(bench_n_strategies * sizeof(struct bench_strategy *));
+    if (!strategies) {
+        perror("malloc");
+        return -1;
+    }
+    if (!bench_strategy_list_parse(bench_list ? bench_list : "serial", strategies,
+                                   &lj.n_strategies)) {
+        lj.strategies = strategies;
+        rc = lowjitter_run(&lj, stdout);
     }
+    free(strategies);
     return rc;
 }
 
-static int bench_cpu_group_open(struct bench_cpu_group *bcg)
+/*
+ * Look up the best strategy and grouping for this host in the cache, or find and cache it.
+ */
+static int bench_autotune_exec(const struct bench *ctx, enum autotune_objective obj,
+                               uint32_t iters, const char *cache, int retune,
+                               struct autotune_config *cfg)
 {
-    uint32_t i;
-    int e;
-    for (i = 0; i < bcg->n_handles; i++) {
-        if (msr_open(bcg->handles[i])) {
-            e = errno;
-            bench_cpu_group_close(bcg);
-            errno = e;
+    char path[4096];
+    char fp[AUTOTUNE_FINGERPRINT_MAX];
+    char grouping[32];
+    int cached = 0;
+
+    if (!ctx->n_msrs) {
+        fprintf(stderr, "autotune: Needs at least one -m to compare strategies by\n");
+        errno = EINVAL;
+        return -1;
+    }
+    if (!cache) {
+        if (autotune_cache_path(path, sizeof(path))) {
+            fprintf(stderr, "autotune: No cache directory, set --autotune-cache\n");
+            return -1;
+        }
+        cache = path;
+    }
+    if (autotune_fingerprint(fp, sizeof(fp))) {
+        return -1;
+    }
+    if (!retune) {
+        if (!autotune_cache_load(cache, fp, obj, cfg)) {
+            cached = 1;
+        } else if (errno != ENOENT) {
             return -1;
         }
     }
+    if (!cached) {
+        timing_init();
+        if (autotune_run(ctx, obj, iters, cfg, stdout) ||
+            autotune_cache_save(cache, fp, obj, cfg)) {
+            return -1;
+        }
+    }
+    autotune_config_grouping(cfg, grouping, sizeof(grouping));
+    printf("Autotune: %s, grouping %s, %s %.1f ns (%s)\n", cfg->strategy->name, grouping,
+           autotune_objective_name(obj), cfg->score, cached ? "cached" : "tuned");
     return 0;
 }
 
 static void usage(const char *pname, int code)
 {
     fprintf(code ? stderr : stdout,
-            "Usage: %s [-b BENCH] [-c CPUS]+ [-i N] [-m N]+ [-h]\n"
+            "Usage: %s [-b BENCH] [-B BACKEND] [-O OPTS] [-c CPUS]+ [-i N] [-m N]+ [-n]\n"
+            "          [--group-by=LEVEL [--group-split=N]] [--barrier=TYPE] [--spin=N]\n"
+            "          [--workers=N [--task-msrs=N]] [--rate=HZ [--duration=S]]\n"
+            "          [--pipeline-depth=K] [--thread-layout=LAYOUT]\n"
+            "          [--store=N] [--store-file=PATH] [--delta-kernel=NAME]\n"
+            "          [--sweep [--sweep-cpus=LIST] [--sweep-groups=LIST] [--sweep-msrs=LIST]\n"
+            "           [--sweep-depths=LIST] [--sweep-shape=SHAPES] [--format=FORMAT]]\n"
+            "          [--reps=N] [--warmup=N] [--shuffle [--seed=N]] [--cv-max=PCT]\n"
+            "          [--sched-counters] [--pairs]\n"
+            "          [--autotune[=OBJECTIVE] [--autotune-cache=PATH] [--autotune-iters=N]\n"
+            "           [--retune]]\n"
+            "          [--shm-publish=NAME] [--shm-consume=NAME]\n"
+            "          [--read-plan [--plan-fanout] [--msr-scope=MSR:SCOPE[,...]]]\n"
+            "          [--low-jitter[=SETTINGS] [--rt-prio=N]]\n"
+            "          [--trace=PATH [--trace-events=N]] [-h]\n"
             "  -b, --bench=BENCH        Benchmark BENCH, one of:\n"
             "                           [serial, serial_migrate,\n"
             "                            thread, thread_migrate,\n"
-            "                            thread_notif, thread_notif_migrate]\n"
+            "                            thread_notif, thread_notif_migrate,\n"
+            "                            batch, thread_batch,\n"
+            "                            uring, thread_uring,\n"
+            "                            thread_percpu, thread_barrier,\n"
+            "                            thread_barrier_migrate, pool,\n"
+            "                            delta]\n"
             "                           default=serial\n"
+            "  -B, --backend=BACKEND    MSR access backend BACKEND, one of:\n"
+            "                           [linux, sim, batch, perf]\n"
+            "                           default=linux\n"
+            "  -O, --backend-opts=OPTS  Backend options OPTS; OPTS: comma-delimited key=value\n"
+            "                           linux: path (device template, default=/dev/cpu/%%u/msr)\n"
+            "                           batch: path (default=/dev/cpu/%%u/msr_safe),\n"
+            "                                  dev (default=/dev/cpu/msr_batch)\n"
+            "                           perf: path (fallback device template, as for linux),\n"
+            "                                 sysfs (default=/sys/bus/event_source/devices)\n"
+            "                           sim: cpus, sockets, nodes, smt, syscall_ns, ipi_ns,\n"
+            "                                numa_ns, socket_ns, migrate_ns, batch_op_ns,\n"
+            "                                jitter_ns, spike_ns, spike_ppm\n"
             "  -c, --cpu-group=CPUS     Group cpus CPUS together; CPUS: comma-delimited\n"
             "                           If not specified, all cpus are used in one group\n"
+            "      --group-by=LEVEL     Group cpus by topology LEVEL instead of -c, one of:\n"
+            "                           [socket, core, llc, numa, smt]\n"
+            "                           smt groups the n-th SMT sibling of every core\n"
+            "      --group-split=N      Split each --group-by domain into N groups (default=1)\n"
             "  -i, --iters=N            Iterate N times (default=1)\n"
+            "      --rate=HZ            Start iterations at a fixed rate HZ instead of\n"
+            "                           back-to-back; overruns skip (miss) sample slots\n"
+            "      --duration=S         With --rate, run for S seconds instead of -i slots\n"
             "  -m, --msr=N              Read msr N from each cpu\n"
+            "  -n, --no-stats           Don't record or report latency statistics\n"
+            "      --sched-counters     Count context switches, CPU migrations, task clock, and\n"
+            "                           page faults of the driver and its threads per iteration\n"
+            "      --pairs              Break migration and read costs down per source->target\n"
+            "                           CPU pair\n"
+            "      --store=N            Keep the values read in a ring of N samples per cpu\n"
+            "      --store-file=PATH    Back the store with a binary capture file PATH\n"
+            "                           (default depth=%u)\n"
+            "      --delta-kernel=NAME  Counter delta kernel for delta, one of:\n"
+            "                           [auto, scalar, avx2, avx512] (default=auto)\n"
+            "      --sweep              Run every combination of the benchmarks in -b\n"
+            "                           (comma-delimited, default=all) and the lists below\n"
+            "                           over the first N cpus of -c/--group-by, one row each\n"
+            "      --sweep-cpus=LIST    CPU counts (default=powers of 2 and all)\n"
+            "      --sweep-groups=LIST  Group counts (default=1)\n"
+            "      --sweep-msrs=LIST    MSR counts, using the first N of -m (default=all)\n"
+            "      --sweep-depths=LIST  Pipeline depths (default=--pipeline-depth)\n"
+            "      --sweep-shape=SHAPES Group shapes, comma-delimited: [block, interleave]\n"
+            "                           (default=block)\n"
+            "      --format=FORMAT      Sweep output FORMAT, one of: [csv, json] (default=csv)\n"
+            "      --reps=N             Repeat the benchmarks in -b (comma-delimited) N times\n"
+            "                           and report mean, median, stddev, and 95%% confidence\n"
+            "                           intervals; implied by a list in -b (default=%u)\n"
+            "      --warmup=N           Untimed iterations before every repetition (default=0)\n"
+            "      --shuffle            Run the benchmarks in a random order every repetition\n"
+            "      --seed=N             Shuffle seed (default=time-based, printed)\n"
+            "      --cv-max=PCT         Flag benchmarks whose coefficient of variation exceeds\n"
+            "                           PCT percent as noisy (default=%.1f)\n"
+            "      --barrier=TYPE       Barrier TYPE for thread_percpu, thread_barrier*, and pool,\n"
+            "                           one of: [central, dissemination] (default=central)\n"
+            "      --spin=N             Barrier polls before sleeping on a futex\n"
+            "                           (default=%u)\n"
+            "      --workers=N          Worker threads for pool (default=one per group)\n"
+            "      --task-msrs=N        MSRs per pool task, so a CPU's MSRs can be read by\n"
+            "                           several workers (default=all of a CPU's)\n"
+            "      --pipeline-depth=K   Let thread* groups run up to K iterations ahead of the\n"
+            "                           slowest instead of in lockstep (default=1)\n"
+            "      --thread-layout=LAYOUT\n"
+            "                           Per-thread state of thread*, one of: [local, packed]\n"
+            "                           (default=local): local gives each thread its own\n"
+            "                           cache lines on its group's NUMA node, packed keeps\n"
+            "                           all threads' state in one array on the driver's node\n"
+            "      --autotune[=OBJECTIVE]\n"
+            "                           Run the strategy and grouping that best meet OBJECTIVE\n"
+            "                           on this host, one of: [throughput, latency]\n"
+            "                           (default=throughput); the choice is cached per host\n"
+            "                           topology and backend, and tuned if not cached yet\n"
+            "      --autotune-cache=PATH\n"
+            "                           Cache file (default=$XDG_CACHE_HOME/%s)\n"
+            "      --autotune-iters=N   Iterations per candidate when tuning (default=%u)\n"
+            "      --retune             Tune even if cached, and replace the cached choice\n"
+            "      --shm-publish=NAME   Run as a daemon that samples with -b at --rate\n"
+            "                           (default=%.1f Hz) for --duration (default=until\n"
+            "                           SIGINT/SIGTERM) and publishes the values to POSIX\n"
+            "                           shared memory NAME, e.g., /msr, for local consumers\n"
+            "      --shm-consume=NAME   Benchmark reading shared memory NAME -i times while\n"
+            "                           it's published, and check every row is consistent\n"
+            "      --read-plan          Read core- and package-scoped MSRs on one CPU per core\n"
+            "                           or package instead of on every CPU, balanced across\n"
+            "                           groups, and report the reads saved\n"
+            "      --plan-fanout        With --read-plan, copy shared values to every CPU\n"
+            "                           sharing them in published samples\n"
+            "      --msr-scope=LIST     Override MSR scopes; LIST: comma-delimited MSR:SCOPE,\n"
+            "                           SCOPE one of: [thread, core, package]\n"
+            "      --low-jitter[=SETTINGS]\n"
+            "                           Run the benchmarks in -b (comma-delimited) --reps\n"
+            "                           times each as is and with SETTINGS, and report how\n"
+            "                           much of the iteration latency tail is scheduling\n"
+            "                           noise; SETTINGS: comma-delimited, of: [fifo, mlock,\n"
+            "                           isolate] (default=all): SCHED_FIFO for the driver and\n"
+            "                           its threads, mlockall with prefaulting, and pinning\n"
+            "                           the driver and its threads to distinct\n"
+            "                           isolcpus/nohz_full CPUs\n"
+            "      --rt-prio=N          SCHED_FIFO priority for --low-jitter (default=%d)\n"
+            "      --trace=PATH         Record the driver's and each of its threads' iterations,\n"
+            "                           waits, migrations, and reads, and write them to PATH\n"
+            "                           as Chrome trace JSON for Perfetto\n"
+            "      --trace-events=N     Events buffered per thread (default=%u)\n"
             "  -h, --help               Print this message and exit\n",
-            pname);
+            pname, SAMPLE_STORE_DEPTH_DEFAULT, RUNNER_REPS_DEFAULT, RUNNER_CV_MAX_DEFAULT,
+            BARRIER_SPIN_DEFAULT, AUTOTUNE_CACHE_NAME, AUTOTUNE_ITERS_DEFAULT,
+            SHM_BENCH_RATE_DEFAULT, LOWJITTER_PRIO_DEFAULT, TRACE_EVENTS_DEFAULT);
     exit(code);
 }
 
-static const char opts_short[] = "b:c:i:m:h";
+enum {
+    OPT_BARRIER = 0x100,
+    OPT_SPIN,
+    OPT_GROUP_BY,
+    OPT_GROUP_SPLIT,
+    OPT_WORKERS,
+    OPT_RATE,
+    OPT_DURATION,
+    OPT_STORE,
+    OPT_STORE_FILE,
+    OPT_DELTA_KERNEL,
+    OPT_SWEEP,
+    OPT_SWEEP_CPUS,
+    OPT_SWEEP_GROUPS,
+    OPT_SWEEP_MSRS,
+    OPT_SWEEP_SHAPE,
+    OPT_FORMAT,
+    OPT_PAIRS,
+    OPT_PIPELINE_DEPTH,
+    OPT_SWEEP_DEPTHS,
+    OPT_WARMUP,
+    OPT_REPS,
+    OPT_SHUFFLE,
+    OPT_SEED,
+    OPT_CV_MAX,
+    OPT_SCHED_COUNTERS,
+    OPT_AUTOTUNE,
+    OPT_AUTOTUNE_CACHE,
+    OPT_AUTOTUNE_ITERS,
+    OPT_RETUNE,
+    OPT_SHM_PUBLISH,
+    OPT_SHM_CONSUME,
+    OPT_READ_PLAN,
+    OPT_PLAN_FANOUT,
+    OPT_MSR_SCOPE,
+    OPT_THREAD_LAYOUT,
+    OPT_LOW_JITTER,
+    OPT_RT_PRIO,
+    OPT_TRACE,
+    OPT_TRACE_EVENTS,
+    OPT_TASK_MSRS,
+};
+
+static const char opts_short[] = "b:B:O:c:i:m:nh";
 static const struct option opts_long[] = {
     {"bench",       required_argument,  NULL,   'b'},
+    {"backend",     required_argument,  NULL,   'B'},
+    {"backend-opts",required_argument,  NULL,   'O'},
     {"cpu-group",   required_argument,  NULL,   'c'},
     {"iters",       required_argument,  NULL,   'i'},
     {"msr",         required_argument,  NULL,   'm'},
+    {"no-stats",    no_argument,        NULL,   'n'},
+    {"group-by",    required_argument,  NULL,   OPT_GROUP_BY},
+    {"group-split", required_argument,  NULL,   OPT_GROUP_SPLIT},
+    {"barrier",     required_argument,  NULL,   OPT_BARRIER},
+    {"spin",        required_argument,  NULL,   OPT_SPIN},
+    {"workers",     required_argument,  NULL,   OPT_WORKERS},
+    {"rate",        required_argument,  NULL,   OPT_RATE},
+    {"duration",    required_argument,  NULL,   OPT_DURATION},
+    {"store",       required_argument,  NULL,   OPT_STORE},
+    {"store-file",  required_argument,  NULL,   OPT_STORE_FILE},
+    {"delta-kernel", required_argument, NULL,   OPT_DELTA_KERNEL},
+    {"sweep",       no_argument,        NULL,   OPT_SWEEP},
+    {"sweep-cpus",  required_argument,  NULL,   OPT_SWEEP_CPUS},
+    {"sweep-groups", required_argument, NULL,   OPT_SWEEP_GROUPS},
+    {"sweep-msrs",  required_argument,  NULL,   OPT_SWEEP_MSRS},
+    {"sweep-shape", required_argument,  NULL,   OPT_SWEEP_SHAPE},
+    {"format",      required_argument,  NULL,   OPT_FORMAT},
+    {"pairs",       no_argument,        NULL,   OPT_PAIRS},
+    {"pipeline-depth", required_argument, NULL, OPT_PIPELINE_DEPTH},
+    {"sweep-depths", required_argument, NULL,   OPT_SWEEP_DEPTHS},
+    {"warmup",      required_argument,  NULL,   OPT_WARMUP},
+    {"reps",        required_argument,  NULL,   OPT_REPS},
+    {"shuffle",     no_argument,        NULL,   OPT_SHUFFLE},
+    {"seed",        required_argument,  NULL,   OPT_SEED},
+    {"cv-max",      required_argument,  NULL,   OPT_CV_MAX},
+    {"sched-counters", no_argument,     NULL,   OPT_SCHED_COUNTERS},
+    {"autotune",    optional_argument,  NULL,   OPT_AUTOTUNE},
+    {"autotune-cache", required_argument, NULL, OPT_AUTOTUNE_CACHE},
+    {"autotune-iters", required_argument, NULL, OPT_AUTOTUNE_ITERS},
+    {"retune",      no_argument,        NULL,   OPT_RETUNE},
+    {"shm-publish", required_argument,  NULL,   OPT_SHM_PUBLISH},
+    {"shm-consume", required_argument,  NULL,   OPT_SHM_CONSUME},
+    {"read-plan",   no_argument,        NULL,   OPT_READ_PLAN},
+    {"plan-fanout", no_argument,        NULL,   OPT_PLAN_FANOUT},
+    {"msr-scope",   required_argument,  NULL,   OPT_MSR_SCOPE},
+    {"thread-layout", required_argument, NULL,  OPT_THREAD_LAYOUT},
+    {"low-jitter",  optional_argument,  NULL,   OPT_LOW_JITTER},
+    {"rt-prio",     required_argument,  NULL,   OPT_RT_PRIO},
+    {"trace",       required_argument,  NULL,   OPT_TRACE},
+    {"trace-events", required_argument, NULL,   OPT_TRACE_EVENTS},
+    {"task-msrs",   required_argument,  NULL,   OPT_TASK_MSRS},
     {"help",        no_argument,        NULL,   'h'},
     {0, 0, 0, 0}
 };
 
 int main(int argc, char **argv)
 {
-    const char *b = "serial";
-    struct bench_cpu_group cpu_groups[CPU_GROUPS_MAX] = { { 0 } };
-    uint32_t msrs[MSRS_MAX] = { 0 };
+    const char *b = NULL;
+    const char *backend = "linux";
+    const char *backend_opts = NULL;
+    struct cpu_table table;
+    uint32_t *msrs = NULL;
+    uint32_t cap_msrs = 0;
     struct bench ctx = {
-        .cpu_groups = cpu_groups,
+        .cpu_groups = NULL,
         .n_cpu_groups = 0,
-        .msrs = msrs,
+        .msrs = NULL,
         .n_msrs = 0,
         .iters = 1,
+        .barrier = BARRIER_CENTRAL,
+        .spin = BARRIER_SPIN_DEFAULT,
+        .workers = 0,
+        .task_msrs = 0,
+        .pipeline_depth = 1,
+        .thr_layout = BENCH_THR_LOCAL,
+        .rate = 0,
+        .duration = 0,
+        .stats = NULL,
+        .store = NULL,
+        .delta = NULL,
+        .sched = NULL,
+    };
+    enum topology_level group_by = TOPOLOGY_SOCKET;
+    uint32_t group_split = 1;
+    int is_group_by = 0;
+    uint64_t reads_per_iter = 0;
+    int no_stats = 0;
+    int pairs = 0;
+    uint32_t store_depth = 0;
+    const char *store_file = NULL;
+    const char *delta_kernel = NULL;
+    const struct bench_strategy *strategy;
+    struct bench_sweep_opts sweep_opts = { NULL, NULL, NULL, NULL, NULL, NULL };
+    int sweep = 0;
+    struct runner runner = {
+        .warmup = 0,
+        .reps = 0,
+        .shuffle = 0,
+        .seed = 0,
+        .cv_max = RUNNER_CV_MAX_DEFAULT,
     };
+    int run_engine = 0;
+    struct sched_counters sched;
+    int is_sched = 0;
+    int autotune = 0;
+    enum autotune_objective objective = AUTOTUNE_THROUGHPUT;
+    const char *autotune_cache = NULL;
+    uint32_t autotune_iters = AUTOTUNE_ITERS_DEFAULT;
+    int retune = 0;
+    struct autotune_config tuned;
+    const char *shm_publish = NULL;
+    const char *shm_consume = NULL;
+    struct read_plan plan;
+    int is_plan = 0;
+    int plan_fanout = 0;
+    int low_jitter = 0;
+    uint32_t jitter_settings = LOWJITTER_ALL;
+    int rt_prio = LOWJITTER_PRIO_DEFAULT;
+    const char *trace_path = NULL;
+    uint64_t trace_events = TRACE_EVENTS_DEFAULT;
+    FILE *trace_file;
+    uint32_t *m;
+    uint32_t i;
     int c;
-    int i;
     int rc = 0;
 
+    cpu_table_init(&table);
+    memset(&plan, 0, sizeof(plan));
     while ((c = getopt_long(argc, argv, opts_short, opts_long, NULL)) != -1) {
         switch (c) {
         case 'b':
             b = optarg;
             break;
+        case 'B':
+            backend = optarg;
+            break;
+        case 'O':
+            backend_opts = optarg;
+            break;
         case 'c':
-            if (ctx.n_cpu_groups == CPU_GROUPS_MAX) {
-                fprintf(stderr, "Too many CPU groups requested, max=%u\n",
-                        CPU_GROUPS_MAX);
-                // TODO: cleanup
-                return E2BIG;
-            }
-            if (bench_cpu_group_alloc_list(&ctx.cpu_groups[ctx.n_cpu_groups], optarg)) {
-                return errno;
+            if (bench_cpu_group_alloc_list(&table, optarg)) {
+                rc = errno;
+                goto out;
             }
-            ctx.n_cpu_groups++;
             break;
         case 'i':
             ctx.iters = strtoul(optarg, NULL, 0);
             break;
         case 'm':
-            if (ctx.n_msrs < MSRS_MAX) {
-                ctx.msrs[ctx.n_msrs] = strtoul(optarg, NULL, 0);
-                ctx.n_msrs++;
-            } else {
-                fprintf(stderr, "Too many MSRs requested, max=%u\n", MSRS_MAX);
-                // TODO: cleanup
-                return E2BIG;
+            if (ctx.n_msrs == cap_msrs) {
+                cap_msrs = cap_msrs ? cap_msrs * 2 : 16;
+                m = realloc(msrs, cap_msrs * sizeof(uint32_t));
+                if (!m) {
+                    perror("realloc");
+                    rc = errno;
+                    goto out;
+                }
+                msrs = m;
+                ctx.msrs = msrs;
+            }
+            ctx.msrs[ctx.n_msrs++] = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            no_stats = 1;
+            break;
+        case OPT_GROUP_BY:
+            if (topology_level_parse(optarg, &group_by)) {
+                fprintf(stderr, "Unknown topology level: %s\n", optarg);
+                usage(argv[0], EINVAL);
+            }
+            is_group_by = 1;
+            break;
+        case OPT_GROUP_SPLIT:
+            group_split = strtoul(optarg, NULL, 0);
+            if (!group_split) {
+                fprintf(stderr, "Group split must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_BARRIER:
+            if (barrier_type_parse(optarg, &ctx.barrier)) {
+                fprintf(stderr, "Unknown barrier: %s\n", optarg);
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_SPIN:
+            ctx.spin = strtoul(optarg, NULL, 0);
+            break;
+        case OPT_RATE:
+            ctx.rate = strtod(optarg, NULL);
+            if (!(ctx.rate > 0) || ctx.rate > 1e9) {
+                fprintf(stderr, "Rate must be in (0, 1e9] Hz\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_DURATION:
+            ctx.duration = strtod(optarg, NULL);
+            if (!(ctx.duration > 0)) {
+                fprintf(stderr, "Duration must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_STORE:
+            store_depth = strtoul(optarg, NULL, 0);
+            if (!store_depth) {
+                fprintf(stderr, "Store depth must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_STORE_FILE:
+            store_file = optarg;
+            break;
+        case OPT_SWEEP:
+            sweep = 1;
+            break;
+        case OPT_SWEEP_CPUS:
+            sweep_opts.cpus = optarg;
+            break;
+        case OPT_SWEEP_GROUPS:
+            sweep_opts.groups = optarg;
+            break;
+        case OPT_SWEEP_MSRS:
+            sweep_opts.msrs = optarg;
+            break;
+        case OPT_SWEEP_SHAPE:
+            sweep_opts.shapes = optarg;
+            break;
+        case OPT_FORMAT:
+            sweep_opts.format = optarg;
+            break;
+        case OPT_DELTA_KERNEL:
+            delta_kernel = optarg;
+            break;
+        case OPT_PAIRS:
+            pairs = 1;
+            break;
+        case OPT_PIPELINE_DEPTH:
+            ctx.pipeline_depth = strtoul(optarg, NULL, 0);
+            if (!ctx.pipeline_depth) {
+                fprintf(stderr, "Pipeline depth must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_THREAD_LAYOUT:
+            if (bench_thr_layout_parse(optarg, &ctx.thr_layout)) {
+                fprintf(stderr, "Unknown thread layout: %s\n", optarg);
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_LOW_JITTER:
+            if (optarg && lowjitter_settings_parse(optarg, &jitter_settings)) {
+                usage(argv[0], EINVAL);
+            }
+            low_jitter = 1;
+            break;
+        case OPT_RT_PRIO:
+            rt_prio = atoi(optarg);
+            if (rt_prio < 1 || rt_prio > 99) {
+                fprintf(stderr, "Real-time priority must be 1-99\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_TRACE:
+            trace_path = optarg;
+            break;
+        case OPT_TRACE_EVENTS:
+            trace_events = strtoull(optarg, NULL, 0);
+            if (!trace_events) {
+                fprintf(stderr, "Trace events must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_SWEEP_DEPTHS:
+            sweep_opts.depths = optarg;
+            break;
+        case OPT_WARMUP:
+            runner.warmup = strtoul(optarg, NULL, 0);
+            run_engine = 1;
+            break;
+        case OPT_REPS:
+            runner.reps = strtoul(optarg, NULL, 0);
+            if (!runner.reps) {
+                fprintf(stderr, "Repetitions must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            run_engine = 1;
+            break;
+        case OPT_SHUFFLE:
+            runner.shuffle = 1;
+            run_engine = 1;
+            break;
+        case OPT_SEED:
+            runner.seed = strtoull(optarg, NULL, 0);
+            break;
+        case OPT_SCHED_COUNTERS:
+            is_sched = 1;
+            break;
+        case OPT_AUTOTUNE:
+            if (optarg && autotune_objective_parse(optarg, &objective)) {
+                fprintf(stderr, "Unknown autotune objective: %s\n", optarg);
+                usage(argv[0], EINVAL);
+            }
+            autotune = 1;
+            break;
+        case OPT_AUTOTUNE_CACHE:
+            autotune_cache = optarg;
+            break;
+        case OPT_AUTOTUNE_ITERS:
+            autotune_iters = strtoul(optarg, NULL, 0);
+            if (!autotune_iters) {
+                fprintf(stderr, "Autotune iterations must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_RETUNE:
+            retune = 1;
+            break;
+        case OPT_SHM_PUBLISH:
+            shm_publish = optarg;
+            break;
+        case OPT_SHM_CONSUME:
+            shm_consume = optarg;
+            break;
+        case OPT_READ_PLAN:
+            is_plan = 1;
+            break;
+        case OPT_PLAN_FANOUT:
+            is_plan = 1;
+            plan_fanout = 1;
+            break;
+        case OPT_MSR_SCOPE:
+            if (bench_msr_scope_list(optarg)) {
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_CV_MAX:
+            runner.cv_max = strtod(optarg, NULL);
+            if (!(runner.cv_max > 0)) {
+                fprintf(stderr, "CV threshold must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_WORKERS:
+            ctx.workers = strtoul(optarg, NULL, 0);
+            if (!ctx.workers) {
+                fprintf(stderr, "Workers must be > 0\n");
+                usage(argv[0], EINVAL);
+            }
+            break;
+        case OPT_TASK_MSRS:
+            ctx.task_msrs = strtoul(optarg, NULL, 0);
+            if (!ctx.task_msrs) {
+                fprintf(stderr, "MSRs per task must be > 0\n");
+                usage(argv[0], EINVAL);
             }
             break;
         case 'h':
@@ -234,48 +957,256 @@ int main(int argc, char **argv)
             break;
         }
     }
+    if (sweep && (store_depth || store_file)) {
+        fprintf(stderr, "--sweep and --store are mutually exclusive\n");
+        usage(argv[0], EINVAL);
+    }
+    if (b && strchr(b, ',') && !sweep) {
+        run_engine = 1;
+    }
+    if (sweep && run_engine) {
+        fprintf(stderr, "--sweep and the run engine options are mutually exclusive\n");
+        usage(argv[0], EINVAL);
+    }
+    if (is_sched && no_stats) {
+        fprintf(stderr, "--sched-counters requires statistics, remove -n\n");
+        usage(argv[0], EINVAL);
+    }
+    if ((run_engine || low_jitter) && no_stats) {
+        fprintf(stderr, "The run engine options and --low-jitter require statistics, "
+                "remove -n\n");
+        usage(argv[0], EINVAL);
+    }
+    if (trace_path && (sweep || run_engine || low_jitter || shm_publish || shm_consume)) {
+        fprintf(stderr, "--trace traces a single run, remove --sweep, --low-jitter,"
+                " --shm-publish, --shm-consume, and the run engine options\n");
+        usage(argv[0], EINVAL);
+    }
+    if (low_jitter && (sweep || autotune || shm_publish || shm_consume)) {
+        fprintf(stderr, "--low-jitter is mutually exclusive with --sweep, --autotune,"
+                " --shm-publish, and --shm-consume\n");
+        usage(argv[0], EINVAL);
+    }
+    if (autotune && (b || table.n_groups || is_group_by || sweep || run_engine)) {
+        fprintf(stderr, "--autotune picks the benchmark and grouping, remove -b, -c, --group-by,"
+                " --sweep, and the run engine options\n");
+        usage(argv[0], EINVAL);
+    }
+    if (shm_publish && (sweep || run_engine || store_depth || store_file || shm_consume)) {
+        fprintf(stderr, "--shm-publish is mutually exclusive with --sweep, --store,"
+                " --shm-consume, and the run engine options\n");
+        usage(argv[0], EINVAL);
+    }
+    if (is_plan && sweep) {
+        fprintf(stderr, "--read-plan and --sweep are mutually exclusive\n");
+        usage(argv[0], EINVAL);
+    }
+    if (ctx.duration > 0 && !(ctx.rate > 0) && !shm_publish) {
+        fprintf(stderr, "--duration requires --rate\n");
+        usage(argv[0], EINVAL);
+    }
+
+    if (shm_consume) {
+        timing_init();
+        if (shm_bench_consume(shm_consume, ctx.iters, stdout)) {
+            rc = errno ? errno : EIO;
+        }
+        goto out;
+    }
 
-    if (!ctx.n_cpu_groups) {
-        if (bench_cpu_group_alloc_all(&ctx.cpu_groups[0])) {
-            return errno;
+    ctx.delta = delta_kernel_select(delta_kernel);
+    if (!ctx.delta) {
+        if (errno == EINVAL) {
+            fprintf(stderr, "Unknown delta kernel: %s\n", delta_kernel);
         }
-        ctx.n_cpu_groups++;
+        usage(argv[0], errno);
     }
 
+    if (msr_backend_select(backend, backend_opts)) {
+        rc = errno;
+        goto out;
+    }
+
+    if (autotune) {
+        if (bench_autotune_exec(&ctx, objective, autotune_iters, autotune_cache, retune,
+                                &tuned)) {
+            rc = errno;
+            goto out;
+        }
+        b = tuned.strategy->name;
+        is_group_by = tuned.is_group_by;
+        group_by = tuned.group_by;
+        group_split = tuned.group_split;
+    }
+
+    if (is_group_by) {
+        if (table.n_groups) {
+            fprintf(stderr, "--group-by and -c are mutually exclusive\n");
+            rc = EINVAL;
+            goto out;
+        }
+        if (cpu_table_add_topology(&table, group_by, group_split)) {
+            rc = errno;
+            goto out;
+        }
+    }
+
+    if (!table.n_groups) {
+        if (cpu_table_add_all(&table)) {
+            rc = errno;
+            goto out;
+        }
+    }
+
+    if (cpu_table_build(&table) || cpu_table_open(&table)) {
+        rc = errno;
+        goto out;
+    }
+    ctx.cpu_groups = table.groups;
+    ctx.n_cpu_groups = table.n_groups;
     for (i = 0; i < ctx.n_cpu_groups; i++) {
-        if (bench_cpu_group_open(&ctx.cpu_groups[i])) {
+        reads_per_iter += (uint64_t) ctx.cpu_groups[i].n_handles * ctx.n_msrs;
+    }
+    if (is_plan) {
+        if (read_plan_build(&plan, &table, ctx.msrs, ctx.n_msrs, plan_fanout)) {
             rc = errno;
             goto out;
         }
+        read_plan_print(stdout, &plan);
+        ctx.cpu_groups = plan.groups;
+        ctx.n_cpu_groups = plan.n_groups;
+        ctx.plan = &plan;
+        reads_per_iter = plan.n_reads;
     }
 
-    if (!strncmp(b, "serial", strlen("serial") + 1)) {
-        printf("Benchmark: serial\n");
-        rc = bench_serial(&ctx);
-    } else if (!strncmp(b, "serial_migrate", strlen("serial_migrate") + 1)) {
-        printf("Benchmark: serial_migrate\n");
-        rc = bench_serial_migrate(&ctx);
-    } else if (!strncmp(b, "thread", strlen("thread") + 1)) {
-        printf("Benchmark: thread\n");
-        rc = bench_thread(&ctx);
-    } else if (!strncmp(b, "thread_migrate", strlen("thread_migrate") + 1)) {
-        printf("Benchmark: thread_migrate\n");
-        rc = bench_thread_migrate(&ctx);
-    } else if (!strncmp(b, "thread_notif", strlen("thread_notif") + 1)) {
-        printf("Benchmark: thread_notif\n");
-        rc = bench_thread_notif(&ctx);
-    } else if (!strncmp(b, "thread_notif_migrate", strlen("thread_notif_migrate") + 1)) {
-        printf("Benchmark: thread_notif_migrate\n");
-        rc = bench_thread_notif_migrate(&ctx);
-    } else {
+    if (shm_publish) {
+        strategy = bench_strategy_find(b ? b : "serial");
+        if (!strategy) {
+            fprintf(stderr, "Unknown benchmark: %s\n", b);
+            rc = EINVAL;
+            goto out;
+        }
+        if (shm_bench_publish(&ctx, strategy, table.cpus, table.n_cpus, shm_publish, stdout)) {
+            rc = errno ? errno : EIO;
+        }
+        goto out;
+    }
+
+    if (!no_stats || sweep || run_engine || store_depth || store_file || trace_path) {
+        timing_init();
+    }
+    if (store_depth || store_file) {
+        ctx.store = bench_store_alloc(&ctx, store_depth ? store_depth : SAMPLE_STORE_DEPTH_DEFAULT,
+                                      store_file);
+        if (!ctx.store) {
+            rc = errno;
+            goto out;
+        }
+    }
+    if (!no_stats) {
+        ctx.stats = bench_stats_alloc(ctx.n_cpu_groups);
+        if (!ctx.stats || (pairs && bench_stats_enable_pairs(ctx.stats))) {
+            rc = errno;
+            goto out;
+        }
+    }
+
+    if (is_sched) {
+        if (sched_counters_open(&sched)) {
+            rc = errno;
+            goto out;
+        }
+        ctx.sched = &sched;
+    }
+
+    if (sweep) {
+        if (bench_sweep_exec(&ctx, b, &sweep_opts)) {
+            rc = errno ? errno : EIO;
+        }
+        goto out;
+    }
+    if (low_jitter) {
+        rc = bench_lowjitter_exec(&ctx, b, &runner, jitter_settings, rt_prio);
+        if (rc < 0) {
+            rc = errno ? errno : EIO;
+        }
+        goto out;
+    }
+    if (run_engine) {
+        if (!runner.reps) {
+            runner.reps = RUNNER_REPS_DEFAULT;
+        }
+        if (!runner.seed) {
+            runner.seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+        }
+        rc = bench_runner_exec(&ctx, b, &runner);
+        if (rc < 0) {
+            rc = errno ? errno : EIO;
+        }
+        goto out;
+    }
+
+    if (!b) {
+        b = "serial";
+    }
+    strategy = bench_strategy_find(b);
+    if (!strategy) {
         fprintf(stderr, "Unknown benchmark: %s\n", b);
         rc = EINVAL;
+        goto out;
+    }
+    if (strategy->run == bench_delta && !ctx.n_msrs) {
+        fprintf(stderr, "%s needs at least one -m\n", strategy->name);
+        rc = EINVAL;
+        goto out;
+    }
+    if (trace_path) {
+        ctx.trace = trace_alloc(bench_strategy_n_threads(strategy, &ctx), trace_events);
+        if (!ctx.trace) {
+            rc = errno;
+            goto out;
+        }
+    }
+    if (strategy->run == bench_delta) {
+        printf("Benchmark: %s (%s)\n", strategy->name, ctx.delta->name);
+    } else if (bench_strategy_has_thr_layout(strategy)) {
+        printf("Benchmark: %s (%s layout)\n", strategy->name,
+               bench_thr_layout_name(ctx.thr_layout));
+    } else {
+        printf("Benchmark: %s\n", strategy->name);
+    }
+    rc = bench_strategy_run(strategy, &ctx);
+
+    if (!rc && ctx.stats) {
+        bench_stats_print(stdout, ctx.stats, reads_per_iter);
+    }
+    if (!rc && ctx.trace) {
+        trace_file = fopen(trace_path, "w");
+        if (!trace_file) {
+            perror(trace_path);
+            rc = errno;
+            goto out;
+        }
+        if (trace_write_json(ctx.trace, trace_file) | fclose(trace_file)) {
+            perror(trace_path);
+            rc = errno;
+            goto out;
+        }
+        trace_print_summary(stdout, ctx.trace, ctx.stats ? ctx.stats->iter.count : ctx.iters,
+                            ctx.stats && ctx.stats->iter.count ?
+                            timing_ticks_to_ns(hist_mean(&ctx.stats->iter)) : 0);
+        printf("Trace written to %s\n", trace_path);
     }
 
 out:
-    for (i = 0; i < ctx.n_cpu_groups; i++) {
-        rc |= bench_cpu_group_close(&ctx.cpu_groups[i]);
-        bench_cpu_group_free(&ctx.cpu_groups[i]);
+    if (ctx.sched) {
+        sched_counters_close(ctx.sched);
     }
+    bench_stats_free(ctx.stats);
+    sample_store_free(ctx.store);
+    trace_free(ctx.trace);
+    read_plan_free(&plan);
+    rc |= cpu_table_free(&table);
+    free(msrs);
     return rc;
 }
@@ -0,0 +1,270 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "msr-shm.h"
+
+struct msr_shm {
+    void *base;
+    size_t size;
+    char *name;
+    // created by this process, so unlinked by msr_shm_close()
+    int is_owner;
+};
+
+static size_t msr_shm_align(size_t n, size_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+static inline void msr_shm_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline struct msr_shm_row *msr_shm_row(const struct msr_shm *s, uint32_t row)
+{
+    const struct msr_shm_hdr *hdr = s->base;
+    return (struct msr_shm_row *) ((char *) s->base + hdr->row_offset + row * hdr->row_size);
+}
+
+static struct msr_shm *msr_shm_new(const char *name)
+{
+    struct msr_shm *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->name = strdup(name);
+    if (!s->name) {
+        perror("strdup");
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+struct msr_shm *msr_shm_create(const char *name, const uint32_t *cpus, uint32_t n_cpus,
+                               const uint32_t *msrs, uint32_t n_msrs, uint64_t interval_ns)
+{
+    struct msr_shm *s;
+    struct msr_shm_hdr *hdr;
+    size_t hdr_size;
+    size_t row_size;
+    uint32_t i;
+    int fd;
+
+    if (!n_cpus || !n_msrs) {
+        errno = EINVAL;
+        return NULL;
+    }
+    s = msr_shm_new(name);
+    if (!s) {
+        return NULL;
+    }
+    hdr_size = msr_shm_align(sizeof(struct msr_shm_hdr) + n_msrs * sizeof(uint32_t), 64);
+    row_size = msr_shm_align(sizeof(struct msr_shm_row) + n_msrs * sizeof(uint64_t), 64);
+    s->size = hdr_size + n_cpus * row_size;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        goto fail;
+    }
+    s->is_owner = 1;
+    if (ftruncate(fd, (off_t) s->size)) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        close(fd);
+        goto fail;
+    }
+    s->base = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->base == MAP_FAILED) {
+        perror("mmap");
+        s->base = NULL;
+        goto fail;
+    }
+
+    // the segment starts zeroed: every row is unlocked at sample 0
+    hdr = s->base;
+    memcpy(hdr->magic, MSR_SHM_MAGIC, sizeof(hdr->magic));
+    hdr->version = MSR_SHM_VERSION;
+    hdr->n_rows = n_cpus;
+    hdr->n_msrs = n_msrs;
+    hdr->reserved = 0;
+    hdr->row_offset = hdr_size;
+    hdr->row_size = row_size;
+    hdr->interval_ns = interval_ns;
+    hdr->pid = getpid();
+    memcpy(hdr + 1, msrs, n_msrs * sizeof(uint32_t));
+    for (i = 0; i < n_cpus; i++) {
+        msr_shm_row(s, i)->cpu = cpus[i];
+    }
+    return s;
+
+fail:
+    msr_shm_close(s);
+    return NULL;
+}
+
+struct msr_shm *msr_shm_open(const char *name)
+{
+    struct msr_shm *s;
+    const struct msr_shm_hdr *hdr;
+    struct stat st;
+    int fd;
+
+    s = msr_shm_new(name);
+    if (!s) {
+        return NULL;
+    }
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        goto fail;
+    }
+    if (fstat(fd, &st)) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        close(fd);
+        goto fail;
+    }
+    s->size = (size_t) st.st_size;
+    if (s->size < sizeof(struct msr_shm_hdr)) {
+        close(fd);
+        goto bad;
+    }
+    s->base = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->base == MAP_FAILED) {
+        perror("mmap");
+        s->base = NULL;
+        goto fail;
+    }
+    hdr = s->base;
+    if (memcmp(hdr->magic, MSR_SHM_MAGIC, sizeof(hdr->magic)) ||
+        hdr->version != MSR_SHM_VERSION ||
+        hdr->row_size < sizeof(struct msr_shm_row) + hdr->n_msrs * sizeof(uint64_t) ||
+        hdr->row_offset + (uint64_t) hdr->n_rows * hdr->row_size > s->size) {
+        goto bad;
+    }
+    return s;
+
+bad:
+    fprintf(stderr, "%s: Not an MSR shared-memory segment\n", name);
+    msr_shm_close(s);
+    errno = EINVAL;
+    return NULL;
+fail:
+    msr_shm_close(s);
+    return NULL;
+}
+
+int msr_shm_close(struct msr_shm *s)
+{
+    int rc = 0;
+    if (!s) {
+        return 0;
+    }
+    if (s->base) {
+        rc |= munmap(s->base, s->size);
+    }
+    if (s->is_owner) {
+        rc |= shm_unlink(s->name);
+    }
+    free(s->name);
+    free(s);
+    return rc;
+}
+
+const struct msr_shm_hdr *msr_shm_get_hdr(const struct msr_shm *s)
+{
+    return s->base;
+}
+
+uint32_t msr_shm_get_msr(const struct msr_shm *s, uint32_t m)
+{
+    return ((const uint32_t *) ((const struct msr_shm_hdr *) s->base + 1))[m];
+}
+
+uint32_t msr_shm_get_cpu(const struct msr_shm *s, uint32_t row)
+{
+    return msr_shm_row(s, row)->cpu;
+}
+
+void msr_shm_publish(struct msr_shm *s, uint64_t ns, const uint64_t *values)
+{
+    struct msr_shm_hdr *hdr = s->base;
+    const uint32_t n_msrs = hdr->n_msrs;
+    const uint64_t sample = atomic_load_explicit(&hdr->samples, memory_order_relaxed) + 1;
+    struct msr_shm_row *r;
+    uint64_t check;
+    uint32_t seq;
+    uint32_t i;
+    uint32_t m;
+    for (i = 0; i < hdr->n_rows; i++, values += n_msrs) {
+        r = msr_shm_row(s, i);
+        seq = atomic_load_explicit(&r->seq, memory_order_relaxed);
+        atomic_store_explicit(&r->seq, seq + 1, memory_order_relaxed);
+        // readers must see the odd seq before any of the new data
+        atomic_thread_fence(memory_order_release);
+        check = sample ^ ns;
+        for (m = 0; m < n_msrs; m++) {
+            atomic_store_explicit(&r->values[m], values[m], memory_order_relaxed);
+            check ^= values[m];
+        }
+        atomic_store_explicit(&r->sample, sample, memory_order_relaxed);
+        atomic_store_explicit(&r->ns, ns, memory_order_relaxed);
+        atomic_store_explicit(&r->check, check, memory_order_relaxed);
+        atomic_store_explicit(&r->seq, seq + 2, memory_order_release);
+    }
+    atomic_store_explicit(&hdr->samples, sample, memory_order_release);
+}
+
+int msr_shm_read_row(const struct msr_shm *s, uint32_t row, uint64_t *values,
+                     uint64_t *sample, uint64_t *ns)
+{
+    const struct msr_shm_hdr *hdr = s->base;
+    struct msr_shm_row *r = msr_shm_row(s, row);
+    uint32_t retries = 0;
+    uint32_t seq;
+    uint64_t check;
+    uint32_t m;
+    for (;;) {
+        seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (!(seq & 1)) {
+            for (m = 0; m < hdr->n_msrs; m++) {
+                values[m] = atomic_load_explicit(&r->values[m], memory_order_relaxed);
+            }
+            *sample = atomic_load_explicit(&r->sample, memory_order_relaxed);
+            *ns = atomic_load_explicit(&r->ns, memory_order_relaxed);
+            check = atomic_load_explicit(&r->check, memory_order_relaxed);
+            // the copy must complete before seq is checked again
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&r->seq, memory_order_relaxed) == seq) {
+                break;
+            }
+        }
+        if (++retries == MSR_SHM_RETRIES_MAX) {
+            errno = EAGAIN;
+            return -1;
+        }
+        msr_shm_relax();
+    }
+    check ^= *sample ^ *ns;
+    for (m = 0; m < hdr->n_msrs; m++) {
+        check ^= values[m];
+    }
+    if (check) {
+        errno = EIO;
+        return -1;
+    }
+    return (int) retries;
+}
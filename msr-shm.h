@@ -0,0 +1,95 @@
+#ifndef MSR_SHM_H
+#define MSR_SHM_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+/*
+ * POSIX shared-memory segment of the latest MSR values, published by one sampling process
+ * (msr-scaling-bench --shm-publish) so any number of local consumers can read them without
+ * reading MSRs themselves, and without syscalls or locks: each CPU's row is guarded by a
+ * seqlock, so the writer never waits on readers and a reader retries only if it overlapped
+ * a write of that row.
+ *
+ *   struct msr_shm_hdr
+ *   uint32_t msrs[n_msrs]
+ *   (padding to row_offset)
+ *   n_rows rows of row_size bytes: struct msr_shm_row, uint64_t values[n_msrs]
+ *
+ * All fields are native-endian. Rows are cache-line aligned, so updating one row doesn't
+ * disturb readers of another. Timestamps are CLOCK_MONOTONIC nanoseconds, comparable
+ * across processes.
+ */
+
+#define MSR_SHM_MAGIC   "MSRSHM01"
+#define MSR_SHM_VERSION 1
+
+// a reader gives up on a row after this many retries, e.g., if the writer died mid-update
+#ifndef MSR_SHM_RETRIES_MAX
+#define MSR_SHM_RETRIES_MAX (1u << 20)
+#endif
+
+struct msr_shm_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_rows;
+    uint32_t n_msrs;
+    uint32_t reserved;
+    uint64_t row_offset;
+    uint64_t row_size;
+    // the writer's sampling period, 0 if unpaced
+    uint64_t interval_ns;
+    int64_t pid;
+    // samples published so far
+    _Atomic uint64_t samples;
+};
+
+struct msr_shm_row {
+    // odd while the row is being written
+    _Atomic uint32_t seq;
+    uint32_t cpu;
+    _Atomic uint64_t sample;
+    _Atomic uint64_t ns;
+    // sample ^ ns ^ values, so readers can verify they got one consistent row
+    _Atomic uint64_t check;
+    _Atomic uint64_t values[];
+} __attribute__((aligned(64)));
+
+struct msr_shm;
+
+/**
+ * Create (replacing any existing) segment name, e.g., "/msr", with one row per CPU.
+ */
+struct msr_shm *msr_shm_create(const char *name, const uint32_t *cpus, uint32_t n_cpus,
+                               const uint32_t *msrs, uint32_t n_msrs, uint64_t interval_ns);
+
+/**
+ * Map an existing segment read-only.
+ */
+struct msr_shm *msr_shm_open(const char *name);
+
+/**
+ * Unmap the segment, and remove it if this process created it.
+ */
+int msr_shm_close(struct msr_shm *s);
+
+const struct msr_shm_hdr *msr_shm_get_hdr(const struct msr_shm *s);
+
+uint32_t msr_shm_get_msr(const struct msr_shm *s, uint32_t m);
+
+uint32_t msr_shm_get_cpu(const struct msr_shm *s, uint32_t row);
+
+/**
+ * Publish a sample taken at ns: values holds n_msrs values per row, row-major.
+ * Single writer.
+ */
+void msr_shm_publish(struct msr_shm *s, uint64_t ns, const uint64_t *values);
+
+/**
+ * Read one consistent copy of a row. Returns the number of retries, or -1 with
+ * errno=EAGAIN if the row stayed locked, or errno=EIO if the copy fails its check.
+ */
+int msr_shm_read_row(const struct msr_shm *s, uint32_t row, uint64_t *values,
+                     uint64_t *sample, uint64_t *ns);
+
+#endif // MSR_SHM_H
@@ -0,0 +1,297 @@
+/*
+ * Simulated MSR backend - injects latency instead of accessing hardware.
+ *
+ * CPUs are enumerated like Linux does on x86: SMT siblings of core C are C, C + n_cores, ...
+ * and cores are split evenly across sockets, then NUMA nodes within each socket.
+ *
+ * Each read costs syscall_ns, plus an IPI if the calling thread's simulated CPU differs from
+ * the target: ipi_ns, plus numa_ns if on another node, plus socket_ns if on another socket.
+ * Each migration costs migrate_ns plus the same distance penalty, less the ipi_ns base.
+ * A batch costs one syscall_ns, plus batch_op_ns per read, plus the largest IPI cost
+ * among its CPUs since the kernel sends the IPIs in parallel.
+ * Every cost gets uniform jitter in [0, jitter_ns), and one in spike_ppm reads
+ * takes an extra spike_ns (e.g., an interrupt or preemption).
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "msr-backend.h"
+
+struct msr_sim_cfg {
+    uint32_t cpus;
+    uint32_t sockets;
+    uint32_t nodes;
+    uint32_t smt;
+    uint64_t syscall_ns;
+    uint64_t ipi_ns;
+    uint64_t numa_ns;
+    uint64_t socket_ns;
+    uint64_t migrate_ns;
+    uint64_t batch_op_ns;
+    uint64_t jitter_ns;
+    uint64_t spike_ns;
+    uint64_t spike_ppm;
+};
+
+static struct msr_sim_cfg cfg = {
+    .cpus = 64,
+    .sockets = 2,
+    .nodes = 1,
+    .smt = 2,
+    .syscall_ns = 500,
+    .ipi_ns = 1500,
+    .numa_ns = 500,
+    .socket_ns = 2000,
+    .migrate_ns = 4000,
+    .batch_op_ns = 100,
+    .jitter_ns = 200,
+    .spike_ns = 20000,
+    .spike_ppm = 100,
+};
+
+// the simulated CPU the calling thread is running on
+static __thread uint32_t sim_cpu = UINT32_MAX;
+static __thread uint64_t sim_rand;
+
+static uint64_t msr_sim_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t msr_sim_rand(void)
+{
+    // xorshift64
+    if (!sim_rand) {
+        sim_rand = msr_sim_now() ^ (uintptr_t) &sim_rand;
+        sim_rand |= 1;
+    }
+    sim_rand ^= sim_rand << 13;
+    sim_rand ^= sim_rand >> 7;
+    sim_rand ^= sim_rand << 17;
+    return sim_rand;
+}
+
+static uint32_t msr_sim_cur_cpu(void)
+{
+    int cpu;
+    if (sim_cpu == UINT32_MAX) {
+        cpu = sched_getcpu();
+        sim_cpu = cpu < 0 ? 0 : (uint32_t) cpu % cfg.cpus;
+    }
+    return sim_cpu;
+}
+
+static uint32_t msr_sim_core(uint32_t cpu)
+{
+    return cpu % (cfg.cpus / cfg.smt);
+}
+
+static uint32_t msr_sim_socket(uint32_t cpu)
+{
+    return msr_sim_core(cpu) / (cfg.cpus / cfg.smt / cfg.sockets);
+}
+
+static uint32_t msr_sim_node(uint32_t cpu)
+{
+    return msr_sim_core(cpu) / (cfg.cpus / cfg.smt / (cfg.sockets * cfg.nodes));
+}
+
+static uint64_t msr_sim_distance(uint32_t src, uint32_t dst, uint64_t base)
+{
+    uint64_t ns;
+    if (src == dst) {
+        return 0;
+    }
+    ns = base;
+    if (msr_sim_node(src) != msr_sim_node(dst)) {
+        ns += cfg.numa_ns;
+    }
+    if (msr_sim_socket(src) != msr_sim_socket(dst)) {
+        ns += cfg.socket_ns;
+    }
+    return ns;
+}
+
+static void msr_sim_delay(uint64_t ns)
+{
+    uint64_t r;
+    uint64_t deadline;
+    if (cfg.jitter_ns) {
+        ns += msr_sim_rand() % cfg.jitter_ns;
+    }
+    if (cfg.spike_ppm) {
+        r = msr_sim_rand();
+        if (r % 1000000 < cfg.spike_ppm) {
+            ns += cfg.spike_ns;
+        }
+    }
+    // spin - the real costs consume the caller's CPU time too
+    deadline = msr_sim_now() + ns;
+    while (msr_sim_now() < deadline);
+}
+
+static int msr_sim_parse(const char *key, const char *val, void *arg)
+{
+    static const struct {
+        const char *key;
+        size_t off;
+        int is_u32;
+    } keys[] = {
+        { "cpus", offsetof(struct msr_sim_cfg, cpus), 1 },
+        { "sockets", offsetof(struct msr_sim_cfg, sockets), 1 },
+        { "nodes", offsetof(struct msr_sim_cfg, nodes), 1 },
+        { "smt", offsetof(struct msr_sim_cfg, smt), 1 },
+        { "syscall_ns", offsetof(struct msr_sim_cfg, syscall_ns), 0 },
+        { "ipi_ns", offsetof(struct msr_sim_cfg, ipi_ns), 0 },
+        { "numa_ns", offsetof(struct msr_sim_cfg, numa_ns), 0 },
+        { "socket_ns", offsetof(struct msr_sim_cfg, socket_ns), 0 },
+        { "migrate_ns", offsetof(struct msr_sim_cfg, migrate_ns), 0 },
+        { "batch_op_ns", offsetof(struct msr_sim_cfg, batch_op_ns), 0 },
+        { "jitter_ns", offsetof(struct msr_sim_cfg, jitter_ns), 0 },
+        { "spike_ns", offsetof(struct msr_sim_cfg, spike_ns), 0 },
+        { "spike_ppm", offsetof(struct msr_sim_cfg, spike_ppm), 0 },
+    };
+    struct msr_sim_cfg *c = (struct msr_sim_cfg *)arg;
+    unsigned long long v;
+    char *end;
+    size_t i;
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        if (!strcmp(key, keys[i].key)) {
+            errno = 0;
+            v = strtoull(val, &end, 0);
+            if (errno || end == val || *end || (keys[i].is_u32 && v > UINT32_MAX)) {
+                fprintf(stderr, "sim: Bad value for %s: %s\n", key, val);
+                errno = EINVAL;
+                return -1;
+            }
+            if (keys[i].is_u32) {
+                *(uint32_t *)((char *)c + keys[i].off) = (uint32_t) v;
+            } else {
+                *(uint64_t *)((char *)c + keys[i].off) = v;
+            }
+            return 0;
+        }
+    }
+    fprintf(stderr, "sim: Unknown option: %s\n", key);
+    errno = EINVAL;
+    return -1;
+}
+
+static int msr_sim_init(const char *opts)
+{
+    struct msr_sim_cfg c = cfg;
+    if (msr_opts_foreach(opts, msr_sim_parse, &c)) {
+        return -1;
+    }
+    if (!c.cpus || !c.sockets || !c.nodes || !c.smt ||
+        c.cpus % (c.smt * c.sockets * c.nodes)) {
+        fprintf(stderr, "sim: cpus must be a multiple of smt * sockets * nodes\n");
+        errno = EINVAL;
+        return -1;
+    }
+    cfg = c;
+    return 0;
+}
+
+static uint32_t msr_sim_get_count(void)
+{
+    return cfg.cpus;
+}
+
+static int msr_sim_get_topology(uint32_t cpu, struct msr_topology *topo)
+{
+    if (cpu >= cfg.cpus) {
+        errno = ENODEV;
+        return -1;
+    }
+    topo->package = msr_sim_socket(cpu);
+    topo->core = msr_sim_core(cpu);
+    // one LLC per node
+    topo->node = msr_sim_node(cpu);
+    topo->llc = topo->node;
+    topo->thread = cpu / (cfg.cpus / cfg.smt);
+    return 0;
+}
+
+static int msr_sim_open(struct msr_handle *m)
+{
+    if (m->cpu >= cfg.cpus) {
+        fprintf(stderr, "sim: No such CPU: %"PRIu32"\n", m->cpu);
+        errno = ENODEV;
+        return -1;
+    }
+    msr_sim_delay(cfg.syscall_ns);
+    return 0;
+}
+
+static int msr_sim_close(struct msr_handle *m)
+{
+    return 0;
+}
+
+static ssize_t msr_sim_read(const struct msr_handle *m, uint32_t msr, uint64_t* data)
+{
+    msr_sim_delay(cfg.syscall_ns + msr_sim_distance(msr_sim_cur_cpu(), m->cpu, cfg.ipi_ns));
+    // behave like a free-running counter
+    *data = msr_sim_now();
+    return sizeof(uint64_t);
+}
+
+static int msr_sim_migrate(const struct msr_handle *m)
+{
+    uint32_t cur = msr_sim_cur_cpu();
+    // re-binding to the current CPU is just a syscall
+    msr_sim_delay(cur == m->cpu ? cfg.syscall_ns :
+                  cfg.migrate_ns + msr_sim_distance(cur, m->cpu, 0));
+    sim_cpu = m->cpu;
+    return 0;
+}
+
+static int msr_sim_batch_read(struct msr_batch *b, uint64_t *data)
+{
+    uint32_t cur = msr_sim_cur_cpu();
+    uint64_t ipi = 0;
+    uint64_t d;
+    uint64_t now;
+    uint32_t h;
+    uint32_t m;
+    for (h = 0; h < b->n_handles; h++) {
+        d = msr_sim_distance(cur, b->handles[h]->cpu, cfg.ipi_ns);
+        if (d > ipi) {
+            ipi = d;
+        }
+    }
+    msr_sim_delay(cfg.syscall_ns + ipi + cfg.batch_op_ns * b->n_handles * b->n_msrs);
+    now = msr_sim_now();
+    for (h = 0; h < b->n_handles; h++) {
+        for (m = 0; m < b->n_msrs; m++) {
+            *data++ = now;
+        }
+    }
+    return 0;
+}
+
+const struct msr_backend msr_backend_sim = {
+    .name = "sim",
+    .init = msr_sim_init,
+    .get_count = msr_sim_get_count,
+    .get_topology = msr_sim_get_topology,
+    .open = msr_sim_open,
+    .close = msr_sim_close,
+    .read = msr_sim_read,
+    .prepare = NULL,
+    .migrate = msr_sim_migrate,
+    .get_cur_cpu = msr_sim_cur_cpu,
+    .batch_init = NULL,
+    .batch_fini = NULL,
+    .batch_read = msr_sim_batch_read,
+};
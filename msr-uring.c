@@ -0,0 +1,330 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/io_uring.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "msr.h"
+#include "msr-uring.h"
+
+#ifndef MSR_URING_ENTRIES_MAX
+#define MSR_URING_ENTRIES_MAX 4096
+#endif
+
+struct msr_uring {
+    struct msr_handle *const *handles;
+    uint32_t n_handles;
+    const uint32_t *msrs;
+    uint32_t n_msrs;
+    uint32_t n_ops;
+    // ring fd, or -1 when using the fallback
+    int fd;
+    uint32_t entries;
+    int fixed_files;
+    int fixed_bufs;
+    int *fds;
+    // reads land here, registered with the ring when possible
+    uint64_t *buf;
+    void *sq_ptr;
+    size_t sq_sz;
+    void *cq_ptr;
+    size_t cq_sz;
+    struct io_uring_sqe *sqes;
+    size_t sqes_sz;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Returns 1 if the kernel supports opcode, 0 if not or if it's too old to say (before 5.6,
+ * which added both IORING_REGISTER_PROBE and IORING_OP_READ).
+ */
+static int msr_uring_op_supported(int fd, uint8_t opcode)
+{
+    const size_t sz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, sz);
+    int rc = 0;
+    if (!probe) {
+        return 0;
+    }
+    if (!io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) &&
+        opcode <= probe->last_op && opcode < probe->ops_len) {
+        rc = !!(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return rc;
+}
+
+static void msr_uring_teardown(struct msr_uring *u)
+{
+    if (u->sqes && u->sqes != MAP_FAILED) {
+        munmap(u->sqes, u->sqes_sz);
+    }
+    if (u->cq_ptr && u->cq_ptr != MAP_FAILED && u->cq_ptr != u->sq_ptr) {
+        munmap(u->cq_ptr, u->cq_sz);
+    }
+    if (u->sq_ptr && u->sq_ptr != MAP_FAILED) {
+        munmap(u->sq_ptr, u->sq_sz);
+    }
+    if (u->fd >= 0) {
+        close(u->fd);
+    }
+    u->sqes = NULL;
+    u->cq_ptr = NULL;
+    u->sq_ptr = NULL;
+    u->fd = -1;
+}
+
+static int msr_uring_setup(struct msr_uring *u)
+{
+    struct io_uring_params p;
+    struct iovec iov;
+    uint32_t i;
+
+    for (i = 0; i < u->n_handles; i++) {
+        if ((u->fds[i] = msr_get_fd(u->handles[i])) < 0) {
+            // e.g., the simulated backend
+            errno = ENOTSUP;
+            return -1;
+        }
+    }
+
+    u->entries = 1;
+    while (u->entries < u->n_ops && u->entries < MSR_URING_ENTRIES_MAX) {
+        u->entries <<= 1;
+    }
+    memset(&p, 0, sizeof(p));
+    if ((u->fd = io_uring_setup(u->entries, &p)) < 0) {
+        u->fd = -1;
+        return -1;
+    }
+    u->entries = p.sq_entries;
+
+    u->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_sz > u->sq_sz) {
+            u->sq_sz = u->cq_sz;
+        }
+        u->cq_sz = u->sq_sz;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(NULL, u->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) {
+            return -1;
+        }
+    }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        return -1;
+    }
+    u->sq_tail = (unsigned *)((char *)u->sq_ptr + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_ptr + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_ptr + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_ptr + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ptr + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_ptr + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ptr + p.cq_off.cqes);
+
+    // registration is an optimization - plain fds and buffers work without it
+    u->fixed_files = !io_uring_register(u->fd, IORING_REGISTER_FILES, u->fds, u->n_handles);
+    iov.iov_base = u->buf;
+    iov.iov_len = u->n_ops * sizeof(uint64_t);
+    u->fixed_bufs = !io_uring_register(u->fd, IORING_REGISTER_BUFFERS, &iov, 1);
+    // IORING_OP_READ_FIXED is as old as io_uring, but IORING_OP_READ needs 5.6
+    if (!u->fixed_bufs && !msr_uring_op_supported(u->fd, IORING_OP_READ)) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    return 0;
+}
+
+struct msr_uring *msr_uring_alloc(struct msr_handle *const *handles, uint32_t n_handles,
+                                  const uint32_t *msrs, uint32_t n_msrs)
+{
+    struct msr_uring *u = calloc(1, sizeof(*u));
+    if (!u) {
+        perror("calloc");
+        return NULL;
+    }
+    u->handles = handles;
+    u->n_handles = n_handles;
+    u->msrs = msrs;
+    u->n_msrs = n_msrs;
+    u->n_ops = n_handles * n_msrs;
+    u->fd = -1;
+    u->fds = malloc(n_handles * sizeof(int));
+    u->buf = aligned_alloc(64, ((u->n_ops * sizeof(uint64_t) + 63) / 64) * 64);
+    if (!u->fds || !u->buf) {
+        perror("malloc");
+        msr_uring_free(u);
+        return NULL;
+    }
+    // fault it in now, e.g., for the fallback, which doesn't register it
+    memset(u->buf, 0, ((u->n_ops * sizeof(uint64_t) + 63) / 64) * 64);
+    if (msr_uring_setup(u)) {
+        fprintf(stderr, "io_uring unavailable, falling back to msr_read: %s\n", strerror(errno));
+        msr_uring_teardown(u);
+    }
+    return u;
+}
+
+void msr_uring_free(struct msr_uring *u)
+{
+    if (u) {
+        msr_uring_teardown(u);
+        free(u->fds);
+        free(u->buf);
+        free(u);
+    }
+}
+
+int msr_uring_is_native(const struct msr_uring *u)
+{
+    return u->fd >= 0;
+}
+
+static int msr_uring_fallback(struct msr_uring *u, uint64_t *data)
+{
+    ssize_t rc;
+    uint32_t h;
+    uint32_t m;
+    for (h = 0; h < u->n_handles; h++) {
+        for (m = 0; m < u->n_msrs; m++) {
+            // a short read fails, as it does through the ring
+            rc = msr_read(u->handles[h], u->msrs[m], data++);
+            if (rc != sizeof(uint64_t)) {
+                if (rc >= 0) {
+                    errno = EIO;
+                }
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int msr_uring_reap(struct msr_uring *u, uint32_t n)
+{
+    struct io_uring_cqe *cqe;
+    unsigned head = *u->cq_head;
+    unsigned tail;
+    int err = 0;
+    while (n) {
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (io_uring_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+                return -1;
+            }
+            continue;
+        }
+        for (; head != tail && n; head++, n--) {
+            cqe = &u->cqes[head & *u->cq_mask];
+            if (cqe->res != sizeof(uint64_t) && !err) {
+                err = cqe->res < 0 ? -cqe->res : EIO;
+            }
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+int msr_uring_read(struct msr_uring *u, uint64_t *data)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail;
+    unsigned idx;
+    uint32_t done;
+    uint32_t chunk;
+    uint32_t i;
+    uint32_t k;
+    int rc;
+    if (u->fd < 0) {
+        return msr_uring_fallback(u, data);
+    }
+    for (done = 0; done < u->n_ops; done += chunk) {
+        chunk = u->n_ops - done < u->entries ? u->n_ops - done : u->entries;
+        tail = *u->sq_tail;
+        for (k = 0; k < chunk; k++, tail++) {
+            i = done + k;
+            idx = tail & *u->sq_mask;
+            sqe = &u->sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = u->fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            if (u->fixed_files) {
+                sqe->fd = (int) (i / u->n_msrs);
+                sqe->flags = IOSQE_FIXED_FILE;
+            } else {
+                sqe->fd = u->fds[i / u->n_msrs];
+            }
+            sqe->addr = (uint64_t) (uintptr_t) &u->buf[i];
+            sqe->len = sizeof(uint64_t);
+            sqe->off = u->msrs[i % u->n_msrs];
+            sqe->buf_index = 0;
+            sqe->user_data = i;
+            u->sq_array[idx] = idx;
+        }
+        __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+        // normally submits and waits for everything in one syscall
+        for (k = 0; k < chunk; k += rc) {
+            rc = io_uring_enter(u->fd, chunk - k, chunk - k, IORING_ENTER_GETEVENTS);
+            if (rc < 0) {
+                if (errno != EINTR) {
+                    return -1;
+                }
+                rc = 0;
+            }
+        }
+        if (msr_uring_reap(u, chunk)) {
+            // the kernel or file doesn't take the read after all: stop trying it
+            if (errno == EINVAL || errno == EOPNOTSUPP) {
+                fprintf(stderr, "io_uring read unsupported, falling back to msr_read: %s\n",
+                        strerror(errno));
+                msr_uring_teardown(u);
+                return msr_uring_fallback(u, data);
+            }
+            return -1;
+        }
+    }
+    memcpy(data, u->buf, u->n_ops * sizeof(uint64_t));
+    return 0;
+}
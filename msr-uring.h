@@ -0,0 +1,37 @@
+#ifndef MSR_URING_H
+#define MSR_URING_H
+
+#include <inttypes.h>
+
+#include "msr.h"
+
+/*
+ * Read many MSRs with io_uring: one submission queues a read for every {handle, msr},
+ * using the handles' file descriptors as registered files and a registered buffer.
+ * Falls back to sequential msr_read() calls if io_uring or its read opcode is unavailable,
+ * the reads complete with EINVAL or EOPNOTSUPP, or the backend doesn't use file descriptors.
+ */
+
+struct msr_uring;
+
+/**
+ * Allocate a ring that reads each MSR in msrs from each handle in handles.
+ * The handles must be open and, like msrs, must outlive the ring.
+ */
+struct msr_uring *msr_uring_alloc(struct msr_handle *const *handles, uint32_t n_handles,
+                                  const uint32_t *msrs, uint32_t n_msrs);
+
+void msr_uring_free(struct msr_uring *u);
+
+/**
+ * Submit all reads and wait for their completions.
+ * data must hold n_handles * n_msrs values, which are written handle-major.
+ */
+int msr_uring_read(struct msr_uring *u, uint64_t *data);
+
+/**
+ * Returns 1 if reads are submitted with io_uring, 0 if using the fallback.
+ */
+int msr_uring_is_native(const struct msr_uring *u);
+
+#endif // MSR_URING_H
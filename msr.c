@@ -0,0 +1,250 @@
+#include <errno.h>
+#include <sched.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "msr.h"
+#include "msr-backend.h"
+
+static const struct msr_backend *backends[] = {
+    &msr_backend_linux,
+    &msr_backend_sim,
+    &msr_backend_batch,
+    &msr_backend_perf,
+};
+
+static const struct msr_backend *backend = &msr_backend_linux;
+
+int msr_opts_foreach(const char *opts,
+                     int (*fn)(const char *key, const char *val, void *arg),
+                     void *arg)
+{
+    char *saveptr;
+    char *kv;
+    char *val;
+    char *o;
+    int rc = 0;
+    if (!opts || !*opts) {
+        return 0;
+    }
+    o = strdup(opts);
+    if (!o) {
+        perror("strdup");
+        return -1;
+    }
+    kv = strtok_r(o, ",", &saveptr);
+    while (kv && !rc) {
+        val = strchr(kv, '=');
+        if (val) {
+            *val++ = '\0';
+        } else {
+            val = "";
+        }
+        rc = fn(kv, val, arg);
+        kv = strtok_r(NULL, ",", &saveptr);
+    }
+    free(o);
+    return rc;
+}
+
+int msr_path_check(const char *fmt)
+{
+    const char *p = fmt;
+    int n = 0;
+    while ((p = strchr(p, '%'))) {
+        if (p[1] != 'u') {
+            break;
+        }
+        n++;
+        p += 2;
+    }
+    if (p || n != 1) {
+        fprintf(stderr, "Bad device path template, expected exactly one %%u: %s\n", fmt);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int msr_backend_select(const char *name, const char *opts)
+{
+    size_t i;
+    for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (!strcmp(name, backends[i]->name)) {
+            if (backends[i]->init && backends[i]->init(opts)) {
+                return -1;
+            }
+            backend = backends[i];
+            return 0;
+        }
+    }
+    fprintf(stderr, "Unknown MSR backend: %s\n", name);
+    errno = EINVAL;
+    return -1;
+}
+
+const char *msr_backend_get_name(void)
+{
+    return backend->name;
+}
+
+uint32_t msr_get_count(void)
+{
+    return backend->get_count();
+}
+
+int msr_get_topology(uint32_t cpu, struct msr_topology *topo)
+{
+    if (!backend->get_topology) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return backend->get_topology(cpu, topo);
+}
+
+struct msr_handle *msr_alloc(uint32_t cpu)
+{
+    struct msr_handle *m;
+    m = malloc(sizeof(*m));
+    if (!m) {
+        perror("malloc");
+        return NULL;
+    }
+    m->cpu = cpu;
+    m->fd = -1;
+    m->priv = NULL;
+    return m;
+}
+
+void msr_free(struct msr_handle *m)
+{
+    free(m);
+}
+
+struct msr_handle *msr_alloc_array(const uint32_t *cpus, uint32_t n)
+{
+    struct msr_handle *arr;
+    size_t size = ((n ? n : 1) * sizeof(*arr) + 63) / 64 * 64;
+    uint32_t i;
+    arr = aligned_alloc(64, size);
+    if (!arr) {
+        perror("aligned_alloc");
+        return NULL;
+    }
+    for (i = 0; i < n; i++) {
+        arr[i].cpu = cpus[i];
+        arr[i].fd = -1;
+        arr[i].priv = NULL;
+    }
+    return arr;
+}
+
+struct msr_handle *msr_array_get(struct msr_handle *arr, uint32_t i)
+{
+    return &arr[i];
+}
+
+void msr_free_array(struct msr_handle *arr)
+{
+    free(arr);
+}
+
+uint32_t msr_get_cpu(const struct msr_handle *m)
+{
+    return m->cpu;
+}
+
+int msr_get_fd(const struct msr_handle *m)
+{
+    return m->fd;
+}
+
+int msr_open(struct msr_handle *m)
+{
+    return backend->open(m);
+}
+
+int msr_close(struct msr_handle *m)
+{
+    return backend->close(m);
+}
+
+ssize_t msr_read(const struct msr_handle *m, uint32_t msr, uint64_t* data)
+{
+    return backend->read(m, msr, data);
+}
+
+int msr_prepare(const struct msr_handle *m, const uint32_t *msrs, uint32_t n_msrs)
+{
+    return backend->prepare ? backend->prepare(m, msrs, n_msrs) : 0;
+}
+
+int msr_migrate(const struct msr_handle *m)
+{
+    return backend->migrate(m);
+}
+
+uint32_t msr_get_cur_cpu(void)
+{
+    int cpu;
+    if (backend->get_cur_cpu) {
+        return backend->get_cur_cpu();
+    }
+    cpu = sched_getcpu();
+    return cpu < 0 ? UINT32_MAX : (uint32_t) cpu;
+}
+
+struct msr_batch *msr_batch_alloc(struct msr_handle *const *handles, uint32_t n_handles,
+                                  const uint32_t *msrs, uint32_t n_msrs)
+{
+    struct msr_batch *b = malloc(sizeof(*b));
+    if (!b) {
+        perror("malloc");
+        return NULL;
+    }
+    b->handles = handles;
+    b->n_handles = n_handles;
+    b->msrs = msrs;
+    b->n_msrs = n_msrs;
+    b->priv = NULL;
+    if (backend->batch_init && backend->batch_init(b)) {
+        free(b);
+        return NULL;
+    }
+    return b;
+}
+
+void msr_batch_free(struct msr_batch *b)
+{
+    if (b) {
+        if (backend->batch_fini) {
+            backend->batch_fini(b);
+        }
+        free(b);
+    }
+}
+
+int msr_batch_read(struct msr_batch *b, uint64_t *data)
+{
+    ssize_t rc;
+    uint32_t h;
+    uint32_t m;
+    if (backend->batch_read) {
+        return backend->batch_read(b, data);
+    }
+    for (h = 0; h < b->n_handles; h++) {
+        for (m = 0; m < b->n_msrs; m++) {
+            rc = backend->read(b->handles[h], b->msrs[m], data++);
+            if (rc != sizeof(uint64_t)) {
+                if (rc >= 0) {
+                    errno = EIO;
+                }
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
@@ -6,18 +6,97 @@
 
 struct msr_handle;
 
+struct msr_batch;
+
+struct msr_topology {
+    uint32_t package;
+    // unique across packages
+    uint32_t core;
+    // identifies the last-level cache domain
+    uint32_t llc;
+    uint32_t node;
+    // index among the core's SMT siblings
+    uint32_t thread;
+};
+
+/**
+ * Select the MSR access backend by name, e.g., "linux" (the default) or "sim".
+ * opts is an optional comma-delimited list of key=value backend options.
+ * Must be called before any other msr_* function.
+ */
+int msr_backend_select(const char *name, const char *opts);
+
+const char *msr_backend_get_name(void);
+
 uint32_t msr_get_count(void);
 
+/**
+ * Get a CPU's topology if the backend models its own (e.g., "sim").
+ * Returns -1 with errno=ENOTSUP if the host topology applies.
+ */
+int msr_get_topology(uint32_t cpu, struct msr_topology *topo);
+
 struct msr_handle *msr_alloc(uint32_t cpu);
 
 void msr_free(struct msr_handle *m);
 
+/**
+ * Allocate handles for cpus[0..n) contiguously in one cache-aligned arena, in order, so
+ * iterating over them touches consecutive cache lines. Free with msr_free_array().
+ */
+struct msr_handle *msr_alloc_array(const uint32_t *cpus, uint32_t n);
+
+/**
+ * Get the i-th handle of an array from msr_alloc_array().
+ */
+struct msr_handle *msr_array_get(struct msr_handle *arr, uint32_t i);
+
+void msr_free_array(struct msr_handle *arr);
+
 uint32_t msr_get_cpu(const struct msr_handle *m);
 
+/**
+ * Get the handle's file descriptor, or -1 if the backend doesn't use one.
+ */
+int msr_get_fd(const struct msr_handle *m);
+
 int msr_open(struct msr_handle *m);
 
 int msr_close(struct msr_handle *m);
 
 ssize_t msr_read(const struct msr_handle *m, uint32_t msr, uint64_t* data);
 
+/**
+ * Set up reading msrs from the handle, e.g., open their perf events, so the first read of
+ * each doesn't pay for it. Reads work without it.
+ */
+int msr_prepare(const struct msr_handle *m, const uint32_t *msrs, uint32_t n_msrs);
+
+/**
+ * Bind the calling thread to the handle's CPU.
+ */
+int msr_migrate(const struct msr_handle *m);
+
+/**
+ * Get the CPU the calling thread is running on, as seen by the backend.
+ * Returns UINT32_MAX if unknown.
+ */
+uint32_t msr_get_cur_cpu(void);
+
+/**
+ * Allocate a batch that reads each MSR in msrs from each handle in handles.
+ * The handles must be open and, like msrs, must outlive the batch.
+ */
+struct msr_batch *msr_batch_alloc(struct msr_handle *const *handles, uint32_t n_handles,
+                                  const uint32_t *msrs, uint32_t n_msrs);
+
+void msr_batch_free(struct msr_batch *b);
+
+/**
+ * Execute a batch, with a single syscall if the backend supports it.
+ * data must hold n_handles * n_msrs values, which are written handle-major. A short read
+ * fails with EIO.
+ */
+int msr_batch_read(struct msr_batch *b, uint64_t *data);
+
 #endif // MSR_H
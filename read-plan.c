@@ -0,0 +1,277 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "cpu-table.h"
+#include "msr-info.h"
+#include "read-plan.h"
+#include "topology.h"
+
+// scratch state while planning, per table CPU unless noted
+struct read_plan_work {
+    // index into the topology, UINT32_MAX if the CPU isn't in it
+    uint32_t *topo_idx;
+    uint32_t *group;
+    // ordinal of the CPU's core or package, for the scope being planned
+    uint32_t *dom;
+    uint32_t *keys;
+    // n_cpus x n_msrs: whether the CPU reads the MSR, and whose read it takes
+    uint8_t *reads;
+    uint32_t *src;
+    uint8_t *visited;
+    // per group: reads planned so far
+    uint64_t *load;
+};
+
+static void read_plan_work_free(struct read_plan_work *w)
+{
+    free(w->topo_idx);
+    free(w->group);
+    free(w->dom);
+    free(w->keys);
+    free(w->reads);
+    free(w->src);
+    free(w->visited);
+    free(w->load);
+}
+
+static uint32_t read_plan_domain(const struct topology *topo, uint32_t idx,
+                                 enum msr_scope scope)
+{
+    return topology_domain(topo, idx, scope == MSR_SCOPE_CORE ? TOPOLOGY_CORE : TOPOLOGY_SOCKET);
+}
+
+// number the CPUs' domains in order of first appearance; CPUs without topology stand alone
+static uint32_t read_plan_domains(const struct cpu_table *t, const struct topology *topo,
+                                  struct read_plan_work *w, enum msr_scope scope)
+{
+    uint32_t n_dom = 0;
+    uint32_t key;
+    uint32_t i;
+    uint32_t d;
+    for (i = 0; i < t->n_cpus; i++) {
+        if (w->topo_idx[i] == UINT32_MAX) {
+            w->keys[n_dom] = UINT32_MAX;
+            w->dom[i] = n_dom++;
+            continue;
+        }
+        key = read_plan_domain(topo, w->topo_idx[i], scope);
+        for (d = 0; d < n_dom && w->keys[d] != key; d++);
+        if (d == n_dom) {
+            w->keys[n_dom++] = key;
+        }
+        w->dom[i] = d;
+    }
+    return n_dom;
+}
+
+// read the scope's MSRs on one CPU per domain, the one in the least loaded group
+static void read_plan_scope(struct read_plan *p, const struct cpu_table *t,
+                            const struct topology *topo, struct read_plan_work *w,
+                            const uint32_t *msrs, enum msr_scope scope)
+{
+    const uint32_t n_msrs = p->n_msrs;
+    uint32_t n_dom = read_plan_domains(t, topo, w, scope);
+    uint32_t rep;
+    uint32_t d;
+    uint32_t i;
+    uint32_t m;
+    for (d = 0; d < n_dom; d++) {
+        rep = UINT32_MAX;
+        for (i = 0; i < t->n_cpus; i++) {
+            if (w->dom[i] != d) {
+                continue;
+            }
+            // prefer a CPU that's visited anyway, so no extra CPU is touched
+            if (rep == UINT32_MAX || w->load[w->group[i]] < w->load[w->group[rep]] ||
+                (w->load[w->group[i]] == w->load[w->group[rep]] && w->visited[i] &&
+                 !w->visited[rep])) {
+                rep = i;
+            }
+        }
+        for (m = 0; m < n_msrs; m++) {
+            if (msr_info_scope(msrs[m]) != scope) {
+                continue;
+            }
+            w->reads[(uint64_t) rep * n_msrs + m] = 1;
+            for (i = 0; i < t->n_cpus; i++) {
+                if (w->dom[i] == d) {
+                    w->src[(uint64_t) i * n_msrs + m] = rep;
+                }
+            }
+        }
+        w->load[w->group[rep]] += p->scope_msrs[scope];
+        w->visited[rep] = 1;
+        p->scope_reads[scope] += p->scope_msrs[scope];
+    }
+}
+
+static int read_plan_emit(struct read_plan *p, const struct cpu_table *t,
+                          const struct read_plan_work *w)
+{
+    const uint32_t n_msrs = p->n_msrs;
+    uint64_t c = 0;
+    uint32_t g;
+    uint32_t i;
+    uint32_t k = 0;
+    uint32_t m;
+
+    for (i = 0; i < t->n_cpus; i++) {
+        p->n_handles += w->visited[i];
+        for (m = 0; m < n_msrs; m++) {
+            p->n_copies += w->src[(uint64_t) i * n_msrs + m] != i;
+        }
+    }
+    p->n_groups = t->n_groups;
+    p->groups = calloc(t->n_groups ? t->n_groups : 1, sizeof(struct bench_cpu_group));
+    p->group_reads = calloc(t->n_groups ? t->n_groups : 1, sizeof(uint64_t));
+    p->handles = malloc((p->n_handles ? p->n_handles : 1) * sizeof(struct msr_handle *));
+    p->rows = malloc((p->n_handles ? p->n_handles : 1) * sizeof(uint32_t));
+    p->reads = malloc(p->n_handles ? (uint64_t) p->n_handles * n_msrs : 1);
+    p->copies = malloc((p->n_copies ? p->n_copies : 1) * 2 * sizeof(uint64_t));
+    if (!p->groups || !p->group_reads || !p->handles || !p->rows || !p->reads || !p->copies) {
+        perror("malloc");
+        return -1;
+    }
+
+    for (g = 0; g < t->n_groups; g++) {
+        p->groups[g].handles = &p->handles[k];
+        p->groups[g].first = k;
+        for (i = t->offsets[g]; i < t->offsets[g + 1]; i++) {
+            if (!w->visited[i]) {
+                continue;
+            }
+            p->handles[k] = t->handles[i];
+            p->rows[k] = i;
+            memcpy(&p->reads[(uint64_t) k * n_msrs], &w->reads[(uint64_t) i * n_msrs], n_msrs);
+            for (m = 0; m < n_msrs; m++) {
+                p->group_reads[g] += w->reads[(uint64_t) i * n_msrs + m];
+            }
+            k++;
+        }
+        p->groups[g].n_handles = k - p->groups[g].first;
+        p->n_reads += p->group_reads[g];
+    }
+
+    for (i = 0; i < t->n_cpus; i++) {
+        for (m = 0; m < n_msrs; m++) {
+            if (w->src[(uint64_t) i * n_msrs + m] != i) {
+                p->copies[2 * c] = (uint64_t) w->src[(uint64_t) i * n_msrs + m] * n_msrs + m;
+                p->copies[2 * c + 1] = (uint64_t) i * n_msrs + m;
+                c++;
+            }
+        }
+    }
+    return 0;
+}
+
+int read_plan_build(struct read_plan *p, const struct cpu_table *t, const uint32_t *msrs,
+                    uint32_t n_msrs, int fanout)
+{
+    struct read_plan_work w;
+    struct topology topo;
+    const uint64_t n = (uint64_t) t->n_cpus * n_msrs;
+    enum msr_scope scope;
+    uint32_t g;
+    uint32_t i;
+    uint32_t j;
+    uint32_t m;
+    int rc = -1;
+
+    memset(p, 0, sizeof(*p));
+    memset(&w, 0, sizeof(w));
+    p->n_msrs = n_msrs;
+    p->fanout = fanout;
+    if (topology_load(&topo)) {
+        return -1;
+    }
+    w.topo_idx = malloc((t->n_cpus ? t->n_cpus : 1) * sizeof(uint32_t));
+    w.group = malloc((t->n_cpus ? t->n_cpus : 1) * sizeof(uint32_t));
+    w.dom = malloc((t->n_cpus ? t->n_cpus : 1) * sizeof(uint32_t));
+    w.keys = malloc((t->n_cpus ? t->n_cpus : 1) * sizeof(uint32_t));
+    w.reads = calloc(n ? n : 1, 1);
+    w.src = malloc((n ? n : 1) * sizeof(uint32_t));
+    w.visited = calloc(t->n_cpus ? t->n_cpus : 1, 1);
+    w.load = calloc(t->n_groups ? t->n_groups : 1, sizeof(uint64_t));
+    if (!w.topo_idx || !w.group || !w.dom || !w.keys || !w.reads || !w.src || !w.visited ||
+        !w.load) {
+        perror("malloc");
+        goto out;
+    }
+    for (i = 0; i < t->n_cpus; i++) {
+        for (j = 0; j < topo.n_cpus && topo.cpus[j] != t->cpus[i]; j++);
+        w.topo_idx[i] = j < topo.n_cpus ? j : UINT32_MAX;
+    }
+    for (g = 0; g < t->n_groups; g++) {
+        for (i = t->offsets[g]; i < t->offsets[g + 1]; i++) {
+            w.group[i] = g;
+        }
+    }
+
+    // thread-scoped MSRs are read everywhere, which the rest are balanced against
+    for (m = 0; m < n_msrs; m++) {
+        scope = msr_info_scope(msrs[m]);
+        p->scope_msrs[scope]++;
+        p->scope_naive[scope] += t->n_cpus;
+        for (i = 0; i < t->n_cpus; i++) {
+            w.src[(uint64_t) i * n_msrs + m] = i;
+            if (scope == MSR_SCOPE_THREAD) {
+                w.reads[(uint64_t) i * n_msrs + m] = 1;
+                w.visited[i] = 1;
+                w.load[w.group[i]]++;
+            }
+        }
+    }
+    p->scope_reads[MSR_SCOPE_THREAD] = p->scope_naive[MSR_SCOPE_THREAD];
+    for (scope = MSR_SCOPE_CORE; scope < MSR_SCOPE_N; scope++) {
+        if (p->scope_msrs[scope]) {
+            read_plan_scope(p, t, &topo, &w, msrs, scope);
+        }
+    }
+    p->n_naive = n;
+    rc = read_plan_emit(p, t, &w);
+
+out:
+    read_plan_work_free(&w);
+    topology_free(&topo);
+    if (rc) {
+        read_plan_free(p);
+    }
+    return rc;
+}
+
+void read_plan_free(struct read_plan *p)
+{
+    free(p->groups);
+    free(p->handles);
+    free(p->rows);
+    free(p->reads);
+    free(p->group_reads);
+    free(p->copies);
+    memset(p, 0, sizeof(*p));
+}
+
+void read_plan_print(FILE *f, const struct read_plan *p)
+{
+    uint64_t lo = UINT64_MAX;
+    uint64_t hi = 0;
+    uint32_t s;
+    uint32_t g;
+    for (g = 0; g < p->n_groups; g++) {
+        lo = p->group_reads[g] < lo ? p->group_reads[g] : lo;
+        hi = p->group_reads[g] > hi ? p->group_reads[g] : hi;
+    }
+    fprintf(f, "Read plan: %"PRIu64" reads per iteration instead of %"PRIu64" (%.1f%% fewer), "
+            "from %"PRIu32" CPUs, %"PRIu64"-%"PRIu64" per group%s\n",
+            p->n_reads, p->n_naive,
+            p->n_naive ? 100.0 * (p->n_naive - p->n_reads) / p->n_naive : 0.0,
+            p->n_handles, p->n_groups ? lo : 0, hi, p->fanout ? ", fanned out" : "");
+    fprintf(f, "%-16s %8s %12s %12s\n", "Scope", "msrs", "naive", "planned");
+    for (s = 0; s < MSR_SCOPE_N; s++) {
+        fprintf(f, "%-16s %8"PRIu32" %12"PRIu64" %12"PRIu64"\n", msr_scope_name(s),
+                p->scope_msrs[s], p->scope_naive[s], p->scope_reads[s]);
+    }
+}
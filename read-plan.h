@@ -0,0 +1,89 @@
+#ifndef READ_PLAN_H
+#define READ_PLAN_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "cpu-table.h"
+#include "msr-info.h"
+
+/*
+ * Which CPUs read which MSRs, so that each instance of a register is read once per
+ * iteration: thread-scoped MSRs are read on every CPU, but core- and package-scoped ones
+ * only on one representative CPU of each core or package among the table's CPUs.
+ * Representatives are picked from whichever group has planned the fewest reads so far, so
+ * the work stays balanced across groups (threads).
+ *
+ * The plan's groups hold each table group's CPUs that read anything, and are what the
+ * strategies run over. Values still go to out in table order; with fanout, every CPU's
+ * unread values are copied from its representative's after each sample.
+ */
+struct read_plan {
+    // the groups to run, in table group order, possibly empty
+    struct bench_cpu_group *groups;
+    uint32_t n_groups;
+    struct msr_handle **handles;
+    uint32_t n_handles;
+    uint32_t n_msrs;
+    // per planned handle: its table index, i.e., its row in out
+    uint32_t *rows;
+    // per planned handle and MSR: 1 if it's read, n_handles x n_msrs
+    uint8_t *reads;
+    // planned reads of each group per iteration
+    uint64_t *group_reads;
+    // out indexes to copy from and to for fanout
+    uint64_t *copies;
+    uint64_t n_copies;
+    int fanout;
+    // reads per iteration, planned and for every CPU x MSR, by scope
+    uint64_t n_reads;
+    uint64_t n_naive;
+    uint64_t scope_reads[MSR_SCOPE_N];
+    uint64_t scope_naive[MSR_SCOPE_N];
+    uint32_t scope_msrs[MSR_SCOPE_N];
+};
+
+/**
+ * Plan reads of msrs from a built table's CPUs, using the topology to find which CPUs
+ * share a core or package.
+ */
+int read_plan_build(struct read_plan *p, const struct cpu_table *t, const uint32_t *msrs,
+                    uint32_t n_msrs, int fanout);
+
+void read_plan_free(struct read_plan *p);
+
+/**
+ * Report the planned reads against reading every MSR on every CPU.
+ */
+void read_plan_print(FILE *f, const struct read_plan *p);
+
+/**
+ * Does the h-th handle of planned group g read the m-th MSR?
+ */
+static inline int read_plan_reads(const struct read_plan *p, uint32_t g, uint32_t h,
+                                  uint32_t m)
+{
+    return p->reads[(uint64_t) (p->groups[g].first + h) * p->n_msrs + m];
+}
+
+/**
+ * Get the row in out of the h-th handle of planned group g.
+ */
+static inline uint32_t read_plan_row(const struct read_plan *p, uint32_t g, uint32_t h)
+{
+    return p->rows[p->groups[g].first + h];
+}
+
+/**
+ * Copy representatives' values to the CPUs that share them, if the plan fans out.
+ */
+static inline void read_plan_fanout(const struct read_plan *p, uint64_t *out)
+{
+    uint64_t i;
+    for (i = 0; p->fanout && i < p->n_copies; i++) {
+        out[p->copies[2 * i + 1]] = out[p->copies[2 * i]];
+    }
+}
+
+#endif // READ_PLAN_H
@@ -0,0 +1,313 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench-stats.h"
+#include "hist.h"
+#include "runner.h"
+#include "sched-counters.h"
+#include "sysenv.h"
+#include "timing.h"
+
+// two-sided 95% critical values of Student's t for 1 to 30 degrees of freedom
+static const double t_975[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static double runner_t(double df)
+{
+    uint32_t i = df < 1 ? 1 : (uint32_t) df;
+    return i <= sizeof(t_975) / sizeof(t_975[0]) ? t_975[i - 1] : 1.960;
+}
+
+// what one strategy measured across its repetitions
+struct runner_result {
+    // time per iteration of every run, and the median iteration latency
+    double *ns;
+    double *p50;
+    uint32_t n;
+    // runs that started or ended with more runnable tasks, or a higher load average, than CPUs
+    uint32_t loaded;
+    // runs after which the governor or turbo differed from the start
+    uint32_t unstable;
+    // scheduling counts summed over all runs, if recorded
+    struct sched_counts sched;
+    uint64_t sched_iters;
+};
+
+struct runner_summary {
+    double mean;
+    double median;
+    double stddev;
+    double ci;
+    double cv;
+};
+
+static int runner_cmp(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void runner_summarize(const double *v, uint32_t n, double *tmp, struct runner_summary *s)
+{
+    double sum = 0;
+    double sq = 0;
+    uint32_t i;
+    memset(s, 0, sizeof(*s));
+    if (!n) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        sum += v[i];
+    }
+    s->mean = sum / n;
+    for (i = 0; i < n; i++) {
+        sq += (v[i] - s->mean) * (v[i] - s->mean);
+    }
+    if (n > 1) {
+        s->stddev = sqrt(sq / (n - 1));
+        s->ci = runner_t(n - 1) * s->stddev / sqrt(n);
+    }
+    s->cv = s->mean > 0 ? 100.0 * s->stddev / s->mean : 0;
+    memcpy(tmp, v, n * sizeof(double));
+    qsort(tmp, n, sizeof(double), runner_cmp);
+    s->median = n % 2 ? tmp[n / 2] : (tmp[n / 2 - 1] + tmp[n / 2]) / 2;
+}
+
+// xorshift64*, enough to shuffle a handful of strategies reproducibly
+static uint64_t runner_rand(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+static void runner_shuffle(uint32_t *order, uint32_t n, uint64_t *state)
+{
+    uint32_t i;
+    uint32_t j;
+    uint32_t t;
+    for (i = n; i > 1; i--) {
+        j = (uint32_t) (runner_rand(state) % i);
+        t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+}
+
+int runner_run_strategy(const char *what, const struct bench_strategy *strategy,
+                        struct bench *ctx, uint32_t warmup)
+{
+    struct bench warm;
+    int rc;
+    if (warmup) {
+        warm = *ctx;
+        warm.iters = warmup;
+        warm.rate = 0;
+        warm.duration = 0;
+        warm.stats = NULL;
+        warm.store = NULL;
+        if ((rc = strategy->run(&warm))) {
+            fprintf(stderr, "%s: %s warmup failed: %s\n", what, strategy->name, strerror(errno));
+            return rc;
+        }
+    }
+    bench_stats_reset(ctx->stats);
+    if ((rc = bench_strategy_run(strategy, ctx))) {
+        fprintf(stderr, "%s: %s failed: %s\n", what, strategy->name, strerror(errno));
+    }
+    return rc;
+}
+
+static int runner_run_one(const struct runner *r, FILE *f, uint32_t rep, uint32_t st,
+                          const struct sysenv *env0, struct runner_result *res)
+{
+    const struct bench_strategy *strategy = r->strategies[st];
+    struct sysenv env;
+    struct sysenv env_end;
+    struct bench ctx = r->base;
+    double elapsed_ns;
+    int loaded;
+    int rc;
+
+    sysenv_snapshot(&env);
+    if ((rc = runner_run_strategy("run", strategy, &ctx, r->warmup))) {
+        return rc;
+    }
+    // the load at either end, since a single snapshot misses load that came or went
+    sysenv_snapshot(&env_end);
+    loaded = sysenv_loaded(&env) || sysenv_loaded(&env_end);
+
+    elapsed_ns = timing_ticks_to_ns(ctx.stats->elapsed);
+    res->ns[res->n] = ctx.stats->iter.count ? elapsed_ns / ctx.stats->iter.count : 0;
+    res->p50[res->n] = timing_ticks_to_ns(hist_percentile(&ctx.stats->iter, 50.0));
+    fprintf(f, "rep %3"PRIu32"  %-24s %12.1f ns/iter %12.0f ns p50%s", rep + 1, strategy->name,
+            res->ns[res->n], res->p50[res->n], loaded ? "  [loaded]" : "");
+    if (ctx.stats->sched) {
+        sched_counts_add(&res->sched, &ctx.stats->sched_driver);
+        sched_counts_add(&res->sched, &ctx.stats->sched_workers);
+        res->sched_iters += ctx.stats->iter.count;
+    }
+    res->n++;
+    res->loaded += loaded;
+    if (sysenv_diff(stderr, strategy->name, env0, &env_end)) {
+        fprintf(f, "  [unstable]");
+        res->unstable++;
+    }
+    fprintf(f, "\n");
+    return 0;
+}
+
+static void runner_report(const struct runner *r, FILE *f, const struct runner_result *res,
+                          double *tmp)
+{
+    struct runner_summary s0;
+    struct runner_summary s;
+    struct runner_summary p;
+    double se;
+    double df;
+    double lo;
+    double hi;
+    double d;
+    uint32_t noisy = 0;
+    uint32_t st;
+    uint32_t i;
+
+    fprintf(f, "\n%-24s %12s %12s %10s %25s %8s %12s\n", "ns/iter", "mean", "median", "stddev",
+            "95% CI", "CV", "p50 median");
+    for (st = 0; st < r->n_strategies; st++) {
+        runner_summarize(res[st].ns, res[st].n, tmp, &s);
+        runner_summarize(res[st].p50, res[st].n, tmp, &p);
+        fprintf(f, "%-24s %12.1f %12.1f %10.1f [%10.1f, %10.1f] %7.2f%% %12.0f%s\n",
+                r->strategies[st]->name, s.mean, s.median, s.stddev, s.mean - s.ci, s.mean + s.ci,
+                s.cv, p.median, s.cv > r->cv_max ? "  NOISY" : "");
+        noisy += s.cv > r->cv_max;
+    }
+
+    // Welch's t interval for the difference of the means, which doesn't assume equal variance
+    if (r->n_strategies > 1 && res[0].n > 1) {
+        runner_summarize(res[0].ns, res[0].n, tmp, &s0);
+        fprintf(f, "\n%-24s %12s %25s\n", "vs", "diff", "95% CI");
+        for (st = 1; st < r->n_strategies; st++) {
+            if (res[st].n < 2) {
+                continue;
+            }
+            runner_summarize(res[st].ns, res[st].n, tmp, &s);
+            d = s.mean - s0.mean;
+            lo = s0.stddev * s0.stddev / res[0].n;
+            hi = s.stddev * s.stddev / res[st].n;
+            se = sqrt(lo + hi);
+            df = se > 0 ? pow(lo + hi, 2) / (lo * lo / (res[0].n - 1) + hi * hi / (res[st].n - 1))
+                        : 1;
+            lo = d - runner_t(df) * se;
+            hi = d + runner_t(df) * se;
+            fprintf(f, "%-24s %+11.2f%% [%+9.2f%%, %+9.2f%%] %s\n", r->strategies[st]->name,
+                    s0.mean > 0 ? 100.0 * d / s0.mean : 0,
+                    s0.mean > 0 ? 100.0 * lo / s0.mean : 0,
+                    s0.mean > 0 ? 100.0 * hi / s0.mean : 0,
+                    lo > 0 || hi < 0 ? "significant" : "not significant");
+        }
+        fprintf(f, "(relative to %s)\n", r->strategies[0]->name);
+    }
+
+    if (res[0].sched_iters) {
+        fprintf(f, "\n%-24s", "Scheduling (per iter)");
+        for (i = 0; i < SCHED_N_COUNTERS; i++) {
+            fprintf(f, " %16s", sched_counter_names[i]);
+        }
+        fprintf(f, "\n");
+        for (st = 0; st < r->n_strategies; st++) {
+            fprintf(f, "%-24s", r->strategies[st]->name);
+            for (i = 0; i < SCHED_N_COUNTERS; i++) {
+                fprintf(f, " %16.3f", res[st].sched_iters ?
+                        (double) res[st].sched.v[i] / res[st].sched_iters : 0);
+            }
+            fprintf(f, "\n");
+        }
+    }
+
+    if (noisy) {
+        fprintf(f, "\nWarning: %"PRIu32" benchmark(s) have a CV above %.1f%%; "
+                "add repetitions or warmup, or quiet the host\n", noisy, r->cv_max);
+    }
+    for (st = 0; st < r->n_strategies; st++) {
+        if (res[st].loaded) {
+            fprintf(f, "Warning: %s: %"PRIu32" of %"PRIu32" runs started or ended with more "
+                    "runnable tasks, or a higher load average, than CPUs\n",
+                    r->strategies[st]->name, res[st].loaded, res[st].n);
+        }
+        if (res[st].unstable) {
+            fprintf(f, "Warning: %s: governor or turbo changed during %"PRIu32" of %"PRIu32
+                    " runs\n", r->strategies[st]->name, res[st].unstable, res[st].n);
+        }
+    }
+}
+
+int runner_run(const struct runner *r, FILE *f)
+{
+    struct runner_result *res;
+    struct sysenv env0;
+    uint64_t state = r->seed ? r->seed : 1;
+    uint32_t *order;
+    double *values;
+    double *tmp;
+    uint32_t rep;
+    uint32_t st;
+    int rc = 0;
+
+    if (!r->base.stats || !r->n_strategies || !r->reps) {
+        errno = EINVAL;
+        return -1;
+    }
+    res = calloc(r->n_strategies, sizeof(struct runner_result));
+    order = malloc(r->n_strategies * sizeof(uint32_t));
+    values = malloc(2 * (size_t) r->n_strategies * r->reps * sizeof(double));
+    tmp = malloc(r->reps * sizeof(double));
+    if (!res || !order || !values || !tmp) {
+        perror("malloc");
+        rc = -1;
+        goto out;
+    }
+    for (st = 0; st < r->n_strategies; st++) {
+        order[st] = st;
+        res[st].ns = &values[2 * (size_t) st * r->reps];
+        res[st].p50 = res[st].ns + r->reps;
+    }
+
+    sysenv_snapshot(&env0);
+    fprintf(f, "Run engine: %"PRIu32" repetitions of %"PRIu32" iterations, "
+            "%"PRIu32" warmup iterations", r->reps, r->base.iters, r->warmup);
+    if (r->shuffle) {
+        fprintf(f, ", shuffled (seed %"PRIu64")", r->seed);
+    }
+    fprintf(f, "\nHost: ");
+    sysenv_print(f, &env0);
+
+    for (rep = 0; rep < r->reps && !rc; rep++) {
+        if (r->shuffle) {
+            runner_shuffle(order, r->n_strategies, &state);
+        }
+        for (st = 0; st < r->n_strategies && !rc; st++) {
+            rc = runner_run_one(r, f, rep, order[st], &env0, &res[order[st]]);
+        }
+    }
+    if (!rc) {
+        runner_report(r, f, res, tmp);
+    }
+
+out:
+    free(tmp);
+    free(values);
+    free(order);
+    free(res);
+    return rc;
+}
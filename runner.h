@@ -0,0 +1,55 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "bench.h"
+
+#ifndef RUNNER_REPS_DEFAULT
+#define RUNNER_REPS_DEFAULT 10
+#endif
+
+#ifndef RUNNER_CV_MAX_DEFAULT
+#define RUNNER_CV_MAX_DEFAULT 5.0
+#endif
+
+/*
+ * Repeat one or more strategies to compare them with confidence: every measured run is
+ * preceded by untimed warmup iterations, repetitions are interleaved across strategies
+ * (optionally in a random order each round) so slow drift in the host hits all of them
+ * alike, and each strategy is summarized by the mean, median, stddev, and 95% confidence
+ * interval of its per-run time per iteration. Runs are flagged as noisy if their
+ * coefficient of variation is too high, or if the frequency governor, turbo, or run-queue
+ * load wasn't stable while they ran.
+ */
+struct runner {
+    // template for every run; stats is required and reset per run
+    struct bench base;
+    const struct bench_strategy **strategies;
+    uint32_t n_strategies;
+    // untimed iterations before every measured run
+    uint32_t warmup;
+    uint32_t reps;
+    // run the strategies in a new random order every repetition
+    int shuffle;
+    uint64_t seed;
+    // flag strategies whose coefficient of variation exceeds this, in percent
+    double cv_max;
+};
+
+/**
+ * One measured run: warmup untimed iterations of strategy as configured in ctx, then a timed
+ * run into ctx's stats, which are reset first. Failures are reported to stderr prefixed with
+ * what. Returns non-zero if either run failed.
+ */
+int runner_run_strategy(const char *what, const struct bench_strategy *strategy,
+                        struct bench *ctx, uint32_t warmup);
+
+/**
+ * Run every repetition and write the per-run results and the summary to f.
+ * Returns non-zero if any run failed, or -1 with errno set on other errors.
+ */
+int runner_run(const struct runner *r, FILE *f);
+
+#endif // RUNNER_H
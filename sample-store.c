@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "sample-store.h"
+#include "timing.h"
+
+struct sample_store {
+    void *base;
+    size_t size;
+    int fd;
+    uint32_t n_groups;
+    uint32_t depth;
+    uint64_t block_size;
+    // index of each group's first block
+    uint32_t *group_first;
+};
+
+static size_t sample_store_align(size_t n, size_t a)
+{
+    return (n + a - 1) / a * a;
+}
+
+struct sample_store *sample_store_alloc(uint32_t n_groups, const uint32_t *n_cpus,
+                                        const uint32_t *cpus, const uint32_t *msrs,
+                                        uint32_t n_msrs, uint32_t depth, const char *path)
+{
+    struct sample_store *s;
+    struct sample_store_hdr *hdr;
+    struct sample_store_cpu *sc;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t hdr_size;
+    uint32_t n_total = 0;
+    uint32_t g;
+    uint32_t h;
+    uint32_t i;
+
+    if (!depth) {
+        errno = EINVAL;
+        return NULL;
+    }
+    s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->fd = -1;
+    s->n_groups = n_groups;
+    s->depth = depth;
+    s->group_first = malloc((n_groups + 1) * sizeof(uint32_t));
+    if (!s->group_first) {
+        perror("malloc");
+        free(s);
+        return NULL;
+    }
+    for (g = 0; g < n_groups; g++) {
+        s->group_first[g] = n_total;
+        n_total += n_cpus[g];
+    }
+    s->group_first[n_groups] = n_total;
+
+    hdr_size = sample_store_align(sizeof(struct sample_store_hdr) + n_msrs * sizeof(uint32_t) +
+                                  n_total * sizeof(struct sample_store_cpu), page);
+    // timestamps plus one column per MSR
+    s->block_size = sample_store_align(sizeof(struct sample_block) +
+                                       (uint64_t) (n_msrs + 1) * depth * sizeof(uint64_t), page);
+    s->size = hdr_size + n_total * s->block_size;
+
+    if (path) {
+        if ((s->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            goto fail;
+        }
+        if (ftruncate(s->fd, (off_t) s->size)) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            goto fail;
+        }
+        s->base = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    } else {
+        s->base = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (s->base == MAP_FAILED) {
+        perror("mmap");
+        s->base = NULL;
+        goto fail;
+    }
+
+    // only the header is written now - blocks are left for their writers to touch first
+    hdr = (struct sample_store_hdr *)s->base;
+    memcpy(hdr->magic, SAMPLE_STORE_MAGIC, sizeof(hdr->magic));
+    hdr->version = SAMPLE_STORE_VERSION;
+    hdr->n_groups = n_groups;
+    hdr->n_cpus = n_total;
+    hdr->n_msrs = n_msrs;
+    hdr->depth = depth;
+    hdr->reserved = 0;
+    hdr->block_offset = hdr_size;
+    hdr->block_size = s->block_size;
+    hdr->ns_per_tick = timing_ticks_to_ns(1.0);
+    memcpy(hdr + 1, msrs, n_msrs * sizeof(uint32_t));
+    sc = (struct sample_store_cpu *)((uint32_t *)(hdr + 1) + n_msrs);
+    for (g = 0, i = 0; g < n_groups; g++) {
+        for (h = 0; h < n_cpus[g]; h++, i++) {
+            sc[i].group = g;
+            sc[i].cpu = cpus[i];
+        }
+    }
+    return s;
+
+fail:
+    sample_store_free(s);
+    return NULL;
+}
+
+void sample_store_free(struct sample_store *s)
+{
+    if (s) {
+        if (s->base) {
+            munmap(s->base, s->size);
+        }
+        if (s->fd >= 0) {
+            close(s->fd);
+        }
+        free(s->group_first);
+        free(s);
+    }
+}
+
+struct sample_block *sample_store_block(const struct sample_store *s, uint32_t g, uint32_t h)
+{
+    const struct sample_store_hdr *hdr = (const struct sample_store_hdr *)s->base;
+    return (struct sample_block *)((char *)s->base + hdr->block_offset +
+                                   (s->group_first[g] + h) * s->block_size);
+}
+
+void sample_store_touch(struct sample_store *s, uint32_t g, uint32_t h_first, uint32_t n)
+{
+    const struct sample_store_cpu *sc;
+    const struct sample_store_hdr *hdr = (const struct sample_store_hdr *)s->base;
+    struct sample_block *b;
+    uint32_t h;
+    sc = (const struct sample_store_cpu *)((const uint32_t *)(hdr + 1) + hdr->n_msrs);
+    for (h = h_first; h < h_first + n; h++) {
+        b = sample_store_block(s, g, h);
+        memset(b, 0, s->block_size);
+        b->group = g;
+        b->cpu = sc[s->group_first[g] + h].cpu;
+        b->depth = s->depth;
+    }
+}
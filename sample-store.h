@@ -0,0 +1,106 @@
+#ifndef SAMPLE_STORE_H
+#define SAMPLE_STORE_H
+
+#include <inttypes.h>
+
+/*
+ * Columnar ring buffer of sampled MSR values, preallocated so storing costs no more than
+ * a real telemetry agent's: one page-aligned block per CPU, holding a timestamp column and
+ * one value column per MSR, each depth rows deep. Rows wrap once depth is exceeded.
+ *
+ * Blocks aren't touched at allocation, so each lands on the NUMA node of the thread that
+ * first touches it (see sample_store_touch()).
+ *
+ * The store can be backed by a file, which is then a self-describing capture:
+ *
+ *   struct sample_store_hdr
+ *   uint32_t msrs[n_msrs]
+ *   struct sample_store_cpu cpus[n_cpus]
+ *   (padding to block_offset)
+ *   n_cpus blocks of block_size bytes: struct sample_block,
+ *     uint64_t ts[depth], uint64_t val[n_msrs][depth]
+ *
+ * All fields are native-endian. Row r of a block holds sample r % depth; block.seq is the
+ * number of rows written, so the newest row is (seq - 1) % depth.
+ */
+
+#define SAMPLE_STORE_MAGIC      "MSRSTORE"
+#define SAMPLE_STORE_VERSION    1
+
+#ifndef SAMPLE_STORE_DEPTH_DEFAULT
+#define SAMPLE_STORE_DEPTH_DEFAULT 1024
+#endif
+
+struct sample_store_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_groups;
+    uint32_t n_cpus;
+    uint32_t n_msrs;
+    uint32_t depth;
+    uint32_t reserved;
+    uint64_t block_offset;
+    uint64_t block_size;
+    // converts timestamps (timing ticks) to nanoseconds
+    double ns_per_tick;
+};
+
+struct sample_store_cpu {
+    uint32_t group;
+    uint32_t cpu;
+};
+
+struct sample_block {
+    uint64_t seq;
+    uint32_t group;
+    uint32_t cpu;
+    uint32_t depth;
+    uint32_t reserved;
+    uint64_t pad[5];
+    uint64_t data[];
+} __attribute__((aligned(64)));
+
+struct sample_store;
+
+/**
+ * Allocate a store for n_groups groups, where group g has the n_cpus[g] CPUs listed
+ * group-major in cpus. If path is non-NULL, the store is a shared mapping of that file.
+ */
+struct sample_store *sample_store_alloc(uint32_t n_groups, const uint32_t *n_cpus,
+                                        const uint32_t *cpus, const uint32_t *msrs,
+                                        uint32_t n_msrs, uint32_t depth, const char *path);
+
+/**
+ * Unmap the store. A file-backed store's contents remain in the file.
+ */
+void sample_store_free(struct sample_store *s);
+
+/**
+ * Get the block of the h-th CPU in group g.
+ */
+struct sample_block *sample_store_block(const struct sample_store *s, uint32_t g, uint32_t h);
+
+/**
+ * Initialize the blocks of CPUs [h_first, h_first + n) of group g from the calling thread,
+ * faulting them in on its NUMA node. Each block must be touched before it's written.
+ */
+void sample_store_touch(struct sample_store *s, uint32_t g, uint32_t h_first, uint32_t n);
+
+/**
+ * Store value of the m-th MSR into the block's current row. Single writer per block.
+ */
+static inline void sample_block_put(struct sample_block *b, uint32_t m, uint64_t value)
+{
+    b->data[(uint64_t) (m + 1) * b->depth + b->seq % b->depth] = value;
+}
+
+/**
+ * Timestamp the current row and advance to the next.
+ */
+static inline void sample_block_commit(struct sample_block *b, uint64_t ts)
+{
+    b->data[b->seq % b->depth] = ts;
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif // SAMPLE_STORE_H
@@ -0,0 +1,113 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sched-counters.h"
+
+const char *const sched_counter_names[SCHED_N_COUNTERS] = {
+    [SCHED_COUNTER_CONTEXT_SWITCHES] = "context switches",
+    [SCHED_COUNTER_MIGRATIONS] = "cpu migrations",
+    [SCHED_COUNTER_TASK_CLOCK] = "task clock (ns)",
+    [SCHED_COUNTER_PAGE_FAULTS] = "page faults",
+    [SCHED_COUNTER_INVOLUNTARY] = "involuntary",
+};
+
+static const uint64_t sched_perf_configs[SCHED_N_PERF_COUNTERS] = {
+    [SCHED_COUNTER_CONTEXT_SWITCHES] = PERF_COUNT_SW_CONTEXT_SWITCHES,
+    [SCHED_COUNTER_MIGRATIONS] = PERF_COUNT_SW_CPU_MIGRATIONS,
+    [SCHED_COUNTER_TASK_CLOCK] = PERF_COUNT_SW_TASK_CLOCK,
+    [SCHED_COUNTER_PAGE_FAULTS] = PERF_COUNT_SW_PAGE_FAULTS,
+};
+
+static long sched_nivcsw(void)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru)) {
+        return 0;
+    }
+    return ru.ru_nivcsw;
+}
+
+int sched_counters_open(struct sched_counters *c)
+{
+    struct perf_event_attr attr;
+    uint32_t i;
+    int e;
+    for (i = 0; i < SCHED_N_PERF_COUNTERS; i++) {
+        c->fds[i] = -1;
+    }
+    for (i = 0; i < SCHED_N_PERF_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = sched_perf_configs[i];
+        attr.read_format = PERF_FORMAT_GROUP;
+        c->fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, i ? c->fds[0] : -1,
+                                  PERF_FLAG_FD_CLOEXEC);
+        if (c->fds[i] < 0) {
+            e = errno;
+            fprintf(stderr, "perf_event_open: %s: %s\n", sched_counter_names[i], strerror(e));
+            sched_counters_close(c);
+            errno = e;
+            return -1;
+        }
+    }
+    c->nivcsw = sched_nivcsw();
+    return 0;
+}
+
+int sched_counters_reset(struct sched_counters *c)
+{
+    if (ioctl(c->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP)) {
+        perror("ioctl: PERF_EVENT_IOC_RESET");
+        return -1;
+    }
+    c->nivcsw = sched_nivcsw();
+    return 0;
+}
+
+int sched_counters_read(struct sched_counters *c, struct sched_counts *counts)
+{
+    // nr followed by one value per event, in the order they joined the group
+    uint64_t buf[1 + SCHED_N_PERF_COUNTERS];
+    uint32_t i;
+    ssize_t n = read(c->fds[0], buf, sizeof(buf));
+    if (n != (ssize_t) sizeof(buf) || buf[0] != SCHED_N_PERF_COUNTERS) {
+        if (n >= 0) {
+            errno = EIO;
+        }
+        perror("read: sched counters");
+        return -1;
+    }
+    for (i = 0; i < SCHED_N_PERF_COUNTERS; i++) {
+        counts->v[i] += buf[1 + i];
+    }
+    counts->v[SCHED_COUNTER_INVOLUNTARY] += (uint64_t) (sched_nivcsw() - c->nivcsw);
+    return 0;
+}
+
+void sched_counters_close(struct sched_counters *c)
+{
+    uint32_t i;
+    // members before the leader
+    for (i = SCHED_N_PERF_COUNTERS; i > 0; i--) {
+        if (c->fds[i - 1] >= 0) {
+            close(c->fds[i - 1]);
+            c->fds[i - 1] = -1;
+        }
+    }
+}
+
+void sched_counts_add(struct sched_counts *dst, const struct sched_counts *src)
+{
+    uint32_t i;
+    for (i = 0; i < SCHED_N_COUNTERS; i++) {
+        dst->v[i] += src->v[i];
+    }
+}
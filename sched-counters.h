@@ -0,0 +1,59 @@
+#ifndef SCHED_COUNTERS_H
+#define SCHED_COUNTERS_H
+
+#include <inttypes.h>
+#include <sys/resource.h>
+
+/*
+ * Kernel scheduling counters for one thread: software perf events for context switches, CPU
+ * migrations, task clock, and page faults, plus involuntary context switches from rusage.
+ * The perf events are one group, so the counters are read together with a single read().
+ */
+
+enum sched_counter {
+    SCHED_COUNTER_CONTEXT_SWITCHES,
+    SCHED_COUNTER_MIGRATIONS,
+    SCHED_COUNTER_TASK_CLOCK,
+    SCHED_COUNTER_PAGE_FAULTS,
+    // perf events above, rusage below
+    SCHED_COUNTER_INVOLUNTARY,
+    SCHED_N_COUNTERS,
+};
+
+#define SCHED_N_PERF_COUNTERS SCHED_COUNTER_INVOLUNTARY
+
+// task clock is in ns, the rest are event counts
+struct sched_counts {
+    uint64_t v[SCHED_N_COUNTERS];
+};
+
+struct sched_counters {
+    // the first is the group leader
+    int fds[SCHED_N_PERF_COUNTERS];
+    // involuntary context switches at the last reset
+    long nivcsw;
+};
+
+extern const char *const sched_counter_names[SCHED_N_COUNTERS];
+
+/**
+ * Open and start counters for the calling thread.
+ */
+int sched_counters_open(struct sched_counters *c);
+
+/**
+ * Restart counting from zero. Must be called by the thread that opened c.
+ */
+int sched_counters_reset(struct sched_counters *c);
+
+/**
+ * Add the counts since opening or the last reset to counts.
+ * Must be called by the thread that opened c.
+ */
+int sched_counters_read(struct sched_counters *c, struct sched_counts *counts);
+
+void sched_counters_close(struct sched_counters *c);
+
+void sched_counts_add(struct sched_counts *dst, const struct sched_counts *src);
+
+#endif // SCHED_COUNTERS_H
@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "hist.h"
+#include "msr-shm.h"
+#include "shm-bench.h"
+#include "timing.h"
+
+static volatile sig_atomic_t shm_bench_stopping;
+
+static void shm_bench_stop(int sig)
+{
+    (void) sig;
+    shm_bench_stopping = 1;
+}
+
+static uint64_t shm_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void shm_bench_print_hist(FILE *f, const char *name, const struct hist *h, double scale)
+{
+    if (!h->count) {
+        fprintf(f, "%-16s %12"PRIu64"\n", name, h->count);
+        return;
+    }
+    fprintf(f, "%-16s %12"PRIu64" %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+            name, h->count, h->min * scale, hist_percentile(h, 50.0) * scale,
+            hist_percentile(h, 99.0) * scale, hist_percentile(h, 99.9) * scale,
+            h->max * scale, hist_mean(h) * scale);
+}
+
+static void shm_bench_print_header(FILE *f)
+{
+    fprintf(f, "%-16s %12s %10s %10s %10s %10s %10s %10s\n", "Latency (ns)", "count", "min",
+            "p50", "p99", "p99.9", "max", "mean");
+}
+
+int shm_bench_publish(const struct bench *ctx, const struct bench_strategy *strategy,
+                      const uint32_t *cpus, uint32_t n_cpus, const char *name, FILE *f)
+{
+    struct bench run = *ctx;
+    struct bench_session *session;
+    struct msr_shm *shm;
+    struct sigaction sa;
+    struct sigaction old_int;
+    struct sigaction old_term;
+    struct timespec ts;
+    struct hist sample;
+    uint64_t *values;
+    double rate = ctx->rate > 0 ? ctx->rate : SHM_BENCH_RATE_DEFAULT;
+    uint64_t interval = (uint64_t) (1e9 / rate);
+    uint64_t end = 0;
+    uint64_t missed = 0;
+    uint64_t next;
+    uint64_t now;
+    uint64_t t0;
+    uint64_t k;
+    int rc = 0;
+    int err;
+
+    if (!strategy->session) {
+        fprintf(stderr, "%s can't take one sample at a time, so it can't publish\n",
+                strategy->name);
+        errno = ENOTSUP;
+        return -1;
+    }
+    values = calloc((size_t) n_cpus * ctx->n_msrs, sizeof(uint64_t));
+    if (!values) {
+        perror("calloc");
+        return -1;
+    }
+    shm = msr_shm_create(name, cpus, n_cpus, ctx->msrs, ctx->n_msrs, interval);
+    if (!shm) {
+        free(values);
+        return -1;
+    }
+    // one lockstep sample per period, written straight into the buffer that's published
+    run.iters = 1;
+    run.pipeline_depth = 1;
+    run.rate = 0;
+    run.duration = 0;
+    run.stats = NULL;
+    run.store = NULL;
+    run.sched = NULL;
+    run.out = values;
+    session = bench_session_start(strategy, &run);
+    if (!session) {
+        err = errno;
+        msr_shm_close(shm);
+        free(values);
+        errno = err;
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = shm_bench_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+    shm_bench_stopping = 0;
+
+    fprintf(f, "Publishing %"PRIu32" CPUs x %"PRIu32" MSRs to %s at %.1f Hz with %s\n",
+            n_cpus, ctx->n_msrs, name, rate, strategy->name);
+    fflush(f);
+    hist_reset(&sample);
+    next = shm_bench_now();
+    if (ctx->duration > 0) {
+        end = next + (uint64_t) (ctx->duration * 1e9);
+    }
+    while (!shm_bench_stopping) {
+        t0 = shm_bench_now();
+        if ((rc = bench_session_sample(session))) {
+            break;
+        }
+        now = shm_bench_now();
+        msr_shm_publish(shm, now, values);
+        hist_record(&sample, now - t0);
+        if (end && now >= end) {
+            break;
+        }
+        // overruns skip slots rather than bursting to catch up
+        next += interval;
+        if (next <= now) {
+            k = (now - next) / interval + 1;
+            missed += k;
+            next += k * interval;
+        }
+        ts.tv_sec = (time_t) (next / 1000000000ull);
+        ts.tv_nsec = (long) (next % 1000000000ull);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    err = errno;
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    fprintf(f, "Published: %"PRIu64" samples, missed: %"PRIu64" slots\n",
+            msr_shm_get_hdr(shm)->samples, missed);
+    shm_bench_print_header(f);
+    shm_bench_print_hist(f, "sample", &sample, 1.0);
+    if (rc) {
+        bench_session_stop(session);
+    } else {
+        rc = bench_session_stop(session);
+        err = errno;
+    }
+    msr_shm_close(shm);
+    free(values);
+    errno = err;
+    return rc;
+}
+
+int shm_bench_consume(const char *name, uint32_t iters, FILE *f)
+{
+    const struct msr_shm_hdr *hdr;
+    struct msr_shm *shm;
+    struct timespec poll = { 0, 1000000 };
+    struct hist read;
+    struct hist pass;
+    struct hist age;
+    uint64_t *values = NULL;
+    uint64_t *last = NULL;
+    uint64_t samples0;
+    uint64_t samples1;
+    uint64_t sample;
+    uint64_t ns;
+    uint64_t t_pass;
+    uint64_t t;
+    uint64_t retries = 0;
+    uint64_t retried = 0;
+    uint64_t updates = 0;
+    uint64_t torn = 0;
+    uint64_t stuck = 0;
+    uint64_t backwards = 0;
+    uint32_t waited;
+    uint32_t it;
+    uint32_t row;
+    int r;
+    int rc = -1;
+
+    shm = msr_shm_open(name);
+    if (!shm) {
+        return -1;
+    }
+    hdr = msr_shm_get_hdr(shm);
+    values = malloc(hdr->n_msrs * sizeof(uint64_t));
+    last = calloc(hdr->n_rows, sizeof(uint64_t));
+    if (!values || !last) {
+        perror("malloc");
+        goto out;
+    }
+    for (waited = 0; !atomic_load(&hdr->samples); waited++) {
+        if (waited == SHM_BENCH_WAIT_MS) {
+            fprintf(stderr, "%s: No samples published\n", name);
+            errno = ETIMEDOUT;
+            goto out;
+        }
+        nanosleep(&poll, NULL);
+    }
+    fprintf(f, "Consuming %s: %"PRIu32" CPUs x %"PRIu32" MSRs from pid %"PRId64" at %.1f Hz\n",
+            name, hdr->n_rows, hdr->n_msrs, hdr->pid,
+            hdr->interval_ns ? 1e9 / hdr->interval_ns : 0.0);
+
+    hist_reset(&read);
+    hist_reset(&pass);
+    hist_reset(&age);
+    samples0 = atomic_load(&hdr->samples);
+    for (it = 0; it < iters; it++) {
+        t_pass = timing_now();
+        for (row = 0; row < hdr->n_rows; row++) {
+            t = timing_now();
+            r = msr_shm_read_row(shm, row, values, &sample, &ns);
+            hist_record(&read, timing_now() - t);
+            if (r < 0) {
+                if (errno == EIO) {
+                    torn++;
+                } else {
+                    stuck++;
+                }
+                continue;
+            }
+            retries += (uint64_t) r;
+            retried += r > 0;
+            if (sample < last[row]) {
+                backwards++;
+            } else if (last[row] && sample > last[row]) {
+                updates++;
+            }
+            last[row] = sample;
+            t = shm_bench_now();
+            hist_record(&age, t > ns ? t - ns : 0);
+        }
+        hist_record(&pass, timing_now() - t_pass);
+    }
+    samples1 = atomic_load(&hdr->samples);
+
+    fprintf(f, "Row reads: %"PRIu64", retried: %"PRIu64" (%"PRIu64" retries), "
+            "updates seen: %"PRIu64", samples published meanwhile: %"PRIu64"\n",
+            read.count, retried, retries, updates, samples1 - samples0);
+    fprintf(f, "Consistency: %"PRIu64" torn, %"PRIu64" out of order, %"PRIu64" stuck\n",
+            torn, backwards, stuck);
+    shm_bench_print_header(f);
+    shm_bench_print_hist(f, "row", &read, timing_ticks_to_ns(1.0));
+    shm_bench_print_hist(f, "pass", &pass, timing_ticks_to_ns(1.0));
+    shm_bench_print_hist(f, "age", &age, 1.0);
+    if (torn || backwards || stuck) {
+        errno = EIO;
+        goto out;
+    }
+    rc = 0;
+
+out:
+    free(values);
+    free(last);
+    msr_shm_close(shm);
+    return rc;
+}
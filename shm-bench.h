@@ -0,0 +1,39 @@
+#ifndef SHM_BENCH_H
+#define SHM_BENCH_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "bench.h"
+
+#ifndef SHM_BENCH_RATE_DEFAULT
+#define SHM_BENCH_RATE_DEFAULT 10.0
+#endif
+
+// how long a consumer waits for the first sample
+#ifndef SHM_BENCH_WAIT_MS
+#define SHM_BENCH_WAIT_MS 5000
+#endif
+
+/*
+ * Share one sampler between many local tools: the publisher reads every CPU's MSRs once per
+ * period with a strategy's session and publishes them to an msr-shm segment, and the
+ * consumer benchmark measures what reading that segment costs, and checks that every row
+ * it reads is consistent, while the publisher updates it.
+ */
+
+/**
+ * Publish samples of ctx's CPUs (cpus, in table order) and MSRs to segment name, at
+ * ctx->rate (or SHM_BENCH_RATE_DEFAULT) Hz, for ctx->duration seconds or until SIGINT or
+ * SIGTERM. Reports the sampling cost to f on exit.
+ */
+int shm_bench_publish(const struct bench *ctx, const struct bench_strategy *strategy,
+                      const uint32_t *cpus, uint32_t n_cpus, const char *name, FILE *f);
+
+/**
+ * Read every row of segment name iters times, and report the cost per row and per pass,
+ * retries, the age of the values, and any torn or out-of-order rows, which fail the run.
+ */
+int shm_bench_consume(const char *name, uint32_t iters, FILE *f);
+
+#endif // SHM_BENCH_H
@@ -0,0 +1,303 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench-stats.h"
+#include "hist.h"
+#include "sched-counters.h"
+#include "sweep.h"
+#include "timing.h"
+
+static const char *const shape_names[] = {
+    [SWEEP_SHAPE_BLOCK] = "block",
+    [SWEEP_SHAPE_INTERLEAVE] = "interleave",
+};
+
+static const char *const format_names[] = {
+    [SWEEP_FORMAT_CSV] = "csv",
+    [SWEEP_FORMAT_JSON] = "json",
+};
+
+int sweep_shape_parse(const char *name, enum sweep_shape *shape)
+{
+    uint32_t i;
+    for (i = 0; i < sizeof(shape_names) / sizeof(shape_names[0]); i++) {
+        if (!strcmp(name, shape_names[i])) {
+            *shape = (enum sweep_shape) i;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int sweep_format_parse(const char *name, enum sweep_format *format)
+{
+    uint32_t i;
+    for (i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+        if (!strcmp(name, format_names[i])) {
+            *format = (enum sweep_format) i;
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+int sweep_list_parse(const char *s, uint32_t **list, uint32_t *n)
+{
+    const char *p;
+    char *end;
+    unsigned long v;
+    uint32_t cap = 1;
+    for (p = s; *p; p++) {
+        if (*p == ',') {
+            cap++;
+        }
+    }
+    *list = malloc(cap * sizeof(uint32_t));
+    if (!*list) {
+        perror("malloc");
+        return -1;
+    }
+    *n = 0;
+    for (p = s; *n < cap; p = end + 1) {
+        errno = 0;
+        v = strtoul(p, &end, 0);
+        if (errno || end == p || !v || v > UINT32_MAX || (*end && *end != ',')) {
+            fprintf(stderr, "Bad list: %s\n", s);
+            free(*list);
+            *list = NULL;
+            errno = EINVAL;
+            return -1;
+        }
+        (*list)[(*n)++] = (uint32_t) v;
+        if (!*end) {
+            break;
+        }
+    }
+    return 0;
+}
+
+// split the first n_cpus handles into n_groups groups of nearly equal size
+static void sweep_shape_groups(const struct sweep *sw, enum sweep_shape shape,
+                               uint32_t n_cpus, uint32_t n_groups,
+                               struct msr_handle **slots, struct bench_cpu_group *groups)
+{
+    uint32_t first = 0;
+    uint32_t g;
+    uint32_t h;
+    for (g = 0; g < n_groups; g++) {
+        groups[g].handles = &slots[first];
+        groups[g].n_handles = n_cpus / n_groups + (g < n_cpus % n_groups);
+        groups[g].first = first;
+        for (h = 0; h < groups[g].n_handles; h++) {
+            if (shape == SWEEP_SHAPE_BLOCK) {
+                slots[first + h] = sw->handles[first + h];
+            } else {
+                slots[first + h] = sw->handles[g + h * n_groups];
+            }
+        }
+        first += groups[g].n_handles;
+    }
+}
+
+static void sweep_header(const struct sweep *sw, FILE *f)
+{
+    if (sw->format == SWEEP_FORMAT_CSV) {
+        fprintf(f, "strategy,shape,cpus,groups,msrs,depth,layout,iterations,reads,elapsed_ns,"
+                "reads_per_s,"
+                "ns_per_read,iter_p50_ns,iter_p99_ns,iter_mean_ns,read_p50_ns,read_p99_ns,"
+                "skew_p50_ns,skew_p99_ns,missed,migrate_p50_ns,first_p50_ns,local_pct,"
+                "cs_per_iter,migrations_per_iter,task_clock_ns_per_iter,faults_per_iter,"
+                "involuntary_per_iter\n");
+    } else {
+        fprintf(f, "[");
+    }
+}
+
+// one combination of the grid
+struct sweep_point {
+    const struct bench_strategy *strategy;
+    enum sweep_shape shape;
+    uint32_t cpus;
+    uint32_t groups;
+    uint32_t msrs;
+    uint32_t depth;
+};
+
+static void sweep_row(const struct sweep *sw, FILE *f, int is_first, const struct sweep_point *pt,
+                      const struct bench_stats *s, const struct bench_group_stats *all)
+{
+    const struct hist *read = &all->read;
+    uint64_t issued = all->local + all->remote;
+    double local_pct = issued ? 100.0 * all->local / issued : 0;
+    uint64_t reads = (uint64_t) pt->cpus * pt->msrs * s->iter.count;
+    double elapsed_ns = timing_ticks_to_ns(s->elapsed);
+    double reads_per_s = elapsed_ns > 0 ? reads / (elapsed_ns / 1e9) : 0;
+    double ns_per_read = reads ? elapsed_ns / reads : 0;
+    double sched[SCHED_N_COUNTERS];
+    // empty (null) unless the strategy's threads follow it
+    const char *layout = bench_strategy_has_thr_layout(pt->strategy) ?
+                         bench_thr_layout_name(sw->base.thr_layout) : NULL;
+    uint32_t i;
+    // empty (0) unless --sched-counters
+    for (i = 0; i < SCHED_N_COUNTERS; i++) {
+        sched[i] = s->iter.count ? (double) (s->sched_driver.v[i] + s->sched_workers.v[i]) /
+                                   s->iter.count : 0;
+    }
+    if (sw->format == SWEEP_FORMAT_CSV) {
+        fprintf(f, "%s,%s,%"PRIu32",%"PRIu32",%"PRIu32",%"PRIu32",%s,%"PRIu64",%"PRIu64",%.0f,"
+                "%.0f,%.1f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%"PRIu64",%.0f,%.0f,%.2f,"
+                "%.3f,%.3f,%.0f,%.3f,%.3f\n",
+                pt->strategy->name, shape_names[pt->shape], pt->cpus, pt->groups, pt->msrs,
+                pt->depth, layout ? layout : "",
+                s->iter.count, reads, elapsed_ns, reads_per_s, ns_per_read,
+                timing_ticks_to_ns(hist_percentile(&s->iter, 50.0)),
+                timing_ticks_to_ns(hist_percentile(&s->iter, 99.0)),
+                timing_ticks_to_ns(hist_mean(&s->iter)),
+                timing_ticks_to_ns(hist_percentile(read, 50.0)),
+                timing_ticks_to_ns(hist_percentile(read, 99.0)),
+                timing_ticks_to_ns(hist_percentile(&s->skew, 50.0)),
+                timing_ticks_to_ns(hist_percentile(&s->skew, 99.0)),
+                s->missed,
+                timing_ticks_to_ns(hist_percentile(&all->migrate, 50.0)),
+                timing_ticks_to_ns(hist_percentile(&all->first, 50.0)),
+                local_pct, sched[SCHED_COUNTER_CONTEXT_SWITCHES],
+                sched[SCHED_COUNTER_MIGRATIONS], sched[SCHED_COUNTER_TASK_CLOCK],
+                sched[SCHED_COUNTER_PAGE_FAULTS], sched[SCHED_COUNTER_INVOLUNTARY]);
+    } else {
+        fprintf(f, "%s\n  {\"strategy\": \"%s\", \"shape\": \"%s\", \"cpus\": %"PRIu32", "
+                "\"groups\": %"PRIu32", \"msrs\": %"PRIu32", \"depth\": %"PRIu32", "
+                "\"layout\": %s%s%s, \"iterations\": %"PRIu64", "
+                "\"reads\": %"PRIu64", \"elapsed_ns\": %.0f, \"reads_per_s\": %.0f, "
+                "\"ns_per_read\": %.1f, \"iter_p50_ns\": %.0f, \"iter_p99_ns\": %.0f, "
+                "\"iter_mean_ns\": %.0f, \"read_p50_ns\": %.0f, \"read_p99_ns\": %.0f, "
+                "\"skew_p50_ns\": %.0f, \"skew_p99_ns\": %.0f, \"missed\": %"PRIu64", "
+                "\"migrate_p50_ns\": %.0f, "
+                "\"first_p50_ns\": %.0f, \"local_pct\": %.2f, \"cs_per_iter\": %.3f, "
+                "\"migrations_per_iter\": %.3f, \"task_clock_ns_per_iter\": %.0f, "
+                "\"faults_per_iter\": %.3f, \"involuntary_per_iter\": %.3f}",
+                is_first ? "" : ",",
+                pt->strategy->name, shape_names[pt->shape], pt->cpus, pt->groups, pt->msrs,
+                pt->depth, layout ? "\"" : "", layout ? layout : "null", layout ? "\"" : "",
+                s->iter.count, reads, elapsed_ns, reads_per_s, ns_per_read,
+                timing_ticks_to_ns(hist_percentile(&s->iter, 50.0)),
+                timing_ticks_to_ns(hist_percentile(&s->iter, 99.0)),
+                timing_ticks_to_ns(hist_mean(&s->iter)),
+                timing_ticks_to_ns(hist_percentile(read, 50.0)),
+                timing_ticks_to_ns(hist_percentile(read, 99.0)),
+                timing_ticks_to_ns(hist_percentile(&s->skew, 50.0)),
+                timing_ticks_to_ns(hist_percentile(&s->skew, 99.0)),
+                s->missed,
+                timing_ticks_to_ns(hist_percentile(&all->migrate, 50.0)),
+                timing_ticks_to_ns(hist_percentile(&all->first, 50.0)),
+                local_pct, sched[SCHED_COUNTER_CONTEXT_SWITCHES],
+                sched[SCHED_COUNTER_MIGRATIONS], sched[SCHED_COUNTER_TASK_CLOCK],
+                sched[SCHED_COUNTER_PAGE_FAULTS], sched[SCHED_COUNTER_INVOLUNTARY]);
+    }
+    // long sweeps are easier to watch, and a crash keeps the rows so far
+    fflush(f);
+}
+
+static int sweep_run_one(const struct sweep *sw, FILE *f, const struct sweep_point *pt,
+                         struct msr_handle **slots,
+                         struct bench_cpu_group *groups, uint32_t *n_rows)
+{
+    struct bench ctx;
+    struct bench_group_stats *all;
+    int rc = 0;
+    if (pt->cpus > sw->n_handles || pt->groups > pt->cpus || pt->msrs > sw->base.n_msrs) {
+        return 0;
+    }
+    sweep_shape_groups(sw, pt->shape, pt->cpus, pt->groups, slots, groups);
+    ctx = sw->base;
+    ctx.cpu_groups = groups;
+    ctx.n_cpu_groups = pt->groups;
+    ctx.n_msrs = pt->msrs;
+    ctx.pipeline_depth = pt->depth;
+    ctx.stats = bench_stats_alloc(ctx.n_cpu_groups);
+    if (!ctx.stats) {
+        return -1;
+    }
+    if (bench_strategy_run(pt->strategy, &ctx)) {
+        fprintf(stderr, "sweep: %s failed with %"PRIu32" cpus, %"PRIu32" groups, "
+                "%"PRIu32" msrs, depth %"PRIu32": %s\n", pt->strategy->name, pt->cpus,
+                pt->groups, pt->msrs, pt->depth, strerror(errno));
+        rc = -1;
+    } else if (!(all = bench_stats_merge_all(ctx.stats))) {
+        rc = -1;
+    } else {
+        sweep_row(sw, f, !*n_rows, pt, ctx.stats, all);
+        bench_stats_merge_free(all);
+        (*n_rows)++;
+    }
+    bench_stats_free(ctx.stats);
+    return rc;
+}
+
+int sweep_run(const struct sweep *sw, FILE *f)
+{
+    struct sweep_point pt;
+    struct bench_cpu_group *groups;
+    struct msr_handle **slots;
+    uint32_t max_groups = 0;
+    uint32_t n_rows = 0;
+    uint32_t st;
+    uint32_t sh;
+    uint32_t c;
+    uint32_t g;
+    uint32_t m;
+    uint32_t d;
+    uint32_t n_depths;
+    int is_pipelined;
+    int rc = 0;
+
+    for (g = 0; g < sw->n_groups; g++) {
+        if (sw->groups[g] > max_groups) {
+            max_groups = sw->groups[g];
+        }
+    }
+    groups = calloc(max_groups, sizeof(struct bench_cpu_group));
+    slots = calloc(sw->n_handles, sizeof(struct msr_handle *));
+    if (!groups || !slots) {
+        perror("calloc");
+        free(groups);
+        free(slots);
+        return -1;
+    }
+
+    sweep_header(sw, f);
+    for (st = 0; st < sw->n_strategies && !rc; st++) {
+        pt.strategy = sw->strategies[st];
+        // one row, at depth 0, for strategies that don't pipeline, which would repeat it
+        is_pipelined = bench_strategy_has_thr_layout(pt.strategy);
+        n_depths = is_pipelined ? sw->n_depths : 1;
+        for (sh = 0; sh < sw->n_shapes && !rc; sh++) {
+            pt.shape = sw->shapes[sh];
+            for (c = 0; c < sw->n_cpus && !rc; c++) {
+                pt.cpus = sw->cpus[c];
+                for (g = 0; g < sw->n_groups && !rc; g++) {
+                    pt.groups = sw->groups[g];
+                    for (m = 0; m < sw->n_msrs && !rc; m++) {
+                        pt.msrs = sw->msrs[m];
+                        for (d = 0; d < n_depths && !rc; d++) {
+                            pt.depth = is_pipelined ? sw->depths[d] : 0;
+                            rc = sweep_run_one(sw, f, &pt, slots, groups, &n_rows);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (sw->format == SWEEP_FORMAT_JSON) {
+        fprintf(f, "\n]\n");
+    }
+
+    free(groups);
+    free(slots);
+    return rc;
+}
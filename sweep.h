@@ -0,0 +1,66 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "msr.h"
+
+/*
+ * Run benchmarks over a grid of CPU counts, group counts and shapes, MSR counts, pipeline
+ * depths, and strategies in one process, reusing the same open handles, and emit one result row
+ * per run.
+ */
+
+enum sweep_shape {
+    // contiguous runs of CPUs
+    SWEEP_SHAPE_BLOCK,
+    // CPUs dealt round-robin
+    SWEEP_SHAPE_INTERLEAVE,
+};
+
+enum sweep_format {
+    SWEEP_FORMAT_CSV,
+    SWEEP_FORMAT_JSON,
+};
+
+struct sweep {
+    // template for every run; cpu_groups, msrs, and stats are set per run
+    struct bench base;
+    // open handles, taken in order: a run over N CPUs uses the first N
+    struct msr_handle **handles;
+    uint32_t n_handles;
+    // a run over N MSRs uses the first N of base.msrs
+    const struct bench_strategy **strategies;
+    uint32_t n_strategies;
+    const uint32_t *cpus;
+    uint32_t n_cpus;
+    const uint32_t *groups;
+    uint32_t n_groups;
+    const uint32_t *msrs;
+    uint32_t n_msrs;
+    // pipeline depths for the thread* strategies, others run once with a depth of 0
+    const uint32_t *depths;
+    uint32_t n_depths;
+    const enum sweep_shape *shapes;
+    uint32_t n_shapes;
+    enum sweep_format format;
+};
+
+/**
+ * Run every combination, writing results to f. Combinations with more groups than
+ * CPUs are skipped. Stops at the first failed run.
+ */
+int sweep_run(const struct sweep *sw, FILE *f);
+
+/**
+ * Parse a comma-delimited list of positive integers into a new array.
+ */
+int sweep_list_parse(const char *s, uint32_t **list, uint32_t *n);
+
+int sweep_shape_parse(const char *name, enum sweep_shape *shape);
+
+int sweep_format_parse(const char *name, enum sweep_format *format);
+
+#endif // SWEEP_H
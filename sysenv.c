@@ -0,0 +1,145 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sysenv.h"
+#include "topology.h"
+
+static int sysenv_read_line(const char *path, char *buf, size_t size)
+{
+    FILE *f = fopen(path, "r");
+    int rc = -1;
+    if (!f) {
+        return -1;
+    }
+    if (fgets(buf, (int) size, f)) {
+        buf[strcspn(buf, "\n")] = '\0';
+        rc = 0;
+    }
+    fclose(f);
+    return rc;
+}
+
+static void sysenv_governor(struct sysenv *e)
+{
+    char path[256];
+    char gov[sizeof(e->governor)];
+    uint32_t cpu;
+    e->governor[0] = '\0';
+    e->governor_uniform = 1;
+    for (cpu = 0; cpu < e->n_cpus; cpu++) {
+        snprintf(path, sizeof(path), SYSENV_SYSFS "/cpu%"PRIu32"/cpufreq/scaling_governor", cpu);
+        if (sysenv_read_line(path, gov, sizeof(gov))) {
+            continue;
+        }
+        if (!e->governor[0]) {
+            snprintf(e->governor, sizeof(e->governor), "%s", gov);
+        } else if (strcmp(gov, e->governor)) {
+            e->governor_uniform = 0;
+        }
+    }
+}
+
+static void sysenv_turbo(struct sysenv *e)
+{
+    char buf[16];
+    // intel_pstate reports the inverse
+    if (!sysenv_read_line(SYSENV_SYSFS "/intel_pstate/no_turbo", buf, sizeof(buf))) {
+        e->turbo = !atoi(buf);
+    } else if (!sysenv_read_line(SYSENV_SYSFS "/cpufreq/boost", buf, sizeof(buf))) {
+        e->turbo = !!atoi(buf);
+    } else {
+        e->turbo = -1;
+    }
+}
+
+static void sysenv_load(struct sysenv *e)
+{
+    char line[256];
+    FILE *f;
+    e->procs_running = 0;
+    e->loadavg = 0;
+    f = fopen(SYSENV_PROCFS "/stat", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "procs_running %"SCNu32, &e->procs_running) == 1) {
+                break;
+            }
+        }
+        fclose(f);
+    }
+    if (!sysenv_read_line(SYSENV_PROCFS "/loadavg", line, sizeof(line))) {
+        e->loadavg = strtod(line, NULL);
+    }
+}
+
+static void sysenv_cpu_set(uint32_t cpu, void *arg)
+{
+    if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, (cpu_set_t *) arg);
+    }
+}
+
+// a sysfs cpulist, empty if it's missing or empty
+static void sysenv_cpulist(const char *path, cpu_set_t *set)
+{
+    char buf[1024];
+    CPU_ZERO(set);
+    if (!sysenv_read_line(path, buf, sizeof(buf)) && buf[0]) {
+        topology_parse_cpulist(buf, sysenv_cpu_set, set);
+    }
+}
+
+void sysenv_snapshot(struct sysenv *e)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    e->n_cpus = n > 0 ? (uint32_t) n : 0;
+    sysenv_governor(e);
+    sysenv_turbo(e);
+    sysenv_load(e);
+    sysenv_cpulist(SYSENV_SYSFS "/isolated", &e->isolated);
+    sysenv_cpulist(SYSENV_SYSFS "/nohz_full", &e->nohz_full);
+}
+
+static const char *sysenv_turbo_name(int turbo)
+{
+    return turbo < 0 ? "unknown" : turbo ? "on" : "off";
+}
+
+int sysenv_diff(FILE *f, const char *what, const struct sysenv *a, const struct sysenv *b)
+{
+    int n = 0;
+    if (strcmp(a->governor, b->governor) || a->governor_uniform != b->governor_uniform) {
+        fprintf(f, "%s: scaling governor changed: %s%s -> %s%s\n", what,
+                a->governor[0] ? a->governor : "none", a->governor_uniform ? "" : " (mixed)",
+                b->governor[0] ? b->governor : "none", b->governor_uniform ? "" : " (mixed)");
+        n++;
+    }
+    if (a->turbo != b->turbo) {
+        fprintf(f, "%s: turbo changed: %s -> %s\n", what, sysenv_turbo_name(a->turbo),
+                sysenv_turbo_name(b->turbo));
+        n++;
+    }
+    return n;
+}
+
+int sysenv_loaded(const struct sysenv *e)
+{
+    // procs_running counts the caller too
+    return e->n_cpus && (e->procs_running > e->n_cpus || e->loadavg > e->n_cpus);
+}
+
+void sysenv_print(FILE *f, const struct sysenv *e)
+{
+    fprintf(f, "governor %s%s, turbo %s, procs_running %"PRIu32" (%"PRIu32" CPUs), "
+            "loadavg %.2f", e->governor[0] ? e->governor : "none",
+            e->governor_uniform ? "" : " (mixed)", sysenv_turbo_name(e->turbo),
+            e->procs_running, e->n_cpus, e->loadavg);
+    if (CPU_COUNT(&e->isolated) || CPU_COUNT(&e->nohz_full)) {
+        fprintf(f, ", isolated %d, nohz_full %d", CPU_COUNT(&e->isolated),
+                CPU_COUNT(&e->nohz_full));
+    }
+    fprintf(f, "\n");
+}
@@ -0,0 +1,57 @@
+#ifndef SYSENV_H
+#define SYSENV_H
+
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+
+#ifndef SYSENV_SYSFS
+#define SYSENV_SYSFS "/sys/devices/system/cpu"
+#endif
+
+#ifndef SYSENV_PROCFS
+#define SYSENV_PROCFS "/proc"
+#endif
+
+/*
+ * Host state that skews benchmark results when it changes mid-run: the CPU frequency
+ * governor, turbo, and how many tasks compete for the CPUs. Also which CPUs the kernel keeps
+ * quiet, which is set at boot.
+ */
+struct sysenv {
+    // scaling governor of the first CPU that has one, "" if there's no cpufreq
+    char governor[32];
+    // all CPUs with cpufreq use the same governor
+    int governor_uniform;
+    // 1 if turbo/boost is enabled, 0 if disabled, -1 if unknown
+    int turbo;
+    // tasks running or runnable right now, including the caller
+    uint32_t procs_running;
+    uint32_t n_cpus;
+    double loadavg;
+    // CPUs isolated from the scheduler's load balancing (isolcpus), and running without the
+    // periodic tick when they have a single task (nohz_full); empty if none or unknown
+    cpu_set_t isolated;
+    cpu_set_t nohz_full;
+};
+
+/**
+ * Sample the current state. Anything that can't be read is left empty or unknown.
+ */
+void sysenv_snapshot(struct sysenv *e);
+
+/**
+ * Compare two snapshots' governor and turbo state, printing each difference to f
+ * prefixed with what. Returns the number of differences.
+ */
+int sysenv_diff(FILE *f, const char *what, const struct sysenv *a, const struct sysenv *b);
+
+/**
+ * Returns 1 if more tasks were runnable than there are CPUs, or the load average exceeded
+ * the CPU count, 0 if not or if unknown.
+ */
+int sysenv_loaded(const struct sysenv *e);
+
+void sysenv_print(FILE *f, const struct sysenv *e);
+
+#endif // SYSENV_H
@@ -0,0 +1,100 @@
+#ifndef FAKE_MSR_H
+#define FAKE_MSR_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * A temporary directory of regular files standing in for /dev/cpu/N/msr, for the linux and
+ * batch backends' path= option: dir/N/msr holds fake_msr_value(N, msr) at offset msr.
+ */
+
+static inline uint64_t fake_msr_value(uint32_t cpu, uint32_t msr)
+{
+    // high bits set, so a truncated read doesn't pass
+    return 0xa5a5000000000000ull ^ ((uint64_t) cpu << 32) ^ msr;
+}
+
+/**
+ * Create the files for n_cpus CPUs with msrs set, in a new directory written to dir.
+ */
+static inline int fake_msr_create(char *dir, size_t size, uint32_t n_cpus, const uint32_t *msrs,
+                                  uint32_t n_msrs)
+{
+    char fname[4096];
+    uint64_t val;
+    uint32_t cpu;
+    uint32_t m;
+    int fd;
+    snprintf(dir, size, "/tmp/fake-msr-XXXXXX");
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return -1;
+    }
+    for (cpu = 0; cpu < n_cpus; cpu++) {
+        snprintf(fname, sizeof(fname), "%s/%"PRIu32, dir, cpu);
+        if (mkdir(fname, 0700)) {
+            perror("mkdir");
+            return -1;
+        }
+        snprintf(fname, sizeof(fname), "%s/%"PRIu32"/msr", dir, cpu);
+        if ((fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+            perror("open");
+            return -1;
+        }
+        for (m = 0; m < n_msrs; m++) {
+            val = fake_msr_value(cpu, msrs[m]);
+            if (pwrite(fd, &val, sizeof(val), msrs[m]) != sizeof(val)) {
+                perror("pwrite");
+                close(fd);
+                return -1;
+            }
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+static inline void fake_msr_remove(const char *dir, uint32_t n_cpus)
+{
+    char fname[4096];
+    uint32_t cpu;
+    for (cpu = 0; cpu < n_cpus; cpu++) {
+        snprintf(fname, sizeof(fname), "%s/%"PRIu32"/msr", dir, cpu);
+        unlink(fname);
+        snprintf(fname, sizeof(fname), "%s/%"PRIu32, dir, cpu);
+        rmdir(fname);
+    }
+    rmdir(dir);
+}
+
+/**
+ * Compare a sample of the n_cpus CPUs in cpus, each with the n_msrs MSRs in msrs, to the
+ * fake values, reporting each mismatch under name. Returns the number of mismatches.
+ */
+static inline uint32_t fake_msr_check(const char *name, const uint64_t *values,
+                                      const uint32_t *cpus, uint32_t n_cpus,
+                                      const uint32_t *msrs, uint32_t n_msrs)
+{
+    uint32_t bad = 0;
+    uint32_t i;
+    uint32_t m;
+    for (i = 0; i < n_cpus; i++) {
+        for (m = 0; m < n_msrs; m++) {
+            if (values[i * n_msrs + m] != fake_msr_value(cpus[i], msrs[m])) {
+                fprintf(stderr, "%s: CPU %"PRIu32" MSR 0x%"PRIx32": 0x%"PRIx64", expected "
+                        "0x%"PRIx64"\n", name, cpus[i], msrs[m], values[i * n_msrs + m],
+                        fake_msr_value(cpus[i], msrs[m]));
+                bad++;
+            }
+        }
+    }
+    return bad;
+}
+
+#endif // FAKE_MSR_H
@@ -0,0 +1,244 @@
+/*
+ * The batch and thread_batch strategies against fake MSR files. With the linux backend, which
+ * falls back to a read per MSR, every value must match and a short read must fail the sample.
+ * With the batch backend, an ioctl() interposer answers X86_IOC_MSR_BATCH from the fake values,
+ * so every value must match, a sample must take one ioctl per group, and an op's error must
+ * fail the sample; without the interposer, the batch device must fail cleanly when it doesn't
+ * take the ioctl.
+ */
+#include <dlfcn.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "fake-msr.h"
+#include "msr-sampler.h"
+
+#define N_CPUS 4
+#define N_GROUPS 2
+#define N_SAMPLES 3
+
+// past the end of the fake files, and denied by the fake batch device, as msr-safe denies
+// MSRs missing from its allowlist
+#define MSR_DENIED 0x10000
+
+static const uint32_t cpus[N_CPUS] = { 0, 1, 2, 3 };
+static const uint32_t msrs[] = { 0x10, 0x19c, 0x611 };
+static const uint32_t n_msrs = sizeof(msrs) / sizeof(msrs[0]);
+
+// ABI from msr-safe's msr_safe.h, as in msr-batch.c
+struct msr_safe_batch_op {
+    uint16_t cpu;
+    uint16_t isrdmsr;
+    int32_t err;
+    uint32_t msr;
+    uint64_t msrdata;
+    uint64_t wmask;
+};
+
+struct msr_safe_batch_array {
+    uint32_t numops;
+    struct msr_safe_batch_op *ops;
+};
+
+#define X86_IOC_MSR_BATCH _IOWR('c', 0xA2, struct msr_safe_batch_array)
+
+// answer X86_IOC_MSR_BATCH from the fake values instead of passing it to the file
+static int fake_batch;
+// batch ioctls answered, from the driver or from thread_batch's threads
+static atomic_uint n_batch_ioctls;
+
+static int fake_batch_ioctl(struct msr_safe_batch_array *arr)
+{
+    struct msr_safe_batch_op *op;
+    uint32_t i;
+    uint32_t m;
+    atomic_fetch_add(&n_batch_ioctls, 1);
+    for (i = 0; i < arr->numops; i++) {
+        op = &arr->ops[i];
+        if (!op->isrdmsr || op->cpu >= N_CPUS) {
+            fprintf(stderr, "batch ioctl: bad op %"PRIu32": CPU %u, isrdmsr %u\n", i,
+                    op->cpu, op->isrdmsr);
+            errno = EINVAL;
+            return -1;
+        }
+        op->err = -EACCES;
+        for (m = 0; m < n_msrs; m++) {
+            if (op->msr == msrs[m]) {
+                op->msrdata = fake_msr_value(op->cpu, op->msr);
+                op->err = 0;
+            }
+        }
+    }
+    return 0;
+}
+
+// resolves the library's ioctl() calls ahead of libc's
+int ioctl(int fd, unsigned long request, ...)
+{
+    static int (*real)(int, unsigned long, ...);
+    va_list ap;
+    void *arg;
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+    if (fake_batch && request == X86_IOC_MSR_BATCH) {
+        return fake_batch_ioctl(arg);
+    }
+    if (!real && !(real = (int (*)(int, unsigned long, ...)) dlsym(RTLD_NEXT, "ioctl"))) {
+        errno = ENOSYS;
+        return -1;
+    }
+    return real(fd, request, arg);
+}
+
+static struct msr_sampler *test_sampler(const char *backend, const char *opts,
+                                        const uint32_t *ms, uint32_t n_ms)
+{
+    struct msr_sampler *s = msr_sampler_init(backend, opts);
+    uint32_t m;
+    if (!s) {
+        return NULL;
+    }
+    // two groups, so thread_batch runs a thread per group
+    if (msr_sampler_add_group(s, &cpus[0], N_CPUS / N_GROUPS) ||
+        msr_sampler_add_group(s, &cpus[N_CPUS / N_GROUPS], N_CPUS - N_CPUS / N_GROUPS)) {
+        msr_sampler_teardown(s);
+        return NULL;
+    }
+    for (m = 0; m < n_ms; m++) {
+        if (msr_sampler_add_msr(s, ms[m])) {
+            msr_sampler_teardown(s);
+            return NULL;
+        }
+    }
+    return s;
+}
+
+static uint32_t test_strategy(struct msr_sampler *s, const char *strategy, uint64_t *values)
+{
+    uint32_t bad = 0;
+    int i;
+    if (msr_sampler_configure(s, strategy)) {
+        fprintf(stderr, "%s: configure: %s\n", strategy, strerror(errno));
+        return 1;
+    }
+    // more than once, so reusing the batch is covered
+    for (i = 0; i < N_SAMPLES; i++) {
+        memset(values, 0, msr_sampler_get_n_values(s) * sizeof(uint64_t));
+        if (msr_sampler_sample(s, values)) {
+            fprintf(stderr, "%s: sample: %s\n", strategy, strerror(errno));
+            return 1;
+        }
+        bad += fake_msr_check(strategy, values, cpus, N_CPUS, msrs, n_msrs);
+    }
+    return bad;
+}
+
+static uint32_t test_values(const char *backend, const char *opts, uint64_t *values)
+{
+    static const char *const strategies[] = { "batch", "thread_batch" };
+    struct msr_sampler *s = test_sampler(backend, opts, msrs, n_msrs);
+    uint32_t bad = 0;
+    uint32_t n;
+    uint32_t i;
+    if (!s) {
+        return 1;
+    }
+    for (i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        atomic_store(&n_batch_ioctls, 0);
+        bad += test_strategy(s, strategies[i], values);
+        n = atomic_load(&n_batch_ioctls);
+        if (fake_batch && n != N_SAMPLES * N_GROUPS) {
+            fprintf(stderr, "%s: %"PRIu32" batch ioctls for %u samples of %u groups\n",
+                    strategies[i], n, N_SAMPLES, N_GROUPS);
+            bad++;
+        }
+    }
+    if (msr_sampler_teardown(s)) {
+        fprintf(stderr, "teardown: %s\n", strerror(errno));
+        bad++;
+    }
+    return bad;
+}
+
+/**
+ * Sample an MSR that fails to read, with errno expected (0 for any), along with one that
+ * reads: the sample must fail, not leave a value.
+ */
+static uint32_t test_failure(const char *backend, const char *opts, uint32_t msr, int expected,
+                             uint64_t *values)
+{
+    static const char *const strategies[] = { "batch", "thread_batch" };
+    const uint32_t ms[] = { msrs[0], msr };
+    struct msr_sampler *s = test_sampler(backend, opts, ms, 2);
+    uint32_t bad = 0;
+    uint32_t i;
+    if (!s) {
+        return 1;
+    }
+    for (i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+        if (msr_sampler_configure(s, strategies[i])) {
+            fprintf(stderr, "%s: configure: %s\n", strategies[i], strerror(errno));
+            bad++;
+        } else if (!msr_sampler_sample(s, values)) {
+            fprintf(stderr, "%s: %s: sample of MSR 0x%"PRIx32" succeeded\n", backend,
+                    strategies[i], msr);
+            bad++;
+        } else if (expected && errno != expected) {
+            fprintf(stderr, "%s: %s: sample of MSR 0x%"PRIx32" failed with %s, expected %s\n",
+                    backend, strategies[i], msr, strerror(errno), strerror(expected));
+            bad++;
+        }
+    }
+    msr_sampler_teardown(s);
+    return bad;
+}
+
+int main(void)
+{
+    struct msr_sampler *s;
+    uint64_t values[N_CPUS * 3];
+    char dir[64];
+    char opts[256];
+    uint32_t bad = 0;
+
+    if (fake_msr_create(dir, sizeof(dir), N_CPUS, msrs, n_msrs)) {
+        return 1;
+    }
+
+    snprintf(opts, sizeof(opts), "path=%s/%%u/msr", dir);
+    bad += test_values("linux", opts, values);
+    // past the end of the files
+    bad += test_failure("linux", opts, MSR_DENIED, EIO, values);
+
+    // any file for the batch device, since the interposer answers its ioctl
+    snprintf(opts, sizeof(opts), "path=%s/%%u/msr,dev=%s/0/msr", dir, dir);
+    fake_batch = 1;
+    bad += test_values("batch", opts, values);
+    bad += test_failure("batch", opts, MSR_DENIED, EACCES, values);
+
+    // a regular file for the batch device: the ioctl fails, which a sample must report
+    fake_batch = 0;
+    if (!(s = test_sampler("batch", opts, msrs, n_msrs))) {
+        bad++;
+    } else {
+        if (!msr_sampler_configure(s, "batch") && !msr_sampler_sample(s, values)) {
+            fprintf(stderr, "batch backend: sample succeeded without the batch ioctl\n");
+            bad++;
+        }
+        msr_sampler_teardown(s);
+    }
+
+    fake_msr_remove(dir, N_CPUS);
+    if (bad) {
+        fprintf(stderr, "%"PRIu32" failures\n", bad);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Every SIMD delta kernel the CPU supports against the scalar one on the same inputs: counters
+ * wrapping at 32 and 48 bits, deltas above 2^52, where converting to double rounds, and lengths
+ * that leave a tail after the vectors. Elements past the length must be left alone.
+ */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+
+#define N_MAX 35
+// elements past the length, which must be left alone
+#define N_GUARD 9
+#define GUARD 0x5a5a5a5a5a5a5a5aull
+
+struct delta_arrays {
+    uint64_t prev[N_MAX + N_GUARD];
+    uint64_t cur[N_MAX + N_GUARD];
+    uint64_t total[N_MAX + N_GUARD];
+    double scaled[N_MAX + N_GUARD];
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng_next(void)
+{
+    // xorshift64
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// counters of the mask's width, with deltas near 0, near the wrap, and spread over the width
+static void delta_fill(struct delta_arrays *a, uint64_t mask)
+{
+    uint32_t i;
+    for (i = 0; i < N_MAX + N_GUARD; i++) {
+        a->prev[i] = rng_next() & mask;
+        switch (i % 4) {
+        case 0:
+            // wrapped past the counter's width
+            a->prev[i] = mask - (rng_next() & 0xff);
+            a->cur[i] = rng_next() & 0xff;
+            break;
+        case 1:
+            a->cur[i] = (a->prev[i] + (rng_next() & 0xffff)) & mask;
+            break;
+        case 2:
+            // a delta with more bits than a double's mantissa, where the mask allows it
+            a->cur[i] = (a->prev[i] + ((1ull << 53) | rng_next())) & mask;
+            break;
+        default:
+            a->cur[i] = rng_next() & mask;
+            break;
+        }
+        a->total[i] = rng_next() >> 1;
+        a->scaled[i] = -1;
+    }
+}
+
+static void delta_guard(struct delta_arrays *a, size_t n)
+{
+    const uint64_t guard = GUARD;
+    size_t i;
+    for (i = n; i < N_MAX + N_GUARD; i++) {
+        a->prev[i] = guard;
+        a->total[i] = guard;
+        memcpy(&a->scaled[i], &guard, sizeof(double));
+    }
+}
+
+static uint32_t delta_compare(const char *name, const struct delta_arrays *want,
+                              const struct delta_arrays *got, size_t n, uint64_t mask)
+{
+    size_t i;
+    for (i = 0; i < N_MAX + N_GUARD; i++) {
+        if (got->prev[i] != want->prev[i] || got->total[i] != want->total[i] ||
+            memcmp(&got->scaled[i], &want->scaled[i], sizeof(double))) {
+            fprintf(stderr, "%s: n=%zu mask=0x%"PRIx64" [%zu]: prev 0x%"PRIx64" total "
+                    "0x%"PRIx64" scaled %a, expected 0x%"PRIx64" 0x%"PRIx64" %a\n", name, n,
+                    mask, i, got->prev[i], got->total[i], got->scaled[i], want->prev[i],
+                    want->total[i], want->scaled[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t test_kernel(const struct delta_kernel *scalar, const struct delta_kernel *k)
+{
+    static const uint64_t masks[] = { 0xffffffffull, 0xffffffffffffull, UINT64_MAX };
+    static const double scales[] = { 1.0, 0.1 };
+    struct delta_arrays in;
+    struct delta_arrays want;
+    struct delta_arrays got;
+    uint32_t bad = 0;
+    size_t n;
+    size_t m;
+    size_t s;
+    for (m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+        for (s = 0; s < sizeof(scales) / sizeof(scales[0]); s++) {
+            for (n = 0; n <= N_MAX; n++) {
+                delta_fill(&in, masks[m]);
+                delta_guard(&in, n);
+                want = in;
+                got = in;
+                scalar->apply(want.prev, want.cur, want.total, want.scaled, n, masks[m],
+                              scales[s]);
+                k->apply(got.prev, got.cur, got.total, got.scaled, n, masks[m], scales[s]);
+                bad += delta_compare(k->name, &want, &got, n, masks[m]);
+            }
+        }
+    }
+    return bad;
+}
+
+// the reference itself, on a counter wrapping at 32 bits
+static uint32_t test_scalar(const struct delta_kernel *scalar)
+{
+    uint64_t prev = 0xfffffff0;
+    uint64_t cur = 0x10;
+    uint64_t total = 1;
+    double scaled = 0;
+    scalar->apply(&prev, &cur, &total, &scaled, 1, 0xffffffffull, 0.5);
+    if (prev != cur || total != 0x21 || scaled != 16.0) {
+        fprintf(stderr, "scalar: wrap: prev 0x%"PRIx64" total 0x%"PRIx64" scaled %f\n", prev,
+                total, scaled);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const char *const names[] = { "avx2", "avx512", "auto" };
+    const struct delta_kernel *scalar = delta_kernel_select("scalar");
+    const struct delta_kernel *k;
+    uint32_t bad = 0;
+    size_t i;
+    if (!scalar) {
+        return 1;
+    }
+    bad += test_scalar(scalar);
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (!(k = delta_kernel_select(names[i]))) {
+            // ENOTSUP if the CPU lacks it, EINVAL if not built for this architecture
+            printf("%s: skipped: %s\n", names[i], strerror(errno));
+            continue;
+        }
+        printf("%s: %s\n", names[i], k->name);
+        bad += test_kernel(scalar, k);
+    }
+    if (bad) {
+        fprintf(stderr, "%"PRIu32" failures\n", bad);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#include <inttypes.h>
+#include <time.h>
+
+#include "timing.h"
+
+static double ns_per_tick = 1.0;
+
+#if TIMING_TSC
+static uint64_t timing_mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+void timing_init(void)
+{
+#if TIMING_TSC
+    const struct timespec delay = { .tv_sec = 0, .tv_nsec = 20000000 };
+    uint64_t ns0 = timing_mono_ns();
+    uint64_t t0 = timing_now();
+    nanosleep(&delay, NULL);
+    uint64_t ns1 = timing_mono_ns();
+    uint64_t t1 = timing_now();
+    if (t1 > t0) {
+        ns_per_tick = (double) (ns1 - ns0) / (t1 - t0);
+    }
+#endif
+}
+
+double timing_ticks_to_ns(double ticks)
+{
+    return ticks * ns_per_tick;
+}
+
+double timing_ns_to_ticks(double ns)
+{
+    return ns / ns_per_tick;
+}
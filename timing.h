@@ -0,0 +1,45 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <inttypes.h>
+#include <time.h>
+
+#ifndef TIMING_TSC
+#define TIMING_TSC 0
+#endif
+
+#if TIMING_TSC
+#include <x86intrin.h>
+#endif
+
+/**
+ * Get a timestamp in ticks: nanoseconds of CLOCK_MONOTONIC_RAW, or TSC cycles if
+ * built with TIMING_TSC=1.
+ */
+static inline uint64_t timing_now(void)
+{
+#if TIMING_TSC
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Calibrate the tick rate - call once before converting ticks.
+ */
+void timing_init(void);
+
+/**
+ * Convert a tick count to nanoseconds.
+ */
+double timing_ticks_to_ns(double ticks);
+
+/**
+ * Convert nanoseconds to a tick count.
+ */
+double timing_ns_to_ticks(double ns);
+
+#endif // TIMING_H
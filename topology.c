@@ -0,0 +1,310 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "msr.h"
+#include "topology.h"
+
+static int topology_read_str(const char *path, char *buf, size_t len)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    if (!fgets(buf, (int) len, f)) {
+        fclose(f);
+        errno = EIO;
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static int topology_read_u32(const char *path, uint32_t *val)
+{
+    char buf[32];
+    if (topology_read_str(path, buf, sizeof(buf))) {
+        return -1;
+    }
+    *val = (uint32_t) strtoul(buf, NULL, 0);
+    return 0;
+}
+
+int topology_parse_cpulist(const char *list, void (*fn)(uint32_t cpu, void *arg), void *arg)
+{
+    const char *p = list;
+    char *end;
+    unsigned long lo;
+    unsigned long hi;
+    while (*p) {
+        lo = strtoul(p, &end, 10);
+        if (end == p) {
+            errno = EINVAL;
+            return -1;
+        }
+        hi = lo;
+        p = end;
+        if (*p == '-') {
+            hi = strtoul(p + 1, &end, 10);
+            if (end == p + 1 || hi < lo) {
+                errno = EINVAL;
+                return -1;
+            }
+            p = end;
+        }
+        for (; lo <= hi; lo++) {
+            fn((uint32_t) lo, arg);
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct topology_cpus {
+    uint32_t *cpus;
+    uint32_t n;
+    uint32_t max;
+};
+
+static void topology_add_cpu(uint32_t cpu, void *arg)
+{
+    struct topology_cpus *tc = (struct topology_cpus *)arg;
+    if (tc->n < tc->max) {
+        tc->cpus[tc->n++] = cpu;
+    }
+}
+
+static void topology_first_cpu(uint32_t cpu, void *arg)
+{
+    uint32_t *first = (uint32_t *)arg;
+    if (cpu < *first) {
+        *first = cpu;
+    }
+}
+
+struct topology_sibling {
+    uint32_t cpu;
+    uint32_t idx;
+    uint32_t found;
+};
+
+static void topology_sibling_idx(uint32_t cpu, void *arg)
+{
+    struct topology_sibling *ts = (struct topology_sibling *)arg;
+    if (cpu == ts->cpu) {
+        ts->found = 1;
+    } else if (!ts->found) {
+        ts->idx++;
+    }
+}
+
+struct topology_node {
+    struct topology *t;
+    uint32_t node;
+};
+
+static void topology_set_node(uint32_t cpu, void *arg)
+{
+    struct topology_node *tn = (struct topology_node *)arg;
+    uint32_t i;
+    for (i = 0; i < tn->t->n_cpus; i++) {
+        if (tn->t->cpus[i] == cpu) {
+            tn->t->topo[i].node = tn->node;
+            break;
+        }
+    }
+}
+
+static int topology_load_cpu(uint32_t cpu, struct msr_topology *topo)
+{
+    struct topology_sibling ts = { .cpu = cpu, .idx = 0, .found = 0 };
+    char path[256];
+    char buf[4096];
+    uint32_t level;
+    uint32_t llc_level = 0;
+    uint32_t core_id;
+    int idx;
+
+    snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu/cpu%"PRIu32"/topology/physical_package_id", cpu);
+    if (topology_read_u32(path, &topo->package)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu/cpu%"PRIu32"/topology/core_id", cpu);
+    if (topology_read_u32(path, &core_id)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    // core ids repeat across packages, so key the core by its lowest sibling instead
+    snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu/cpu%"PRIu32"/topology/thread_siblings_list", cpu);
+    topo->core = cpu;
+    topo->thread = 0;
+    if (!topology_read_str(path, buf, sizeof(buf))) {
+        topology_parse_cpulist(buf, topology_first_cpu, &topo->core);
+        topology_parse_cpulist(buf, topology_sibling_idx, &ts);
+        topo->thread = ts.idx;
+    }
+    // the highest-level cache is the LLC, keyed by its lowest CPU
+    topo->llc = topo->package;
+    for (idx = 0; ; idx++) {
+        snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu/cpu%"PRIu32"/cache/index%d/level", cpu, idx);
+        if (topology_read_u32(path, &level)) {
+            break;
+        }
+        if (level < llc_level) {
+            continue;
+        }
+        snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu/cpu%"PRIu32"/cache/index%d/shared_cpu_list",
+                 cpu, idx);
+        if (!topology_read_str(path, buf, sizeof(buf))) {
+            llc_level = level;
+            topo->llc = cpu;
+            topology_parse_cpulist(buf, topology_first_cpu, &topo->llc);
+        }
+    }
+    topo->node = 0;
+    return 0;
+}
+
+int topology_load(struct topology *t)
+{
+    struct topology_cpus tc;
+    struct topology_node tn;
+    char path[256];
+    char *buf;
+    uint32_t n = msr_get_count();
+    uint32_t i;
+    int rc = 0;
+
+    if (!n) {
+        return -1;
+    }
+    t->cpus = calloc(n, sizeof(uint32_t));
+    t->topo = calloc(n, sizeof(struct msr_topology));
+    buf = malloc(4096);
+    if (!t->cpus || !t->topo || !buf) {
+        perror("calloc");
+        rc = -1;
+        goto out;
+    }
+
+    if (!msr_get_topology(0, &t->topo[0])) {
+        // the backend models its own CPUs
+        for (i = 0; i < n; i++) {
+            t->cpus[i] = i;
+            if (msr_get_topology(i, &t->topo[i])) {
+                rc = -1;
+                goto out;
+            }
+        }
+        t->n_cpus = n;
+        goto out;
+    }
+
+    tc.cpus = t->cpus;
+    tc.n = 0;
+    tc.max = n;
+    if (topology_read_str(TOPOLOGY_SYSFS "/cpu/online", buf, 4096) ||
+        topology_parse_cpulist(buf, topology_add_cpu, &tc)) {
+        perror(TOPOLOGY_SYSFS "/cpu/online");
+        rc = -1;
+        goto out;
+    }
+    t->n_cpus = tc.n;
+    for (i = 0; i < t->n_cpus; i++) {
+        if (topology_load_cpu(t->cpus[i], &t->topo[i])) {
+            rc = -1;
+            goto out;
+        }
+    }
+    // NUMA nodes are optional, e.g., !CONFIG_NUMA
+    tn.t = t;
+    for (tn.node = 0; ; tn.node++) {
+        snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/node/node%"PRIu32"/cpulist", tn.node);
+        if (topology_read_str(path, buf, 4096)) {
+            // node ids can be sparse
+            if (tn.node < 1024) {
+                continue;
+            }
+            break;
+        }
+        topology_parse_cpulist(buf, topology_set_node, &tn);
+    }
+
+out:
+    free(buf);
+    if (rc) {
+        topology_free(t);
+    }
+    return rc;
+}
+
+void topology_free(struct topology *t)
+{
+    free(t->cpus);
+    free(t->topo);
+    t->cpus = NULL;
+    t->topo = NULL;
+    t->n_cpus = 0;
+}
+
+uint32_t topology_domain(const struct topology *t, uint32_t i, enum topology_level level)
+{
+    switch (level) {
+    case TOPOLOGY_SOCKET:
+        return t->topo[i].package;
+    case TOPOLOGY_CORE:
+        return t->topo[i].core;
+    case TOPOLOGY_LLC:
+        return t->topo[i].llc;
+    case TOPOLOGY_NUMA:
+        return t->topo[i].node;
+    case TOPOLOGY_SMT:
+        return t->topo[i].thread;
+    }
+    return 0;
+}
+
+const char *topology_level_name(enum topology_level level)
+{
+    switch (level) {
+    case TOPOLOGY_SOCKET:
+        return "socket";
+    case TOPOLOGY_CORE:
+        return "core";
+    case TOPOLOGY_LLC:
+        return "llc";
+    case TOPOLOGY_NUMA:
+        return "numa";
+    case TOPOLOGY_SMT:
+        return "smt";
+    }
+    return "unknown";
+}
+
+int topology_level_parse(const char *name, enum topology_level *level)
+{
+    if (!strcmp(name, "socket")) {
+        *level = TOPOLOGY_SOCKET;
+    } else if (!strcmp(name, "core")) {
+        *level = TOPOLOGY_CORE;
+    } else if (!strcmp(name, "llc")) {
+        *level = TOPOLOGY_LLC;
+    } else if (!strcmp(name, "numa")) {
+        *level = TOPOLOGY_NUMA;
+    } else if (!strcmp(name, "smt")) {
+        *level = TOPOLOGY_SMT;
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <inttypes.h>
+
+#include "msr.h"
+
+#ifndef TOPOLOGY_SYSFS
+#define TOPOLOGY_SYSFS "/sys/devices/system"
+#endif
+
+enum topology_level {
+    TOPOLOGY_SOCKET,
+    TOPOLOGY_CORE,
+    TOPOLOGY_LLC,
+    TOPOLOGY_NUMA,
+    // SMT thread index, i.e., all first siblings, all second siblings, ...
+    TOPOLOGY_SMT,
+};
+
+struct topology {
+    uint32_t *cpus;
+    struct msr_topology *topo;
+    uint32_t n_cpus;
+};
+
+/**
+ * Load the topology of all CPUs, from the MSR backend if it models one, otherwise from sysfs.
+ */
+int topology_load(struct topology *t);
+
+void topology_free(struct topology *t);
+
+/**
+ * Get the domain of CPU index i (not CPU id) at the given level.
+ */
+uint32_t topology_domain(const struct topology *t, uint32_t i, enum topology_level level);
+
+int topology_level_parse(const char *name, enum topology_level *level);
+
+const char *topology_level_name(enum topology_level level);
+
+/**
+ * Parse a Linux cpulist (e.g., "0-3,8,10-11"), calling fn for each CPU.
+ */
+int topology_parse_cpulist(const char *list, void (*fn)(uint32_t cpu, void *arg), void *arg);
+
+#endif // TOPOLOGY_H
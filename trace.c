@@ -0,0 +1,200 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timing.h"
+#include "trace.h"
+
+_Thread_local struct trace_buf *trace_cur;
+
+static const char *const trace_type_names[] = {
+    "iteration",
+    "wait",
+    "migrate",
+    "read",
+    "batch",
+};
+
+// the cheapest of a few rounds, so a preemption doesn't count as tracing cost
+static double trace_calibrate(struct trace_buf *b)
+{
+    struct trace_buf *prev = trace_cur;
+    double best = 0;
+    uint64_t t0;
+    uint64_t dt;
+    uint32_t round;
+    uint32_t i;
+    uint32_t n = b->cap < TRACE_CALIBRATE_EVENTS ? (uint32_t) b->cap : TRACE_CALIBRATE_EVENTS;
+    if (!n) {
+        return 0;
+    }
+    trace_attach(b);
+    for (round = 0; round < 8; round++) {
+        b->n = 0;
+        t0 = timing_now();
+        for (i = 0; i < n; i++) {
+            trace_record(TRACE_READ, i, i);
+        }
+        dt = timing_now() - t0;
+        if (!round || (double) dt / n < best) {
+            best = (double) dt / n;
+        }
+    }
+    b->n = 0;
+    trace_attach(prev);
+    return best;
+}
+
+struct trace *trace_alloc(uint32_t n_threads, uint64_t cap)
+{
+    struct trace *t;
+    uint32_t i;
+    t = calloc(1, sizeof(*t));
+    if (!t) {
+        perror("calloc");
+        return NULL;
+    }
+    t->n_bufs = n_threads + 1;
+    t->bufs = aligned_alloc(64, t->n_bufs * sizeof(struct trace_buf));
+    if (!t->bufs) {
+        perror("aligned_alloc");
+        free(t);
+        return NULL;
+    }
+    memset(t->bufs, 0, t->n_bufs * sizeof(struct trace_buf));
+    for (i = 0; i < t->n_bufs; i++) {
+        t->bufs[i].events = malloc((cap ? cap : 1) * sizeof(struct trace_event));
+        if (!t->bufs[i].events) {
+            perror("malloc");
+            trace_free(t);
+            return NULL;
+        }
+        // fault it in now rather than while tracing
+        memset(t->bufs[i].events, 0, (cap ? cap : 1) * sizeof(struct trace_event));
+        t->bufs[i].cap = cap;
+        if (i) {
+            snprintf(t->bufs[i].name, sizeof(t->bufs[i].name), "thread %"PRIu32, i - 1);
+        } else {
+            snprintf(t->bufs[i].name, sizeof(t->bufs[i].name), "driver");
+        }
+    }
+    t->cost = trace_calibrate(&t->bufs[0]);
+    return t;
+}
+
+void trace_free(struct trace *t)
+{
+    uint32_t i;
+    if (!t) {
+        return;
+    }
+    for (i = 0; t->bufs && i < t->n_bufs; i++) {
+        free(t->bufs[i].events);
+    }
+    free(t->bufs);
+    free(t);
+}
+
+static void trace_write_event(FILE *f, const struct trace_event *e, uint32_t tid, uint64_t t0,
+                              const char **sep)
+{
+    const uint32_t type = e->type & ~TRACE_END;
+    const double ts = timing_ticks_to_ns((double) (e->t - t0)) / 1e3;
+    if (e->type & TRACE_END) {
+        fprintf(f, "%s\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%"PRIu32"}", *sep, ts, tid);
+        *sep = ",";
+        return;
+    }
+    fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"msr\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,"
+            "\"tid\":%"PRIu32",\"args\":{\"iter\":%"PRIu32, *sep,
+            type < TRACE_N_TYPES ? trace_type_names[type] : "unknown", ts, tid, e->seq);
+    if (e->cpu != TRACE_NONE) {
+        fprintf(f, ",\"cpu\":%"PRIu32, e->cpu);
+    }
+    if (e->msr != TRACE_NONE) {
+        fprintf(f, ",\"msr\":\"0x%"PRIx32"\"", e->msr);
+    }
+    fprintf(f, "}}");
+    *sep = ",";
+}
+
+int trace_write_json(const struct trace *t, FILE *f)
+{
+    const struct trace_buf *b;
+    const char *sep = "";
+    uint64_t t0 = UINT64_MAX;
+    uint64_t i;
+    uint64_t open;
+    uint32_t k;
+
+    for (k = 0; k < t->n_bufs; k++) {
+        if (t->bufs[k].n && t->bufs[k].events[0].t < t0) {
+            t0 = t->bufs[k].events[0].t;
+        }
+    }
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"trace_ns_per_event\":%.1f},"
+            "\"traceEvents\":[", timing_ticks_to_ns(t->cost));
+    fprintf(f, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+            "\"args\":{\"name\":\"msr-scaling-bench\"}}");
+    sep = ",";
+    for (k = 0; k < t->n_bufs; k++) {
+        b = &t->bufs[k];
+        if (!b->n) {
+            continue;
+        }
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%"PRIu32","
+                "\"args\":{\"name\":\"%s\"}}", k, b->name);
+        fprintf(f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%"PRIu32","
+                "\"args\":{\"sort_index\":%"PRIu32"}}", k, k);
+        open = 0;
+        for (i = 0; i < b->n; i++) {
+            trace_write_event(f, &b->events[i], k, t0, &sep);
+            if (b->events[i].type & TRACE_END) {
+                open -= open > 0;
+            } else {
+                open++;
+            }
+        }
+        for (; open; open--) {
+            fprintf(f, ",\n{\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":%"PRIu32"}",
+                    timing_ticks_to_ns((double) (b->events[b->n - 1].t - t0)) / 1e3, k);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    if (ferror(f)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+void trace_print_summary(FILE *f, const struct trace *t, uint64_t iters, double iter_ns)
+{
+    uint64_t events = 0;
+    uint64_t dropped = 0;
+    uint64_t busiest = 0;
+    uint32_t threads = 0;
+    uint32_t k;
+    double cost_ns = timing_ticks_to_ns(t->cost);
+    double per_iter;
+    for (k = 0; k < t->n_bufs; k++) {
+        events += t->bufs[k].n;
+        dropped += t->bufs[k].dropped;
+        threads += t->bufs[k].n > 0;
+        if (t->bufs[k].n + t->bufs[k].dropped > busiest) {
+            busiest = t->bufs[k].n + t->bufs[k].dropped;
+        }
+    }
+    fprintf(f, "Trace: %"PRIu64" events from %"PRIu32" threads, %"PRIu64" dropped "
+            "(buffers of %"PRIu64" events)\n", events, threads, dropped,
+            t->n_bufs ? t->bufs[0].cap : 0);
+    per_iter = iters ? cost_ns * busiest / iters : 0;
+    fprintf(f, "Trace overhead: %.1f ns per event, %.0f ns per iteration on the busiest thread",
+            cost_ns, per_iter);
+    if (iter_ns > 0) {
+        fprintf(f, " (%.1f%% of the mean iteration)", 100.0 * per_iter / iter_ns);
+    }
+    fprintf(f, "\n");
+}
@@ -0,0 +1,134 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "timing.h"
+
+// events preallocated per traced thread
+#ifndef TRACE_EVENTS_DEFAULT
+#define TRACE_EVENTS_DEFAULT 65536
+#endif
+
+// events recorded per round when measuring what recording costs
+#ifndef TRACE_CALIBRATE_EVENTS
+#define TRACE_CALIBRATE_EVENTS 4096
+#endif
+
+/*
+ * Per-thread event timelines, e.g., to see which group was late in an iteration, when a
+ * thread migrated, and how long it waited to be issued work. Every traced thread records to
+ * its own preallocated, prefaulted buffer, so an event costs a clock read and a few stores,
+ * without locks; a full buffer counts what it drops. The buffers are written out after the
+ * run as Chrome trace JSON, which Perfetto (ui.perfetto.dev) and chrome://tracing load.
+ */
+
+enum trace_type {
+    // the driver issuing or taking a sample, or a thread reading its group's part
+    TRACE_ITER,
+    // the driver waiting for the slowest group, or a thread waiting to be issued an iteration
+    TRACE_WAIT,
+    // binding to the CPU read next
+    TRACE_MIGRATE,
+    TRACE_READ,
+    // a group's batch of reads, which aren't individually observable
+    TRACE_BATCH,
+    TRACE_N_TYPES,
+};
+
+// or'd into the type of the event that ends a span
+#define TRACE_END   0x80000000u
+// no CPU or MSR
+#define TRACE_NONE  UINT32_MAX
+
+struct trace_event {
+    // timing ticks
+    uint64_t t;
+    uint32_t type;
+    uint32_t cpu;
+    uint32_t msr;
+    // the thread's iteration
+    uint32_t seq;
+};
+
+// on lines of its own, since its thread updates n, dropped, and seq at every event
+struct trace_buf {
+    struct trace_event *events;
+    uint64_t n;
+    uint64_t cap;
+    uint64_t dropped;
+    uint32_t seq;
+    char name[32];
+} __attribute__((aligned(64)));
+
+struct trace {
+    // [0] the driver's, [1 + i] the i-th thread's the strategy starts
+    struct trace_buf *bufs;
+    uint32_t n_bufs;
+    // what recording an event costs, in ticks
+    double cost;
+};
+
+// the buffer the calling thread records to, NULL if it isn't traced
+extern _Thread_local struct trace_buf *trace_cur;
+
+/**
+ * Allocate buffers of cap events for the driver and n_threads threads, named "thread i"
+ * until renamed, and measure the cost of recording. timing_init() must have been called.
+ */
+struct trace *trace_alloc(uint32_t n_threads, uint64_t cap);
+
+void trace_free(struct trace *t);
+
+/**
+ * Record the calling thread's events to b from now on, NULL to stop.
+ */
+static inline void trace_attach(struct trace_buf *b)
+{
+    trace_cur = b;
+}
+
+static inline void trace_record(uint32_t type, uint32_t cpu, uint32_t msr)
+{
+    struct trace_buf *b = trace_cur;
+    struct trace_event *e;
+    if (!b) {
+        return;
+    }
+    if (b->n == b->cap) {
+        b->dropped++;
+        return;
+    }
+    e = &b->events[b->n++];
+    e->t = timing_now();
+    e->type = type;
+    e->cpu = cpu;
+    e->msr = msr;
+    e->seq = b->seq;
+}
+
+/**
+ * Start iteration seq, which the thread's events are tagged with until the next.
+ */
+static inline void trace_iter_begin(uint32_t seq)
+{
+    if (trace_cur) {
+        trace_cur->seq = seq;
+        trace_record(TRACE_ITER, TRACE_NONE, TRACE_NONE);
+    }
+}
+
+/**
+ * Write every buffer as Chrome trace JSON, with times relative to the first event. Spans
+ * left open by a full buffer are closed at the thread's last event.
+ */
+int trace_write_json(const struct trace *t, FILE *f);
+
+/**
+ * Report the events recorded and dropped, and what recording them cost per iteration on the
+ * busiest thread, also relative to iter_ns, the mean iteration time, if non-zero.
+ */
+void trace_print_summary(FILE *f, const struct trace *t, uint64_t iters, double iter_ns);
+
+#endif // TRACE_H